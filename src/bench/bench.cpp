@@ -0,0 +1,93 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <boost/xpressive/xpressive_dynamic.hpp>
+
+using namespace std;
+
+namespace benchmark {
+
+static double GetTimeDouble()
+{
+    return GetTimeMicros() * 0.000001;
+}
+
+State::State(const std::string& strNameIn, double dMinTimeIn) :
+    strName(strNameIn), dMinTime(dMinTimeIn), dBeginTime(0), dLastTime(0),
+    nCount(0), nCountMask(0), nBytesPerOp(0)
+{
+}
+
+bool State::KeepRunning()
+{
+    // Only read the clock once every nCountMask + 1 iterations
+    if (nCount & nCountMask)
+    {
+        ++nCount;
+        return true;
+    }
+
+    double dNow = GetTimeDouble();
+    if (nCount == 0)
+        dBeginTime = dNow;
+    else if (dNow - dLastTime < dMinTime / 1024 && nCountMask < (1 << 24))
+    {
+        // Fast operations spend most of their time reading the clock;
+        // check it eight times less often
+        nCountMask = (nCountMask << 3) | 7;
+    }
+    dLastTime = dNow;
+
+    if (nCount == 0 || dNow - dBeginTime < dMinTime)
+    {
+        ++nCount;
+        return true;
+    }
+
+    double dElapsed = dNow - dBeginTime;
+    printf("%-28s %12"PRI64u" %14.1f ns/op", strName.c_str(), nCount, dElapsed * 1e9 / nCount);
+    if (nBytesPerOp)
+        printf(" %10.2f MB/s", (double)nBytesPerOp * nCount / dElapsed / 1e6);
+    printf("\n");
+    return false;
+}
+
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarksMap;
+    return benchmarksMap;
+}
+
+BenchRunner::BenchRunner(const std::string& strName, BenchFunction func)
+{
+    benchmarks().insert(make_pair(strName, func));
+}
+
+bool BenchRunner::RunAll(const std::string& strFilter, double dMinTime)
+{
+    boost::xpressive::sregex reFilter;
+    try
+    {
+        reFilter = boost::xpressive::sregex::compile(strFilter);
+    }
+    catch (boost::xpressive::regex_error& e)
+    {
+        fprintf(stderr, "Error: invalid -filter regular expression '%s': %s\n", strFilter.c_str(), e.what());
+        return false;
+    }
+
+    printf("%-28s %12s %20s %15s\n", "# benchmark", "iterations", "time", "throughput");
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it)
+    {
+        if (!boost::xpressive::regex_search(it->first, reFilter))
+            continue;
+        State state(it->first, dMinTime);
+        it->second(state);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include "util.h"
+
+#include <map>
+#include <string>
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+//
+// Microbenchmarks for bench_trinity.
+//
+// Define a benchmark with:
+//
+//   static void CodeToTime(benchmark::State& state)
+//   {
+//       ... setup, not timed ...
+//       state.SetBytesPerOp(nBytes);    // optional, enables MB/s
+//       while (state.KeepRunning())
+//       {
+//           ... code to time ...
+//       }
+//   }
+//   BENCHMARK(CodeToTime);
+//
+namespace benchmark {
+
+class State
+{
+private:
+    std::string strName;
+    double dMinTime;
+    double dBeginTime;
+    double dLastTime;
+    uint64 nCount;
+    uint64 nCountMask;
+    uint64 nBytesPerOp;
+
+public:
+    State(const std::string& strNameIn, double dMinTimeIn);
+
+    /** Bytes processed by one iteration, used to report throughput */
+    void SetBytesPerOp(uint64 nBytes) { nBytesPerOp = nBytes; }
+
+    /** Returns true while the benchmark should run another iteration;
+        prints the results when it returns false */
+    bool KeepRunning();
+};
+
+typedef void (*BenchFunction)(State&);
+
+class BenchRunner
+{
+    typedef std::map<std::string, BenchFunction> BenchmarkMap;
+    static BenchmarkMap& benchmarks();
+
+public:
+    BenchRunner(const std::string& strName, BenchFunction func);
+
+    /** Run every benchmark whose name matches the regular expression
+        strFilter, each for at least dMinTime seconds */
+    static bool RunAll(const std::string& strFilter, double dMinTime);
+};
+
+}
+
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif
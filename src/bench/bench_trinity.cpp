@@ -0,0 +1,46 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "main.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "wallet.h"
+
+CWallet* pwalletMain;
+CClientUIInterface uiInterface;
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+void Shutdown()
+{
+    exit(0);
+}
+
+int main(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("--help"))
+    {
+        fprintf(stdout,
+            "Usage: bench_trinity [options]\n\n"
+            "Options:\n"
+            "  -filter=<regex>   Only run benchmarks whose name matches <regex> (default: all)\n"
+            "  -mintime=<secs>   Run each benchmark for at least <secs> seconds (default: 1)\n");
+        return 0;
+    }
+
+    // Results go to stdout, not debug.log
+    fPrintToConsole = true;
+
+    double dMinTime = atof(GetArg("-mintime", "1").c_str());
+    if (dMinTime <= 0)
+        dMinTime = 1;
+    bool fRet = benchmark::BenchRunner::RunAll(GetArg("-filter", ".*"), dMinTime);
+
+    return fRet ? 0 : 1;
+}
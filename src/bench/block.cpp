@@ -0,0 +1,42 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "core.h"
+#include "key.h"
+
+// Merkle root of a block with 1000 distinct transactions
+static void BuildMerkleTree_1000(benchmark::State& state)
+{
+    CBlock block;
+    for (int i = 0; i < 1000; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        block.vtx.push_back(tx);
+    }
+    while (state.KeepRunning())
+        block.BuildMerkleTree();
+}
+
+static void CPubKey_Verify(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = Hash(BEGIN(pubkey), END(pubkey));
+    std::vector<unsigned char> vchSig;
+    key.Sign(hash, vchSig);
+    while (state.KeepRunning())
+    {
+        if (!pubkey.Verify(hash, vchSig))
+            throw std::runtime_error("CPubKey_Verify: signature does not verify");
+    }
+}
+
+BENCHMARK(BuildMerkleTree_1000);
+BENCHMARK(CPubKey_Verify);
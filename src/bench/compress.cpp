@@ -0,0 +1,57 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "lzcodec.h"
+
+#include <vector>
+
+// Block-shaped input: random hashes interleaved with standard scripts
+static std::vector<unsigned char> BenchBlockData()
+{
+    std::vector<unsigned char> data;
+    while (data.size() < 1000000)
+    {
+        for (int i = 0; i < 32; i++)
+            data.push_back(insecure_rand());
+        static const unsigned char script[] = { 0x19, 0x76, 0xa9, 0x14 };
+        data.insert(data.end(), script, script + sizeof(script));
+        for (int i = 0; i < 20; i++)
+            data.push_back(insecure_rand());
+        data.push_back(0x88);
+        data.push_back(0xac);
+        data.insert(data.end(), 4, 0xff);
+    }
+    return data;
+}
+
+static void LZCompressLevel(benchmark::State& state, int nLevel)
+{
+    std::vector<unsigned char> in = BenchBlockData(), out;
+    state.SetBytesPerOp(in.size());
+    while (state.KeepRunning())
+    {
+        out.clear();
+        LZCompress(&in[0], in.size(), out, nLevel);
+    }
+}
+
+static void LZ_Compress1(benchmark::State& state) { LZCompressLevel(state, 1); }
+static void LZ_Compress6(benchmark::State& state) { LZCompressLevel(state, 6); }
+static void LZ_Compress9(benchmark::State& state) { LZCompressLevel(state, 9); }
+
+static void LZ_Decompress(benchmark::State& state)
+{
+    std::vector<unsigned char> in = BenchBlockData(), compressed;
+    LZCompress(&in[0], in.size(), compressed, 6);
+    std::vector<unsigned char> out(in.size());
+    state.SetBytesPerOp(in.size());
+    while (state.KeepRunning())
+        LZDecompress(&compressed[0], compressed.size(), &out[0], out.size());
+}
+
+BENCHMARK(LZ_Compress1);
+BENCHMARK(LZ_Compress6);
+BENCHMARK(LZ_Compress9);
+BENCHMARK(LZ_Decompress);
@@ -0,0 +1,146 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "hash.h"
+#include "hashgroestl.h"
+#include "hashqubit.h"
+#include "hashskein.h"
+
+#include "sph_blake.h"
+#include "sph_bmw.h"
+#include "sph_cubehash.h"
+#include "sph_echo.h"
+#include "sph_groestl.h"
+#include "sph_jh.h"
+#include "sph_keccak.h"
+#include "sph_luffa.h"
+#include "sph_shavite.h"
+#include "sph_simd.h"
+#include "sph_skein.h"
+
+#include <vector>
+
+// Header-sized input, as hashed for proof-of-work
+static const size_t HEADER_SIZE = 80;
+static const size_t LARGE_SIZE = 1024 * 1024;
+
+static void SHA256d_Header(benchmark::State& state)
+{
+    std::vector<unsigned char> in(HEADER_SIZE, 0);
+    state.SetBytesPerOp(in.size());
+    while (state.KeepRunning())
+    {
+        uint256 hash = Hash(in.begin(), in.end());
+        in[0] = *hash.begin();
+    }
+}
+
+static void SHA256d_1MB(benchmark::State& state)
+{
+    std::vector<unsigned char> in(LARGE_SIZE, 0);
+    state.SetBytesPerOp(in.size());
+    while (state.KeepRunning())
+    {
+        uint256 hash = Hash(in.begin(), in.end());
+        in[0] = *hash.begin();
+    }
+}
+
+static void HashGroestl_Header(benchmark::State& state)
+{
+    std::vector<unsigned char> in(HEADER_SIZE, 0);
+    state.SetBytesPerOp(in.size());
+    while (state.KeepRunning())
+    {
+        uint256 hash = HashGroestl(in.begin(), in.end());
+        in[0] = *hash.begin();
+    }
+}
+
+static void HashGroestl_1MB(benchmark::State& state)
+{
+    std::vector<unsigned char> in(LARGE_SIZE, 0);
+    state.SetBytesPerOp(in.size());
+    while (state.KeepRunning())
+    {
+        uint256 hash = HashGroestl(in.begin(), in.end());
+        in[0] = *hash.begin();
+    }
+}
+
+static void HashQubit_Header(benchmark::State& state)
+{
+    std::vector<unsigned char> in(HEADER_SIZE, 0);
+    state.SetBytesPerOp(in.size());
+    while (state.KeepRunning())
+    {
+        uint256 hash = HashQubit(in.begin(), in.end());
+        in[0] = *hash.begin();
+    }
+}
+
+static void HashSkein_Header(benchmark::State& state)
+{
+    std::vector<unsigned char> in(HEADER_SIZE, 0);
+    state.SetBytesPerOp(in.size());
+    while (state.KeepRunning())
+    {
+        uint256 hash = HashSkein(in.begin(), in.end());
+        in[0] = *hash.begin();
+    }
+}
+
+BENCHMARK(SHA256d_Header);
+BENCHMARK(SHA256d_1MB);
+BENCHMARK(HashGroestl_Header);
+BENCHMARK(HashGroestl_1MB);
+BENCHMARK(HashQubit_Header);
+BENCHMARK(HashSkein_Header);
+
+//
+// Every sphlib primitive, on the 64-byte input the chained hashes feed each
+// other and on a 1 MiB buffer for bulk throughput
+//
+#define BENCH_SPH(name) \
+    static void sph_##name##_64(benchmark::State& state) \
+    { \
+        sph_##name##_context ctx; \
+        unsigned char buf[64] = { 0 }; \
+        state.SetBytesPerOp(sizeof(buf)); \
+        while (state.KeepRunning()) \
+        { \
+            sph_##name##_init(&ctx); \
+            sph_##name(&ctx, buf, sizeof(buf)); \
+            sph_##name##_close(&ctx, buf); \
+        } \
+    } \
+    static void sph_##name##_1MB(benchmark::State& state) \
+    { \
+        sph_##name##_context ctx; \
+        std::vector<unsigned char> in(LARGE_SIZE, 0); \
+        unsigned char out[64]; \
+        state.SetBytesPerOp(in.size()); \
+        while (state.KeepRunning()) \
+        { \
+            sph_##name##_init(&ctx); \
+            sph_##name(&ctx, &in[0], in.size()); \
+            sph_##name##_close(&ctx, out); \
+            in[0] = out[0]; \
+        } \
+    } \
+    BENCHMARK(sph_##name##_64); \
+    BENCHMARK(sph_##name##_1MB);
+
+BENCH_SPH(blake512)
+BENCH_SPH(bmw512)
+BENCH_SPH(cubehash512)
+BENCH_SPH(echo512)
+BENCH_SPH(groestl512)
+BENCH_SPH(jh512)
+BENCH_SPH(keccak512)
+BENCH_SPH(luffa512)
+BENCH_SPH(shavite512)
+BENCH_SPH(simd512)
+BENCH_SPH(skein512)
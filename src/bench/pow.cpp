@@ -0,0 +1,129 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "core.h"
+#include "hashgroestl.h"
+#include "scrypt.h"
+#include "sha256d.h"
+
+#include <vector>
+
+static void Scrypt_Generic(benchmark::State& state)
+{
+    char in[80] = { 0 };
+    uint256 hash;
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    state.SetBytesPerOp(sizeof(in));
+    while (state.KeepRunning())
+    {
+        scrypt_1024_1_1_256_sp_generic(in, BEGIN(hash), &scratchpad[0]);
+        in[76]++;
+    }
+}
+
+#if defined(USE_SSE2) && (defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64))
+static void Scrypt_SSE2(benchmark::State& state)
+{
+    char in[80] = { 0 };
+    uint256 hash;
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    state.SetBytesPerOp(sizeof(in));
+    while (state.KeepRunning())
+    {
+        scrypt_1024_1_1_256_sp_sse2(in, BEGIN(hash), &scratchpad[0]);
+        in[76]++;
+    }
+}
+BENCHMARK(Scrypt_SSE2);
+#endif
+
+// One header per iteration, hashed in batches by the widest kernel
+static void Scrypt_Multi(benchmark::State& state)
+{
+    const unsigned int nLanes = scrypt_best_throughput();
+    std::vector<char> in(80 * nLanes, 0);
+    std::vector<uint256> hashes(nLanes);
+    unsigned int nLane = 0;
+    state.SetBytesPerOp(80);
+    while (state.KeepRunning())
+    {
+        if (++nLane < nLanes)
+            continue;
+        nLane = 0;
+        scrypt_1024_1_1_256_multi(&in[0], (char*)&hashes[0], nLanes);
+        in[76]++;
+    }
+}
+
+BENCHMARK(Scrypt_Generic);
+BENCHMARK(Scrypt_Multi);
+
+static void SHA256d_Scan1Way(benchmark::State& state)
+{
+    uint32_t midstate[8] = { 0 }, data[16] = { 0 }, hash[8];
+    uint32_t nNonce = 0;
+    while (state.KeepRunning())
+        sha256d_scan_1way(hash, midstate, data, nNonce++);
+}
+
+// Nonces per second of the kernel the miner selects for this CPU
+static void SHA256d_ScanHash(benchmark::State& state)
+{
+    char pmidstatebuf[32+16]; char* pmidstate = alignup<16>(pmidstatebuf);
+    char pdatabuf[64+16];     char* pdata     = alignup<16>(pdatabuf);
+    char phash1buf[64+16];    char* phash1    = alignup<16>(phash1buf);
+    char phashbuf[32+16];     char* phash     = alignup<16>(phashbuf);
+    memset(pmidstate, 0, 32);
+    memset(pdata, 0, 64);
+    memset(phash1, 0, 64);
+
+    // ScanHash_SHA256d runs up to 0x10000 nonces per call; time each nonce
+    unsigned int nPending = 0;
+    while (state.KeepRunning())
+    {
+        if (nPending == 0)
+        {
+            ScanHash_SHA256d(pmidstate, pdata, phash1, phash, nPending);
+            if (nPending == 0)
+                nPending = 1;
+        }
+        nPending--;
+    }
+}
+
+BENCHMARK(SHA256d_Scan1Way);
+BENCHMARK(SHA256d_ScanHash);
+
+static void Groestl512_Header(benchmark::State& state)
+{
+    unsigned char in[80] = { 0 }, out[64];
+    state.SetBytesPerOp(sizeof(in));
+    while (state.KeepRunning())
+    {
+        Groestl512(in, sizeof(in), out);
+        in[76]++;
+    }
+}
+
+// CBlockHeader::GetPoWHash as used to validate each algorithm's headers
+static void PoWHash(benchmark::State& state, int algo)
+{
+    CBlockHeader header;
+    header.nVersion = BLOCK_VERSION_DEFAULT;
+    while (state.KeepRunning())
+    {
+        uint256 hash = header.GetPoWHash(algo);
+        header.nNonce++;
+    }
+}
+
+static void PoWHash_SHA256d(benchmark::State& state) { PoWHash(state, ALGO_SHA256D); }
+static void PoWHash_Scrypt(benchmark::State& state) { PoWHash(state, ALGO_SCRYPT); }
+static void PoWHash_Groestl(benchmark::State& state) { PoWHash(state, ALGO_GROESTL); }
+
+BENCHMARK(Groestl512_Header);
+BENCHMARK(PoWHash_SHA256d);
+BENCHMARK(PoWHash_Scrypt);
+BENCHMARK(PoWHash_Groestl);
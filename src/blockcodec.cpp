@@ -0,0 +1,539 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcodec.h"
+#include "core.h"
+#include "lzcodec.h"
+#include "script.h"
+#include "util.h"
+#include "version.h"
+
+#include <map>
+
+using namespace std;
+
+// Column streams, in the order they are stored
+enum
+{
+    STREAM_HEADER = 0,      // block header and per-transaction integers
+    STREAM_PREVOUT_REF,     // where each prevout txid comes from, and its output index
+    STREAM_PREVOUT_TXID,    // prevout txids seen for the first time
+    STREAM_SEQUENCE,        // nSequence, inverted so final inputs are zero
+    STREAM_SCRIPTSIG,       // input scripts: signatures and public keys
+    STREAM_AMOUNT,          // output amounts, as CTxOutCompressor::CompressAmount
+    STREAM_SCRIPT_TEMPLATE, // output script template, or script length + 6
+    STREAM_SCRIPT_PAYLOAD,  // template hashes and keys, or the raw script
+    NUM_STREAMS
+};
+
+// How each stream is stored
+enum
+{
+    CODER_RAW = 0,
+    CODER_LZ = 1,
+    CODER_RANGE = 2,
+};
+
+// Prevout references; REF_RECENT + n is the n-th most recent new txid
+enum
+{
+    REF_NULL = 0,       // coinbase input, no output index follows
+    REF_NEW = 1,        // txid follows in STREAM_PREVOUT_TXID
+    REF_BLOCK = 2,      // index of an earlier transaction in this block follows
+    REF_RECENT = 3,
+};
+
+// CScriptCompressor's templates end here; larger values are script lengths
+static const unsigned int SCRIPT_TEMPLATES = 6;
+
+/** CScriptCompressor limited to the templates that decompress without
+ *  elliptic curve math, keeping block reads cheap */
+class CBlockScriptCompressor : public CScriptCompressor
+{
+public:
+    CBlockScriptCompressor(CScript& scriptIn) : CScriptCompressor(scriptIn) { }
+
+    bool CompressTemplate(std::vector<unsigned char>& out) const
+    {
+        return Compress(out) && out[0] < 4;
+    }
+
+    unsigned int GetTemplateSize(unsigned int nTemplate) const
+    {
+        return GetSpecialSize(nTemplate);
+    }
+
+    bool DecompressTemplate(unsigned int nTemplate, const std::vector<unsigned char>& in)
+    {
+        return Decompress(nTemplate, in);
+    }
+};
+
+//
+// Adaptive binary range coder, as used by LZMA, coding each byte as eight
+// bits down a binary tree of probabilities (an order-0 model)
+//
+static const int RC_PROB_BITS = 11;
+static const int RC_MOVE_BITS = 5;
+static const uint32_t RC_PROB_INIT = 1 << (RC_PROB_BITS - 1);
+static const uint32_t RC_TOP = 1 << 24;
+
+class CRangeEncoder
+{
+private:
+    std::vector<unsigned char>& vOut;
+    uint64_t nLow;
+    uint32_t nRange;
+    unsigned char chCache;
+    uint64_t nCacheSize;
+    uint16_t vProb[256];
+
+    void ShiftLow()
+    {
+        if ((uint32_t)nLow < 0xFF000000U || (nLow >> 32) != 0)
+        {
+            unsigned char chCarry = nLow >> 32;
+            unsigned char ch = chCache;
+            do {
+                vOut.push_back(ch + chCarry);
+                ch = 0xFF;
+            } while (--nCacheSize != 0);
+            chCache = (nLow >> 24) & 0xFF;
+        }
+        nCacheSize++;
+        nLow = (nLow & 0x00FFFFFF) << 8;
+    }
+
+    void EncodeBit(uint16_t& nProb, int nBit)
+    {
+        uint32_t nBound = (nRange >> RC_PROB_BITS) * nProb;
+        if (nBit == 0)
+        {
+            nRange = nBound;
+            nProb += ((1 << RC_PROB_BITS) - nProb) >> RC_MOVE_BITS;
+        }
+        else
+        {
+            nLow += nBound;
+            nRange -= nBound;
+            nProb -= nProb >> RC_MOVE_BITS;
+        }
+        while (nRange < RC_TOP)
+        {
+            nRange <<= 8;
+            ShiftLow();
+        }
+    }
+
+public:
+    CRangeEncoder(std::vector<unsigned char>& vOutIn) :
+        vOut(vOutIn), nLow(0), nRange(0xFFFFFFFF), chCache(0), nCacheSize(1)
+    {
+        for (int i = 0; i < 256; i++)
+            vProb[i] = RC_PROB_INIT;
+    }
+
+    void Encode(unsigned char ch)
+    {
+        unsigned int nCtx = 1;
+        for (int i = 7; i >= 0; i--)
+        {
+            int nBit = (ch >> i) & 1;
+            EncodeBit(vProb[nCtx], nBit);
+            nCtx = (nCtx << 1) | nBit;
+        }
+    }
+
+    void Flush()
+    {
+        for (int i = 0; i < 5; i++)
+            ShiftLow();
+    }
+};
+
+class CRangeDecoder
+{
+private:
+    const unsigned char* p;
+    const unsigned char* pend;
+    uint32_t nRange;
+    uint32_t nCode;
+    bool fOverrun;
+    uint16_t vProb[256];
+
+    unsigned char Next()
+    {
+        if (p < pend)
+            return *p++;
+        fOverrun = true;
+        return 0;
+    }
+
+    int DecodeBit(uint16_t& nProb)
+    {
+        uint32_t nBound = (nRange >> RC_PROB_BITS) * nProb;
+        int nBit;
+        if (nCode < nBound)
+        {
+            nRange = nBound;
+            nProb += ((1 << RC_PROB_BITS) - nProb) >> RC_MOVE_BITS;
+            nBit = 0;
+        }
+        else
+        {
+            nCode -= nBound;
+            nRange -= nBound;
+            nProb -= nProb >> RC_MOVE_BITS;
+            nBit = 1;
+        }
+        while (nRange < RC_TOP)
+        {
+            nRange <<= 8;
+            nCode = (nCode << 8) | Next();
+        }
+        return nBit;
+    }
+
+public:
+    CRangeDecoder(const unsigned char* pbegin, const unsigned char* pendIn) :
+        p(pbegin), pend(pendIn), nRange(0xFFFFFFFF), nCode(0), fOverrun(false)
+    {
+        for (int i = 0; i < 256; i++)
+            vProb[i] = RC_PROB_INIT;
+        for (int i = 0; i < 5; i++)
+            nCode = (nCode << 8) | Next();
+    }
+
+    unsigned char Decode()
+    {
+        unsigned int nCtx = 1;
+        while (nCtx < 256)
+            nCtx = (nCtx << 1) | DecodeBit(vProb[nCtx]);
+        return nCtx & 0xFF;
+    }
+
+    bool IsValid() const { return !fOverrun; }
+};
+
+static inline void WriteStreamVarInt(CDataStream& s, uint64 n)
+{
+    s << VARINT(n);
+}
+
+static inline uint64 ReadStreamVarInt(CDataStream& s)
+{
+    uint64 n = 0;
+    s >> VARINT(n);
+    return n;
+}
+
+// Store one stream with whichever coder makes it smallest
+static void WriteStream(const CDataStream& s, std::vector<unsigned char>& vchOut, int nLevel)
+{
+    const unsigned char* pbegin = s.empty() ? NULL : (const unsigned char*)&s.begin()[0];
+    size_t nSize = s.size();
+
+    int nCoder = CODER_RAW;
+    std::vector<unsigned char> vchBest;
+    if (nSize > 0)
+    {
+        std::vector<unsigned char> vchLZ, vchRange;
+        LZCompress(pbegin, nSize, vchLZ, nLevel);
+        CRangeEncoder encoder(vchRange);
+        for (size_t i = 0; i < nSize; i++)
+            encoder.Encode(pbegin[i]);
+        encoder.Flush();
+
+        if (vchLZ.size() < nSize && vchLZ.size() <= vchRange.size())
+        {
+            nCoder = CODER_LZ;
+            vchBest.swap(vchLZ);
+        }
+        else if (vchRange.size() < nSize)
+        {
+            nCoder = CODER_RANGE;
+            vchBest.swap(vchRange);
+        }
+    }
+
+    CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+    ssHeader << (unsigned char)nCoder;
+    WriteStreamVarInt(ssHeader, nSize);
+    WriteStreamVarInt(ssHeader, nCoder == CODER_RAW ? nSize : vchBest.size());
+    vchOut.insert(vchOut.end(), ssHeader.begin(), ssHeader.end());
+    if (nCoder == CODER_RAW)
+        vchOut.insert(vchOut.end(), pbegin, pbegin + nSize);
+    else
+        vchOut.insert(vchOut.end(), vchBest.begin(), vchBest.end());
+}
+
+// Read one stream from ssIn, which holds the bytes up to pend
+static bool ReadStream(CDataStream& ssIn, const unsigned char* pend, std::vector<unsigned char>& vchStream)
+{
+    unsigned char nCoder;
+    ssIn >> nCoder;
+    uint64 nSize = ReadStreamVarInt(ssIn);
+    uint64 nEncodedSize = ReadStreamVarInt(ssIn);
+    if (nSize > MAX_SIZE || nEncodedSize > ssIn.size())
+        return false;
+
+    const unsigned char* pstream = pend - ssIn.size();
+    ssIn.ignore(nEncodedSize);
+
+    vchStream.resize(nSize);
+    switch (nCoder)
+    {
+        case CODER_RAW:
+            if (nEncodedSize != nSize)
+                return false;
+            if (nSize)
+                memcpy(&vchStream[0], pstream, nSize);
+            return true;
+        case CODER_LZ:
+            return LZDecompress(pstream, nEncodedSize, nSize ? &vchStream[0] : NULL, nSize);
+        case CODER_RANGE:
+        {
+            CRangeDecoder decoder(pstream, pstream + nEncodedSize);
+            for (uint64 i = 0; i < nSize; i++)
+                vchStream[i] = decoder.Decode();
+            return decoder.IsValid();
+        }
+    }
+    return false;
+}
+
+static bool EncodeBlock(const CBlock& block, std::vector<unsigned char>& vchOut, int nLevel)
+{
+    std::vector<CDataStream> vStreams(NUM_STREAMS, CDataStream(SER_DISK, CLIENT_VERSION));
+    CDataStream& sHeader = vStreams[STREAM_HEADER];
+    CDataStream& sRef = vStreams[STREAM_PREVOUT_REF];
+
+    sHeader << block.GetBlockHeader();
+    WriteStreamVarInt(sHeader, block.vtx.size());
+
+    std::map<uint256, unsigned int> mapBlockTx;
+    std::map<uint256, unsigned int> mapRecent;
+    unsigned int nRecent = 0;
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction& tx = block.vtx[i];
+        WriteStreamVarInt(sHeader, (unsigned int)tx.nVersion);
+        WriteStreamVarInt(sHeader, tx.vin.size());
+        WriteStreamVarInt(sHeader, tx.vout.size());
+        WriteStreamVarInt(sHeader, tx.nLockTime);
+
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            const COutPoint& prevout = txin.prevout;
+            std::map<uint256, unsigned int>::const_iterator it;
+            if (prevout.IsNull())
+                WriteStreamVarInt(sRef, REF_NULL);
+            else if ((it = mapBlockTx.find(prevout.hash)) != mapBlockTx.end())
+            {
+                WriteStreamVarInt(sRef, REF_BLOCK);
+                WriteStreamVarInt(sRef, it->second);
+            }
+            else if ((it = mapRecent.find(prevout.hash)) != mapRecent.end())
+                WriteStreamVarInt(sRef, REF_RECENT + (nRecent - 1 - it->second));
+            else
+            {
+                WriteStreamVarInt(sRef, REF_NEW);
+                vStreams[STREAM_PREVOUT_TXID] << prevout.hash;
+                mapRecent[prevout.hash] = nRecent++;
+            }
+            if (!prevout.IsNull())
+                WriteStreamVarInt(sRef, prevout.n);
+
+            WriteStreamVarInt(vStreams[STREAM_SEQUENCE], ~txin.nSequence);
+            vStreams[STREAM_SCRIPTSIG] << txin.scriptSig;
+        }
+
+        BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        {
+            if (txout.nValue < 0)
+                return false;
+            WriteStreamVarInt(vStreams[STREAM_AMOUNT], CTxOutCompressor::CompressAmount(txout.nValue));
+
+            CScript script(txout.scriptPubKey);
+            std::vector<unsigned char> vchTemplate;
+            if (CBlockScriptCompressor(script).CompressTemplate(vchTemplate))
+            {
+                WriteStreamVarInt(vStreams[STREAM_SCRIPT_TEMPLATE], vchTemplate[0]);
+                vStreams[STREAM_SCRIPT_PAYLOAD].write((const char*)&vchTemplate[1], vchTemplate.size() - 1);
+            }
+            else
+            {
+                WriteStreamVarInt(vStreams[STREAM_SCRIPT_TEMPLATE], script.size() + SCRIPT_TEMPLATES);
+                if (!script.empty())
+                    vStreams[STREAM_SCRIPT_PAYLOAD].write((const char*)&script[0], script.size());
+            }
+        }
+
+        mapBlockTx[tx.GetHash()] = i;
+    }
+
+    vchOut.clear();
+    vchOut.push_back(NUM_STREAMS);
+    for (int i = 0; i < NUM_STREAMS; i++)
+        WriteStream(vStreams[i], vchOut, nLevel);
+    return true;
+}
+
+static bool DecodeBlock(const unsigned char* pbegin, const unsigned char* pend, CBlock& block)
+{
+    CDataStream ssIn((const char*)pbegin, (const char*)pend, SER_DISK, CLIENT_VERSION);
+    unsigned char nStreams;
+    ssIn >> nStreams;
+    if (nStreams != NUM_STREAMS)
+        return false;
+
+    std::vector<CDataStream> vStreams(NUM_STREAMS, CDataStream(SER_DISK, CLIENT_VERSION));
+    for (int i = 0; i < NUM_STREAMS; i++)
+    {
+        std::vector<unsigned char> vchStream;
+        if (!ReadStream(ssIn, pend, vchStream))
+            return false;
+        vStreams[i].write((const char*)(vchStream.empty() ? NULL : &vchStream[0]), vchStream.size());
+    }
+    if (!ssIn.empty())
+        return false;
+
+    CDataStream& sHeader = vStreams[STREAM_HEADER];
+    CDataStream& sRef = vStreams[STREAM_PREVOUT_REF];
+
+    block.SetNull();
+    sHeader >> *(CBlockHeader*)&block;
+
+    // Every transaction takes at least four bytes of the header stream, and
+    // every input and output at least one byte of their streams
+    uint64 nTx = ReadStreamVarInt(sHeader);
+    if (nTx > sHeader.size())
+        return false;
+    block.vtx.resize(nTx);
+
+    std::vector<uint256> vRecent;
+    std::vector<uint256> vTxHash(nTx);
+    std::vector<bool> vTxHashed(nTx, false);
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        CTransaction& tx = block.vtx[i];
+        tx.nVersion = (int)ReadStreamVarInt(sHeader);
+        uint64 nIn = ReadStreamVarInt(sHeader);
+        uint64 nOut = ReadStreamVarInt(sHeader);
+        tx.nLockTime = ReadStreamVarInt(sHeader);
+        if (nIn > sRef.size() || nOut > vStreams[STREAM_AMOUNT].size())
+            return false;
+        tx.vin.resize(nIn);
+        tx.vout.resize(nOut);
+
+        BOOST_FOREACH(CTxIn& txin, tx.vin)
+        {
+            uint64 nRef = ReadStreamVarInt(sRef);
+            if (nRef == REF_NULL)
+                txin.prevout.SetNull();
+            else
+            {
+                if (nRef == REF_NEW)
+                {
+                    vStreams[STREAM_PREVOUT_TXID] >> txin.prevout.hash;
+                    vRecent.push_back(txin.prevout.hash);
+                }
+                else if (nRef == REF_BLOCK)
+                {
+                    uint64 nTxPrev = ReadStreamVarInt(sRef);
+                    if (nTxPrev >= i)
+                        return false;
+                    // Only hash the earlier transactions that are referenced
+                    if (!vTxHashed[nTxPrev])
+                    {
+                        vTxHash[nTxPrev] = block.vtx[nTxPrev].GetHash();
+                        vTxHashed[nTxPrev] = true;
+                    }
+                    txin.prevout.hash = vTxHash[nTxPrev];
+                }
+                else
+                {
+                    uint64 nBack = nRef - REF_RECENT;
+                    if (nBack >= vRecent.size())
+                        return false;
+                    txin.prevout.hash = vRecent[vRecent.size() - 1 - nBack];
+                }
+                txin.prevout.n = ReadStreamVarInt(sRef);
+            }
+
+            txin.nSequence = ~(unsigned int)ReadStreamVarInt(vStreams[STREAM_SEQUENCE]);
+            vStreams[STREAM_SCRIPTSIG] >> txin.scriptSig;
+        }
+
+        BOOST_FOREACH(CTxOut& txout, tx.vout)
+        {
+            txout.nValue = CTxOutCompressor::DecompressAmount(ReadStreamVarInt(vStreams[STREAM_AMOUNT]));
+
+            CDataStream& sPayload = vStreams[STREAM_SCRIPT_PAYLOAD];
+            uint64 nTemplate = ReadStreamVarInt(vStreams[STREAM_SCRIPT_TEMPLATE]);
+            if (nTemplate < SCRIPT_TEMPLATES)
+            {
+                CBlockScriptCompressor compressor(txout.scriptPubKey);
+                std::vector<unsigned char> vch(compressor.GetTemplateSize(nTemplate));
+                sPayload.read((char*)&vch[0], vch.size());
+                if (!compressor.DecompressTemplate(nTemplate, vch))
+                    return false;
+            }
+            else
+            {
+                uint64 nSize = nTemplate - SCRIPT_TEMPLATES;
+                if (nSize > sPayload.size())
+                    return false;
+                txout.scriptPubKey.resize(nSize);
+                if (nSize)
+                    sPayload.read((char*)&txout.scriptPubKey[0], nSize);
+            }
+        }
+    }
+
+    for (int i = 0; i < NUM_STREAMS; i++)
+        if (!vStreams[i].empty())
+            return false;
+    return true;
+}
+
+bool EncodeBlockColumns(const std::vector<unsigned char>& vchBlock, std::vector<unsigned char>& vchOut, int nLevel)
+{
+    CBlock block;
+    try {
+        CDataStream ssBlock(vchBlock, SER_DISK, CLIENT_VERSION);
+        ssBlock >> block;
+        if (!ssBlock.empty())
+            return false;
+        if (!EncodeBlock(block, vchOut, nLevel))
+            return false;
+    }
+    catch (std::exception &e) {
+        return false;
+    }
+
+    // Only blocks that survive the round trip byte for byte can use this
+    // codec; anything serialized unusually is left to the generic codecs
+    std::vector<unsigned char> vchCheck;
+    if (vchOut.empty() || !DecodeBlockColumns(&vchOut[0], &vchOut[0] + vchOut.size(), vchCheck))
+        return false;
+    return vchCheck == vchBlock;
+}
+
+bool DecodeBlockColumns(const unsigned char* pbegin, const unsigned char* pend, std::vector<unsigned char>& vchBlock)
+{
+    try {
+        CBlock block;
+        if (!DecodeBlock(pbegin, pend, block))
+            return false;
+        CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+        ssBlock.reserve(pend - pbegin);
+        ssBlock << block;
+        vchBlock.assign(ssBlock.begin(), ssBlock.end());
+    }
+    catch (std::exception &e) {
+        return false;
+    }
+    return true;
+}
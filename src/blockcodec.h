@@ -0,0 +1,34 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCODEC_H
+#define BITCOIN_BLOCKCODEC_H
+
+#include <vector>
+
+/**
+ * Structure-aware block codec.
+ *
+ * The serialized block is parsed and its fields are split into separate
+ * streams: the header and per-transaction integers, prevout references,
+ * prevout txids, sequence numbers, input scripts, amounts, output script
+ * templates and output script payloads. Each stream is then stored raw,
+ * LZ compressed or range coded with an adaptive order-0 model, whichever
+ * is smallest, so random data such as txids and signatures costs nothing
+ * to decode while the predictable streams shrink well.
+ *
+ * Prevout txids repeated within a block, or naming an earlier transaction
+ * of the same block, become short references. Output scripts use the
+ * CScriptCompressor templates for pay-to-pubkey-hash, pay-to-script-hash
+ * and compressed pay-to-pubkey.
+ */
+
+/** Encode a serialized block; fails if it does not parse or would not
+ *  decode to the identical bytes, in which case another codec must be used */
+bool EncodeBlockColumns(const std::vector<unsigned char>& vchBlock, std::vector<unsigned char>& vchOut, int nLevel);
+
+/** Decode the output of EncodeBlockColumns back to the serialized block */
+bool DecodeBlockColumns(const unsigned char* pbegin, const unsigned char* pend, std::vector<unsigned char>& vchBlock);
+
+#endif // BITCOIN_BLOCKCODEC_H
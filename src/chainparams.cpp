@@ -30,9 +30,9 @@ public:
         vAlertPubKey = ParseHex("04a82e43bebee0af77bb6d4f830c5b2095b7479a480e91bbbf3547fb261c5e6d1be2c27e3c57503f501480f5027371ec62b2be1b6f00fc746e4b3777259e7f6a78");
         nDefaultPort = 62621;
         nRPCPort = 6420;
-        bnProofOfWorkLimit[ALGO_SHA256D] = CBigNum(~uint256(0) >> 20);
-        bnProofOfWorkLimit[ALGO_SCRYPT]  = CBigNum(~uint256(0) >> 20);
-        bnProofOfWorkLimit[ALGO_GROESTL]   = CBigNum(~uint256(0) >> 20);
+        bnProofOfWorkLimit[ALGO_SHA256D] = ~uint256(0) >> 20;
+        bnProofOfWorkLimit[ALGO_SCRYPT]  = ~uint256(0) >> 20;
+        bnProofOfWorkLimit[ALGO_GROESTL]   = ~uint256(0) >> 20;
         //nSubsidyHalvingInterval = 524160; // ~ every 6 months (2880 blocks per day including all algorithms)
 
         // Build the genesis block. Note that the output of the genesis coinbase cannot
@@ -145,9 +145,9 @@ public:
         pchMessageStart[2] = 0xa5;
         pchMessageStart[3] = 0x5a;
         nSubsidyHalvingInterval = 150;
-        bnProofOfWorkLimit[ALGO_SHA256D] = CBigNum(~uint256(0) >> 1);
-        bnProofOfWorkLimit[ALGO_SCRYPT]  = CBigNum(~uint256(0) >> 1);
-        bnProofOfWorkLimit[ALGO_GROESTL] = CBigNum(~uint256(0) >> 1);
+        bnProofOfWorkLimit[ALGO_SHA256D] = ~uint256(0) >> 1;
+        bnProofOfWorkLimit[ALGO_SCRYPT]  = ~uint256(0) >> 1;
+        bnProofOfWorkLimit[ALGO_GROESTL] = ~uint256(0) >> 1;
         genesis.nTime = 1296688602;
         genesis.nBits = 0x207fffff;
         genesis.nNonce = 4;
@@ -71,6 +71,32 @@ namespace Checkpoints
             return data;
     }
 
+    // Serialized hashes (CCoinsStats::hashSerialized) of UTXO sets at the given
+    // heights, checked against the chain before being added here. A set
+    // loaded with -loadtxoutset must match one of them unless the user
+    // vouches for it with -loadtxoutsethash.
+    static MapCheckpoints mapTxOutSetHashes;
+    static MapCheckpoints mapTxOutSetHashesTestnet;
+
+    static const MapCheckpoints &TxOutSetHashes() {
+        if (TestNet())
+            return mapTxOutSetHashesTestnet;
+        else
+            return mapTxOutSetHashes;
+    }
+
+    uint256 GetTxOutSetHash(int nHeight)
+    {
+        MapCheckpoints::const_iterator i = TxOutSetHashes().find(nHeight);
+        if (i == TxOutSetHashes().end()) return 0;
+        return i->second;
+    }
+
+    bool HaveTxOutSetHashes()
+    {
+        return !TxOutSetHashes().empty();
+    }
+
     bool CheckBlock(int nHeight, const uint256& hash)
     {
         if (!fEnabled)
@@ -124,7 +150,7 @@ namespace Checkpoints
         return checkpoints.rbegin()->first;
     }
 
-    CBlockIndex* GetLastCheckpoint(const std::map<uint256, CBlockIndex*>& mapBlockIndex)
+    CBlockIndex* GetLastCheckpoint(const CBlockMap& mapBlockIndex)
     {
         if (!fEnabled)
             return NULL;
@@ -134,7 +160,7 @@ namespace Checkpoints
         BOOST_REVERSE_FOREACH(const MapCheckpoints::value_type& i, checkpoints)
         {
             const uint256& hash = i.second;
-            std::map<uint256, CBlockIndex*>::const_iterator t = mapBlockIndex.find(hash);
+            CBlockMap::const_iterator t = mapBlockIndex.find(hash);
             if (t != mapBlockIndex.end())
                 return t->second;
         }
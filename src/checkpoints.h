@@ -8,6 +8,7 @@
 
 class uint256;
 class CBlockIndex;
+class CBlockMap;
 
 /** Block-chain checkpoints are compiled-in sanity checks.
  * They are updated every release or three.
@@ -21,10 +22,16 @@ namespace Checkpoints
     int GetTotalBlocksEstimate();
 
     // Returns last CBlockIndex* in mapBlockIndex that is a checkpoint
-    CBlockIndex* GetLastCheckpoint(const std::map<uint256, CBlockIndex*>& mapBlockIndex);
+    CBlockIndex* GetLastCheckpoint(const CBlockMap& mapBlockIndex);
 
     double GuessVerificationProgress(CBlockIndex *pindex);
 
+    // Known hash of the UTXO set at nHeight, 0 if there is none
+    uint256 GetTxOutSetHash(int nHeight);
+
+    // Whether any UTXO set hashes are compiled in for this network
+    bool HaveTxOutSetHashes();
+
     extern bool fEnabled;
 }
 
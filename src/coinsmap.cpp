@@ -0,0 +1,179 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsmap.h"
+#include "util.h"
+
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <string.h>
+
+static const size_t MIN_SLOTS = 16;
+static const size_t MIN_CHUNK_ENTRIES = 16;
+static const size_t MAX_CHUNK_ENTRIES = 4096;
+
+CCoinsMap::CCoinsMap() : nSize(0), nChunkEntries(0), nChunkUsed(0), nPoolBytes(0), pFree(NULL)
+{
+    // A per-map salt keeps the slot of a txid unpredictable to whoever created it
+    nSalt0 = GetRand(std::numeric_limits<uint64>::max());
+    nSalt1 = GetRand(std::numeric_limits<uint64>::max());
+}
+
+CCoinsMap::~CCoinsMap()
+{
+    clear();
+}
+
+uint64 CCoinsMap::Hash(const uint256 &key) const
+{
+    uint64 a, b;
+    memcpy(&a, key.begin(), 8);
+    memcpy(&b, key.begin() + 8, 8);
+    uint64 h = (a ^ nSalt0) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 32) ^ b ^ nSalt1) * 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 31);
+}
+
+size_t CCoinsMap::FindSlot(const uint256 &key, uint64 nHash) const
+{
+    // Returns the slot holding key, or the empty slot where it belongs
+    size_t nMask = vSlots.size() - 1;
+    size_t nPos = nHash & nMask;
+    while (vSlots[nPos].p != NULL) {
+        if (vSlots[nPos].nHash == nHash && vSlots[nPos].p->first == key)
+            break;
+        nPos = (nPos + 1) & nMask;
+    }
+    return nPos;
+}
+
+void CCoinsMap::Grow()
+{
+    std::vector<Slot> vOld;
+    vOld.swap(vSlots);
+    Slot empty = { 0, NULL };
+    vSlots.assign(vOld.empty() ? MIN_SLOTS : vOld.size() * 2, empty);
+    size_t nMask = vSlots.size() - 1;
+    for (size_t i = 0; i < vOld.size(); i++) {
+        if (vOld[i].p == NULL)
+            continue;
+        size_t nPos = vOld[i].nHash & nMask;
+        while (vSlots[nPos].p != NULL)
+            nPos = (nPos + 1) & nMask;
+        vSlots[nPos] = vOld[i];
+    }
+}
+
+CCoinsMap::value_type *CCoinsMap::AllocEntry(const uint256 &key)
+{
+    void *pMem;
+    if (pFree != NULL) {
+        pMem = pFree;
+        pFree = *(void**)pFree;
+    } else {
+        if (vChunks.empty() || nChunkUsed == nChunkEntries) {
+            nChunkEntries = vChunks.empty() ? MIN_CHUNK_ENTRIES : std::min(nChunkEntries * 2, MAX_CHUNK_ENTRIES);
+            vChunks.push_back(::operator new(nChunkEntries * sizeof(value_type)));
+            nPoolBytes += nChunkEntries * sizeof(value_type);
+            nChunkUsed = 0;
+        }
+        pMem = (char*)vChunks.back() + nChunkUsed * sizeof(value_type);
+        nChunkUsed++;
+    }
+    return new (pMem) value_type(key, CCoinsCacheEntry());
+}
+
+void CCoinsMap::FreeEntry(value_type *p)
+{
+    p->~value_type();
+    *(void**)p = pFree;
+    pFree = p;
+}
+
+CCoinsMap::iterator CCoinsMap::find(const uint256 &key)
+{
+    if (nSize == 0)
+        return end();
+    size_t nPos = FindSlot(key, Hash(key));
+    return vSlots[nPos].p != NULL ? iterator(&vSlots, nPos) : end();
+}
+
+CCoinsMap::const_iterator CCoinsMap::find(const uint256 &key) const
+{
+    if (nSize == 0)
+        return end();
+    size_t nPos = FindSlot(key, Hash(key));
+    return vSlots[nPos].p != NULL ? const_iterator(&vSlots, nPos) : end();
+}
+
+std::pair<CCoinsMap::iterator, bool> CCoinsMap::insert(const uint256 &key)
+{
+    // Keep the load factor at or below 3/4
+    if ((nSize + 1) * 4 > vSlots.size() * 3)
+        Grow();
+    uint64 nHash = Hash(key);
+    size_t nPos = FindSlot(key, nHash);
+    if (vSlots[nPos].p != NULL)
+        return std::make_pair(iterator(&vSlots, nPos), false);
+    vSlots[nPos].nHash = nHash;
+    vSlots[nPos].p = AllocEntry(key);
+    nSize++;
+    return std::make_pair(iterator(&vSlots, nPos), true);
+}
+
+void CCoinsMap::erase(iterator it)
+{
+    size_t nMask = vSlots.size() - 1;
+    size_t nHole = it.nPos;
+    FreeEntry(vSlots[nHole].p);
+    vSlots[nHole].p = NULL;
+    nSize--;
+
+    // Shift later members of the probe run back, so lookups need no tombstones
+    for (size_t nPos = (nHole + 1) & nMask; vSlots[nPos].p != NULL; nPos = (nPos + 1) & nMask) {
+        size_t nHome = vSlots[nPos].nHash & nMask;
+        // Move unless the entry's home lies cyclically in (nHole, nPos]
+        bool fStay = nHole <= nPos ? (nHole < nHome && nHome <= nPos) : (nHole < nHome || nHome <= nPos);
+        if (fStay)
+            continue;
+        vSlots[nHole] = vSlots[nPos];
+        vSlots[nPos].p = NULL;
+        nHole = nPos;
+    }
+}
+
+void CCoinsMap::clear()
+{
+    for (size_t i = 0; i < vSlots.size(); i++)
+        if (vSlots[i].p != NULL)
+            vSlots[i].p->~value_type();
+    std::vector<Slot>().swap(vSlots);
+    for (size_t i = 0; i < vChunks.size(); i++)
+        ::operator delete(vChunks[i]);
+    std::vector<void*>().swap(vChunks);
+    nSize = 0;
+    nChunkEntries = 0;
+    nChunkUsed = 0;
+    nPoolBytes = 0;
+    pFree = NULL;
+}
+
+void CCoinsMap::swap(CCoinsMap &other)
+{
+    vSlots.swap(other.vSlots);
+    std::swap(nSize, other.nSize);
+    std::swap(nSalt0, other.nSalt0);
+    std::swap(nSalt1, other.nSalt1);
+    vChunks.swap(other.vChunks);
+    std::swap(nChunkEntries, other.nChunkEntries);
+    std::swap(nChunkUsed, other.nChunkUsed);
+    std::swap(nPoolBytes, other.nPoolBytes);
+    std::swap(pFree, other.pFree);
+}
+
+size_t CCoinsMap::DynamicMemoryUsage() const
+{
+    return vSlots.capacity() * sizeof(Slot) + nPoolBytes + vChunks.capacity() * sizeof(void*);
+}
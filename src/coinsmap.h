@@ -0,0 +1,155 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_COINSMAP_H
+#define BITCOIN_COINSMAP_H
+
+#include "core.h"
+#include "uint256.h"
+
+#include <utility>
+#include <vector>
+
+/** A cached CCoins with its state relative to the view below the cache */
+class CCoinsCacheEntry
+{
+public:
+    CCoins coins;
+    unsigned char flags;
+    // Outputs that may differ from the view below, so a view storing them one by
+    // one need not read back what it has; not kept for FRESH entries
+    std::vector<unsigned int> vChanged;
+
+    enum Flags {
+        DIRTY = (1 << 0),   // differs from the view below, must be written back
+        FRESH = (1 << 1),   // the view below has no unspent version, so if this
+                            // becomes pruned it can be dropped instead of erased
+        PENDING = (1 << 2), // handed out for modification, memory usage not yet recounted
+        UNLISTED = (1 << 3), // modified through a reference, vChanged is incomplete
+    };
+
+    CCoinsCacheEntry() : flags(0) {}
+
+    size_t DynamicMemoryUsage() const {
+        return coins.DynamicMemoryUsage() + vChanged.capacity() * sizeof(unsigned int);
+    }
+};
+
+/**
+ * Hash table of cached coins, keyed by txid.
+ *
+ * Lookups probe a contiguous array of slots (open addressing with linear
+ * probing), each holding the salted hash of its key and a pointer to the
+ * entry. Entries are carved out of large chunks and recycled through a free
+ * list, so they never move: references and pointers to an entry stay valid
+ * until it is erased, even when the table grows. Iterators do not survive
+ * insert or erase.
+ */
+class CCoinsMap
+{
+public:
+    typedef std::pair<const uint256, CCoinsCacheEntry> value_type;
+
+private:
+    struct Slot {
+        uint64 nHash;
+        value_type *p;
+    };
+
+    std::vector<Slot> vSlots;   // size is zero or a power of two
+    size_t nSize;
+    uint64 nSalt0, nSalt1;
+
+    // Entry pool: chunks double in size up to a limit, freed entries are reused
+    std::vector<void*> vChunks;
+    size_t nChunkEntries;       // size of the newest chunk
+    size_t nChunkUsed;          // entries handed out from the newest chunk
+    size_t nPoolBytes;
+    void *pFree;
+
+    uint64 Hash(const uint256 &key) const;
+    size_t FindSlot(const uint256 &key, uint64 nHash) const;
+    void Grow();
+    value_type *AllocEntry(const uint256 &key);
+    void FreeEntry(value_type *p);
+
+    // Position of end(), which must not depend on the table size since
+    // callers may take end() before an insert grows the table
+    static const size_t END_POS = (size_t)-1;
+
+    // not copyable
+    CCoinsMap(const CCoinsMap &);
+    CCoinsMap &operator=(const CCoinsMap &);
+
+public:
+    class const_iterator;
+
+    class iterator
+    {
+        friend class CCoinsMap;
+        friend class const_iterator;
+        std::vector<Slot> *pvSlots;
+        size_t nPos;
+        iterator(std::vector<Slot> *pvSlotsIn, size_t nPosIn) : pvSlots(pvSlotsIn), nPos(nPosIn) { Skip(); }
+        void Skip() {
+            while (nPos < pvSlots->size() && (*pvSlots)[nPos].p == NULL) nPos++;
+            if (nPos >= pvSlots->size()) nPos = END_POS;
+        }
+    public:
+        iterator() : pvSlots(NULL), nPos(END_POS) {}
+        value_type &operator*() const { return *(*pvSlots)[nPos].p; }
+        value_type *operator->() const { return (*pvSlots)[nPos].p; }
+        iterator &operator++() { nPos++; Skip(); return *this; }
+        iterator operator++(int) { iterator ret = *this; ++*this; return ret; }
+        bool operator==(const iterator &it) const { return nPos == it.nPos; }
+        bool operator!=(const iterator &it) const { return nPos != it.nPos; }
+    };
+
+    class const_iterator
+    {
+        friend class CCoinsMap;
+        const std::vector<Slot> *pvSlots;
+        size_t nPos;
+        const_iterator(const std::vector<Slot> *pvSlotsIn, size_t nPosIn) : pvSlots(pvSlotsIn), nPos(nPosIn) { Skip(); }
+        void Skip() {
+            while (nPos < pvSlots->size() && (*pvSlots)[nPos].p == NULL) nPos++;
+            if (nPos >= pvSlots->size()) nPos = END_POS;
+        }
+    public:
+        const_iterator() : pvSlots(NULL), nPos(END_POS) {}
+        const_iterator(const iterator &it) : pvSlots(it.pvSlots), nPos(it.nPos) {}
+        const value_type &operator*() const { return *(*pvSlots)[nPos].p; }
+        const value_type *operator->() const { return (*pvSlots)[nPos].p; }
+        const_iterator &operator++() { nPos++; Skip(); return *this; }
+        const_iterator operator++(int) { const_iterator ret = *this; ++*this; return ret; }
+        bool operator==(const const_iterator &it) const { return nPos == it.nPos; }
+        bool operator!=(const const_iterator &it) const { return nPos != it.nPos; }
+    };
+
+    CCoinsMap();
+    ~CCoinsMap();
+
+    iterator begin() { return iterator(&vSlots, 0); }
+    iterator end() { return iterator(&vSlots, END_POS); }
+    const_iterator begin() const { return const_iterator(&vSlots, 0); }
+    const_iterator end() const { return const_iterator(&vSlots, END_POS); }
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+    size_t count(const uint256 &key) const { return find(key) != end() ? 1 : 0; }
+
+    iterator find(const uint256 &key);
+    const_iterator find(const uint256 &key) const;
+
+    // Insert a default entry for key unless one exists; the bool tells whether it was added
+    std::pair<iterator, bool> insert(const uint256 &key);
+
+    void erase(iterator it);
+    void clear();
+    void swap(CCoinsMap &other);
+
+    // Bytes held by the slot array and the entry pool, excluding memory
+    // owned by the CCoins themselves
+    size_t DynamicMemoryUsage() const;
+};
+
+#endif // BITCOIN_COINSMAP_H
@@ -3,17 +3,25 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "compressedstorage.h"
+#include "blockcodec.h"
 #include "hash.h"
+#include "lzcodec.h"
 #include "util.h"
 #include <algorithm>
 #include <cstring>
 
-// We'll use a simple but effective compression scheme
-// For production, this could use zlib, LZ4, or custom blockchain-specific compression
+// Block payloads use one of the TCMP_CODEC_* codecs; transactions use the
+// run-length encoder directly
 
 // Magic bytes to identify compressed data
 static const unsigned char COMPRESSION_MAGIC[4] = { 'T', 'C', 'M', 'P' }; // Trinity CoMPressed
-static const unsigned char COMPRESSION_VERSION = 0x01;
+
+// Version 1 header: magic, version, flags, original size, compressed size (RLE only)
+// Version 2 header: magic, version, flags, codec, original size, compressed size
+static const unsigned char COMPRESSION_VERSION_RLE = 0x01;
+static const unsigned char COMPRESSION_VERSION = 0x02;
+static const size_t COMPRESSION_HEADER_SIZE_RLE = 14;
+static const size_t COMPRESSION_HEADER_SIZE = 15;
 
 // Compression format flags
 static const unsigned char FLAG_COMPRESSED = 0x01;
@@ -22,8 +30,12 @@ static const unsigned char FLAG_DELTA_ENCODED = 0x04;
 
 CCompressedStorage compressedStorage;
 
+// Default memory budget for the deduplication dictionary
+static const size_t DEFAULT_PATTERN_CACHE_BYTES = 16 << 20;
+
 CCompressedStorage::CCompressedStorage() 
-    : fCompressionEnabled(false), nCompressionLevel(6)
+    : nCacheBytes(0), nMaxCacheBytes(DEFAULT_PATTERN_CACHE_BYTES),
+      fCompressionEnabled(false), nCompressionLevel(6), nCodec(TCMP_CODEC_LZ)
 {
 }
 
@@ -44,6 +56,53 @@ void CCompressedStorage::SetCompressionLevel(int level)
     nCompressionLevel = level;
 }
 
+bool CCompressedStorage::SetCodec(int codec)
+{
+    if (codec != TCMP_CODEC_STORE && codec != TCMP_CODEC_RLE && codec != TCMP_CODEC_LZ &&
+        codec != TCMP_CODEC_COLUMNAR)
+        return false;
+    nCodec = codec;
+    return true;
+}
+
+void CCompressedStorage::SetMaxCacheSize(size_t nBytes)
+{
+    LOCK(cs_patterns);
+    nMaxCacheBytes = nBytes;
+}
+
+size_t CCompressedStorage::PatternUsage(const TxPattern& pattern)
+{
+    // Pattern and data, plus the map node holding it
+    return sizeof(TxPattern) + pattern.data.size() +
+           4 * sizeof(void*) + sizeof(uint256);
+}
+
+TxPattern* CCompressedStorage::CachePattern(const TxPattern& pattern)
+{
+    TxPattern& cached = mapTxPatterns[pattern.patternHash];
+    cached = pattern;
+    nCacheBytes += PatternUsage(cached);
+    return &cached;
+}
+
+void CCompressedStorage::UncachePattern(const uint256& hash)
+{
+    std::map<uint256, TxPattern>::iterator mi = mapTxPatterns.find(hash);
+    if (mi == mapTxPatterns.end())
+        return;
+    nCacheBytes -= PatternUsage(mi->second);
+    mapTxPatterns.erase(mi);
+}
+
+TxPattern* CCompressedStorage::LookupPattern(const uint256& hash)
+{
+    std::map<uint256, TxPattern>::iterator mi = mapTxPatterns.find(hash);
+    if (mi == mapTxPatterns.end())
+        return NULL;
+    return &mi->second;
+}
+
 uint256 CCompressedStorage::ComputePatternHash(const std::vector<unsigned char>& data)
 {
     return Hash(data.begin(), data.end());
@@ -52,24 +111,40 @@ uint256 CCompressedStorage::ComputePatternHash(const std::vector<unsigned char>&
 bool CCompressedStorage::FindDuplicatePattern(const std::vector<unsigned char>& data, uint256& hashOut)
 {
     hashOut = ComputePatternHash(data);
-    return mapTxPatterns.count(hashOut) > 0;
+    return LookupPattern(hashOut) != NULL;
 }
 
-void CCompressedStorage::StorePattern(const uint256& hash, const std::vector<unsigned char>& data)
+bool CCompressedStorage::StorePattern(const uint256& hash, const std::vector<unsigned char>& data)
 {
-    if (mapTxPatterns.count(hash) > 0) {
-        mapTxPatterns[hash].refCount++;
-    } else {
-        TxPattern pattern;
-        pattern.patternHash = hash;
-        pattern.data = data;
-        pattern.refCount = 1;
-        mapTxPatterns[hash] = pattern;
+    TxPattern* ppattern = LookupPattern(hash);
+    if (ppattern) {
+        ppattern->refCount++;
+        return true;
     }
+
+    TxPattern pattern;
+    pattern.patternHash = hash;
+    pattern.data = data;
+    pattern.refCount = 1;
+    if (nCacheBytes + PatternUsage(pattern) > nMaxCacheBytes)
+        return false; // full: leave this one out of the dictionary
+    CachePattern(pattern);
+    return true;
 }
 
-// Simple RLE (Run-Length Encoding) compression for demonstration
-// In production, this would use zlib or LZ4
+bool CCompressedStorage::ReleasePattern(const uint256& hash)
+{
+    TxPattern* ppattern = LookupPattern(hash);
+    if (!ppattern)
+        return true; // never stored, e.g. refused when the dictionary was full
+    if (ppattern->refCount > 0)
+        ppattern->refCount--;
+    if (ppattern->refCount == 0)
+        UncachePattern(hash);
+    return true;
+}
+
+// Simple RLE (Run-Length Encoding) compression, the original block codec
 bool CCompressedStorage::CompressData(const std::vector<unsigned char>& input,
                                      std::vector<unsigned char>& output, int level)
 {
@@ -95,8 +170,9 @@ bool CCompressedStorage::CompressData(const std::vector<unsigned char>& input,
             runLength++;
         }
         
-        // If run is long enough, encode it
-        if (runLength >= 4) {
+        // If run is long enough, encode it; a literal escape byte must
+        // always be encoded as a run or it would decode as one
+        if (runLength >= 4 || current == 0xFF) {
             output.push_back(0xFF); // Escape byte
             output.push_back((unsigned char)runLength);
             output.push_back(current);
@@ -110,10 +186,6 @@ bool CCompressedStorage::CompressData(const std::vector<unsigned char>& input,
         }
     }
     
-    // Update statistics
-    stats.nTotalBytesOriginal += input.size();
-    stats.nTotalBytesCompressed += output.size();
-    
     return true;
 }
 
@@ -148,6 +220,53 @@ bool CCompressedStorage::DecompressData(const std::vector<unsigned char>& input,
     return true;
 }
 
+bool CCompressedStorage::CompressPayload(const std::vector<unsigned char>& input,
+                                        std::vector<unsigned char>& output, int codec, int level)
+{
+    output.clear();
+    switch (codec)
+    {
+        case TCMP_CODEC_STORE:
+            output = input;
+            return true;
+        case TCMP_CODEC_RLE:
+            return CompressData(input, output, level);
+        case TCMP_CODEC_LZ:
+            if (!input.empty())
+                LZCompress(&input[0], input.size(), output, level);
+            return true;
+        case TCMP_CODEC_COLUMNAR:
+            // Fails quietly for data that is not a canonically serialized block
+            return EncodeBlockColumns(input, output, level);
+    }
+    return error("CompressPayload() : unknown codec %d", codec);
+}
+
+bool CCompressedStorage::DecompressPayload(const unsigned char* pbegin, const unsigned char* pend,
+                                          std::vector<unsigned char>& output, int codec, uint32_t nOriginalSize)
+{
+    // The sizes come from disk; refuse anything no block or record can reach
+    if (nOriginalSize > MAX_SIZE)
+        return error("DecompressPayload() : original size %u too large", nOriginalSize);
+
+    switch (codec)
+    {
+        case TCMP_CODEC_STORE:
+            output.assign(pbegin, pend);
+            return true;
+        case TCMP_CODEC_RLE:
+            return DecompressData(std::vector<unsigned char>(pbegin, pend), output);
+        case TCMP_CODEC_LZ:
+            output.resize(nOriginalSize);
+            if (nOriginalSize == 0)
+                return pbegin == pend;
+            return LZDecompress(pbegin, pend - pbegin, &output[0], nOriginalSize);
+        case TCMP_CODEC_COLUMNAR:
+            return DecodeBlockColumns(pbegin, pend, output);
+    }
+    return error("DecompressPayload() : unknown codec %d", codec);
+}
+
 bool CCompressedStorage::DeltaEncode(const std::vector<unsigned char>& base,
                                     const std::vector<unsigned char>& target,
                                     std::vector<unsigned char>& delta)
@@ -213,17 +332,26 @@ bool CCompressedStorage::DeltaDecode(const std::vector<unsigned char>& base,
     return target.size() == targetSize;
 }
 
-bool CCompressedStorage::CompressBlock(const std::vector<unsigned char>& input,
-                                      std::vector<unsigned char>& output)
+bool CCompressedStorage::CompressRecord(const std::vector<unsigned char>& input,
+                                       std::vector<unsigned char>& output, int codec)
 {
-    if (!fCompressionEnabled) {
-        output = input;
-        return true;
+    // Compress the data, storing it as-is if that does not make it smaller
+    std::vector<unsigned char> compressed;
+    if (!CompressPayload(input, compressed, codec, nCompressionLevel)) {
+        if (codec != TCMP_CODEC_COLUMNAR)
+            return false;
+        codec = TCMP_CODEC_LZ;
+        if (!CompressPayload(input, compressed, codec, nCompressionLevel))
+            return false;
+    }
+    if (compressed.size() >= input.size() && codec != TCMP_CODEC_STORE) {
+        codec = TCMP_CODEC_STORE;
+        compressed = input;
     }
     
     // Build header
     output.clear();
-    output.reserve(input.size() + 16); // Reserve space for header + data
+    output.reserve(COMPRESSION_HEADER_SIZE + compressed.size());
     
     // Write magic bytes
     output.insert(output.end(), COMPRESSION_MAGIC, COMPRESSION_MAGIC + 4);
@@ -235,6 +363,9 @@ bool CCompressedStorage::CompressBlock(const std::vector<unsigned char>& input,
     unsigned char flags = FLAG_COMPRESSED;
     output.push_back(flags);
     
+    // Write codec
+    output.push_back((unsigned char)codec);
+    
     // Write original size (4 bytes)
     uint32_t originalSize = input.size();
     output.push_back((originalSize >> 24) & 0xFF);
@@ -242,12 +373,6 @@ bool CCompressedStorage::CompressBlock(const std::vector<unsigned char>& input,
     output.push_back((originalSize >> 8) & 0xFF);
     output.push_back(originalSize & 0xFF);
     
-    // Compress the data
-    std::vector<unsigned char> compressed;
-    if (!CompressData(input, compressed, nCompressionLevel)) {
-        return false;
-    }
-    
     // Write compressed size (4 bytes)
     uint32_t compressedSize = compressed.size();
     output.push_back((compressedSize >> 24) & 0xFF);
@@ -258,56 +383,103 @@ bool CCompressedStorage::CompressBlock(const std::vector<unsigned char>& input,
     // Append compressed data
     output.insert(output.end(), compressed.begin(), compressed.end());
     
-    stats.nBlocksCompressed++;
-    
     return true;
 }
 
-bool CCompressedStorage::DecompressBlock(const std::vector<unsigned char>& input,
-                                        std::vector<unsigned char>& output)
+bool CCompressedStorage::CompressBlock(const std::vector<unsigned char>& input,
+                                      std::vector<unsigned char>& output)
 {
-    if (!fCompressionEnabled || input.size() < 14) {
+    if (!fCompressionEnabled) {
         output = input;
         return true;
     }
     
-    // Check magic bytes
-    if (memcmp(&input[0], COMPRESSION_MAGIC, 4) != 0) {
-        // Not compressed, return as-is
+    return CompressRecord(input, output, nCodec);
+}
+
+bool CCompressedStorage::CompressUndo(const std::vector<unsigned char>& input,
+                                     std::vector<unsigned char>& output)
+{
+    if (!fCompressionEnabled) {
         output = input;
         return true;
     }
     
-    // Check version
-    if (input[4] != COMPRESSION_VERSION) {
+    return CompressRecord(input, output, nCodec == TCMP_CODEC_COLUMNAR ? (int)TCMP_CODEC_LZ : nCodec);
+}
+
+void CCompressedStorage::CountStored(bool fUndo, size_t nOriginal, size_t nStored)
+{
+    LOCK(cs_stats);
+    if (fUndo) {
+        stats.nUndoBytesOriginal += nOriginal;
+        stats.nUndoBytesCompressed += nStored;
+        stats.nUndoCompressed++;
+    } else {
+        stats.nTotalBytesOriginal += nOriginal;
+        stats.nTotalBytesCompressed += nStored;
+        stats.nBlocksCompressed++;
+    }
+}
+
+bool CCompressedStorage::IsCompressedBlock(const unsigned char* pbegin, const unsigned char* pend) const
+{
+    // Records written while compression was on stay readable after it is turned off
+    return (size_t)(pend - pbegin) >= COMPRESSION_HEADER_SIZE_RLE &&
+           memcmp(pbegin, COMPRESSION_MAGIC, 4) == 0;
+}
+
+bool CCompressedStorage::DecompressBlock(const std::vector<unsigned char>& input,
+                                        std::vector<unsigned char>& output)
+{
+    if (input.empty() || !IsCompressedBlock(&input[0], &input[0] + input.size())) {
+        // Not compressed, return as-is
+        output = input;
+        return true;
+    }
+    return DecompressBlock(&input[0], &input[0] + input.size(), output);
+}
+
+bool CCompressedStorage::DecompressBlock(const unsigned char* pbegin, const unsigned char* pend,
+                                        std::vector<unsigned char>& output)
+{
+    if (!IsCompressedBlock(pbegin, pend))
+        return error("DecompressBlock() : not a compressed block");
+    size_t nInput = pend - pbegin;
+    
+    // Check version; version 1 blocks have no codec byte and are always RLE
+    size_t nHeaderSize;
+    int codec;
+    if (pbegin[4] == COMPRESSION_VERSION_RLE) {
+        nHeaderSize = COMPRESSION_HEADER_SIZE_RLE;
+        codec = TCMP_CODEC_RLE;
+    } else if (pbegin[4] == COMPRESSION_VERSION && nInput >= COMPRESSION_HEADER_SIZE) {
+        nHeaderSize = COMPRESSION_HEADER_SIZE;
+        codec = pbegin[6];
+    } else {
         return error("DecompressBlock() : unsupported compression version");
     }
     
-    // Read flags
-    unsigned char flags = input[5];
-    
     // Read original size
-    uint32_t originalSize = ((uint32_t)input[6] << 24) |
-                           ((uint32_t)input[7] << 16) |
-                           ((uint32_t)input[8] << 8) |
-                           (uint32_t)input[9];
+    const unsigned char* pheader = pbegin + nHeaderSize - 8;
+    uint32_t originalSize = ((uint32_t)pheader[0] << 24) |
+                           ((uint32_t)pheader[1] << 16) |
+                           ((uint32_t)pheader[2] << 8) |
+                           (uint32_t)pheader[3];
     
     // Read compressed size
-    uint32_t compressedSize = ((uint32_t)input[10] << 24) |
-                             ((uint32_t)input[11] << 16) |
-                             ((uint32_t)input[12] << 8) |
-                             (uint32_t)input[13];
+    uint32_t compressedSize = ((uint32_t)pheader[4] << 24) |
+                             ((uint32_t)pheader[5] << 16) |
+                             ((uint32_t)pheader[6] << 8) |
+                             (uint32_t)pheader[7];
     
-    if (14 + compressedSize > input.size()) {
+    if (compressedSize > nInput - nHeaderSize) {
         return error("DecompressBlock() : invalid compressed size");
     }
     
-    // Extract compressed data
-    std::vector<unsigned char> compressed(input.begin() + 14, 
-                                         input.begin() + 14 + compressedSize);
-    
-    // Decompress
-    if (!DecompressData(compressed, output)) {
+    // Decompress straight from the input buffer
+    const unsigned char* ppayload = pbegin + nHeaderSize;
+    if (!DecompressPayload(ppayload, ppayload + compressedSize, output, codec, originalSize)) {
         return error("DecompressBlock() : decompression failed");
     }
     
@@ -326,13 +498,18 @@ bool CCompressedStorage::CompressTransaction(const std::vector<unsigned char>& i
         return true;
     }
     
+    LOCK(cs_patterns);
+    
     // Check if this transaction pattern has been seen before
     uint256 patternHash;
     if (FindDuplicatePattern(input, patternHash)) {
         // Reference existing pattern
+        if (!StorePattern(patternHash, input))
+            return false;
         output.clear();
         output.push_back(0xFE); // Deduplication marker
         output.insert(output.end(), patternHash.begin(), patternHash.end());
+        LOCK(cs_stats);
         stats.nDedupedTransactions++;
         return true;
     }
@@ -341,7 +518,15 @@ bool CCompressedStorage::CompressTransaction(const std::vector<unsigned char>& i
     StorePattern(patternHash, input);
     
     // Compress normally
-    return CompressData(input, output, nCompressionLevel);
+    if (!CompressData(input, output, nCompressionLevel))
+        return false;
+    
+    {
+        LOCK(cs_stats);
+        stats.nTotalBytesOriginal += input.size();
+        stats.nTotalBytesCompressed += output.size();
+    }
+    return true;
 }
 
 bool CCompressedStorage::DecompressTransaction(const std::vector<unsigned char>& input,
@@ -357,8 +542,10 @@ bool CCompressedStorage::DecompressTransaction(const std::vector<unsigned char>&
         uint256 patternHash;
         memcpy(patternHash.begin(), &input[1], 32);
         
-        if (mapTxPatterns.count(patternHash) > 0) {
-            output = mapTxPatterns[patternHash].data;
+        LOCK(cs_patterns);
+        TxPattern* ppattern = LookupPattern(patternHash);
+        if (ppattern) {
+            output = ppattern->data;
             return true;
         } else {
             return error("DecompressTransaction() : pattern not found");
@@ -369,21 +556,47 @@ bool CCompressedStorage::DecompressTransaction(const std::vector<unsigned char>&
     return DecompressData(input, output);
 }
 
+bool CCompressedStorage::ReleaseTransaction(const std::vector<unsigned char>& input)
+{
+    if (!fCompressionEnabled || input.empty())
+        return true;
+    
+    uint256 patternHash;
+    if (input[0] == 0xFE && input.size() == 33) {
+        memcpy(patternHash.begin(), &input[1], 32);
+    } else {
+        // A first occurrence holds a reference to its own pattern
+        std::vector<unsigned char> data;
+        if (!DecompressData(input, data))
+            return false;
+        patternHash = ComputePatternHash(data);
+    }
+    
+    LOCK(cs_patterns);
+    return ReleasePattern(patternHash);
+}
+
+CompressionStats CCompressedStorage::GetStats() const
+{
+    LOCK(cs_stats);
+    return stats;
+}
+
 void CCompressedStorage::ResetStats()
 {
+    LOCK(cs_stats);
     stats = CompressionStats();
 }
 
 void CCompressedStorage::ClearCache()
 {
+    LOCK(cs_patterns);
     mapTxPatterns.clear();
+    nCacheBytes = 0;
 }
 
 size_t CCompressedStorage::GetCacheSize() const
 {
-    size_t total = 0;
-    for (const auto& pair : mapTxPatterns) {
-        total += pair.second.data.size() + sizeof(TxPattern);
-    }
-    return total;
+    LOCK(cs_patterns);
+    return nCacheBytes;
 }
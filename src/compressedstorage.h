@@ -6,6 +6,7 @@
 #define BITCOIN_COMPRESSED_STORAGE_H
 
 #include "serialize.h"
+#include "sync.h"
 #include "uint256.h"
 #include <vector>
 #include <map>
@@ -24,20 +25,39 @@
  * full backward compatibility with the network protocol.
  */
 
+/** Codec used for the payload, recorded in the TCMP header */
+enum
+{
+    TCMP_CODEC_STORE = 0,   // uncompressed, for data that does not shrink
+    TCMP_CODEC_RLE   = 1,   // escape-byte run-length encoding (all version 1 blocks)
+    TCMP_CODEC_LZ    = 2,   // LZ77 block codec, see lzcodec.h
+    TCMP_CODEC_COLUMNAR = 3, // per-field streams of a parsed block, see blockcodec.h
+};
+
 // Compression statistics for monitoring
 struct CompressionStats {
     uint64_t nTotalBytesOriginal;
     uint64_t nTotalBytesCompressed;
     uint64_t nBlocksCompressed;
     uint64_t nDedupedTransactions;
+    // Undo records are counted apart from blocks and transactions
+    uint64_t nUndoBytesOriginal;
+    uint64_t nUndoBytesCompressed;
+    uint64_t nUndoCompressed;
     
     CompressionStats() : nTotalBytesOriginal(0), nTotalBytesCompressed(0), 
-                         nBlocksCompressed(0), nDedupedTransactions(0) {}
+                         nBlocksCompressed(0), nDedupedTransactions(0),
+                         nUndoBytesOriginal(0), nUndoBytesCompressed(0), nUndoCompressed(0) {}
     
     double GetCompressionRatio() const {
         return nTotalBytesOriginal > 0 ? 
             (double)nTotalBytesCompressed / nTotalBytesOriginal : 1.0;
     }
+    
+    double GetUndoCompressionRatio() const {
+        return nUndoBytesOriginal > 0 ? 
+            (double)nUndoBytesCompressed / nUndoBytesOriginal : 1.0;
+    }
 };
 
 // Transaction pattern for deduplication
@@ -52,26 +72,45 @@ struct TxPattern {
 class CCompressedStorage
 {
 private:
-    // Deduplication cache - stores common transaction patterns
+    // Deduplication dictionary, within nMaxCacheBytes. It lives in memory
+    // only, so nothing written to disk may refer to it; new patterns are
+    // refused once it is full rather than evicting ones still referenced.
     std::map<uint256, TxPattern> mapTxPatterns;
+    size_t nCacheBytes;
+    size_t nMaxCacheBytes;
+    mutable CCriticalSection cs_patterns;
     
     // Compression statistics
     CompressionStats stats;
+    mutable CCriticalSection cs_stats;
     
     // Configuration
     bool fCompressionEnabled;
     int nCompressionLevel;  // 1-9, higher = more compression but slower
+    int nCodec;             // TCMP_CODEC_* used for new blocks
     
     // Helper functions for compression
     bool CompressData(const std::vector<unsigned char>& input, 
                      std::vector<unsigned char>& output, int level);
     bool DecompressData(const std::vector<unsigned char>& input, 
                        std::vector<unsigned char>& output);
+    // Frame data compressed with codec, falling back to LZ and then to storing it
+    bool CompressRecord(const std::vector<unsigned char>& input,
+                        std::vector<unsigned char>& output, int codec);
+    bool CompressPayload(const std::vector<unsigned char>& input,
+                        std::vector<unsigned char>& output, int codec, int level);
+    bool DecompressPayload(const unsigned char* pbegin, const unsigned char* pend,
+                          std::vector<unsigned char>& output, int codec, uint32_t nOriginalSize);
     
     // Deduplication helpers
     uint256 ComputePatternHash(const std::vector<unsigned char>& data);
     bool FindDuplicatePattern(const std::vector<unsigned char>& data, uint256& hashOut);
-    void StorePattern(const uint256& hash, const std::vector<unsigned char>& data);
+    bool StorePattern(const uint256& hash, const std::vector<unsigned char>& data);
+    bool ReleasePattern(const uint256& hash);
+    TxPattern* LookupPattern(const uint256& hash);
+    TxPattern* CachePattern(const TxPattern& pattern);
+    void UncachePattern(const uint256& hash);
+    static size_t PatternUsage(const TxPattern& pattern);
     
     // Delta encoding for similar blocks
     bool DeltaEncode(const std::vector<unsigned char>& base,
@@ -92,6 +131,13 @@ public:
     // Set compression level (1-9)
     void SetCompressionLevel(int level);
     int GetCompressionLevel() const { return nCompressionLevel; }
+
+    // Set the codec used to compress new blocks; any codec can be decompressed
+    bool SetCodec(int codec);
+    int GetCodec() const { return nCodec; }
+    
+    // Memory budget for the deduplication dictionary, in bytes
+    void SetMaxCacheSize(size_t nBytes);
     
     /**
      * Compress a block's serialized data
@@ -111,6 +157,39 @@ public:
     bool DecompressBlock(const std::vector<unsigned char>& input,
                         std::vector<unsigned char>& output);
     
+    /** Decompress a stored block in place, e.g. in a mapped file; unlike
+     *  the vector form this fails if the data is not compressed */
+    bool DecompressBlock(const unsigned char* pbegin, const unsigned char* pend,
+                        std::vector<unsigned char>& output);
+    
+    /** Whether stored block data carries a compression header */
+    bool IsCompressedBlock(const unsigned char* pbegin, const unsigned char* pend) const;
+    
+    /**
+     * Compress a serialized CBlockUndo with the same framing as blocks.
+     * The columnar codec only understands blocks, so LZ is used instead.
+     * @param input  Original undo data
+     * @param output Compressed undo data
+     * @return true if compression succeeded
+     */
+    bool CompressUndo(const std::vector<unsigned char>& input,
+                      std::vector<unsigned char>& output);
+    
+    /** Decompress an undo record written by CompressUndo */
+    bool DecompressUndo(const unsigned char* pbegin, const unsigned char* pend,
+                        std::vector<unsigned char>& output)
+    {
+        return DecompressBlock(pbegin, pend, output);
+    }
+    
+    /**
+     * Count a block or undo record in the statistics, once the caller has
+     * chosen whether to store it compressed or as it was
+     * @param nOriginal  Size of the uncompressed record
+     * @param nStored    Size of what was written
+     */
+    void CountStored(bool fUndo, size_t nOriginal, size_t nStored);
+    
     /**
      * Compress transaction data with deduplication
      * @param input  Transaction data
@@ -129,14 +208,23 @@ public:
     bool DecompressTransaction(const std::vector<unsigned char>& input,
                               std::vector<unsigned char>& output);
     
+    /**
+     * Drop the dictionary reference held by data returned from
+     * CompressTransaction, once that data is deleted or rewritten.
+     * Patterns are removed when their last reference goes.
+     * @param input  Compressed/deduplicated data
+     * @return true if successful
+     */
+    bool ReleaseTransaction(const std::vector<unsigned char>& input);
+    
     // Get compression statistics
-    const CompressionStats& GetStats() const { return stats; }
+    CompressionStats GetStats() const;
     void ResetStats();
     
-    // Clear deduplication cache
+    // Clear the in-memory hot set of the deduplication dictionary
     void ClearCache();
     
-    // Get cache size in bytes
+    // Get memory used by the hot set in bytes
     size_t GetCacheSize() const;
 };
 
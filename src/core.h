@@ -58,6 +58,20 @@ inline std::string GetAlgoName(int Algo)
     return std::string("unknown");       
 }
 
+/** Parse an algorithm name as accepted by -algo; returns -1 if unknown */
+inline int GetAlgoByName(std::string strAlgo)
+{
+    for (std::string::iterator it = strAlgo.begin(); it != strAlgo.end(); ++it)
+        *it = tolower(*it);
+    if (strAlgo == "sha" || strAlgo == "sha256" || strAlgo == "sha256d")
+        return ALGO_SHA256D;
+    if (strAlgo == "scrypt")
+        return ALGO_SCRYPT;
+    if (strAlgo == "groestl" || strAlgo == "groestlsha2")
+        return ALGO_GROESTL;
+    return -1;
+}
+
 class CTransaction;
 
 /** An outpoint - a combination of a transaction hash and an index n into its vout */
@@ -578,6 +592,14 @@ public:
                 return false;
         return true;
     }
+
+    // heap memory held by the outputs and their scripts
+    size_t DynamicMemoryUsage() const {
+        size_t nUsage = vout.capacity() * sizeof(CTxOut);
+        BOOST_FOREACH(const CTxOut &out, vout)
+            nUsage += out.scriptPubKey.capacity();
+        return nUsage;
+    }
 };
 
 
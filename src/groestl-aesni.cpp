@@ -0,0 +1,202 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Groestl-512 built on the AES-NI round instructions, as an alternative to
+// the T-table code in groestl.c. Must be compiled with -maes -mssse3; only
+// called after Groestl512() has checked for AES-NI at runtime.
+//
+// The 8x16 byte state is kept as one xmm register per row, so ShiftBytes is
+// a byte rotation within each register (folded into the pshufb that undoes
+// AES ShiftRows before AESENCLAST does SubBytes) and MixBytes is a linear
+// combination of whole rows.
+//
+
+#include "hashgroestl.h"
+
+#include <string.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+// pshufb masks: rotate row i left by its ShiftBytes amount, then apply
+// inverse ShiftRows so that AESENCLAST leaves the bytes in place
+static const unsigned char pshufP[8][16] __attribute__((aligned(16))) = {
+    {  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3 },
+    {  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4 },
+    {  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5 },
+    {  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6 },
+    {  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7 },
+    {  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8 },
+    {  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9 },
+    { 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14 },
+};
+
+static const unsigned char pshufQ[8][16] __attribute__((aligned(16))) = {
+    {  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4 },
+    {  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6 },
+    {  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8 },
+    { 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14 },
+    {  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3 },
+    {  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5 },
+    {  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7 },
+    {  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9 },
+};
+
+static inline __m128i xtime(__m128i x)
+{
+    __m128i msb = _mm_cmplt_epi8(x, _mm_setzero_si128());
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(msb, _mm_set1_epi8(0x1b)));
+}
+
+// SubBytes, ShiftBytes and MixBytes with B = circ(02,02,03,04,05,03,05,07):
+// row i = A ^ 2 * (B ^ 2 * C) where A, B, C sum the rows i+t whose
+// coefficient has bit 0, 1, 2 set respectively, sharing adjacent-row sums
+static inline void groestl_round(__m128i x[8], const unsigned char pshuf[8][16])
+{
+    __m128i y[8];
+    for (int i = 0; i < 8; i++)
+        y[i] = _mm_aesenclast_si128(_mm_shuffle_epi8(x[i], _mm_load_si128((const __m128i*)pshuf[i])), _mm_setzero_si128());
+
+    __m128i t[8];
+    for (int i = 0; i < 8; i++)
+        t[i] = _mm_xor_si128(y[i], y[(i + 1) & 7]);
+
+    for (int i = 0; i < 8; i++)
+    {
+        __m128i a = _mm_xor_si128(y[(i + 2) & 7], _mm_xor_si128(t[(i + 4) & 7], t[(i + 6) & 7]));
+        __m128i b = _mm_xor_si128(_mm_xor_si128(t[i], y[(i + 2) & 7]), _mm_xor_si128(y[(i + 5) & 7], y[(i + 7) & 7]));
+        __m128i c = _mm_xor_si128(t[(i + 3) & 7], t[(i + 6) & 7]);
+        x[i] = _mm_xor_si128(a, xtime(_mm_xor_si128(b, xtime(c))));
+    }
+}
+
+static const unsigned char pcolP[16] __attribute__((aligned(16))) = {
+    0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xa0, 0xb0, 0xc0, 0xd0, 0xe0, 0xf0
+};
+static const unsigned char pcolQ[16] __attribute__((aligned(16))) = {
+    0xff, 0xef, 0xdf, 0xcf, 0xbf, 0xaf, 0x9f, 0x8f, 0x7f, 0x6f, 0x5f, 0x4f, 0x3f, 0x2f, 0x1f, 0x0f
+};
+
+// AddRoundConstant for round r of P (row 0) and Q (all rows inverted, row 7)
+static inline void groestl_addconst_P(__m128i x[8], int r)
+{
+    x[0] = _mm_xor_si128(x[0], _mm_xor_si128(_mm_load_si128((const __m128i*)pcolP), _mm_set1_epi8(r)));
+}
+
+static inline void groestl_addconst_Q(__m128i x[8], int r)
+{
+    const __m128i ones = _mm_set1_epi8((char)0xff);
+    for (int i = 0; i < 7; i++)
+        x[i] = _mm_xor_si128(x[i], ones);
+    x[7] = _mm_xor_si128(x[7], _mm_xor_si128(_mm_load_si128((const __m128i*)pcolQ), _mm_set1_epi8(r)));
+}
+
+static inline void groestl_P(__m128i x[8])
+{
+    for (int r = 0; r < 14; r++)
+    {
+        groestl_addconst_P(x, r);
+        groestl_round(x, pshufP);
+    }
+}
+
+// Transpose an 8x8 matrix of 16-bit words
+static inline void transpose_8x8_epi16(__m128i x[8])
+{
+    __m128i a[8], b[8];
+    for (int i = 0; i < 4; i++)
+    {
+        a[2 * i]     = _mm_unpacklo_epi16(x[2 * i], x[2 * i + 1]);
+        a[2 * i + 1] = _mm_unpackhi_epi16(x[2 * i], x[2 * i + 1]);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        b[4 * i]     = _mm_unpacklo_epi32(a[4 * i], a[4 * i + 2]);
+        b[4 * i + 1] = _mm_unpackhi_epi32(a[4 * i], a[4 * i + 2]);
+        b[4 * i + 2] = _mm_unpacklo_epi32(a[4 * i + 1], a[4 * i + 3]);
+        b[4 * i + 3] = _mm_unpackhi_epi32(a[4 * i + 1], a[4 * i + 3]);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        x[2 * i]     = _mm_unpacklo_epi64(b[i], b[i + 4]);
+        x[2 * i + 1] = _mm_unpackhi_epi64(b[i], b[i + 4]);
+    }
+}
+
+// Message bytes are column-major (byte 8 * j + i is row i, column j). Each
+// 16-byte chunk holds two columns; interleave them so every 16-bit word is
+// one row of a column pair, then transpose the words.
+static inline void groestl_load_rows(__m128i x[8], const unsigned char *pblock)
+{
+    const __m128i interleave = _mm_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+    for (int k = 0; k < 8; k++)
+        x[k] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pblock + 16 * k)), interleave);
+    transpose_8x8_epi16(x);
+}
+
+// Inverse of groestl_load_rows
+static inline void groestl_store_rows(unsigned char *pblock, __m128i x[8])
+{
+    const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    transpose_8x8_epi16(x);
+    for (int k = 0; k < 8; k++)
+        _mm_storeu_si128((__m128i*)(pblock + 16 * k), _mm_shuffle_epi8(x[k], deinterleave));
+}
+
+// h = P(h ^ m) ^ Q(m) ^ h
+static inline void groestl_compress(__m128i h[8], const unsigned char *pblock)
+{
+    __m128i p[8], q[8];
+    groestl_load_rows(q, pblock);
+    for (int i = 0; i < 8; i++)
+        p[i] = _mm_xor_si128(h[i], q[i]);
+    // P and Q are independent; running their rounds side by side hides
+    // the AESENCLAST latency
+    for (int r = 0; r < 14; r++)
+    {
+        groestl_addconst_P(p, r);
+        groestl_addconst_Q(q, r);
+        groestl_round(p, pshufP);
+        groestl_round(q, pshufQ);
+    }
+    for (int i = 0; i < 8; i++)
+        h[i] = _mm_xor_si128(h[i], _mm_xor_si128(p[i], q[i]));
+}
+
+void groestl512_aesni(const void *pdata, size_t nLen, unsigned char *pout)
+{
+    const unsigned char *pbegin = (const unsigned char *)pdata;
+    unsigned char pbuf[256];
+    __m128i h[8], p[8];
+
+    // IV: the output length 512 as a big endian number in the last two bytes
+    for (int i = 0; i < 8; i++)
+        h[i] = _mm_setzero_si128();
+    h[6] = _mm_insert_epi16(h[6], 0x0200, 7);
+
+    size_t nBlocks = nLen / 128;
+    for (size_t n = 0; n < nBlocks; n++)
+        groestl_compress(h, pbegin + 128 * n);
+
+    // Pad with 0x80, zeros and the 64-bit big endian count of blocks
+    size_t nRemain = nLen - 128 * nBlocks;
+    size_t nPadBlocks = (nRemain + 9 <= 128) ? 1 : 2;
+    memset(pbuf, 0, sizeof(pbuf));
+    memcpy(pbuf, pbegin + 128 * nBlocks, nRemain);
+    pbuf[nRemain] = 0x80;
+    uint64_t nCount = nBlocks + nPadBlocks;
+    for (int i = 0; i < 8; i++)
+        pbuf[128 * nPadBlocks - 1 - i] = (unsigned char)(nCount >> (8 * i));
+    for (size_t n = 0; n < nPadBlocks; n++)
+        groestl_compress(h, pbuf + 128 * n);
+
+    // Output transformation: truncate P(h) ^ h to its last 512 bits
+    for (int i = 0; i < 8; i++)
+        p[i] = h[i];
+    groestl_P(p);
+    for (int i = 0; i < 8; i++)
+        p[i] = _mm_xor_si128(p[i], h[i]);
+    groestl_store_rows(pbuf, p);
+    memcpy(pout, pbuf + 64, 64);
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hashgroestl.h"
+#include "util.h"
+
+#if defined(USE_AESNI)
+#if defined(__GNUC__)
+#include <cpuid.h>
+#endif
+
+static bool groestl512_detect_aesni()
+{
+    static int nAESNI = -1;
+    if (nAESNI == -1)
+    {
+        int n = 0;
+#if defined(__GNUC__)
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) && (ecx & bit_SSSE3))
+            n = 1;
+#endif
+        printf("groestl: using %s Groestl-512.\n", n ? "aes-ni" : "table-based");
+        nAESNI = n;
+    }
+    return nAESNI;
+}
+#endif
+
+void Groestl512(const void* pdata, size_t nLen, unsigned char* pout)
+{
+#if defined(USE_AESNI)
+    if (groestl512_detect_aesni())
+    {
+        groestl512_aesni(pdata, nLen, pout);
+        return;
+    }
+#endif
+    sph_groestl512_context ctx;
+    sph_groestl512_init(&ctx);
+    sph_groestl512(&ctx, pdata, nLen);
+    sph_groestl512_close(&ctx, pout);
+}
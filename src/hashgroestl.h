@@ -14,19 +14,23 @@
 #include <vector>
 
 
+/** Groestl-512 of nLen bytes at pdata into 64 bytes at pout, using AES-NI
+    when the CPU supports it and the sphlib tables otherwise */
+void Groestl512(const void* pdata, size_t nLen, unsigned char* pout);
+#if defined(USE_AESNI)
+void groestl512_aesni(const void* pdata, size_t nLen, unsigned char* pout);
+#endif
+
 template<typename T1>
 inline uint256 HashGroestl(const T1 pbegin, const T1 pend)
 
 {
-    sph_groestl512_context ctx_groestl;
     static unsigned char pblank[1];
 
     uint512 hash1;
     uint256 hash2;
 
-    sph_groestl512_init(&ctx_groestl);
-    sph_groestl512(&ctx_groestl, (pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0])), (pend - pbegin) * sizeof(pbegin[0]));
-    sph_groestl512_close(&ctx_groestl, static_cast<void*>(&hash1));
+    Groestl512((pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0])), (pend - pbegin) * sizeof(pbegin[0]), (unsigned char*)&hash1);
     
     SHA256((unsigned char*)&hash1, 64, (unsigned char*)&hash2);
     
@@ -15,6 +15,7 @@
 #include "ui_interface.h"
 #include "checkpoints.h"
 #include "compressedstorage.h"
+#include "mappedfile.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -92,8 +93,6 @@ bool ShutdownRequested()
     return fRequestShutdown;
 }
 
-static CCoinsViewDB *pcoinsdbview;
-
 void Shutdown()
 {
     static CCriticalSection cs_Shutdown;
@@ -111,11 +110,15 @@ void Shutdown()
         LOCK(cs_main);
         if (pwalletMain)
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
+        CloseBlockFiles();
         if (pblocktree)
             pblocktree->Flush();
         if (pcoinsTip)
             pcoinsTip->Flush();
         delete pcoinsTip; pcoinsTip = NULL;
+        delete pcoinsPrefetch; pcoinsPrefetch = NULL;
+        // waits for the last flush to be written
+        delete pcoinsFlusher; pcoinsFlusher = NULL;
         delete pcoinsdbview; pcoinsdbview = NULL;
         delete pblocktree; pblocktree = NULL;
     }
@@ -173,6 +176,8 @@ std::string HelpMessage()
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<file>         " + _("Specify wallet file (within data directory)") + "\n";
     strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n";
+    strUsage += "  -prune=<n>             " + _("Delete old block and undo files to keep them under <n> MiB; at least 550, 0 = keep everything (default: 0)") + "\n";
+    strUsage += "  -blocksyncinterval=<n> " + _("Commit new blocks to disk at most every <n> seconds; more may be lost on a crash (default: 0)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n";
     strUsage += "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n";
@@ -235,12 +240,20 @@ std::string HelpMessage()
     strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n";
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 288, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-4, default: 3)") + "\n";
+    strUsage += "  -mmapblocks            " + _("Read finished block files through memory mappings (default: 1 on 64-bit systems)") + "\n";
     strUsage += "  -txindex               " + _("Maintain a full transaction index (default: 0)") + "\n";
+    strUsage += "  -utxobyoutput          " + _("Store unspent outputs one record per output; converts an existing database once and cannot be undone without -reindex (default: 0)") + "\n";
     strUsage += "  -usecompression        " + _("Enable block storage compression (default: 0)") + "\n";
     strUsage += "  -compressionlevel=<n>  " + _("Set compression level 1-9 (default: 6)") + "\n";
+    strUsage += "  -compressioncodec=<c>  " + _("Compress new blocks with <c>: lz or columnar (default: lz)") + "\n";
+    strUsage += "  -compressbackground    " + _("Write new blocks uncompressed and compress finished block files in the background (default: 0)") + "\n";
+    strUsage += "  -compressbackgroundrate=<n> " + _("Limit background block file compression to <n> megabytes per second (default: 4)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + "\n";
+    strUsage += "  -loadtxoutset=<file>   " + _("Start a new block chain from a UTXO set written by dumptxoutset; older blocks are never downloaded") + "\n";
+    strUsage += "  -loadtxoutsethash=<hash> " + _("Accept a UTXO set from -loadtxoutset only if its hash_serialized (as dumptxoutset reports it) is <hash>. The coins are not checked against the blocks, so this hash must come from a node you trust; without it only UTXO sets built into the client are accepted") + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + "\n";
     strUsage += "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n";
+    strUsage += "  -prefetchthreads=<n>   " + _("Set the number of threads reading the inputs of incoming blocks ahead of validation (up to 16, 0 = off, default: 4)") + "\n";
     strUsage += "  -algo=<algo>           " + _("Mining algorithm: sha256d, scrypt, groestl") + "\n";
     strUsage += "\n" + _("Block creation options:") + "\n";
     strUsage += "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n";
@@ -269,7 +282,7 @@ struct CImportingNow
     }
 };
 
-void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
+void ThreadImport(std::vector<boost::filesystem::path> vImportFiles, boost::filesystem::path pathTxOutSet, uint256 hashTxOutSet)
 {
     RenameThread("bitcoin-loadblk");
 
@@ -293,6 +306,17 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         InitBlockIndex();
     }
 
+    // -loadtxoutset=, before anything moves the chain past the genesis block
+    if (!pathTxOutSet.empty()) {
+        FILE *file = fopen(pathTxOutSet.string().c_str(), "rb");
+        if (file) {
+            CImportingNow imp;
+            printf("Loading UTXO set from %s...\n", pathTxOutSet.string().c_str());
+            LoadTxOutSet(file, hashTxOutSet);
+        } else
+            printf("Can't open UTXO set file %s\n", pathTxOutSet.string().c_str());
+    }
+
     // hardcoded $DATADIR/bootstrap.dat
     filesystem::path pathBootstrap = GetDataDir() / "bootstrap.dat";
     if (filesystem::exists(pathBootstrap)) {
@@ -413,15 +437,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
 
     // Algo
-    std::string strAlgo = GetArg("-algo", "sha256d");
-    transform(strAlgo.begin(),strAlgo.end(),strAlgo.begin(),::tolower);
-    if (strAlgo == "sha" || strAlgo == "sha256" || strAlgo == "sha256d")
-        miningAlgo = ALGO_SHA256D;
-    else if (strAlgo == "scrypt")
-        miningAlgo = ALGO_SCRYPT;
-    else if (strAlgo == "groestl" || strAlgo == "groestlsha2")
-        miningAlgo = ALGO_GROESTL;
-    else
+    miningAlgo = GetAlgoByName(GetArg("-algo", "sha256d"));
+    if (miningAlgo < 0)
         miningAlgo = ALGO_SHA256D;
     
     // Make sure enough file descriptors are available
@@ -547,6 +564,8 @@ bool AppInit2(boost::thread_group& threadGroup)
         printf("Using %u threads for script verification\n", nScriptCheckThreads);
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadPoWCheck);
     }
 
     int64 nStart;
@@ -728,6 +747,37 @@ bool AppInit2(boost::thread_group& threadGroup)
         }
     }
 
+    // Block file pruning
+    int64 nPruneArg = GetArg("-prune", 0);
+    if (nPruneArg < 0)
+        return InitError(_("Prune cannot be configured with a negative value."));
+    nPruneTarget = (uint64)nPruneArg << 20;
+    if (nPruneTarget) {
+        if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES)
+            return InitError(strprintf(_("Prune configured below the minimum of %d MiB. Please use a higher number."), (int)(MIN_DISK_SPACE_FOR_BLOCK_FILES >> 20)));
+        if (GetBoolArg("-txindex", false))
+            return InitError(_("Prune mode is incompatible with -txindex."));
+        fPruneMode = true;
+        // Old blocks can't be served, so don't claim to be a full node
+        nLocalServices &= ~NODE_NETWORK;
+        printf("Prune configured to keep block files under %"PRI64u" MiB\n", nPruneTarget >> 20);
+    }
+
+    if (mapArgs.count("-loadtxoutset") && GetBoolArg("-txindex", false))
+        return InitError(_("Loading a UTXO set is incompatible with -txindex."));
+    uint256 hashTxOutSet = 0;
+    if (mapArgs.count("-loadtxoutsethash")) {
+        std::string strHash = mapArgs["-loadtxoutsethash"];
+        if (strHash.size() != 64 || !IsHex(strHash))
+            return InitError(strprintf(_("Invalid hash in -loadtxoutsethash: '%s'"), strHash.c_str()));
+        hashTxOutSet.SetHex(strHash);
+    }
+    if (mapArgs.count("-loadtxoutset") && hashTxOutSet == 0 && !Checkpoints::HaveTxOutSetHashes())
+        return InitError(_("Loading a UTXO set requires -loadtxoutsethash=<hash> from a node you trust."));
+
+    // Durability window for block, undo and index writes
+    nBlockSyncInterval = std::max((int64)0, GetArg("-blocksyncinterval", 0));
+
     // cache size calculations
     size_t nTotalCache = GetArg("-dbcache", 25) << 20;
     if (nTotalCache < (1 << 22))
@@ -738,7 +788,14 @@ bool AppInit2(boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest goes to the in-memory coins cache
+
+    // Inputs of incoming blocks are read ahead on their own threads
+    int nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetchthreads", 4), MAX_PREFETCH_THREADS));
+
+    // Finished block files are read in place; keep 32-bit address space free by default
+    if (GetBoolArg("-mmapblocks", sizeof(void*) >= 8))
+        mappedBlockFiles.SetMaxFiles(MAX_MAPPED_BLOCK_FILES);
 
     // Initialize compressed storage
     bool fUseCompression = GetBoolArg("-usecompression", false);
@@ -746,7 +803,17 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (fUseCompression) {
         int nCompressionLevel = GetArg("-compressionlevel", 6);
         compressedStorage.SetCompressionLevel(nCompressionLevel);
-        printf("Block storage compression enabled (level %d)\n", nCompressionLevel);
+        std::string strCodec = GetArg("-compressioncodec", "lz");
+        if (strCodec == "lz")
+            compressedStorage.SetCodec(TCMP_CODEC_LZ);
+        else if (strCodec == "columnar")
+            compressedStorage.SetCodec(TCMP_CODEC_COLUMNAR);
+        else
+            return InitError(strprintf(_("Unknown -compressioncodec: '%s'"), strCodec.c_str()));
+        fCompressInBackground = GetBoolArg("-compressbackground", false);
+        if (fCompressInBackground && GetBoolArg("-txindex", false))
+            return InitError(_("-compressbackground is not compatible with -txindex"));
+        printf("Block storage compression enabled (%s, level %d)\n", strCodec.c_str(), nCompressionLevel);
     }
 
     bool fLoaded = false;
@@ -761,12 +828,31 @@ bool AppInit2(boost::thread_group& threadGroup)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsPrefetch;
+                delete pcoinsFlusher;
                 delete pcoinsdbview;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
+                pcoinsFlusher = new CCoinsViewFlusher(*pcoinsdbview);
+                pcoinsPrefetch = new CCoinsViewPrefetch(*pcoinsFlusher, nPrefetchThreads);
+                pcoinsTip = new CCoinsViewCache(*pcoinsPrefetch);
+
+                if (pcoinsdbview->IsLoading()) {
+                    strLoadError = _("Loading a UTXO set was interrupted. You need to rebuild the database using -reindex");
+                    break;
+                }
+
+                // Once started, a conversion must finish before coins can be read
+                if (pcoinsdbview->GetLayout() == COINS_LAYOUT_UPGRADING ||
+                    (GetBoolArg("-utxobyoutput", false) && pcoinsdbview->GetLayout() == COINS_LAYOUT_TXID)) {
+                    uiInterface.InitMessage(_("Upgrading unspent output database..."));
+                    if (!pcoinsdbview->UpgradeToOutputLayout()) {
+                        strLoadError = _("Error upgrading unspent output database");
+                        break;
+                    }
+                }
 
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
@@ -787,6 +873,13 @@ bool AppInit2(boost::thread_group& threadGroup)
                     break;
                 }
 
+                // Pruned data can only come back by downloading it again; a
+                // chain started from a UTXO set never had it to begin with
+                if (fHavePruned && !fPruneMode && !fLoadedTxOutSet) {
+                    strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
+                    break;
+                }
+
                 // Check for changed -txindex state
                 if (fTxIndex != GetBoolArg("-txindex", false)) {
                     strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
@@ -836,6 +929,10 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     printf(" block index %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
+    // Blocks below a loaded UTXO set can't be served either
+    if (fLoadedTxOutSet)
+        nLocalServices &= ~NODE_NETWORK;
+
     if (GetBoolArg("-printblockindex", false) || GetBoolArg("-printblocktree", false))
     {
         PrintBlockTree();
@@ -846,7 +943,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (CBlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -945,6 +1042,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     if (pindexBest && pindexBest != pindexRescan)
     {
+        // A pruned node can only rescan blocks it still has
+        if (!HaveBlockDataSince(pindexRescan))
+            return InitError(_("Prune: last wallet synchronisation goes beyond pruned data. You need to -reindex (download the whole blockchain again in case of pruned node)"));
         uiInterface.InitMessage(_("Rescanning..."));
         printf("Rescanning last %i blocks (from block %i)...\n", pindexBest->nHeight - pindexRescan->nHeight, pindexRescan->nHeight);
         nStart = GetTimeMillis();
@@ -967,7 +1067,11 @@ bool AppInit2(boost::thread_group& threadGroup)
         BOOST_FOREACH(string strFile, mapMultiArgs["-loadblock"])
             vImportFiles.push_back(strFile);
     }
-    threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    boost::filesystem::path pathTxOutSet = GetArg("-loadtxoutset", "");
+    threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles, pathTxOutSet, hashTxOutSet));
+
+    if (fCompressInBackground)
+        threadGroup.create_thread(&ThreadRecompressBlockFiles);
 
     // ********************************************************* Step 10: load peers
 
@@ -42,6 +42,10 @@ public:
         batch.Put(slKey, slValue);
     }
 
+    void Clear() {
+        batch.Clear();
+    }
+
     template<typename K> void Erase(const K& key) {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
@@ -80,14 +84,16 @@ public:
     CLevelDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
     ~CLevelDB();
 
-    template<typename K, typename V> bool Read(const K& key, V& value) throw(leveldb_error) {
+    template<typename K, typename V> bool Read(const K& key, V& value, const leveldb::Snapshot *psnapshot = NULL) throw(leveldb_error) {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
         ssKey << key;
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
+        leveldb::ReadOptions options = readoptions;
+        options.snapshot = psnapshot;
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -145,8 +151,19 @@ public:
     }
 
     // not exactly clean encapsulation, but it's easiest for now
-    leveldb::Iterator *NewIterator() {
-        return pdb->NewIterator(iteroptions);
+    leveldb::Iterator *NewIterator(const leveldb::Snapshot *psnapshot = NULL) {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = psnapshot;
+        return pdb->NewIterator(options);
+    }
+
+    // A consistent view for reads spread over several iterators or threads
+    const leveldb::Snapshot *GetSnapshot() {
+        return pdb->GetSnapshot();
+    }
+
+    void ReleaseSnapshot(const leveldb::Snapshot *psnapshot) {
+        pdb->ReleaseSnapshot(psnapshot);
     }
 };
 
@@ -0,0 +1,311 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lzcodec.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static const size_t LZ_MINMATCH = 4;
+// No match may start in the last 12 bytes, and the last 5 bytes are always literals
+static const size_t LZ_MFLIMIT = 12;
+static const size_t LZ_LASTLITERALS = 5;
+static const size_t LZ_MAXOFFSET = 65535;
+
+static const int LZ_HASHLOG = 16;
+static const size_t LZ_CHAINSIZE = 65536;
+
+// Candidates examined per position, by level
+static const int nLZChainDepth[10] = { 0, 1, 1, 4, 8, 16, 32, 64, 128, 256 };
+
+static inline uint32_t LZRead32(const unsigned char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t LZRead64(const unsigned char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline unsigned int LZHash(const unsigned char* p)
+{
+    return (LZRead32(p) * 2654435761U) >> (32 - LZ_HASHLOG);
+}
+
+// Number of bytes at p that equal those at pmatch, not reading past plimit
+static inline size_t LZCount(const unsigned char* p, const unsigned char* pmatch, const unsigned char* plimit)
+{
+    const unsigned char* pstart = p;
+    while (p + 8 <= plimit && LZRead64(p) == LZRead64(pmatch))
+    {
+        p += 8;
+        pmatch += 8;
+    }
+    while (p < plimit && *p == *pmatch)
+    {
+        p++;
+        pmatch++;
+    }
+    return p - pstart;
+}
+
+static inline void LZWriteLength(std::vector<unsigned char>& vOut, size_t nLen)
+{
+    while (nLen >= 255)
+    {
+        vOut.push_back(255);
+        nLen -= 255;
+    }
+    vOut.push_back((unsigned char)nLen);
+}
+
+// Emit one sequence; nMatch == 0 marks the final, literals-only sequence
+static void LZWriteSequence(std::vector<unsigned char>& vOut, const unsigned char* plit, size_t nLit, size_t nOffset, size_t nMatch)
+{
+    size_t nToken = vOut.size();
+    vOut.push_back(0);
+    unsigned char token;
+    if (nLit >= 15)
+    {
+        token = 15 << 4;
+        LZWriteLength(vOut, nLit - 15);
+    }
+    else
+        token = nLit << 4;
+    vOut.insert(vOut.end(), plit, plit + nLit);
+
+    if (nMatch)
+    {
+        vOut.push_back(nOffset & 0xff);
+        vOut.push_back(nOffset >> 8);
+        size_t nLen = nMatch - LZ_MINMATCH;
+        if (nLen >= 15)
+        {
+            token |= 15;
+            LZWriteLength(vOut, nLen - 15);
+        }
+        else
+            token |= nLen;
+    }
+    vOut[nToken] = token;
+}
+
+/** Hash table of the most recent position for each 4-byte prefix, optionally
+ *  chained to earlier positions with the same hash within the window */
+class CLZMatchFinder
+{
+private:
+    const unsigned char* pin;
+    const unsigned char* pmatchlimit;
+    std::vector<uint32_t> vHead;    // position + 1, 0 if empty
+    std::vector<uint16_t> vChain;   // distance to the previous position, 0 if none
+    size_t nNextInsert;
+    int nDepth;
+
+public:
+    CLZMatchFinder(const unsigned char* pinIn, size_t nIn, int nLevel) :
+        pin(pinIn), pmatchlimit(pinIn + nIn - LZ_LASTLITERALS),
+        vHead(1 << LZ_HASHLOG, 0), nNextInsert(0), nDepth(nLZChainDepth[nLevel])
+    {
+        if (nDepth > 1)
+            vChain.resize(LZ_CHAINSIZE, 0);
+    }
+
+    void Insert(size_t nPos)
+    {
+        if (vChain.empty())
+        {
+            vHead[LZHash(pin + nPos)] = nPos + 1;
+            return;
+        }
+        // Chained mode must see every position exactly once
+        while (nNextInsert <= nPos)
+        {
+            unsigned int h = LZHash(pin + nNextInsert);
+            size_t nDelta = vHead[h] ? nNextInsert - (vHead[h] - 1) : 0;
+            vChain[nNextInsert & (LZ_CHAINSIZE - 1)] = nDelta > LZ_MAXOFFSET ? 0 : nDelta;
+            vHead[h] = nNextInsert + 1;
+            nNextInsert++;
+        }
+    }
+
+    /** Longest match for the bytes at nPos among earlier inserted positions */
+    size_t Find(size_t nPos, size_t& nOffset)
+    {
+        const unsigned char* ip = pin + nPos;
+        uint32_t nHead = vHead[LZHash(ip)];
+        if (nHead == 0)
+            return 0;
+        size_t nCandidate = nHead - 1;
+        size_t nBest = 0;
+        uint32_t nPrefix = LZRead32(ip);
+        for (int nLeft = nDepth; nLeft > 0; nLeft--)
+        {
+            if (nPos - nCandidate > LZ_MAXOFFSET)
+                break;
+            const unsigned char* pmatch = pin + nCandidate;
+            // Cheap reject: a longer match must also agree at the current best length
+            if (pmatch[nBest] == ip[nBest] && LZRead32(pmatch) == nPrefix)
+            {
+                size_t nLen = LZ_MINMATCH + LZCount(ip + LZ_MINMATCH, pmatch + LZ_MINMATCH, pmatchlimit);
+                if (nLen > nBest)
+                {
+                    nBest = nLen;
+                    nOffset = nPos - nCandidate;
+                    if (ip + nLen == pmatchlimit)
+                        break;
+                }
+            }
+            if (vChain.empty())
+                break;
+            size_t nDelta = vChain[nCandidate & (LZ_CHAINSIZE - 1)];
+            if (nDelta == 0)
+                break;
+            nCandidate -= nDelta;
+        }
+        return nBest;
+    }
+};
+
+void LZCompress(const unsigned char* pin, size_t nIn, std::vector<unsigned char>& vOut, int nLevel)
+{
+    if (nLevel < 1) nLevel = 1;
+    if (nLevel > 9) nLevel = 9;
+    vOut.reserve(vOut.size() + nIn + nIn / 255 + 16);
+
+    size_t nAnchor = 0;
+    if (nIn > LZ_MFLIMIT)
+    {
+        const size_t nLimit = nIn - LZ_MFLIMIT;
+        const bool fChained = nLevel >= 3;
+        const bool fLazy = nLevel >= 6;
+        // Fast levels step further the longer they go without a match
+        const int nSkipShift = (nLevel == 1) ? 4 : 6;
+
+        CLZMatchFinder finder(pin, nIn, nLevel);
+        size_t nPos = 0;
+        while (nPos < nLimit)
+        {
+            size_t nOffset = 0;
+            size_t nLen = finder.Find(nPos, nOffset);
+            finder.Insert(nPos);
+            if (nLen < LZ_MINMATCH)
+            {
+                nPos += fChained ? 1 : 1 + ((nPos - nAnchor) >> nSkipShift);
+                continue;
+            }
+
+            // Lazy evaluation: emit a literal instead if the next byte starts a longer match
+            while (fLazy && nPos + 1 < nLimit)
+            {
+                size_t nNextOffset = 0;
+                size_t nNextLen = finder.Find(nPos + 1, nNextOffset);
+                finder.Insert(nPos + 1);
+                if (nNextLen <= nLen)
+                    break;
+                nPos++;
+                nLen = nNextLen;
+                nOffset = nNextOffset;
+            }
+
+            LZWriteSequence(vOut, pin + nAnchor, nPos - nAnchor, nOffset, nLen);
+            nPos += nLen;
+            nAnchor = nPos;
+            if (fChained)
+                finder.Insert(nPos - 1);
+            else if (nPos >= 2)
+                finder.Insert(nPos - 2);
+        }
+    }
+    LZWriteSequence(vOut, pin + nAnchor, nIn - nAnchor, 0, 0);
+}
+
+bool LZDecompress(const unsigned char* pin, size_t nIn, unsigned char* pout, size_t nOut)
+{
+    const unsigned char* ip = pin;
+    const unsigned char* iend = pin + nIn;
+    unsigned char* op = pout;
+    unsigned char* oend = pout + nOut;
+
+    while (true)
+    {
+        if (ip >= iend)
+            return false;
+        unsigned int token = *ip++;
+
+        size_t nLit = token >> 4;
+        if (nLit == 15)
+        {
+            unsigned char s;
+            do {
+                if (ip >= iend)
+                    return false;
+                s = *ip++;
+                nLit += s;
+            } while (s == 255);
+        }
+        if (nLit > (size_t)(iend - ip) || nLit > (size_t)(oend - op))
+            return false;
+        if (nLit <= 16 && iend - ip >= 16 && oend - op >= 16)
+        {
+            // Short literal runs: one fixed-size copy instead of a memcpy call
+            memcpy(op, ip, 16);
+        }
+        else
+            memcpy(op, ip, nLit);
+        ip += nLit;
+        op += nLit;
+
+        // The final sequence has no match part
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        size_t nOffset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (nOffset == 0 || nOffset > (size_t)(op - pout))
+            return false;
+
+        size_t nLen = token & 15;
+        if (nLen == 15)
+        {
+            unsigned char s;
+            do {
+                if (ip >= iend)
+                    return false;
+                s = *ip++;
+                nLen += s;
+            } while (s == 255);
+        }
+        nLen += LZ_MINMATCH;
+        if (nLen > (size_t)(oend - op))
+            return false;
+
+        const unsigned char* pmatch = op - nOffset;
+        unsigned char* pend = op + nLen;
+        if (nOffset >= 8 && (size_t)(oend - pend) >= 8)
+        {
+            // Eight bytes at a time never overlap the bytes being written;
+            // the last chunk may spill into output that is written later
+            do {
+                memcpy(op, pmatch, 8);
+                op += 8;
+                pmatch += 8;
+            } while (op < pend);
+            op = pend;
+        }
+        else
+        {
+            while (op < pend)
+                *op++ = *pmatch++;
+        }
+    }
+    return op == oend;
+}
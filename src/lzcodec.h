@@ -0,0 +1,28 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LZCODEC_H
+#define BITCOIN_LZCODEC_H
+
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Byte-oriented LZ77 block codec in the LZ4 block format: sequences of a
+ * token, literals, a 16-bit match offset and extended lengths. Decoding is
+ * a tight copy loop with no entropy stage, so it runs at memory speed.
+ *
+ * Compression levels:
+ *   1-2  single hash probe, skipping ahead faster through incompressible data
+ *   3-5  hash chains of increasing depth, greedy parsing
+ *   6-9  deeper hash chains with lazy matching
+ */
+
+/** Append the compressed form of pin[0..nIn) to vOut */
+void LZCompress(const unsigned char* pin, size_t nIn, std::vector<unsigned char>& vOut, int nLevel);
+
+/** Decompress exactly nOut bytes to pout; fails on malformed or truncated input */
+bool LZDecompress(const unsigned char* pin, size_t nIn, unsigned char* pout, size_t nOut);
+
+#endif // BITCOIN_LZCODEC_H
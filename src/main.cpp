@@ -16,12 +16,14 @@
 #include "checkqueue.h"
 #include "chainparams.h"
 #include "compressedstorage.h"
+#include "mappedfile.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
 #include "scrypt.h"
+#include "sha256d.h"
 
 using namespace std;
 using namespace boost;
@@ -38,7 +40,7 @@ CCriticalSection cs_main;
 CTxMemPool mempool;
 unsigned int nTransactionsUpdated = 0;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+CBlockMap mapBlockIndex;
 std::vector<CBlockIndex*> vBlockIndexByHeight;
 CBlockIndex* pindexGenesisBlock = NULL;
 int nBestHeight = -1;
@@ -53,7 +55,14 @@ bool fImporting = false;
 bool fReindex = false;
 bool fBenchmark = false;
 bool fTxIndex = false;
-unsigned int nCoinCacheSize = 5000;
+bool fCompressInBackground = false;
+CMappedFileCache mappedBlockFiles;
+int64 nBlockSyncInterval = 0;
+bool fPruneMode = false;
+bool fHavePruned = false;
+bool fLoadedTxOutSet = false;
+uint64 nPruneTarget = 0;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fHaveGUI = false;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for transaction creation) */
@@ -204,7 +213,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 
 CBlockLocator::CBlockLocator(uint256 hashBlock)
 {
-    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi != mapBlockIndex.end())
         Set((*mi).second);
 }
@@ -218,8 +227,7 @@ void CBlockLocator::Set(const CBlockIndex* pindex)
         vHave.push_back(pindex->GetBlockHash());
 
         // Exponentially larger steps back
-        for (int i = 0; pindex && i < nStep; i++)
-            pindex = pindex->pprev;
+        pindex = pindex->nHeight >= nStep ? pindex->GetAncestor(pindex->nHeight - nStep) : NULL;
         if (vHave.size() > 10)
             nStep *= 2;
     }
@@ -233,7 +241,7 @@ int CBlockLocator::GetDistanceBack()
     int nStep = 1;
     BOOST_FOREACH(const uint256& hash, vHave)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        CBlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -252,7 +260,7 @@ CBlockIndex *CBlockLocator::GetBlockIndex()
     // Find the first block the caller has in the main chain
     BOOST_FOREACH(const uint256& hash, vHave)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        CBlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -268,7 +276,7 @@ uint256 CBlockLocator::GetBlockHash()
     // Find the first block the caller has in the main chain
     BOOST_FOREACH(const uint256& hash, vHave)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        CBlockMap::iterator mi = mapBlockIndex.find(hash);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -297,7 +305,7 @@ bool CCoinsView::SetCoins(const uint256 &txid, const CCoins &coins) { return fal
 bool CCoinsView::HaveCoins(const uint256 &txid) { return false; }
 CBlockIndex *CCoinsView::GetBestBlock() { return NULL; }
 bool CCoinsView::SetBestBlock(CBlockIndex *pindex) { return false; }
-bool CCoinsView::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) { return false; }
 
 
@@ -308,43 +316,167 @@ bool CCoinsViewBacked::HaveCoins(const uint256 &txid) { return base->HaveCoins(t
 CBlockIndex *CCoinsViewBacked::GetBestBlock() { return base->GetBestBlock(); }
 bool CCoinsViewBacked::SetBestBlock(CBlockIndex *pindex) { return base->SetBestBlock(pindex); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) { return base->BatchWrite(mapCoins, pindex); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange) { return base->BatchWrite(mapCoins, pindex, statsChange); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) { return base->GetStats(stats); }
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView &baseIn, bool fDummy) : CCoinsViewBacked(baseIn), pindexTip(NULL) { }
+// The hash of one unspent output, as it enters the set hash
+static uint256 GetCoinsStatsElement(const uint256 &txid, unsigned int n, const CCoins &coins)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << COutPoint(txid, n);
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    ss << coins.vout[n];
+    return ss.GetHash();
+}
 
-bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) {
-    if (cacheCoins.count(txid)) {
-        coins = cacheCoins[txid];
-        return true;
+void UpdateCoinsStats(CCoinsStats &stats, const uint256 &txid, const CCoins &coinsOld, const CCoins &coinsNew)
+{
+    // Outputs left alone by a partial spend cancel out, so skip them
+    bool fSameTx = coinsOld.nVersion == coinsNew.nVersion && coinsOld.nHeight == coinsNew.nHeight && coinsOld.fCoinBase == coinsNew.fCoinBase;
+    unsigned int nOutputs = std::max(coinsOld.vout.size(), coinsNew.vout.size());
+    for (unsigned int n = 0; n < nOutputs; n++) {
+        bool fOld = coinsOld.IsAvailable(n), fNew = coinsNew.IsAvailable(n);
+        if (fOld && fNew && fSameTx && coinsOld.vout[n] == coinsNew.vout[n])
+            continue;
+        if (fOld) {
+            stats.muhash.Remove(GetCoinsStatsElement(txid, n, coinsOld));
+            stats.nTransactionOutputs--;
+            stats.nTotalAmount -= coinsOld.vout[n].nValue;
+        }
+        if (fNew) {
+            stats.muhash.Insert(GetCoinsStatsElement(txid, n, coinsNew));
+            stats.nTransactionOutputs++;
+            stats.nTotalAmount += coinsNew.vout[n].nValue;
+        }
+    }
+    if (!coinsOld.IsPruned()) {
+        stats.nTransactions--;
+        stats.nSerializedSize -= 32 + ::GetSerializeSize(coinsOld, SER_DISK, CLIENT_VERSION);
     }
-    if (base->GetCoins(txid, coins)) {
-        cacheCoins[txid] = coins;
+    if (!coinsNew.IsPruned()) {
+        stats.nTransactions++;
+        stats.nSerializedSize += 32 + ::GetSerializeSize(coinsNew, SER_DISK, CLIENT_VERSION);
+    }
+}
+
+void CombineCoinsStats(CCoinsStats &stats, const CCoinsStats &statsOther)
+{
+    // The counters of a change wrap around when it removes more than it adds
+    stats.nTransactions += statsOther.nTransactions;
+    stats.nTransactionOutputs += statsOther.nTransactionOutputs;
+    stats.nSerializedSize += statsOther.nSerializedSize;
+    stats.nTotalAmount += statsOther.nTotalAmount;
+    stats.muhash *= statsOther.muhash;
+}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView &baseIn) : CCoinsViewBacked(baseIn), pindexTip(NULL), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsViewCache &baseIn) : CCoinsViewBacked(static_cast<CCoinsView&>(baseIn)), pindexTip(NULL), cachedCoinsUsage(0) { }
+
+bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) {
+    CCoinsMap::iterator it = FetchCoins(txid);
+    if (it != cacheCoins.end()) {
+        coins = it->second.coins;
         return true;
     }
     return false;
 }
 
-std::map<uint256,CCoins>::iterator CCoinsViewCache::FetchCoins(const uint256 &txid) {
-    std::map<uint256,CCoins>::iterator it = cacheCoins.lower_bound(txid);
-    if (it != cacheCoins.end() && it->first == txid)
+CCoinsMap::iterator CCoinsViewCache::FetchCoins(const uint256 &txid) {
+    CCoinsMap::iterator it = cacheCoins.find(txid);
+    if (it != cacheCoins.end())
         return it;
     CCoins tmp;
     if (!base->GetCoins(txid,tmp))
         return cacheCoins.end();
-    std::map<uint256,CCoins>::iterator ret = cacheCoins.insert(it, std::make_pair(txid, CCoins()));
-    tmp.swap(ret->second);
+    CCoinsMap::iterator ret = cacheCoins.insert(txid).first;
+    CCoinsCacheEntry &entry = ret->second;
+    tmp.swap(entry.coins);
+    // The base only has a spent placeholder, which it deals with itself
+    if (entry.coins.IsPruned())
+        entry.flags = CCoinsCacheEntry::FRESH;
+    cachedCoinsUsage += entry.DynamicMemoryUsage();
     return ret;
 }
 
+CCoinsCacheEntry &CCoinsViewCache::ModifyEntry(const uint256 &txid) {
+    CCoinsMap::iterator it = FetchCoins(txid);
+    assert(it != cacheCoins.end());
+    CCoinsCacheEntry &entry = it->second;
+    entry.flags |= CCoinsCacheEntry::DIRTY;
+    if (!(entry.flags & CCoinsCacheEntry::PENDING)) {
+        cachedCoinsUsage -= entry.DynamicMemoryUsage();
+        entry.flags |= CCoinsCacheEntry::PENDING;
+        vPendingUsage.push_back(&entry);
+    }
+    return entry;
+}
+
 CCoins &CCoinsViewCache::GetCoins(const uint256 &txid) {
-    std::map<uint256,CCoins>::iterator it = FetchCoins(txid);
+    CCoinsCacheEntry &entry = ModifyEntry(txid);
+    if (!(entry.flags & CCoinsCacheEntry::FRESH))
+        entry.flags |= CCoinsCacheEntry::UNLISTED;
+    return entry.coins;
+}
+
+const CCoins &CCoinsViewCache::AccessCoins(const uint256 &txid) {
+    CCoinsMap::iterator it = FetchCoins(txid);
     assert(it != cacheCoins.end());
-    return it->second;
+    return it->second.coins;
 }
 
 bool CCoinsViewCache::SetCoins(const uint256 &txid, const CCoins &coins) {
-    cacheCoins[txid] = coins;
+    // The statistics need what the coins replace, which callers have usually looked up already
+    CCoinsMap::iterator it = FetchCoins(txid);
+    if (it == cacheCoins.end())
+        it = cacheCoins.insert(txid).first;
+    CCoinsCacheEntry &entry = it->second;
+    UpdateCoinsStats(statsChange, txid, entry.coins, coins);
+    if (!(entry.flags & CCoinsCacheEntry::PENDING))
+        cachedCoinsUsage -= entry.DynamicMemoryUsage();
+    if (!(entry.flags & CCoinsCacheEntry::FRESH)) {
+        unsigned int nOutputs = std::max(entry.coins.vout.size(), coins.vout.size());
+        for (unsigned int n = 0; n < nOutputs; n++) {
+            bool fOld = entry.coins.IsAvailable(n), fNew = coins.IsAvailable(n);
+            if (fOld != fNew || (fOld && entry.coins.vout[n] != coins.vout[n]))
+                entry.vChanged.push_back(n);
+        }
+    }
+    entry.coins = coins;
+    entry.flags |= CCoinsCacheEntry::DIRTY;
+    if (!(entry.flags & CCoinsCacheEntry::PENDING))
+        cachedCoinsUsage += entry.DynamicMemoryUsage();
+    return true;
+}
+
+bool CCoinsViewCache::SetNewCoins(const uint256 &txid, const CCoins &coins) {
+    // Anything the base has for txid was cached by the caller's lookup, so an
+    // entry that is not here yet can never need to reach the base if spent
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(txid);
+    if (ret.second)
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    return SetCoins(txid, coins);
+}
+
+bool CCoinsViewCache::SpendCoins(const COutPoint &out, CTxInUndo &undo) {
+    CCoinsCacheEntry &entry = ModifyEntry(out.hash);
+    CCoins &coins = entry.coins;
+    if (!coins.IsAvailable(out.n))
+        return false;
+    if (!(entry.flags & CCoinsCacheEntry::FRESH))
+        entry.vChanged.push_back(out.n);
+    statsChange.muhash.Remove(GetCoinsStatsElement(out.hash, out.n, coins));
+    statsChange.nTransactionOutputs--;
+    statsChange.nTotalAmount -= coins.vout[out.n].nValue;
+    statsChange.nSerializedSize -= ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+    assert(coins.Spend(out, undo));
+    if (coins.IsPruned()) {
+        statsChange.nTransactions--;
+        statsChange.nSerializedSize -= 32;
+    } else {
+        statsChange.nSerializedSize += ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+    }
     return true;
 }
 
@@ -363,17 +495,71 @@ bool CCoinsViewCache::SetBestBlock(CBlockIndex *pindex) {
     return true;
 }
 
-bool CCoinsViewCache::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) {
-    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
-        cacheCoins[it->first] = it->second;
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChangeIn) {
+    UpdatePendingUsage();
+    CombineCoinsStats(statsChange, statsChangeIn);
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        CCoinsCacheEntry &child = it->second;
+        if (!(child.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        CCoinsMap::iterator itUs = cacheCoins.find(it->first);
+        if (itUs == cacheCoins.end()) {
+            // Created and spent again above us: nothing to pass down
+            if ((child.flags & CCoinsCacheEntry::FRESH) && child.coins.IsPruned())
+                continue;
+            CCoinsCacheEntry &entry = cacheCoins.insert(it->first).first->second;
+            entry.coins.swap(child.coins);
+            entry.vChanged.swap(child.vChanged);
+            entry.flags = CCoinsCacheEntry::DIRTY | (child.flags & (CCoinsCacheEntry::FRESH | CCoinsCacheEntry::UNLISTED));
+            cachedCoinsUsage += entry.DynamicMemoryUsage();
+        } else {
+            CCoinsCacheEntry &entry = itUs->second;
+            cachedCoinsUsage -= entry.DynamicMemoryUsage();
+            if ((entry.flags & CCoinsCacheEntry::FRESH) && child.coins.IsPruned()) {
+                cacheCoins.erase(itUs);
+            } else {
+                if (!(entry.flags & CCoinsCacheEntry::FRESH)) {
+                    // A fresh child replaced coins that were all spent here
+                    if (child.flags & CCoinsCacheEntry::FRESH) {
+                        for (unsigned int n = 0; n < child.coins.vout.size(); n++)
+                            if (child.coins.IsAvailable(n))
+                                entry.vChanged.push_back(n);
+                    } else {
+                        entry.vChanged.insert(entry.vChanged.end(), child.vChanged.begin(), child.vChanged.end());
+                    }
+                    entry.flags |= child.flags & CCoinsCacheEntry::UNLISTED;
+                }
+                entry.coins.swap(child.coins);
+                entry.flags |= CCoinsCacheEntry::DIRTY;
+                cachedCoinsUsage += entry.DynamicMemoryUsage();
+            }
+        }
+    }
     pindexTip = pindex;
     return true;
 }
 
+bool CCoinsViewCache::GetStats(CCoinsStats &stats) {
+    if (!base->GetStats(stats))
+        return false;
+    CombineCoinsStats(stats, statsChange);
+    CBlockIndex *pindex = GetBestBlock();
+    if (pindex) {
+        stats.hashBlock = pindex->GetBlockHash();
+        stats.nHeight = pindex->nHeight;
+    }
+    stats.hashSerialized = stats.muhash.GetHash();
+    return true;
+}
+
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, pindexTip);
-    if (fOk)
+    UpdatePendingUsage();
+    bool fOk = base->BatchWrite(cacheCoins, pindexTip, statsChange);
+    if (fOk) {
         cacheCoins.clear();
+        cachedCoinsUsage = 0;
+        statsChange = CCoinsStats();
+    }
     return fOk;
 }
 
@@ -381,6 +567,326 @@ unsigned int CCoinsViewCache::GetCacheSize() {
     return cacheCoins.size();
 }
 
+bool CCoinsViewCache::HaveCoinsInCache(const uint256 &txid) {
+    return cacheCoins.count(txid) > 0;
+}
+
+void CCoinsViewCache::UpdatePendingUsage() {
+    BOOST_FOREACH(CCoinsCacheEntry *pentry, vPendingUsage) {
+        pentry->flags &= ~CCoinsCacheEntry::PENDING;
+        cachedCoinsUsage += pentry->DynamicMemoryUsage();
+    }
+    vPendingUsage.clear();
+}
+
+size_t CCoinsViewCache::DynamicMemoryUsage() {
+    UpdatePendingUsage();
+    return cacheCoins.DynamicMemoryUsage() + cachedCoinsUsage + vPendingUsage.capacity() * sizeof(CCoinsCacheEntry*);
+}
+
+CCoinsViewFlusher::CCoinsViewFlusher(CCoinsView &baseIn) : CCoinsViewBacked(baseIn), pindexWriting(NULL), nWritingUsage(0), fPending(false), fHaveStatsWriting(false), fFailed(false), fStop(false) {
+    pthread = new boost::thread(boost::bind(&CCoinsViewFlusher::Thread, this));
+}
+
+CCoinsViewFlusher::~CCoinsViewFlusher() {
+    if (!Sync())
+        printf("ERROR: CCoinsViewFlusher : coins flushed before shutdown were not written\n");
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    pthread->join();
+    delete pthread;
+}
+
+void CCoinsViewFlusher::Thread() {
+    RenameThread("bitcoin-coinsflush");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (!fPending && !fStop)
+            cond.wait(lock);
+        if (!fPending)
+            return;
+
+        // mapWriting is not modified until fPending is cleared, so the base
+        // can write it while lookups keep reading it
+        lock.unlock();
+        int64 nStart = GetTimeMicros();
+        bool fOk = false;
+        try {
+            fOk = base->BatchWrite(mapWriting, pindexWriting, statsChangeWriting);
+        } catch (std::exception &e) {
+            PrintExceptionContinue(&e, "CCoinsViewFlusher::Thread()");
+        }
+        if (fBenchmark)
+            printf("- Background coins flush: %.2fms\n", 0.001 * (GetTimeMicros() - nStart));
+        if (!fOk)
+            AbortNode(_("Failed to write to coin database"));
+
+        // Free the written layer outside the lock
+        CCoinsMap mapWritten;
+        lock.lock();
+        if (fOk) {
+            mapWriting.swap(mapWritten);
+            pindexWriting = NULL;
+            statsChangeWriting = CCoinsStats();
+            nWritingUsage = 0;
+            fHaveStatsWriting = false;
+        } else {
+            // Keep serving the layer, so lookups stay consistent until shutdown
+            fFailed = true;
+        }
+        fPending = false;
+        cond.notify_all();
+        lock.unlock();
+        mapWritten.clear();
+        lock.lock();
+    }
+}
+
+bool CCoinsViewFlusher::WaitForWriter(boost::unique_lock<boost::mutex> &lock) {
+    while (fPending)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+bool CCoinsViewFlusher::GetCoins(const uint256 &txid, CCoins &coins) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = mapWriting.find(txid);
+        if (it != mapWriting.end()) {
+            if (it->second.coins.IsPruned())
+                return false;
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    // Not in the layer, so the base holds the latest version
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewFlusher::HaveCoins(const uint256 &txid) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = mapWriting.find(txid);
+        if (it != mapWriting.end())
+            return !it->second.coins.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewFlusher::SetCoins(const uint256 &txid, const CCoins &coins) {
+    return Sync() && base->SetCoins(txid, coins);
+}
+
+CBlockIndex *CCoinsViewFlusher::GetBestBlock() {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (pindexWriting != NULL)
+            return pindexWriting;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewFlusher::SetBestBlock(CBlockIndex *pindex) {
+    return Sync() && base->SetBestBlock(pindex);
+}
+
+bool CCoinsViewFlusher::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange) {
+    size_t nUsage = mapCoins.DynamicMemoryUsage();
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
+        nUsage += it->second.DynamicMemoryUsage();
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!WaitForWriter(lock))
+            return false;
+        // Nothing is being written, so the base's statistics are those of what it stores
+        fHaveStatsWriting = base->GetStats(statsWriting);
+        if (fHaveStatsWriting)
+            CombineCoinsStats(statsWriting, statsChange);
+        // The caller is left with the empty map of the previous layer
+        mapWriting.swap(mapCoins);
+        pindexWriting = pindex;
+        statsChangeWriting = statsChange;
+        nWritingUsage = nUsage;
+        fPending = true;
+    }
+    cond.notify_all();
+    return true;
+}
+
+bool CCoinsViewFlusher::GetStats(CCoinsStats &stats) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fFailed)
+            return false;
+        if (fPending) {
+            // Worked out before the layer was handed over, rather than waiting for it
+            if (!fHaveStatsWriting)
+                return false;
+            stats = statsWriting;
+            if (pindexWriting) {
+                stats.hashBlock = pindexWriting->GetBlockHash();
+                stats.nHeight = pindexWriting->nHeight;
+            }
+            stats.hashSerialized = stats.muhash.GetHash();
+            return true;
+        }
+    }
+    return base->GetStats(stats);
+}
+
+bool CCoinsViewFlusher::Sync() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return WaitForWriter(lock);
+}
+
+CBlockIndex *CCoinsViewFlusher::GetDurableBlock() {
+    return base->GetBestBlock();
+}
+
+size_t CCoinsViewFlusher::DynamicMemoryUsage() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nWritingUsage;
+}
+
+// Heap memory of a prefetched entry, including its tree node
+static size_t PrefetchedUsage(const CCoins &coins) {
+    return sizeof(std::pair<const uint256, CCoins>) + 4 * sizeof(void*) + coins.DynamicMemoryUsage();
+}
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView &baseIn, int nThreads) : CCoinsViewBacked(baseIn), nPrefetchedUsage(0), nGeneration(0), fStop(false) {
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&CCoinsViewPrefetch::Thread, this));
+}
+
+CCoinsViewPrefetch::~CCoinsViewPrefetch() {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    threads.join_all();
+}
+
+void CCoinsViewPrefetch::Thread() {
+    RenameThread("bitcoin-prefetch");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (vQueue.empty() && !fStop)
+            cond.wait(lock);
+        if (fStop)
+            return;
+        uint256 txid = vQueue.back();
+        vQueue.pop_back();
+        setReading.insert(txid);
+        unsigned int nGenerationRead = nGeneration;
+
+        lock.unlock();
+        CCoins coins;
+        bool fFound = false;
+        try {
+            fFound = base->GetCoins(txid, coins);
+        } catch (std::exception &e) {
+            // Left for the lookup itself to run into and report
+            PrintExceptionContinue(&e, "CCoinsViewPrefetch::Thread()");
+        }
+        lock.lock();
+
+        // Coins read before the base last changed may be outdated
+        if (fFound && nGenerationRead == nGeneration) {
+            std::pair<std::map<uint256, CCoins>::iterator, bool> ret = mapPrefetched.insert(std::make_pair(txid, CCoins()));
+            if (ret.second) {
+                ret.first->second.swap(coins);
+                nPrefetchedUsage += PrefetchedUsage(ret.first->second);
+            }
+        }
+        setReading.erase(txid);
+        condRead.notify_all();
+    }
+}
+
+void CCoinsViewPrefetch::Invalidate() {
+    std::map<uint256, CCoins> mapOld;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        mapPrefetched.swap(mapOld);
+        nPrefetchedUsage = 0;
+        nGeneration++;
+    }
+}
+
+bool CCoinsViewPrefetch::GetCoins(const uint256 &txid, CCoins &coins) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // Rather than reading the same coins a second time
+        while (setReading.count(txid))
+            condRead.wait(lock);
+        std::map<uint256, CCoins>::iterator it = mapPrefetched.find(txid);
+        if (it != mapPrefetched.end()) {
+            // Handed out once: the cache above keeps it from now on
+            nPrefetchedUsage -= PrefetchedUsage(it->second);
+            coins.swap(it->second);
+            mapPrefetched.erase(it);
+            return true;
+        }
+        // Not read yet, or not found: no thread needs to read it any more
+        std::vector<uint256>::iterator itQueue = std::find(vQueue.begin(), vQueue.end(), txid);
+        if (itQueue != vQueue.end())
+            vQueue.erase(itQueue);
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewPrefetch::HaveCoins(const uint256 &txid) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (mapPrefetched.count(txid))
+            return true;
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewPrefetch::SetCoins(const uint256 &txid, const CCoins &coins) {
+    bool fOk = base->SetCoins(txid, coins);
+    Invalidate();
+    return fOk;
+}
+
+bool CCoinsViewPrefetch::SetBestBlock(CBlockIndex *pindex) {
+    bool fOk = base->SetBestBlock(pindex);
+    Invalidate();
+    return fOk;
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange) {
+    // Reads racing with the write either finish before the invalidation and
+    // are dropped with the rest, or finish after it and are discarded
+    bool fOk = base->BatchWrite(mapCoins, pindex, statsChange);
+    Invalidate();
+    return fOk;
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<uint256> &vTxid) {
+    if (threads.size() == 0)
+        return;
+    std::map<uint256, CCoins> mapOld;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // Whatever the previous block left unused is not going to be asked for
+        mapPrefetched.swap(mapOld);
+        nPrefetchedUsage = 0;
+        vQueue.assign(vTxid.rbegin(), vTxid.rend());
+    }
+    cond.notify_all();
+}
+
+size_t CCoinsViewPrefetch::DynamicMemoryUsage() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nPrefetchedUsage;
+}
+
 /** CCoinsView that brings transactions from a memorypool into view.
     It does not check for spendings by memory pool transactions. */
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView &baseIn, CTxMemPool &mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
@@ -401,6 +907,9 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) {
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewFlusher *pcoinsFlusher = NULL;
+CCoinsViewPrefetch *pcoinsPrefetch = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -693,7 +1202,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1049,7 +1558,7 @@ int CMerkleTx::GetDepthInMainChain(CBlockIndex* &pindexRet) const
         return 0;
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1186,82 +1695,329 @@ CBlockIndex* FindBlockByHeight(int nHeight)
     return vBlockIndexByHeight[nHeight];
 }
 
-bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
+bool HaveBlockDataSince(const CBlockIndex* pindex)
 {
-    // Open history file to append
-    CAutoFile fileout = CAutoFile(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (!fileout)
-        return error("WriteBlockToDisk() : OpenBlockFile failed");
+    if (!fHavePruned)
+        return true;
+    for (int nHeight = pindex->nHeight; nHeight <= nBestHeight; nHeight++)
+        if (!(vBlockIndexByHeight[nHeight]->nStatus & BLOCK_HAVE_DATA))
+            return false;
+    return true;
+}
 
-    // Serialize block to buffer first (for compression)
-    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
-    ssBlock << block;
-    
-    // Convert to vector for compression
-    std::vector<unsigned char> vchBlock(ssBlock.begin(), ssBlock.end());
-    std::vector<unsigned char> vchCompressed;
-    
-    // Apply compression if enabled
-    if (compressedStorage.IsCompressionEnabled()) {
+static boost::filesystem::path GetDiskFilePath(int nFile, const char *prefix, const char *pszSuffix = "")
+{
+    return GetDataDir() / "blocks" / strprintf("%s%05u.dat%s", prefix, nFile, pszSuffix);
+}
+
+static boost::filesystem::path GetBlockFilePath(int nFile, const char *pszSuffix = "")
+{
+    return GetDiskFilePath(nFile, "blk", pszSuffix);
+}
+
+static boost::filesystem::path GetUndoFilePath(int nFile)
+{
+    return GetDiskFilePath(nFile, "rev");
+}
+
+/** Keeps the block and undo files being appended to open, and commits
+ *  everything written since the last commit to disk in one go, instead of
+ *  reopening and syncing the files for every block */
+class CBlockFileWriter
+{
+private:
+    CCriticalSection cs;
+    FILE *file[2];      // block file, undo file
+    int nFile[2];
+    bool fDirty[2];
+    int64 nLastCommit;
+
+    void CloseFile(int i)
+    {
+        if (file[i] == NULL)
+            return;
+        if (fDirty[i])
+            FileCommit(file[i]);
+        fclose(file[i]);
+        file[i] = NULL;
+        nFile[i] = -1;
+        fDirty[i] = false;
+    }
+
+public:
+    CBlockFileWriter() : nLastCommit(0)
+    {
+        for (int i = 0; i < 2; i++) {
+            file[i] = NULL;
+            nFile[i] = -1;
+            fDirty[i] = false;
+        }
+    }
+
+    ~CBlockFileWriter()
+    {
+        Close();
+    }
+
+    // Write a whole record at pos. It is visible to readers right away and
+    // durable after the next Commit().
+    bool Write(bool fUndo, const CDiskBlockPos &pos, const CDataStream &ssRecord)
+    {
+        LOCK(cs);
+        int i = fUndo ? 1 : 0;
+        if (file[i] == NULL || nFile[i] != pos.nFile) {
+            // Writes to the file being left still go out with this group
+            CloseFile(i);
+            CDiskBlockPos posFile(pos.nFile, 0);
+            file[i] = fUndo ? OpenUndoFile(posFile) : OpenBlockFile(posFile);
+            if (file[i] == NULL)
+                return false;
+            nFile[i] = pos.nFile;
+        }
+        if (fseek(file[i], pos.nPos, SEEK_SET))
+            return error("CBlockFileWriter::Write() : fseek failed");
+        if (fwrite(&ssRecord[0], 1, ssRecord.size(), file[i]) != ssRecord.size() || fflush(file[i]))
+            return error("CBlockFileWriter::Write() : write failed");
+        fDirty[i] = true;
+        return true;
+    }
+
+    void Commit()
+    {
+        LOCK(cs);
+        for (int i = 0; i < 2; i++) {
+            if (file[i] && fDirty[i]) {
+                FileCommit(file[i]);
+                fDirty[i] = false;
+            }
+        }
+        nLastCommit = GetTimeMillis();
+    }
+
+    // Whether the durability window since the last commit has passed
+    bool IsCommitDue(int64 nInterval)
+    {
+        LOCK(cs);
+        return GetTimeMillis() - nLastCommit >= nInterval * 1000;
+    }
+
+    void Close()
+    {
+        LOCK(cs);
+        for (int i = 0; i < 2; i++)
+            CloseFile(i);
+    }
+};
+
+static CBlockFileWriter blockFileWriter;
+
+void CloseBlockFiles()
+{
+    blockFileWriter.Close();
+}
+
+bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
+{
+    // Message start and record size, followed by the stored block
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+
+    // Apply compression if enabled, unless it is left to the background
+    // rewrite of finalized block files
+    if (compressedStorage.IsCompressionEnabled() && !fCompressInBackground) {
+        CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+        ssBlock << block;
+        std::vector<unsigned char> vchBlock(ssBlock.begin(), ssBlock.end());
+        std::vector<unsigned char> vchCompressed;
         if (!compressedStorage.CompressBlock(vchBlock, vchCompressed)) {
             return error("WriteBlockToDisk() : compression failed");
         }
+        // FindBlockPos reserved room for the raw block only
+        if (vchCompressed.size() >= vchBlock.size())
+            vchCompressed.swap(vchBlock);
+        unsigned int nSize = vchCompressed.size();
+        compressedStorage.CountStored(false, ssBlock.size(), nSize);
+        ssRecord.reserve(nSize + 8);
+        ssRecord << FLATDATA(Params().MessageStart()) << nSize;
+        ssRecord.write((const char*)&vchCompressed[0], nSize);
     } else {
-        vchCompressed = vchBlock;
+        unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        ssRecord.reserve(nSize + 8);
+        ssRecord << FLATDATA(Params().MessageStart()) << nSize << block;
     }
-    
-    // Write index header with compressed size
-    unsigned int nSize = vchCompressed.size();
-    fileout << FLATDATA(Params().MessageStart()) << nSize;
-
-    // Write block
-    long fileOutPos = ftell(fileout);
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk() : ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    
-    // Write compressed block data
-    fileout.write((const char*)vchCompressed.data(), vchCompressed.size());
 
-    // Flush stdio buffers and commit to disk before returning
-    fflush(fileout);
-    if (!IsInitialBlockDownload())
-        FileCommit(fileout);
+    if (!blockFileWriter.Write(false, pos, ssRecord))
+        return error("WriteBlockToDisk() : write failed");
+    pos.nPos += 8;
 
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+bool CBlockUndo::WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock)
 {
-    block.SetNull();
+    // Index header, stored undo data and checksum
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    if (compressedStorage.IsCompressionEnabled()) {
+        CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+        ssUndo << *this;
+        std::vector<unsigned char> vchUndo(ssUndo.begin(), ssUndo.end());
+        std::vector<unsigned char> vchCompressed;
+        if (!compressedStorage.CompressUndo(vchUndo, vchCompressed))
+            return error("CBlockUndo::WriteToDisk() : compression failed");
+        // FindUndoPos reserved room for the raw undo data only
+        if (vchCompressed.size() >= vchUndo.size())
+            vchCompressed.swap(vchUndo);
+        unsigned int nSize = vchCompressed.size();
+        compressedStorage.CountStored(true, ssUndo.size(), nSize);
+        ssRecord.reserve(nSize + 40);
+        ssRecord << FLATDATA(Params().MessageStart()) << nSize;
+        if (nSize > 0)
+            ssRecord.write((const char*)&vchCompressed[0], nSize);
+    } else {
+        unsigned int nSize = ::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION);
+        ssRecord.reserve(nSize + 40);
+        ssRecord << FLATDATA(Params().MessageStart()) << nSize << *this;
+    }
+
+    // calculate & write checksum over the uncompressed undo data
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << *this;
+    ssRecord << hasher.GetHash();
+
+    if (!blockFileWriter.Write(true, pos, ssRecord))
+        return error("CBlockUndo::WriteToDisk() : write failed");
+    pos.nPos += 8;
+
+    return true;
+}
 
-    // Open history file to read
-    CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+// Deserialize undo data from its stored bytes and verify its checksum
+bool static ReadUndoFromRecord(CBlockUndo& blockundo, const unsigned char* pbegin, const unsigned char* pend,
+                               const uint256& hashBlock, const uint256& hashChecksum)
+{
+    try {
+        CBufferReader reader(pbegin, pend, SER_DISK, CLIENT_VERSION);
+        reader >> blockundo;
+        if (!reader.empty())
+            return false;
+    }
+    catch (std::exception &e) {
+        return false;
+    }
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << blockundo;
+    return hashChecksum == hasher.GetHash();
+}
+
+bool CBlockUndo::ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock)
+{
+    // Open history file at the record size preceding the undo data
+    if (pos.nPos < 8)
+        return error("CBlockUndo::ReadFromDisk() : position %u out of range", pos.nPos);
+    CAutoFile filein = CAutoFile(OpenUndoFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION);
     if (!filein)
-        return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : OpenBlockFile failed");
+        return error("CBlockUndo::ReadFromDisk() : OpenUndoFile failed");
 
-    // Read block - need to handle both compressed and uncompressed formats
+    // Read stored undo data and checksum
+    unsigned int nSize;
+    std::vector<unsigned char> vchStored;
+    uint256 hashChecksum;
     try {
-        if (compressedStorage.IsCompressionEnabled()) {
-            // Read into a data stream first
-            CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
-            filein >> ssBlock;
-            
-            // Convert to vector for decompression
-            std::vector<unsigned char> vchCompressed(ssBlock.begin(), ssBlock.end());
-            std::vector<unsigned char> vchBlock;
-            
-            // Try to decompress - will return original if not compressed
-            if (!compressedStorage.DecompressBlock(vchCompressed, vchBlock)) {
+        filein >> nSize;
+        if (nSize > MAX_SIZE)
+            return error("CBlockUndo::ReadFromDisk() : record size %u too large", nSize);
+        vchStored.resize(nSize);
+        if (nSize > 0)
+            filein.read((char*)&vchStored[0], nSize);
+        filein >> hashChecksum;
+    }
+    catch (std::exception &e) {
+        return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+    }
+    const unsigned char* pbegin = vchStored.empty() ? NULL : &vchStored[0];
+    const unsigned char* pend = pbegin + vchStored.size();
+
+    // Decompress if needed; raw data that merely starts with the magic
+    // bytes fails to decode and is parsed as it is
+    if (compressedStorage.IsCompressedBlock(pbegin, pend)) {
+        std::vector<unsigned char> vchUndo;
+        if (compressedStorage.DecompressUndo(pbegin, pend, vchUndo) && !vchUndo.empty() &&
+            ReadUndoFromRecord(*this, &vchUndo[0], &vchUndo[0] + vchUndo.size(), hashBlock, hashChecksum))
+            return true;
+        vtxundo.clear();
+    }
+    if (!ReadUndoFromRecord(*this, pbegin, pend, hashBlock, hashChecksum))
+        return error("CBlockUndo::ReadFromDisk() : deserialize error or checksum mismatch");
+
+    return true;
+}
+
+// Deserialize a block from its stored bytes, decompressing them first if needed.
+// Compressed records are recognised whether or not -usecompression is set;
+// a raw block whose version merely matches the magic bytes fails to
+// decompress and is parsed as it is.
+bool static ReadBlockFromRecord(CBlock& block, const unsigned char* pbegin, const unsigned char* pend)
+{
+    if (compressedStorage.IsCompressedBlock(pbegin, pend)) {
+        std::vector<unsigned char> vchBlock;
+        if (compressedStorage.DecompressBlock(pbegin, pend, vchBlock) && !vchBlock.empty()) {
+            CBufferReader reader(&vchBlock[0], &vchBlock[0] + vchBlock.size(), SER_DISK, CLIENT_VERSION);
+            reader >> block;
+            return true;
+        }
+    }
+    CBufferReader reader(pbegin, pend, SER_DISK, CLIENT_VERSION);
+    reader >> block;
+    return true;
+}
+
+bool static ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW)
+{
+    block.SetNull();
+
+    // Finalized files no longer change size, so they can be read in place
+    boost::shared_ptr<CMappedFile> pmapped;
+    bool fFinalized;
+    {
+        LOCK(cs_LastBlockFile);
+        fFinalized = pos.nFile < nLastBlockFile;
+    }
+    if (fFinalized)
+        pmapped = mappedBlockFiles.Get(pos.nFile, GetBlockFilePath(pos.nFile));
+
+    try {
+        if (pmapped) {
+            // The stored record length precedes the block data
+            unsigned int nSize;
+            if (pos.nPos < sizeof(nSize) || pos.nPos > pmapped->size())
+                return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : position %u out of range", pos.nPos);
+            CBufferReader(pmapped->begin() + pos.nPos - sizeof(nSize), pmapped->end(), SER_DISK, CLIENT_VERSION) >> nSize;
+            if (nSize > pmapped->size() - pos.nPos)
+                return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : record size %u too large", nSize);
+            const unsigned char* pbegin = pmapped->begin() + pos.nPos;
+            if (!ReadBlockFromRecord(block, pbegin, pbegin + nSize))
                 return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : decompression failed");
-            }
-            
-            // Deserialize from decompressed data
-            CDataStream ssDecompressed(vchBlock, SER_DISK, CLIENT_VERSION);
-            ssDecompressed >> block;
         } else {
-            // Read directly without compression support
-            filein >> block;
+            // Open history file to read
+            CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (!filein)
+                return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : OpenBlockFile failed");
+
+            // Read the whole record, which may have been compressed before
+            // -usecompression was turned off
+            unsigned int nSize;
+            if (pos.nPos < sizeof(nSize) || fseek(filein, pos.nPos - sizeof(nSize), SEEK_SET))
+                return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : fseek failed");
+            filein >> nSize;
+            if (nSize == 0 || nSize > MAX_SIZE)
+                return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : bad record size %u", nSize);
+
+            std::vector<unsigned char> vchStored(nSize);
+            filein.read((char*)&vchStored[0], nSize);
+            if (!ReadBlockFromRecord(block, &vchStored[0], &vchStored[0] + nSize))
+                return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : decompression failed");
         }
     }
     catch (std::exception &e) {
@@ -1269,15 +2025,22 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(block.GetAlgo()), block.nBits, block.GetAlgo()))
+    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(block.GetAlgo()), block.nBits, block.GetAlgo()))
         return error("ReadBlockFromDisk(CBlock&, CDiskBlockPos&) : errors in block header");
 
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    return ReadBlockFromDisk(block, pos, true);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    // If the proof-of-work was verified when the block was accepted, matching
+    // the (cheap) block hash against the index is enough to trust the header.
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), !pindex->HavePoW()))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
@@ -1458,10 +2221,7 @@ unsigned int static GetNextWorkRequired(const CBlockIndex* pindexLast, const CBl
     // Go back by what we want to be nAveragingInterval blocks
     const CBlockIndex* pindexFirst = pindexPrev;
     for (int i = 0; pindexFirst && i < nAveragingInterval - 1; i++)
-    {
-        pindexFirst = pindexFirst->pprev;
-        pindexFirst = GetLastBlockIndexForAlgo(pindexFirst, algo);
-    }
+        pindexFirst = pindexFirst->pprevAlgo;
     if (pindexFirst == NULL)
         return nProofOfWorkLimit; // not nAveragingInterval blocks of this algo available
 
@@ -1473,40 +2233,169 @@ unsigned int static GetNextWorkRequired(const CBlockIndex* pindexLast, const CBl
     if (nActualTimespan > nMaxActualTimespan)
         nActualTimespan = nMaxActualTimespan;
 
-    // Retarget
-    CBigNum bnNew;
-    bnNew.SetCompact(pindexPrev->nBits);
-    bnNew *= nActualTimespan;
-    bnNew /= nAveragingTargetTimespan;
-
-    if (bnNew > Params().ProofOfWorkLimit(algo))
-        bnNew = Params().ProofOfWorkLimit(algo);
+    unsigned int nBitsNew = CalculateNextWorkRequired(pindexPrev->nBits, nActualTimespan, algo);
 
     /// debug print
     printf("GetNextWorkRequired RETARGET\n");
     printf("nTargetTimespan = %"PRI64d"    nActualTimespan = %"PRI64d"\n", nAveragingTargetTimespan, nActualTimespan);
-    printf("Before: %08x  %s\n", pindexPrev->nBits, CBigNum().SetCompact(pindexPrev->nBits).getuint256().ToString().c_str());
-    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
+    printf("Before: %08x  %s\n", pindexPrev->nBits, uint256().SetCompact(pindexPrev->nBits).ToString().c_str());
+    printf("After:  %08x  %s\n", nBitsNew, uint256().SetCompact(nBitsNew).ToString().c_str());
 
+    return nBitsNew;
+}
+
+// Blocks following heights 915235 to 955000 were accepted without checking their
+// difficulty. Every path that accepts headers must apply the same exemption.
+bool static CheckWorkRequired(const CBlockIndex* pindexPrev, const CBlockHeader& header)
+{
+    if (915235 <= pindexPrev->nHeight && pindexPrev->nHeight <= 955000)
+        return true;
+    return header.nBits == GetNextWorkRequired(pindexPrev, &header, header.GetAlgo());
+}
+
+unsigned int CalculateNextWorkRequired(unsigned int nBitsPrev, int64 nActualTimespan, int algo)
+{
+    // bnNew = bnOld * nActualTimespan / nAveragingTargetTimespan, rounded down like
+    // CBigNum did. With a limit close to 2^256 (regtest) the product does not fit in
+    // 256 bits, so it is split into the quotient and remainder of the division; a
+    // result too large for 256 bits is above any limit and is clamped.
+    const uint256 &bnLimit = Params().ProofOfWorkLimit(algo);
+    uint256 bnOld;
+    bnOld.SetCompact(nBitsPrev);
+    uint256 bnTimespan = nActualTimespan, bnTargetTimespan = nAveragingTargetTimespan;
+    uint256 bnQuot = bnOld / bnTargetTimespan;
+    uint256 bnRem = bnOld - bnQuot * bnTargetTimespan;
+
+    if (bnQuot > ~uint256(0) / bnTimespan)
+        return bnLimit.GetCompact();
+    uint256 bnNew = bnQuot * bnTimespan;
+    uint256 bnFrac = bnRem * bnTimespan / bnTargetTimespan; // both factors below 2^64
+    bnNew += bnFrac;
+    if (bnNew < bnFrac || bnNew > bnLimit)
+        return bnLimit.GetCompact();
     return bnNew.GetCompact();
 }
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, int algo)
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > Params().ProofOfWorkLimit(algo))
+    if (fNegative || fOverflow || bnTarget == 0 || bnTarget > Params().ProofOfWorkLimit(algo))
         return error("CheckProofOfWork(algo=%d) : nBits below minimum work", algo);
 
     // Check proof of work matches claimed amount
-    if (hash > bnTarget.getuint256())
+    if (hash > bnTarget)
         return error("CheckProofOfWork(algo=%d) : hash doesn't match nBits", algo);
 
     return true;
 }
 
+/** Closure hashing a run of CheckProofOfWorkBatch() headers that share one algorithm
+ *  Note that this stores pointers into the caller's vector */
+class CPoWBatchCheck
+{
+private:
+    std::vector<CPoWCheck*> vpcheck;
+    int algo;
+
+public:
+    CPoWBatchCheck() : algo(ALGO_SHA256D) {}
+    CPoWBatchCheck(const std::vector<CPoWCheck*>& vpcheckIn, int algoIn) :
+        vpcheck(vpcheckIn), algo(algoIn) {}
+
+    bool operator()()
+    {
+        if (algo == ALGO_SCRYPT)
+        {
+            // Feed the whole run through the widest scrypt kernel at once
+            unsigned int nCount = vpcheck.size();
+            std::vector<char> vInput(80 * nCount);
+            std::vector<uint256> vHash(nCount);
+            for (unsigned int i = 0; i < nCount; i++)
+                memcpy(&vInput[80 * i], BEGIN(vpcheck[i]->header.nVersion), 80);
+            scrypt_1024_1_1_256_multi(&vInput[0], (char*)&vHash[0], nCount);
+            for (unsigned int i = 0; i < nCount; i++)
+                vpcheck[i]->hashPoW = vHash[i];
+        }
+        else
+        {
+            BOOST_FOREACH(CPoWCheck* pcheck, vpcheck)
+                pcheck->hashPoW = pcheck->header.GetPoWHash(algo);
+        }
+        BOOST_FOREACH(CPoWCheck* pcheck, vpcheck)
+            pcheck->fValid = pcheck->hashPoW <= pcheck->hashTarget;
+
+        // A failed share is a result, not an error: never abort the batch
+        return true;
+    }
+
+    void swap(CPoWBatchCheck &check) {
+        vpcheck.swap(check.vpcheck);
+        std::swap(algo, check.algo);
+    }
+};
+
+static CCheckQueue<CPoWBatchCheck> powcheckqueue(4);
+static CCriticalSection cs_PoWCheck;
+
+void ThreadPoWCheck() {
+    RenameThread("bitcoin-powcheck");
+    powcheckqueue.Thread();
+}
+
+void CheckProofOfWorkBatch(std::vector<CPoWCheck>& vChecks)
+{
+    // Group the headers by algorithm, in runs of one scrypt kernel call;
+    // the other algorithms are cheap per header, so use runs large enough
+    // to keep queue overhead down
+    std::vector<CPoWBatchCheck> vBatches;
+    for (int algo = 0; algo < NUM_ALGOS; algo++)
+    {
+        unsigned int nRun = (algo == ALGO_SCRYPT) ? scrypt_best_throughput() : 16;
+        std::vector<CPoWCheck*> vpcheck;
+        vpcheck.reserve(nRun);
+        BOOST_FOREACH(CPoWCheck& check, vChecks)
+        {
+            if (check.algo != algo)
+                continue;
+            vpcheck.push_back(&check);
+            if (vpcheck.size() == nRun)
+            {
+                vBatches.push_back(CPoWBatchCheck(vpcheck, algo));
+                vpcheck.clear();
+            }
+        }
+        if (!vpcheck.empty())
+            vBatches.push_back(CPoWBatchCheck(vpcheck, algo));
+    }
+
+    // Unknown algorithms never satisfy their target
+    BOOST_FOREACH(CPoWCheck& check, vChecks)
+    {
+        if (check.algo < 0 || check.algo >= NUM_ALGOS)
+        {
+            check.hashPoW = 0;
+            check.fValid = false;
+        }
+    }
+
+    if (nScriptCheckThreads == 0 || vBatches.size() <= 1)
+    {
+        BOOST_FOREACH(CPoWBatchCheck& batch, vBatches)
+            batch();
+        return;
+    }
+
+    // The queue only supports one master at a time
+    LOCK(cs_PoWCheck);
+    CCheckQueueControl<CPoWBatchCheck> control(&powcheckqueue);
+    control.Add(vBatches);
+    control.Wait();
+}
+
 // Return maximum amount of blocks that other nodes claim to have
 int GetNumBlocksOfPeers()
 {
@@ -1530,20 +2419,20 @@ bool IsInitialBlockDownload()
 
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
-    if (pindexNew->nChainWork > nBestInvalidWork)
+    if (pindexNew->GetChainWork() > nBestInvalidWork)
     {
-        nBestInvalidWork = pindexNew->nChainWork;
+        nBestInvalidWork = pindexNew->GetChainWork();
         pblocktree->WriteBestInvalidWork(CBigNum(nBestInvalidWork));
         uiInterface.NotifyBlocksChanged();
     }
     printf("InvalidChainFound: invalid block=%s  height=%d  log2_work=%.8g  date=%s\n",
       pindexNew->GetBlockHash().ToString().c_str(), pindexNew->nHeight,
-      log(pindexNew->nChainWork.getdouble())/log(2.0), DateTimeStrFormat("%Y-%m-%d %H:%M:%S",
+      log(pindexNew->GetChainWork().getdouble())/log(2.0), DateTimeStrFormat("%Y-%m-%d %H:%M:%S",
       pindexNew->GetBlockTime()).c_str());
     printf("InvalidChainFound:  current best=%s  height=%d  log2_work=%.8g  date=%s\n",
       hashBestChain.ToString().c_str(), nBestHeight, log(nBestChainWork.getdouble())/log(2.0),
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pindexBest->GetBlockTime()).c_str());
-    if (pindexBest && nBestInvalidWork > nBestChainWork + (pindexBest->GetBlockWorkAdjusted() * 6).getuint256())
+    if (pindexBest && nBestInvalidWork > nBestChainWork + pindexBest->GetBlockWorkAdjusted() * 6)
         printf("InvalidChainFound: Warning: Displayed transactions may not be correct! You may need to upgrade, or other nodes may need to upgrade.\n");
 }
 
@@ -1569,7 +2458,7 @@ bool ConnectBestBlock(CValidationState &state) {
             pindexNewBest = *it;
         }
 
-        if (pindexNewBest == pindexBest || (pindexBest && pindexNewBest->nChainWork == pindexBest->nChainWork))
+        if (pindexNewBest == pindexBest || (pindexBest && pindexNewBest->GetChainWork() == pindexBest->GetChainWork()))
             return true; // nothing to do
 
         // check ancestry
@@ -1589,7 +2478,7 @@ bool ConnectBestBlock(CValidationState &state) {
                 break;
             }
 
-            if (pindexBest == NULL || pindexTest->nChainWork > pindexBest->nChainWork)
+            if (pindexBest == NULL || pindexTest->GetChainWork() > pindexBest->GetChainWork())
                 vAttach.push_back(pindexTest);
 
             if (pindexTest->pprev == NULL || pindexTest->GetNextInMainChain()) {
@@ -1631,7 +2520,7 @@ void UpdateTime(CBlockHeader& block, const CBlockIndex* pindexPrev)
 
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input)
 {
-    const CCoins &coins = GetCoins(input.prevout.hash);
+    const CCoins &coins = AccessCoins(input.prevout.hash);
     assert(coins.IsAvailable(input.prevout.n));
     return coins.vout[input.prevout.n];
 }
@@ -1653,15 +2542,14 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
     // mark inputs spent
     if (!tx.IsCoinBase()) {
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoins &coins = inputs.GetCoins(txin.prevout.hash);
             CTxInUndo undo;
-            assert(coins.Spend(txin.prevout, undo));
+            assert(inputs.SpendCoins(txin.prevout, undo));
             txundo.vprevout.push_back(undo);
         }
     }
 
-    // add outputs
-    assert(inputs.SetCoins(txhash, CCoins(tx, nHeight)));
+    // add outputs; the caller has looked txhash up for BIP30 or the memory pool
+    assert(inputs.SetNewCoins(txhash, CCoins(tx, nHeight)));
 }
 
 bool CCoinsViewCache::HaveInputs(const CTransaction& tx)
@@ -1677,7 +2565,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx)
         // then check whether the actual outputs are available
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins &coins = GetCoins(prevout.hash);
+            const CCoins &coins = AccessCoins(prevout.hash);
             if (!coins.IsAvailable(prevout.n))
                 return false;
         }
@@ -1717,7 +2605,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, CCoinsViewCach
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins &coins = inputs.GetCoins(prevout.hash);
+            const CCoins &coins = inputs.AccessCoins(prevout.hash);
 
             // If prev is coinbase, check that it's matured
             if (coins.IsCoinBase()) {
@@ -1753,7 +2641,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, CCoinsViewCach
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins &coins = inputs.GetCoins(prevout.hash);
+                const CCoins &coins = inputs.AccessCoins(prevout.hash);
 
                 // Verify signature
                 CScriptCheck check(coins, tx, i, flags, 0);
@@ -1808,14 +2696,14 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             fClean = fClean && error("DisconnectBlock() : outputs still spent? database corrupted");
             view.SetCoins(hash, CCoins());
         }
-        CCoins &outs = view.GetCoins(hash);
+        const CCoins &outs = view.AccessCoins(hash);
 
         CCoins outsBlock = CCoins(tx, pindex->nHeight);
         if (outs != outsBlock)
             fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
 
         // remove outputs
-        outs = CCoins();
+        view.SetCoins(hash, CCoins());
 
         // restore inputs
         if (i > 0) { // not coinbases
@@ -1865,20 +2753,23 @@ void static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
 
+    // Everything written since the last commit is on the writer's handles
+    blockFileWriter.Commit();
+    if (!fFinalize)
+        return;
+
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, infoLastBlockFile.nSize);
+        TruncateFile(fileOld, infoLastBlockFile.nSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
 
     fileOld = OpenUndoFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, infoLastBlockFile.nUndoSize);
+        TruncateFile(fileOld, infoLastBlockFile.nUndoSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -1886,6 +2777,99 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
+void static DeleteBlockFiles(int nFile)
+{
+    mappedBlockFiles.Invalidate(nFile);
+    try {
+        boost::filesystem::remove(GetBlockFilePath(nFile));
+        boost::filesystem::remove(GetUndoFilePath(nFile));
+    } catch (boost::filesystem::filesystem_error &e) {
+        printf("DeleteBlockFiles() : %s\n", e.what());
+    }
+}
+
+// Delete the oldest block and undo files while more than -prune bytes are
+// in use, keeping every file with a block within MIN_BLOCKS_TO_KEEP of the tip
+void PruneBlockFiles()
+{
+    int nLast;
+    uint64 nUsed = 0;
+    vector<CBlockFileInfo> vInfo;
+    {
+        LOCK(cs_LastBlockFile);
+        nLast = nLastBlockFile;
+        vInfo.resize(nLast);
+        for (int nFile = 0; nFile < nLast; nFile++) {
+            pblocktree->ReadBlockFileInfo(nFile, vInfo[nFile]);
+            nUsed += vInfo[nFile].nSize + vInfo[nFile].nUndoSize;
+        }
+        nUsed += infoLastBlockFile.nSize + infoLastBlockFile.nUndoSize;
+    }
+
+    // Files forgotten by a run that stopped before deleting them
+    static bool fCleanedUp = false;
+    if (!fCleanedUp && fHavePruned) {
+        for (int nFile = 0; nFile < nLast; nFile++)
+            if (vInfo[nFile].nSize == 0 && vInfo[nFile].nUndoSize == 0)
+                DeleteBlockFiles(nFile);
+        fCleanedUp = true;
+    }
+
+    if (nUsed <= nPruneTarget || nBestHeight < (int)MIN_BLOCKS_TO_KEEP)
+        return;
+
+    // Highest block stored in each file; the recorded height range is not
+    // reliable once side-chain blocks are in the file
+    vector<int> vMaxHeight(nLast, -1);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex) {
+        CBlockIndex* pindex = item.second;
+        if ((pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)) && pindex->nFile < nLast)
+            vMaxHeight[pindex->nFile] = std::max(vMaxHeight[pindex->nFile], pindex->nHeight);
+    }
+
+    // Blocks after the last coins flush that reached the disk are needed to
+    // catch up again after a crash
+    int nKeepFrom = nBestHeight - MIN_BLOCKS_TO_KEEP;
+    CBlockIndex *pindexDurable = pcoinsFlusher->GetDurableBlock();
+    if (pindexDurable != NULL)
+        nKeepFrom = std::min(nKeepFrom, pindexDurable->nHeight);
+    vector<int> vPrune;
+    set<int> setPrune;
+    for (int nFile = 0; nFile < nLast && nUsed > nPruneTarget; nFile++) {
+        uint64 nFileSize = vInfo[nFile].nSize + vInfo[nFile].nUndoSize;
+        if (nFileSize == 0 || vMaxHeight[nFile] >= nKeepFrom)
+            continue;
+        vPrune.push_back(nFile);
+        setPrune.insert(nFile);
+        nUsed -= nFileSize;
+    }
+    if (vPrune.empty())
+        return;
+
+    vector<CBlockIndex*> vIndex;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex) {
+        CBlockIndex* pindex = item.second;
+        if ((pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)) && setPrune.count(pindex->nFile)) {
+            pindex->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            vIndex.push_back(pindex);
+        }
+    }
+    if (!pblocktree->WritePrunedFiles(vPrune, vIndex)) {
+        AbortNode(_("Error: failed to write block index"));
+        return;
+    }
+    fHavePruned = true;
+
+    // The writer may still hold one of the undo files
+    CloseBlockFiles();
+    BOOST_FOREACH(int nFile, vPrune)
+        DeleteBlockFiles(nFile);
+    printf("Pruned %u block files below height %d, %"PRI64u" MiB in use\n", (unsigned int)vPrune.size(), nKeepFrom, nUsed >> 20);
+}
+
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck() {
@@ -1896,7 +2880,8 @@ void ThreadScriptCheck() {
 bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
     // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
+    // (the proof-of-work only if it was not already verified on acceptance)
+    if (!CheckBlock(block, state, !fJustCheck && !pindex->HavePoW(), !fJustCheck))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -1926,7 +2911,7 @@ bool ConnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, C
     // initial block download.
     for (unsigned int i = 0; i < block.vtx.size(); i++) {
         uint256 hash = block.GetTxHash(i);
-        if (view.HaveCoins(hash) && !view.GetCoins(hash).IsPruned())
+        if (view.HaveCoins(hash) && !view.AccessCoins(hash).IsPruned())
             return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"));
     }
 
@@ -2051,7 +3036,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
 {
     // All modifications to the coin state will be done in this cache.
     // Only when all have succeeded, we push it to pcoinsTip.
-    CCoinsViewCache view(*pcoinsTip, true);
+    CCoinsViewCache view(*pcoinsTip);
 
     // Find the fork (typically, there is none)
     CBlockIndex* pfork = view.GetBestBlock();
@@ -2134,9 +3119,18 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
     if (fBenchmark)
         printf("- Flush %i transactions: %.2fms (%.4fms/tx)\n", nModified, 0.001 * nTime, 0.001 * nTime / nModified);
 
-    // Make sure it's successfully written to disk before changing memory structure
+    // Make sure it's successfully written to disk before changing memory structure.
+    // Block files, undo files and both databases are committed together, at
+    // most once per -blocksyncinterval once the initial download is done.
     bool fIsInitialDownload = IsInitialBlockDownload();
-    if (!fIsInitialDownload || pcoinsTip->GetCacheSize() > nCoinCacheSize) {
+    // The layer still being written and the coins read ahead count against
+    // -dbcache too, so the caches together stay within it
+    size_t nCoinsUsage = pcoinsTip->DynamicMemoryUsage();
+    if (pcoinsFlusher)
+        nCoinsUsage += pcoinsFlusher->DynamicMemoryUsage();
+    if (pcoinsPrefetch)
+        nCoinsUsage += pcoinsPrefetch->DynamicMemoryUsage();
+    if ((!fIsInitialDownload && blockFileWriter.IsCommitDue(nBlockSyncInterval)) || nCoinsUsage > nCoinCacheUsage) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
@@ -2146,11 +3140,15 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
             return state.Error();
         FlushBlockFile();
         pblocktree->Sync();
+        // Hands the cache to pcoinsFlusher, which writes it in the background;
+        // this only waits if the previous flush is still being written
         if (!pcoinsTip->Flush())
             return state.Abort(_("Failed to write to coin database"));
+        if (fPruneMode)
+            PruneBlockFiles();
     }
 
-    // At this point, all changes have been done to the database.
+    // At this point, all changes have been handed to the database.
     // Proceed by updating the memory structures.
 
     // Register new best chain
@@ -2183,7 +3181,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew)
     pindexBest = pindexNew;
     pblockindexFBBHLast = NULL;
     nBestHeight = pindexBest->nHeight;
-    nBestChainWork = pindexNew->nChainWork;
+    nBestChainWork = pindexNew->GetChainWork();
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
     printf("SetBestChain: new best=%s  height=%d  pow_algo=%d  block_work=%s  log2_work=%.8g  tx=%lu  date=%s progress=%f\n",
@@ -2238,16 +3236,16 @@ bool AddToBlockIndex(CBlock& block, CValidationState& state, const CDiskBlockPos
     // Construct new block index object
     CBlockIndex* pindexNew = new CBlockIndex(block);
     assert(pindexNew);
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
-    if (miPrev != mapBlockIndex.end())
+    pindexNew->hashBlock = hash;
+    mapBlockIndex.insert(pindexNew);
+    pindexNew->pprev = mapBlockIndex.Lookup(block.hashPrevBlock);
+    if (pindexNew->pprev)
     {
-        pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
     }
+    pindexNew->BuildLinks();
     pindexNew->nTx = block.vtx.size();
-    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + pindexNew->GetBlockWorkAdjusted().getuint256();
+    pindexNew->SetChainWork((pindexNew->pprev ? pindexNew->pprev->GetChainWork() : 0) + pindexNew->GetBlockWorkAdjusted());
     pindexNew->nChainTx = (pindexNew->pprev ? pindexNew->pprev->nChainTx : 0) + pindexNew->nTx;
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
@@ -2442,17 +3440,15 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CDiskBlockPos* dbp)
     CBlockIndex* pindexPrev = NULL;
     int nHeight = 0;
     if (hash != Params().HashGenesisBlock()) {
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        CBlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
         if (mi == mapBlockIndex.end())
             return state.DoS(10, error("AcceptBlock() : prev block not found"));
         pindexPrev = (*mi).second;
         nHeight = pindexPrev->nHeight+1;
 
         // Check proof of work
-if (pindexPrev->nHeight < 915235 || 955000 < pindexPrev->nHeight) {
-        if (block.nBits != GetNextWorkRequired(pindexPrev, &block, block.GetAlgo()))
+        if (!CheckWorkRequired(pindexPrev, block))
             return state.DoS(100, error("AcceptBlock() : incorrect proof of work"));
-}
 
         // Check timestamp against prev
         if (block.GetBlockTime() <= pindexPrev->GetMedianTimePast())
@@ -2509,32 +3505,146 @@ if (pindexPrev->nHeight < 915235 || 955000 < pindexPrev->nHeight) {
         return state.Abort(_("System error: ") + e.what());
     }
 
-    // Relay inventory, but don't relay old inventory during initial block download
-    int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
-    if (hashBestChain == hash)
-    {
-        LOCK(cs_vNodes);
-        BOOST_FOREACH(CNode* pnode, vNodes)
-            if (nBestHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                pnode->PushInventory(CInv(MSG_BLOCK, hash));
+    // Relay inventory, but don't relay old inventory during initial block download
+    int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
+    if (hashBestChain == hash)
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            if (nBestHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                pnode->PushInventory(CInv(MSG_BLOCK, hash));
+    }
+
+    return true;
+}
+
+/*
+bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned int nRequired, unsigned int nToCheck)
+{
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < nToCheck && nFound < nRequired && pstart != NULL; i++)
+    {
+        if (pstart->nVersion >= minVersion)
+            ++nFound;
+        pstart = pstart->pprev;
+    }
+    return (nFound >= nRequired);
+}
+*/
+
+// Clear the lowest set bit of n
+int static inline InvertLowestOne(int n) { return n & (n - 1); }
+
+// The height pskip points to; any lower height would do, but this choice
+// reaches every ancestor within a few dozen steps
+int static inline GetSkipHeight(int height) {
+    if (height < 2)
+        return 0;
+    return (height & 1) ? InvertLowestOne(InvertLowestOne(height - 1)) + 1 : InvertLowestOne(height);
+}
+
+void CBlockIndex::BuildLinks()
+{
+    pprevAlgo = pprev;
+    while (pprevAlgo && pprevAlgo->GetAlgo() != GetAlgo())
+        pprevAlgo = pprevAlgo->pprev;
+    pskip = pprev ? pprev->GetAncestor(GetSkipHeight(nHeight)) : NULL;
+}
+
+CBlockIndex* CBlockIndex::GetAncestor(int height)
+{
+    if (height > nHeight || height < 0)
+        return NULL;
+
+    CBlockIndex* pindexWalk = this;
+    int heightWalk = nHeight;
+    while (heightWalk > height) {
+        int heightSkip = GetSkipHeight(heightWalk);
+        int heightSkipPrev = GetSkipHeight(heightWalk - 1);
+        // Take pskip unless pprev's pskip gets closer to height
+        if (pindexWalk->pskip != NULL &&
+            (heightSkip == height ||
+             (heightSkip > height && !(heightSkipPrev < heightSkip - 2 && heightSkipPrev >= height)))) {
+            pindexWalk = pindexWalk->pskip;
+            heightWalk = heightSkip;
+        } else {
+            pindexWalk = pindexWalk->pprev;
+            heightWalk--;
+        }
+        if (pindexWalk == NULL)
+            return NULL;
+    }
+    return pindexWalk;
+}
+
+const CBlockIndex* CBlockIndex::GetAncestor(int height) const
+{
+    return const_cast<CBlockIndex*>(this)->GetAncestor(height);
+}
+
+void CBlockMap::Grow(size_t nSlots)
+{
+    // The salt is picked on first use rather than during static initialization
+    if (vSlots.empty())
+        nSalt = GetRand(std::numeric_limits<uint64>::max());
+    std::vector<Slot> vOld;
+    vOld.swap(vSlots);
+    Slot empty = { 0, NULL };
+    vSlots.assign(nSlots, empty);
+    size_t nMask = nSlots - 1;
+    for (size_t i = 0; i < vOld.size(); i++) {
+        if (vOld[i].pindex == NULL)
+            continue;
+        size_t nPos = Pos(vOld[i].nKey);
+        while (vSlots[nPos].pindex != NULL)
+            nPos = (nPos + 1) & nMask;
+        vSlots[nPos] = vOld[i];
     }
+}
 
-    return true;
+CBlockMap::const_iterator CBlockMap::find(const uint256 &hash) const
+{
+    if (nSize == 0)
+        return end();
+    uint64 nKey = Key(hash);
+    size_t nMask = vSlots.size() - 1;
+    for (size_t nPos = Pos(nKey); vSlots[nPos].pindex != NULL; nPos = (nPos + 1) & nMask)
+        if (vSlots[nPos].nKey == nKey && vSlots[nPos].pindex->hashBlock == hash)
+            return const_iterator(&vSlots[nPos], &vSlots[0] + vSlots.size());
+    return end();
 }
 
-/*
-bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned int nRequired, unsigned int nToCheck)
+CBlockIndex *CBlockMap::insert(CBlockIndex *pindex)
 {
-    unsigned int nFound = 0;
-    for (unsigned int i = 0; i < nToCheck && nFound < nRequired && pstart != NULL; i++)
-    {
-        if (pstart->nVersion >= minVersion)
-            ++nFound;
-        pstart = pstart->pprev;
-    }
-    return (nFound >= nRequired);
+    // Keep the load factor at or below 3/4
+    if ((nSize + 1) * 4 > vSlots.size() * 3)
+        Grow(vSlots.empty() ? 16 : vSlots.size() * 2);
+    uint64 nKey = Key(pindex->hashBlock);
+    size_t nMask = vSlots.size() - 1;
+    size_t nPos = Pos(nKey);
+    for (; vSlots[nPos].pindex != NULL; nPos = (nPos + 1) & nMask)
+        if (vSlots[nPos].nKey == nKey && vSlots[nPos].pindex->hashBlock == pindex->hashBlock)
+            return vSlots[nPos].pindex;
+    vSlots[nPos].nKey = nKey;
+    vSlots[nPos].pindex = pindex;
+    nSize++;
+    return pindex;
+}
+
+void CBlockMap::reserve(size_t nCount)
+{
+    size_t nSlots = 16;
+    while (nCount * 4 > nSlots * 3)
+        nSlots *= 2;
+    if (nSlots > vSlots.size())
+        Grow(nSlots);
+}
+
+void CBlockMap::clear()
+{
+    std::vector<Slot>().swap(vSlots);
+    nSize = 0;
 }
-*/
 
 void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd)
 {
@@ -2547,7 +3657,43 @@ void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd)
     pnode->PushMessage("getblocks", CBlockLocator(pindexBegin), hashEnd);
 }
 
-bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp)
+// Start reading the coins spent by a block that extends the best chain, and by
+// the orphans waiting for it, before any of them is checked and connected
+void static PrefetchInputs(const CBlock &block, const uint256 &hash)
+{
+    if (pcoinsPrefetch == NULL || block.hashPrevBlock != hashBestChain)
+        return;
+
+    vector<const CBlock*> vBlocks(1, &block);
+    vector<uint256> vWorkQueue(1, hash);
+    for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+        for (multimap<uint256, CBlock*>::iterator mi = mapOrphanBlocksByPrev.lower_bound(vWorkQueue[i]);
+             mi != mapOrphanBlocksByPrev.upper_bound(vWorkQueue[i]);
+             ++mi)
+        {
+            vBlocks.push_back((*mi).second);
+            vWorkQueue.push_back((*mi).second->GetHash());
+        }
+
+    set<uint256> setCreated, setSeen;
+    vector<uint256> vTxid;
+    BOOST_FOREACH(const CBlock *pblock, vBlocks) {
+        BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
+            if (!tx.IsCoinBase()) {
+                BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+                    const uint256 &txid = txin.prevout.hash;
+                    if (setCreated.count(txid) || !setSeen.insert(txid).second || pcoinsTip->HaveCoinsInCache(txid))
+                        continue;
+                    vTxid.push_back(txid);
+                }
+            }
+            setCreated.insert(tx.GetHash());
+        }
+    }
+    pcoinsPrefetch->Prefetch(vTxid);
+}
+
+bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp, bool fCheckPOW)
 {
     // Check for duplicate
     uint256 hash = pblock->GetHash();
@@ -2556,8 +3702,11 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
     if (mapOrphanBlocks.count(hash))
         return state.Invalid(error("ProcessBlock() : already have block (orphan) %s", hash.ToString().c_str()));
 
+    // Read its inputs while the proof of work is checked and the block is stored
+    PrefetchInputs(*pblock, hash);
+
     // Preliminary checks
-    if (!CheckBlock(*pblock, state))
+    if (!CheckBlock(*pblock, state, fCheckPOW))
         return error("ProcessBlock() : CheckBlock FAILED");
 
     CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
@@ -2569,9 +3718,9 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBl
         {
             return state.DoS(100, error("ProcessBlock() : block with timestamp before last checkpoint"));
         }
-        CBigNum bnNewBlock;
+        uint256 bnNewBlock;
         bnNewBlock.SetCompact(pblock->nBits);
-        CBigNum bnRequired;
+        uint256 bnRequired;
         bnRequired.SetCompact(ComputeMinWork(pcheckpoint->nBits, deltaTime));
         if (bnNewBlock > bnRequired)
         {
@@ -2813,7 +3962,7 @@ FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
 {
     if (pos.IsNull())
         return NULL;
-    boost::filesystem::path path = GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
+    boost::filesystem::path path = GetDiskFilePath(pos.nFile, prefix);
     boost::filesystem::create_directories(path.parent_path());
     FILE* file = fopen(path.string().c_str(), "rb+");
     if (!file && !fReadOnly)
@@ -2840,46 +3989,259 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
+// Complete or discard a block file rewrite that was interrupted
+bool static RecoverBlockFileRecompression()
+{
+    try {
+        // Once the new positions are committed, the rewritten file must replace the original
+        int nPending;
+        if (pblocktree->ReadRecompressPending(nPending)) {
+            boost::filesystem::path pathNew = GetBlockFilePath(nPending, ".new");
+            if (boost::filesystem::exists(pathNew)) {
+                printf("RecoverBlockFileRecompression() : completing rewrite of blk%05u.dat\n", nPending);
+                boost::filesystem::rename(pathNew, GetBlockFilePath(nPending));
+            }
+            if (!pblocktree->EraseRecompressPending())
+                return error("RecoverBlockFileRecompression() : failed to clear pending rewrite");
+        }
+
+        // Otherwise any partial output is stale; the original file is still in use
+        int nFile;
+        pblocktree->ReadRecompressCursor(nFile);
+        boost::filesystem::remove(GetBlockFilePath(nFile, ".new"));
+    } catch (boost::filesystem::filesystem_error &e) {
+        return error("RecoverBlockFileRecompression() : %s", e.what());
+    }
+    return true;
+}
+
+// Rewrite a finalized block file with every block compressed and move the
+// index over to it. The original stays in use until the new positions are
+// committed together with a pending rename, so a crash at any point leaves
+// either the old or the new file readable.
+bool static RecompressBlockFile(int nFile, int64 nBytesPerSecond)
+{
+    vector<pair<unsigned int, CBlockIndex*> > vBlocks;
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+            if ((item.second->nStatus & BLOCK_HAVE_DATA) && item.second->nFile == nFile)
+                vBlocks.push_back(make_pair(item.second->nDataPos, item.second));
+    }
+    sort(vBlocks.begin(), vBlocks.end());
+
+    // Nothing left to rewrite, e.g. the file was pruned
+    if (vBlocks.empty())
+        return pblocktree->WriteRecompressCursor(nFile + 1);
+
+    // Pruning marks the blocks as gone before deleting the file, so a file
+    // that disappeared since they were listed has nothing left to rewrite
+    if (!boost::filesystem::exists(GetBlockFilePath(nFile)))
+        return pblocktree->WriteRecompressCursor(nFile + 1);
+
+    boost::filesystem::path pathNew = GetBlockFilePath(nFile, ".new");
+    CAutoFile filein = CAutoFile(OpenBlockFile(CDiskBlockPos(nFile, 0), true), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("RecompressBlockFile() : OpenBlockFile failed");
+    CAutoFile fileout = CAutoFile(fopen(pathNew.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return error("RecompressBlockFile() : unable to create %s", pathNew.string().c_str());
+
+    vector<unsigned int> vNewPos;
+    vNewPos.reserve(vBlocks.size());
+    unsigned int nOldSize = 0, nNewSize = 0;
+    int64 nBytes = 0;
+    int64 nStart = GetTimeMillis();
+    try {
+        for (unsigned int i = 0; i < vBlocks.size(); i++) {
+            unsigned int nPos = vBlocks[i].first;
+            unsigned char pchMessageStart[MESSAGE_START_SIZE];
+            unsigned int nSize;
+            if (nPos < sizeof(pchMessageStart) + sizeof(nSize) || fseek(filein, nPos - sizeof(pchMessageStart) - sizeof(nSize), SEEK_SET))
+                return error("RecompressBlockFile() : fseek failed");
+            filein >> FLATDATA(pchMessageStart) >> nSize;
+            if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) || nSize > MAX_SIZE)
+                return error("RecompressBlockFile() : bad record at blk%05u.dat:%u", nFile, nPos);
+            vector<unsigned char> vchStored(nSize);
+            if (nSize)
+                filein.read((char*)&vchStored[0], nSize);
+
+            // Only move what the index says is there
+            vector<unsigned char> vchBlock, vchCompressed;
+            if (!compressedStorage.DecompressBlock(vchStored, vchBlock))
+                return error("RecompressBlockFile() : decompression failed at blk%05u.dat:%u", nFile, nPos);
+            CDataStream ssHeader(vchBlock, SER_DISK, CLIENT_VERSION);
+            CBlockHeader header;
+            ssHeader >> header;
+            if (header.GetHash() != vBlocks[i].second->GetBlockHash())
+                return error("RecompressBlockFile() : block at blk%05u.dat:%u doesn't match index", nFile, nPos);
+
+            if (!compressedStorage.CompressBlock(vchBlock, vchCompressed))
+                return error("RecompressBlockFile() : compression failed");
+            unsigned int nCompressed = vchCompressed.size();
+            compressedStorage.CountStored(false, vchBlock.size(), nCompressed);
+            fileout << FLATDATA(Params().MessageStart()) << nCompressed;
+            fileout.write((const char*)&vchCompressed[0], nCompressed);
+            nNewSize += sizeof(pchMessageStart) + sizeof(nCompressed);
+            vNewPos.push_back(nNewSize);
+            nNewSize += nCompressed;
+            nOldSize += sizeof(pchMessageStart) + sizeof(nSize) + nSize;
+
+            // Stay within the I/O budget
+            nBytes += nSize + nCompressed;
+            int64 nAhead = nBytes * 1000 / nBytesPerSecond - (GetTimeMillis() - nStart);
+            if (nAhead > 0)
+                MilliSleep(nAhead);
+        }
+        fflush(fileout);
+        FileCommit(fileout);
+    } catch (std::exception &e) {
+        return error("RecompressBlockFile() : %s", e.what());
+    }
+    fileout.fclose();
+    filein.fclose();
+
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+
+        // Nothing else moves blocks out of a finalized file, but make sure none
+        // were added while this one was being written; if so, start over
+        unsigned int nCount = 0;
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+            if ((item.second->nStatus & BLOCK_HAVE_DATA) && item.second->nFile == nFile)
+                nCount++;
+        if (nCount != vBlocks.size()) {
+            try {
+                boost::filesystem::remove(pathNew);
+            } catch (boost::filesystem::filesystem_error &e) {
+                return error("RecompressBlockFile() : %s", e.what());
+            }
+            return true;
+        }
+
+        CBlockFileInfo info;
+        if (!pblocktree->ReadBlockFileInfo(nFile, info))
+            return error("RecompressBlockFile() : failed to read info for blk%05u.dat", nFile);
+        info.nSize = nNewSize;
+
+        vector<CBlockIndex*> vIndex;
+        for (unsigned int i = 0; i < vBlocks.size(); i++) {
+            vBlocks[i].second->nDataPos = vNewPos[i];
+            vIndex.push_back(vBlocks[i].second);
+        }
+        if (!pblocktree->WriteRecompressedFile(nFile, info, vIndex)) {
+            for (unsigned int i = 0; i < vBlocks.size(); i++)
+                vBlocks[i].second->nDataPos = vBlocks[i].first;
+            return error("RecompressBlockFile() : failed to write block index");
+        }
+
+        mappedBlockFiles.Invalidate(nFile);
+        try {
+            boost::filesystem::rename(pathNew, GetBlockFilePath(nFile));
+        } catch (boost::filesystem::filesystem_error &e) {
+            // The index already points into the new file; the rename is retried at startup
+            return AbortNode(_("Error: failed to replace block file: ") + e.what());
+        }
+        pblocktree->EraseRecompressPending();
+    }
+
+    printf("Recompressed blk%05u.dat: %u blocks, %u -> %u bytes\n", nFile, (unsigned int)vBlocks.size(), nOldSize, nNewSize);
+    return true;
+}
+
+void ThreadRecompressBlockFiles()
+{
+    RenameThread("bitcoin-recomp");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+    int64 nBytesPerSecond = std::max((int64)1, GetArg("-compressbackgroundrate", 4)) << 20;
+    try {
+        while (true) {
+            // Every file before the one being appended to is final
+            int nFile, nLast;
+            pblocktree->ReadRecompressCursor(nFile);
+            {
+                LOCK(cs_LastBlockFile);
+                nLast = nLastBlockFile;
+            }
+            if (fImporting || fReindex || nFile >= nLast) {
+                MilliSleep(10000);
+                continue;
+            }
+            if (!RecompressBlockFile(nFile, nBytesPerSecond)) {
+                printf("ThreadRecompressBlockFiles() : stopping at blk%05u.dat\n", nFile);
+                return;
+            }
+        }
+    } catch (std::exception &e) {
+        PrintExceptionContinue(&e, "ThreadRecompressBlockFiles()");
+    }
+}
+
 CBlockIndex * InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
-    if (mi != mapBlockIndex.end())
-        return (*mi).second;
+    CBlockIndex* pindex = mapBlockIndex.Lookup(hash);
+    if (pindex)
+        return pindex;
 
     // Create new
     CBlockIndex* pindexNew = new CBlockIndex();
     if (!pindexNew)
         throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
-    mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
+    pindexNew->hashBlock = hash;
+    mapBlockIndex.insert(pindexNew);
 
     return pindexNew;
 }
 
+// Entries allocated by AllocBlockIndexArena(), freed as a whole
+static vector<pair<CBlockIndex*, size_t> > vBlockIndexArena;
+
+CBlockIndex * AllocBlockIndexArena(size_t nCount)
+{
+    CBlockIndex* pindexArena = new CBlockIndex[nCount];
+    vBlockIndexArena.push_back(make_pair(pindexArena, nCount));
+    return pindexArena;
+}
+
+static bool IsInBlockIndexArena(const CBlockIndex* pindex)
+{
+    for (unsigned int i = 0; i < vBlockIndexArena.size(); i++)
+        if (pindex >= vBlockIndexArena[i].first && pindex < vBlockIndexArena[i].first + vBlockIndexArena[i].second)
+            return true;
+    return false;
+}
+
 bool static LoadBlockIndexDB()
 {
-    if (!pblocktree->LoadBlockIndexGuts())
+    if (!pblocktree->LoadBlockIndexGuts(boost::thread::hardware_concurrency()))
         return false;
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Calculate nChainWork: every entry holds its own block's work, so visit
+    // them by height (a counting sort) and add the parent's total. The links
+    // to ancestors are built in the same pass.
+    int nMaxHeight = 0;
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    vector<unsigned int> vHeightStart(nMaxHeight + 2, 0);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vHeightStart[item.second->nHeight + 1]++;
+    for (int nHeight = 0; nHeight <= nMaxHeight; nHeight++)
+        vHeightStart[nHeight + 1] += vHeightStart[nHeight];
+    vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight[vHeightStart[item.second->nHeight]++] = item.second;
+    BOOST_FOREACH(CBlockIndex* pindex, vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + pindex->GetBlockWorkAdjusted().getuint256();
+        pindex->BuildLinks();
+        if (pindex->pprev)
+            pindex->SetChainWork(pindex->GetChainWork() + pindex->pprev->GetChainWork());
         pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS && !(pindex->nStatus & BLOCK_FAILED_MASK))
             setBlockIndexValid.insert(pindex);
@@ -2891,6 +4253,10 @@ bool static LoadBlockIndexDB()
     if (pblocktree->ReadBlockFileInfo(nLastBlockFile, infoLastBlockFile))
         printf("LoadBlockIndexDB(): last block file info: %s\n", infoLastBlockFile.ToString().c_str());
 
+    // Finish a block file rewrite interrupted by a crash before reading any blocks
+    if (!RecoverBlockFileRecompression())
+        return false;
+
     // Load nBestInvalidWork, OK if it doesn't exist
     CBigNum bnBestInvalidWork;
     pblocktree->ReadBestInvalidWork(bnBestInvalidWork);
@@ -2901,6 +4267,10 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
+    // Check whether any block files were pruned, or the chain started from a UTXO set dump
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    pblocktree->ReadFlag("loadedtxoutset", fLoadedTxOutSet);
+
     // Check whether we have a transaction index
     pblocktree->ReadFlag("txindex", fTxIndex);
     printf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
@@ -2911,7 +4281,7 @@ bool static LoadBlockIndexDB()
         return true;
     hashBestChain = pindexBest->GetBlockHash();
     nBestHeight = pindexBest->nHeight;
-    nBestChainWork = pindexBest->nChainWork;
+    nBestChainWork = pindexBest->GetChainWork();
 
     // register best chain
     CBlockIndex *pindex = pindexBest;
@@ -2939,7 +4309,7 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
         nCheckDepth = nBestHeight;
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     printf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
-    CCoinsViewCache coins(*pcoinsTip, true);
+    CCoinsViewCache coins(*pcoinsTip);
     CBlockIndex* pindexState = pindexBest;
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
@@ -2949,12 +4319,17 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
         boost::this_thread::interruption_point();
         if (pindex->nHeight < nBestHeight-nCheckDepth)
             break;
+        // Pruned nodes can only go back as far as they have data
+        if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            printf("VerifyDB(): block verification stopping at height %d (pruned data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
             return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, !pindex->HavePoW()))
             return error("VerifyDB() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
         // check level 2: verify undo validity
         if (nCheckLevel >= 2 && pindex) {
@@ -2966,7 +4341,7 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth)
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= 2*nCoinCacheSize + 32000) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
@@ -3042,7 +4417,7 @@ bool InitBlockIndex() {
             printf("Searching for genesis block...\n");
             // This will figure out a valid hash and Nonce if you're
             // creating a different genesis block:
-            uint256 hashTarget = CBigNum().SetCompact(block.nBits).getuint256();
+            uint256 hashTarget = uint256().SetCompact(block.nBits);
             uint256 thash;
             char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
 
@@ -3095,7 +4470,7 @@ void PrintBlockTree()
 {
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (CBlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -3161,10 +4536,48 @@ void PrintBlockTree()
     }
 }
 
+// Process blocks read from an external file in file order, after hashing
+// their headers together; false if processing ran into a system error
+static bool ProcessExternalBlocks(vector<pair<uint64, CBlock> > &vBlocks, CDiskBlockPos *dbp, int &nLoaded)
+{
+    vector<CPoWCheck> vChecks(vBlocks.size());
+    for (unsigned int i = 0; i < vBlocks.size(); i++) {
+        CPoWCheck &check = vChecks[i];
+        check.header = vBlocks[i].second.GetBlockHeader();
+        check.algo = check.header.GetAlgo();
+        bool fNegative, fOverflow;
+        check.hashTarget.SetCompact(check.header.nBits, &fNegative, &fOverflow);
+        if (check.algo < 0 || check.algo >= NUM_ALGOS || fNegative || fOverflow || check.hashTarget > Params().ProofOfWorkLimit(check.algo))
+            check.hashTarget = 0;
+    }
+    CheckProofOfWorkBatch(vChecks);
+
+    bool fOk = true;
+    for (unsigned int i = 0; i < vBlocks.size() && fOk; i++) {
+        LOCK(cs_main);
+        if (dbp)
+            dbp->nPos = vBlocks[i].first;
+        // A header that failed is hashed again by CheckBlock, to report why
+        bool fPoWChecked = vChecks[i].fValid && vChecks[i].hashTarget != 0;
+        CValidationState state;
+        if (ProcessBlock(state, NULL, &vBlocks[i].second, dbp, !fPoWChecked))
+            nLoaded++;
+        if (state.IsError())
+            fOk = false;
+    }
+    vBlocks.clear();
+    return fOk;
+}
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
 {
     int64 nStart = GetTimeMillis();
 
+    // Blocks are read ahead in runs, so the scrypt kernels get several
+    // headers at a time
+    vector<pair<uint64, CBlock> > vBlocks;
+    unsigned int nBatchSize = 0;
+
     int nLoaded = 0;
     try {
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
@@ -3209,21 +4622,21 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                // process block
+                // process blocks
                 if (nBlockPos >= nStartByte) {
-                    LOCK(cs_main);
-                    if (dbp)
-                        dbp->nPos = nBlockPos;
-                    CValidationState state;
-                    if (ProcessBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
+                    vBlocks.push_back(make_pair(nBlockPos, block));
+                    nBatchSize += nSize;
                 }
             } catch (std::exception &e) {
                 printf("%s() : Deserialize or I/O error caught during load\n", __PRETTY_FUNCTION__);
             }
+            if (vBlocks.size() >= 256 || nBatchSize >= 4 * MAX_BLOCK_SIZE) {
+                nBatchSize = 0;
+                if (!ProcessExternalBlocks(vBlocks, dbp, nLoaded))
+                    break;
+            }
         }
+        ProcessExternalBlocks(vBlocks, dbp, nLoaded);
         fclose(fileIn);
     } catch(std::runtime_error &e) {
         AbortNode(_("Error: system error: ") + e.what());
@@ -3233,6 +4646,295 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
     return nLoaded > 0;
 }
 
+// Appends the transactions of the coin database to a UTXO set dump
+class CTxOutSetWriter
+{
+private:
+    CAutoFile &fileout;
+
+public:
+    uint64 nWritten;
+
+    CTxOutSetWriter(CAutoFile &fileoutIn) : fileout(fileoutIn), nWritten(0) {}
+
+    bool operator()(const uint256 &txid, const CCoins &coins) {
+        fileout << txid << coins;
+        nWritten++;
+        return true;
+    }
+};
+
+bool DumpTxOutSet(FILE* fileOut, CCoinsStats &stats)
+{
+    CAutoFile fileout = CAutoFile(fileOut, SER_DISK, CLIENT_VERSION);
+    const leveldb::Snapshot *psnapshot = NULL;
+    vector<CBlockIndex*> vChain;
+    {
+        LOCK(cs_main);
+        // Get everything, including the statistics, into the database and
+        // read it from a snapshot, so blocks can be connected meanwhile
+        if (!pcoinsTip->Flush() || !pcoinsFlusher->Sync() || !pcoinsdbview->GetStats(stats))
+            return error("DumpTxOutSet() : failed to write coin database");
+        psnapshot = pcoinsdbview->GetSnapshot();
+        uint256 hashBestChain;
+        CBlockMap::iterator mi;
+        if (!pcoinsdbview->ReadSnapshotState(psnapshot, hashBestChain, stats) ||
+            (mi = mapBlockIndex.find(hashBestChain)) == mapBlockIndex.end() || mi->second->pprev == NULL) {
+            pcoinsdbview->ReleaseSnapshot(psnapshot);
+            return error("DumpTxOutSet() : no block to dump the coins of");
+        }
+        stats.hashBlock = hashBestChain;
+        stats.nHeight = mi->second->nHeight;
+        stats.hashSerialized = stats.muhash.GetHash();
+
+        // The headers of the chain up to it, without the genesis block
+        for (CBlockIndex *pindex = mi->second; pindex->pprev; pindex = pindex->pprev)
+            vChain.push_back(pindex);
+        reverse(vChain.begin(), vChain.end());
+    }
+
+    bool fOk = true;
+    try {
+        fileout << FLATDATA(Params().MessageStart()) << TXOUTSET_DUMP_VERSION;
+        fileout << stats.hashBlock << stats.nHeight;
+        BOOST_FOREACH(CBlockIndex *pindex, vChain)
+            fileout << pindex->GetBlockHeader() << VARINT(pindex->nTx);
+        fileout << stats;
+
+        CTxOutSetWriter writer(fileout);
+        fOk = pcoinsdbview->ReadCoinsRange(psnapshot, 0, 256, boost::ref(writer));
+        if (fOk && writer.nWritten != stats.nTransactions)
+            fOk = error("DumpTxOutSet() : wrote %"PRI64u" transactions, expected %"PRI64u, writer.nWritten, stats.nTransactions);
+    } catch (std::exception &e) {
+        fOk = error("DumpTxOutSet() : I/O error: %s", e.what());
+    }
+    pcoinsdbview->ReleaseSnapshot(psnapshot);
+    if (fOk)
+        printf("Dumped %"PRI64u" transactions at height %d\n", stats.nTransactions, stats.nHeight);
+    return fOk;
+}
+
+// Read the headers of a UTXO set dump and check them the way AcceptBlock
+// would, short of their transactions. They are linked into vChain, but not
+// into mapBlockIndex yet.
+static bool ReadTxOutSetHeaders(CAutoFile &filein, int nHeight, const uint256 &hashBlock,
+                                vector<CBlockIndex*> &vChain)
+{
+    CBlockIndex *pindexPrev = pindexGenesisBlock;
+    while ((int)vChain.size() < nHeight) {
+        boost::this_thread::interruption_point();
+
+        // Hash a run of headers together, then check them in order
+        unsigned int nRun = std::min(nHeight - (int)vChain.size(), 2000);
+        vector<CPoWCheck> vChecks(nRun);
+        vector<unsigned int> vTx(nRun);
+        for (unsigned int i = 0; i < nRun; i++) {
+            CPoWCheck &check = vChecks[i];
+            filein >> check.header >> VARINT(vTx[i]);
+            check.algo = check.header.GetAlgo();
+            bool fNegative, fOverflow;
+            uint256 bnTarget;
+            bnTarget.SetCompact(check.header.nBits, &fNegative, &fOverflow);
+            if (check.algo < 0 || check.algo >= NUM_ALGOS || fNegative || fOverflow || bnTarget == 0 || bnTarget > Params().ProofOfWorkLimit(check.algo))
+                return error("ReadTxOutSetHeaders() : nBits below minimum work at height %d", pindexPrev->nHeight + 1 + (int)i);
+            check.hashTarget = bnTarget;
+        }
+        CheckProofOfWorkBatch(vChecks);
+
+        // GetNextWorkRequired() shares its state with block validation
+        LOCK(cs_main);
+        for (unsigned int i = 0; i < nRun; i++) {
+            CBlockHeader &header = vChecks[i].header;
+            if (!vChecks[i].fValid)
+                return error("ReadTxOutSetHeaders() : proof of work failed at height %d", pindexPrev->nHeight + 1);
+            if (header.hashPrevBlock != pindexPrev->GetBlockHash())
+                return error("ReadTxOutSetHeaders() : headers are not a chain at height %d", pindexPrev->nHeight + 1);
+
+            CBlockIndex *pindex = new CBlockIndex(header);
+            vChain.push_back(pindex);
+            pindex->hashBlock = header.GetHash();
+            pindex->pprev = pindexPrev;
+            pindex->nHeight = pindexPrev->nHeight + 1;
+            pindex->BuildLinks();
+            pindex->nTx = vTx[i];
+            pindex->SetChainWork(pindexPrev->GetChainWork() + pindex->GetBlockWorkAdjusted());
+            pindex->nChainTx = pindexPrev->nChainTx + pindex->nTx;
+            pindex->nStatus = BLOCK_VALID_TREE;
+
+            if (!CheckWorkRequired(pindexPrev, header))
+                return error("ReadTxOutSetHeaders() : incorrect proof of work at height %d", pindex->nHeight);
+            if (header.GetBlockTime() <= pindexPrev->GetMedianTimePast())
+                return error("ReadTxOutSetHeaders() : timestamp too early at height %d", pindex->nHeight);
+            if (header.GetBlockTime() > GetAdjustedTime() + 2 * 60 * 60)
+                return error("ReadTxOutSetHeaders() : timestamp too far in the future at height %d", pindex->nHeight);
+            if (!Checkpoints::CheckBlock(pindex->nHeight, pindex->GetBlockHash()))
+                return error("ReadTxOutSetHeaders() : rejected by checkpoint lock-in at %d", pindex->nHeight);
+            pindexPrev = pindex;
+        }
+    }
+    if (pindexPrev->GetBlockHash() != hashBlock)
+        return error("ReadTxOutSetHeaders() : headers do not end at the dumped block");
+    return true;
+}
+
+// Bulk load the coins of a UTXO set dump, and check them against its statistics
+static bool ReadTxOutSetCoins(CAutoFile &filein, const CCoinsStats &stats)
+{
+    vector<pair<uint256, CCoins> > vBatch;
+    uint256 hashLast = 0;
+    for (uint64 n = 0; n < stats.nTransactions; n++) {
+        boost::this_thread::interruption_point();
+        vBatch.push_back(make_pair(uint256(0), CCoins()));
+        filein >> vBatch.back().first >> vBatch.back().second;
+
+        // Dumps come in key order, so batches go in sorted and duplicates show
+        const uint256 &txid = vBatch.back().first;
+        if (n > 0 && memcmp(hashLast.begin(), txid.begin(), sizeof(uint256)) >= 0)
+            return error("ReadTxOutSetCoins() : transactions out of order at %s", txid.ToString().c_str());
+        if (vBatch.back().second.IsPruned())
+            return error("ReadTxOutSetCoins() : spent transaction %s", txid.ToString().c_str());
+        hashLast = txid;
+
+        if (vBatch.size() == 10000) {
+            if (!pcoinsdbview->LoadCoins(vBatch))
+                return error("ReadTxOutSetCoins() : failed to write coin database");
+            vBatch.clear();
+            if ((n + 1) % 1000000 == 0)
+                printf("Loaded %"PRI64u" of %"PRI64u" transactions\n", n + 1, stats.nTransactions);
+        }
+    }
+    if (!vBatch.empty() && !pcoinsdbview->LoadCoins(vBatch))
+        return error("ReadTxOutSetCoins() : failed to write coin database");
+
+    CCoinsStats statsLoaded;
+    {
+        LOCK(cs_main);
+        if (!pcoinsdbview->GetStats(statsLoaded))
+            return error("ReadTxOutSetCoins() : failed to read statistics");
+    }
+    if (statsLoaded.nTransactions != stats.nTransactions ||
+        statsLoaded.nTransactionOutputs != stats.nTransactionOutputs ||
+        statsLoaded.nSerializedSize != stats.nSerializedSize ||
+        statsLoaded.nTotalAmount != stats.nTotalAmount ||
+        statsLoaded.hashSerialized != stats.muhash.GetHash())
+        return error("ReadTxOutSetCoins() : coins do not match the dumped statistics");
+    return true;
+}
+
+// Make the last block of vChain, whose coins were just loaded, the best block
+static bool ConnectTxOutSet(vector<CBlockIndex*> &vChain)
+{
+    LOCK(cs_main);
+    if (pindexBest != pindexGenesisBlock)
+        return error("ConnectTxOutSet() : the block chain moved on during the load");
+    BOOST_FOREACH(CBlockIndex *pindex, vChain)
+        if (mapBlockIndex.count(pindex->GetBlockHash()))
+            return error("ConnectTxOutSet() : block %s already exists", pindex->GetBlockHash().ToString().c_str());
+
+    // From here on the index entries belong to mapBlockIndex
+    vector<CBlockIndex*> vIndex;
+    vIndex.swap(vChain);
+    mapBlockIndex.reserve(mapBlockIndex.size() + vIndex.size());
+    BOOST_FOREACH(CBlockIndex *pindex, vIndex)
+        mapBlockIndex.insert(pindex);
+    CBlockIndex *pindexNew = vIndex.back();
+    if (!pblocktree->WriteLoadedHeaders(vIndex) || !pcoinsdbview->EndLoad(pindexNew))
+        return AbortNode(_("Error: failed to write block index"));
+    fHavePruned = true;
+    fLoadedTxOutSet = true;
+    nLocalServices &= ~NODE_NETWORK;
+
+    // Move the views above the database along, and drop what they cached of the empty set
+    pcoinsTip->SetBestBlock(pindexNew);
+    if (!pcoinsTip->Flush() || !pcoinsFlusher->Sync())
+        return AbortNode(_("Error: failed to write to coin database"));
+
+    vBlockIndexByHeight.resize(pindexNew->nHeight + 1);
+    for (CBlockIndex *pindex = pindexNew; pindex != NULL; pindex = pindex->pprev)
+        vBlockIndexByHeight[pindex->nHeight] = pindex;
+    hashBestChain = pindexNew->GetBlockHash();
+    pindexBest = pindexNew;
+    pblockindexFBBHLast = NULL;
+    nBestHeight = pindexNew->nHeight;
+    nBestChainWork = pindexNew->GetChainWork();
+    nTimeBestReceived = GetTime();
+    nTransactionsUpdated++;
+
+    // Wallets can't be rescanned over blocks the node never had
+    const CBlockLocator locator(pindexNew);
+    ::SetBestChain(locator);
+
+    uiInterface.NotifyBlocksChanged();
+    return true;
+}
+
+bool LoadTxOutSet(FILE* fileIn, const uint256 &hashTrusted)
+{
+    int64 nStart = GetTimeMillis();
+    CAutoFile filein = CAutoFile(fileIn, SER_DISK, CLIENT_VERSION);
+    {
+        LOCK(cs_main);
+        if (pindexGenesisBlock == NULL || pindexBest != pindexGenesisBlock)
+            return error("LoadTxOutSet() : only a new block chain can start from a UTXO set");
+        if (fTxIndex)
+            return error("LoadTxOutSet() : not possible with -txindex");
+    }
+
+    vector<CBlockIndex*> vChain;
+    CCoinsStats stats;
+    bool fLoading = false, fOk = false;
+    try {
+        MessageStartChars pchMessageStart;
+        int nVersion = 0;
+        filein >> FLATDATA(pchMessageStart) >> nVersion >> stats.hashBlock >> stats.nHeight;
+        if (memcmp(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart)) != 0)
+            error("LoadTxOutSet() : dump is for another network");
+        else if (nVersion != TXOUTSET_DUMP_VERSION)
+            error("LoadTxOutSet() : unknown dump version %d", nVersion);
+        else if (stats.nHeight <= 0)
+            error("LoadTxOutSet() : invalid height %d", stats.nHeight);
+        else if (ReadTxOutSetHeaders(filein, stats.nHeight, stats.hashBlock, vChain)) {
+            printf("Loaded %d headers, loading the coins...\n", stats.nHeight);
+            filein >> stats;
+
+            // The headers prove work, the coins prove nothing by themselves: only
+            // a hash from outside the file can vouch for them
+            uint256 hashSerialized = stats.muhash.GetHash();
+            uint256 hashKnown = Checkpoints::GetTxOutSetHash(stats.nHeight);
+            if (hashKnown == 0 && hashTrusted == 0)
+                error("LoadTxOutSet() : no known UTXO set hash at height %d, use -loadtxoutsethash", stats.nHeight);
+            else if ((hashKnown != 0 && hashSerialized != hashKnown) || (hashTrusted != 0 && hashSerialized != hashTrusted))
+                error("LoadTxOutSet() : UTXO set hash %s is not the expected one", hashSerialized.ToString().c_str());
+            else {
+                fLoading = pcoinsdbview->BeginLoad();
+                fOk = fLoading && ReadTxOutSetCoins(filein, stats) && ConnectTxOutSet(vChain);
+            }
+        }
+    } catch (boost::thread_interrupted) {
+        BOOST_FOREACH(CBlockIndex *pindex, vChain)
+            delete pindex;
+        if (fLoading)
+            pcoinsdbview->AbortLoad();
+        throw;
+    } catch (std::exception &e) {
+        error("LoadTxOutSet() : deserialize or I/O error: %s", e.what());
+    }
+
+    // The headers are handed over to mapBlockIndex by ConnectTxOutSet; once
+    // they are, a failure is a write error that leaves the database marked
+    // as incomplete, to be rebuilt with -reindex
+    bool fUndo = fLoading && !vChain.empty();
+    BOOST_FOREACH(CBlockIndex *pindex, vChain)
+        delete pindex;
+    if (!fOk) {
+        if (fUndo && !pcoinsdbview->AbortLoad())
+            return AbortNode(_("Error: failed to remove a partly loaded UTXO set"));
+        return false;
+    }
+    printf("Loaded %"PRI64u" transactions at height %d from a UTXO set in %"PRI64d"ms\n", stats.nTransactions, stats.nHeight, GetTimeMillis() - nStart);
+    return true;
+}
+
 
 
 
@@ -3270,7 +4972,7 @@ string GetWarnings(string strFor)
     }
 
     // Longer invalid proof-of-work chain
-    if (pindexBest && nBestInvalidWork > nBestChainWork + (pindexBest->GetBlockWorkAdjusted() * 6).getuint256())
+    if (pindexBest && nBestInvalidWork > nBestChainWork + pindexBest->GetBlockWorkAdjusted() * 6)
     {
         nPriority = 2000;
         strStatusBar = strRPC = _("Warning: Displayed transactions may not be correct! You may need to upgrade, or other nodes may need to upgrade.");
@@ -3355,8 +5057,8 @@ void static ProcessGetData(CNode* pfrom)
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                CBlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                if (mi != mapBlockIndex.end() && ((*mi).second->nStatus & BLOCK_HAVE_DATA))
                 {
                     CBlock block;
                     ReadBlockFromDisk(block, (*mi).second);
@@ -3733,6 +5435,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 printf("  getblocks stopping at %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
                 break;
             }
+            // Don't offer blocks that can't be served
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            {
+                printf("  getblocks stopping at pruned block %d %s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
+                break;
+            }
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
             if (--nLimit <= 0)
             {
@@ -3756,7 +5464,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            CBlockMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -4353,54 +6061,37 @@ static const unsigned int pSHA256InitState[8] =
 
 void SHA256Transform(void* pstate, void* pinput, const void* pinit)
 {
-    SHA256_CTX ctx;
-    unsigned char data[64];
-
-    SHA256_Init(&ctx);
-
-    for (int i = 0; i < 16; i++)
-        ((uint32_t*)data)[i] = ByteReverse(((uint32_t*)pinput)[i]);
-
-    for (int i = 0; i < 8; i++)
-        ctx.h[i] = ((uint32_t*)pinit)[i];
-
-    SHA256_Update(&ctx, data, sizeof(data));
-    for (int i = 0; i < 8; i++)
-        ((uint32_t*)pstate)[i] = ctx.h[i];
+    uint32_t state[8];
+    memcpy(state, pinit, sizeof(state));
+    sha256_transform(state, (const uint32_t*)pinput);
+    memcpy(pstate, state, sizeof(state));
 }
 
 //
-// ScanHash scans nonces looking for a hash with at least some zero bits.
-// It operates on big endian data.  Caller does the byte reversing.
-// All input buffers are 16-byte aligned.  nNonce is usually preserved
-// between calls, but periodically or if nNonce is 0xffff0000 or above,
-// the block is rebuilt and nNonce starts over at zero.
+// ScanHash_Groestl scans nonces for a Groestl PoW hash below hashTarget.
+// Groestl-512 uses 128-byte blocks, so the whole 80-byte header is a single
+// compression and there is no midstate to reuse; each attempt hashes the
+// header through Groestl512(), which picks the AES-NI backend when available.
+// nNonce is advanced in place. Returns the nonce when a hash at or below
+// hashTarget is found, or -1 after a batch of 0x1000 attempts.
 //
-unsigned int static ScanHash_CryptoPP(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone)
+unsigned int static ScanHash_Groestl(CBlockHeader* pblock, const uint256& hashTarget, uint256& hash, unsigned int& nHashesDone)
 {
-    unsigned int& nNonce = *(unsigned int*)(pdata + 12);
+    unsigned int& nNonce = pblock->nNonce;
+
+    uint512 hash1;
     for (;;)
     {
-        // Crypto++ SHA256
-        // Hash pdata using pmidstate as the starting state into
-        // pre-formatted buffer phash1, then hash phash1 into phash
-        nNonce++;
-        SHA256Transform(phash1, pdata, pmidstate);
-        SHA256Transform(phash, phash1, pSHA256InitState);
+        Groestl512(BEGIN(pblock->nVersion), (END(pblock->nNonce) - BEGIN(pblock->nVersion)), (unsigned char*)&hash1);
+        SHA256((unsigned char*)&hash1, 64, (unsigned char*)&hash);
+        nHashesDone++;
 
-        // Return the nonce if the hash has at least some zero bits,
-        // caller will check if it has enough to reach the target
-        if (((unsigned short*)phash)[14] == 0)
+        if (hash <= hashTarget)
             return nNonce;
 
-        // If nothing found after trying for a while, return -1
-        if ((nNonce & 0xffff) == 0)
-        {
-            nHashesDone = 0xffff+1;
-            return (unsigned int) -1;
-        }
+        nNonce++;
         if ((nNonce & 0xfff) == 0)
-            boost::this_thread::interruption_point();
+            return (unsigned int) -1;
     }
 }
 
@@ -4516,7 +6207,7 @@ CBlockTemplate* CreateNewBlock(CReserveKey& reservekey, int algo)
     {
         LOCK2(cs_main, mempool.cs);
         CBlockIndex* pindexPrev = pindexBest;
-        CCoinsViewCache view(*pcoinsTip, true);
+        CCoinsViewCache view(*pcoinsTip);
 
         // Priority order to process transactions
         list<COrphan> vOrphan; // list memory doesn't move
@@ -4566,7 +6257,7 @@ CBlockTemplate* CreateNewBlock(CReserveKey& reservekey, int algo)
                     nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
                     continue;
                 }
-                const CCoins &coins = view.GetCoins(txin.prevout.hash);
+                const CCoins &coins = view.AccessCoins(txin.prevout.hash);
 
                 int64 nValueIn = coins.vout[txin.prevout.n].nValue;
                 nTotalIn += nValueIn;
@@ -4706,7 +6397,7 @@ CBlockTemplate* CreateNewBlock(CReserveKey& reservekey, int algo)
         CBlockIndex indexDummy(*pblock);
         indexDummy.pprev = pindexPrev;
         indexDummy.nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache viewNew(*pcoinsTip, true);
+        CCoinsViewCache viewNew(*pcoinsTip);
         CValidationState state;
         if (!ConnectBlock(*pblock, state, &indexDummy, viewNew, true))
             throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
@@ -4786,7 +6477,7 @@ bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
     int algo = pblock->GetAlgo();
     //printf("Algo=%d\n", algo);
     uint256 hashPoW = pblock->GetPoWHash(algo);
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = uint256().SetCompact(pblock->nBits);
     //printf("pow-hash: %s\n  target: %s\n", 
     //    hashPoW.GetHex().c_str(), 
     //    hashTarget.GetHex().c_str());
@@ -4886,7 +6577,7 @@ void static BitcoinMiner(CWallet *pwallet)
         // Search
         //
         int64 nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
         uint256 hashbuf[2];
         uint256& hash = *alignup<16>(hashbuf);
        while (true)
@@ -4894,9 +6585,9 @@ void static BitcoinMiner(CWallet *pwallet)
             unsigned int nHashesDone = 0;
             unsigned int nNonceFound;
 
-            // Crypto++ SHA256
-            nNonceFound = ScanHash_CryptoPP(pmidstate, pdata + 64, phash1,
-                                            (char*)&hash, nHashesDone);
+            // SHA256d nonce scan, using the fastest kernel for this CPU
+            nNonceFound = ScanHash_SHA256d(pmidstate, pdata + 64, phash1,
+                                           (char*)&hash, nHashesDone);
 
             // Check if something found
             if (nNonceFound != (unsigned int) -1)
@@ -4970,7 +6661,7 @@ void static BitcoinMiner(CWallet *pwallet)
             {
                 // Changing pblock->nTime can change work required on testnet:
                 nBlockBits = ByteReverse(pblock->nBits);
-                hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+                hashTarget = uint256().SetCompact(pblock->nBits);
             }
         }
     } 
@@ -5017,40 +6708,44 @@ void static ScryptMiner(CWallet *pwallet)
         // Search
         //
         int64 nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
         while (true)
         {
             unsigned int nHashesDone = 0;
-            uint256 thash;
-            char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-            while (true)
+            // Hash nLanes consecutive nonces per call to the multi-lane scrypt kernel
+            const unsigned int nLanes = scrypt_best_throughput();
+            char pheaders[8 * 80];
+            uint256 phashes[8];
+            bool fFound = false;
+            while (!fFound)
             {
-#if defined(USE_SSE2)
-                // Detection would work, but in cases where we KNOW it always has SSE2,
-                // it is faster to use directly than to use a function pointer or conditional.
-#if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
-                // Always SSE2: x86_64 or Intel MacOS X
-                scrypt_1024_1_1_256_sp_sse2(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#else
-                // Detect SSE2: 32bit x86 Linux or Windows
-                scrypt_1024_1_1_256_sp(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#endif
-#else
-                // Generic scrypt
-                scrypt_1024_1_1_256_sp_generic(BEGIN(pblock->nVersion), BEGIN(thash), scratchpad);
-#endif
+                for (unsigned int i = 0; i < nLanes; i++)
+                {
+                    unsigned int nNonceLane = pblock->nNonce + i;
+                    memcpy(pheaders + 80 * i, BEGIN(pblock->nVersion), 80);
+                    memcpy(pheaders + 80 * i + 76, &nNonceLane, 4);
+                }
+                scrypt_1024_1_1_256_multi(pheaders, (char*)&phashes[0], nLanes);
+                nHashesDone += nLanes;
 
-                if (thash <= hashTarget)
+                for (unsigned int i = 0; i < nLanes; i++)
                 {
-                    // Found a solution
-                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                    CheckWork(pblock, *pwalletMain, reservekey);
-                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                    break;
+                    if (phashes[i] <= hashTarget)
+                    {
+                        // Found a solution
+                        pblock->nNonce += i;
+                        assert(phashes[i] == pblock->GetPoWHash(ALGO_SCRYPT));
+                        SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                        CheckWork(pblock, *pwalletMain, reservekey);
+                        SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                        fFound = true;
+                        break;
+                    }
                 }
-                pblock->nNonce += 1;
-                nHashesDone += 1;
-                if ((pblock->nNonce & 0xFF) == 0)
+                if (fFound)
+                    break;
+                pblock->nNonce += nLanes;
+                if ((pblock->nNonce & 0xFF) < nLanes)
                     break;
             }
 
@@ -5101,7 +6796,7 @@ void static ScryptMiner(CWallet *pwallet)
             {
                 // Changing pblock->nTime can change work required on testnet:
                 nBlockBits = ByteReverse(pblock->nBits);
-                hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+                hashTarget = uint256().SetCompact(pblock->nBits);
             }
             
         }
@@ -5138,13 +6833,18 @@ void static GenericMiner(CWallet *pwallet, int algo)
         //
         // Search
         //
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
         int64 nStart = GetTime();
         uint256 hash;
         while (true)
         {
-            hash = pblock->GetPoWHash(algo);
-            if (hash <= hashTarget){
+            unsigned int nHashesDone = 0;
+            unsigned int nNonceFound = ScanHash_Groestl(pblock, hashTarget, hash, nHashesDone);
+
+            // Check if something found
+            if (nNonceFound != (unsigned int) -1)
+            {
+                assert(hash == pblock->GetPoWHash(algo));
                 SetThreadPriority(THREAD_PRIORITY_NORMAL);
 
                 printf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex().c_str(), hashTarget.GetHex().c_str());
@@ -5154,8 +6854,7 @@ void static GenericMiner(CWallet *pwallet, int algo)
                 SetThreadPriority(THREAD_PRIORITY_LOWEST);
                 break;
             }
-            ++pblock->nNonce;
-            
+
             // Meter hashes/sec
             static int64 nHashCounter;
             if (nHPSTimerStart == 0)
@@ -5164,7 +6863,7 @@ void static GenericMiner(CWallet *pwallet, int algo)
                 nHashCounter = 0;
             }
             else
-                nHashCounter += 1;
+                nHashCounter += nHashesDone;
             if (GetTimeMillis() - nHPSTimerStart > 4000)
             {
                 static CCriticalSection cs;
@@ -5189,7 +6888,7 @@ void static GenericMiner(CWallet *pwallet, int algo)
             boost::this_thread::interruption_point();
             if (vNodes.empty() && Params().NetworkID() != CChainParams::REGTEST)
                 break;
-            if (++pblock->nNonce >= 0xffff0000)
+            if (pblock->nNonce >= 0xffff0000)
                 break;
             if (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60)
                 break;
@@ -5198,12 +6897,10 @@ void static GenericMiner(CWallet *pwallet, int algo)
 
             // Update nTime every few seconds
             UpdateTime(*pblock, pindexPrev);
-            // nBlockTime = ByteReverse(pblock->nTime);
             if (TestNet())
             {
                 // Changing pblock->nTime can change work required on testnet:
-                // nBlockBits = ByteReverse(pblock->nBits);
-                // hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+                hashTarget = uint256().SetCompact(pblock->nBits);
             }
         }
     } 
@@ -5272,10 +6969,14 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        std::map<uint256, CBlockIndex*>::iterator it1 = mapBlockIndex.begin();
+        CBlockMap::iterator it1 = mapBlockIndex.begin();
         for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+            if (!IsInBlockIndexArena((*it1).second))
+                delete (*it1).second;
         mapBlockIndex.clear();
+        for (unsigned int i = 0; i < vBlockIndexArena.size(); i++)
+            delete[] vBlockIndexArena[i].first;
+        vBlockIndexArena.clear();
 
         // orphan blocks
         std::map<uint256, CBlock*>::iterator it2 = mapOrphanBlocks.begin();
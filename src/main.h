@@ -6,6 +6,8 @@
 #define BITCOIN_MAIN_H
 
 #include "core.h"
+#include "coinsmap.h"
+#include "muhash.h"
 #include "bignum.h"
 #include "sync.h"
 #include "net.h"
@@ -22,8 +24,10 @@ class CReserveKey;
 class CAddress;
 class CInv;
 class CNode;
+class CMappedFileCache;
 
 struct CBlockIndexWorkComparator;
+class CBlockMap;
 
 /** The maximum allowed size for a serialized block, in bytes (network rule) */
 static const unsigned int MAX_BLOCK_SIZE = 1000000;
@@ -41,6 +45,14 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Number of blocks below the tip whose data is never pruned, for reorgs */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Smallest -prune target: the kept blocks plus the files being written, in bytes */
+static const uint64 MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
+/** Format version of the UTXO set dumps written by DumpTxOutSet() */
+static const int TXOUTSET_DUMP_VERSION = 1;
+/** Number of finalized blk?????.dat files kept memory mapped for reading */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 8;
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 /** No amount larger than this (in satoshi) is valid */
@@ -52,6 +64,8 @@ static const int COINBASE_MATURITY = 100;
 static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20 1985 UTC
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** Maximum number of coins prefetching threads allowed */
+static const int MAX_PREFETCH_THREADS = 16;
 /** Default amount of block size reserved for high-priority transactions (in bytes) */
 static const int DEFAULT_BLOCK_PRIORITY_SIZE = 27000;
 #ifdef USE_UPNP
@@ -68,7 +82,7 @@ extern int miningAlgo;
 
 
 extern CCriticalSection cs_main;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+extern CBlockMap mapBlockIndex;
 extern std::vector<CBlockIndex*> vBlockIndexByHeight;
 extern std::set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexValid;
 extern CBlockIndex* pindexGenesisBlock;
@@ -91,7 +105,14 @@ extern bool fReindex;
 extern bool fBenchmark;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
-extern unsigned int nCoinCacheSize;
+extern bool fCompressInBackground;
+extern CMappedFileCache mappedBlockFiles;
+extern int64 nBlockSyncInterval;
+extern bool fPruneMode;
+extern bool fHavePruned;
+extern bool fLoadedTxOutSet;
+extern uint64 nPruneTarget;
+extern size_t nCoinCacheUsage;
 extern bool fHaveGUI;
 
 // Settings
@@ -104,13 +125,16 @@ static const uint64 nMinDiskSpace = 52428800;
 class CReserveKey;
 class CCoinsDB;
 class CBlockTreeDB;
+class CCoinsViewDB;
 struct CDiskBlockPos;
 class CCoins;
 class CTxUndo;
 class CCoinsView;
 class CCoinsViewCache;
 class CScriptCheck;
+class CPoWCheck;
 class CValidationState;
+struct CCoinsStats;
 
 struct CBlockTemplate;
 
@@ -130,8 +154,8 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
 
 void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd);
 
-/** Process an incoming block */
-bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL);
+/** Process an incoming block; fCheckPOW is false if the caller already verified its proof-of-work */
+bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL, bool fCheckPOW = true);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64 nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -140,6 +164,12 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Write the unspent transaction outputs and the headers of the best chain to a file */
+bool DumpTxOutSet(FILE* fileOut, CCoinsStats &stats);
+/** Start the chain from a UTXO set written by DumpTxOutSet(), instead of the genesis block. The
+ *  set must hash to hashTrusted if that is not 0, and to the compiled-in hash for its height if
+ *  there is one; with neither it is refused. */
+bool LoadTxOutSet(FILE* fileIn, const uint256 &hashTrusted);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
@@ -152,12 +182,22 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth);
 void PrintBlockTree();
 /** Find a block by height in the currently-connected chain */
 CBlockIndex* FindBlockByHeight(int nHeight);
+/** Whether the blocks of the connected chain from pindex up to the tip are all on disk */
+bool HaveBlockDataSince(const CBlockIndex* pindex);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /** Send queued protocol messages to be sent to a give node */
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the proof-of-work checking thread */
+void ThreadPoWCheck();
+/** Rewrite finalized block files in compressed form */
+void ThreadRecompressBlockFiles();
+/** Commit and close the block and undo files being written */
+void CloseBlockFiles();
+/** Delete the oldest block and undo files while more than nPruneTarget bytes are in use */
+void PruneBlockFiles();
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet);
 /** Generate a new block, without valid proof-of-work */
@@ -170,8 +210,12 @@ void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash
 bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey);
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, int algo);
+/** Hash a batch of headers on the proof-of-work checking threads and compare each against its target */
+void CheckProofOfWorkBatch(std::vector<CPoWCheck>& vChecks);
 /** Calculate the minimum amount of work a received block needs, without knowing its direct parent */
 unsigned int ComputeMinWork(unsigned int nBase, int64 nTime);
+/** Target after a retarget of nBitsPrev over nActualTimespan seconds, already within the adjustment bounds */
+unsigned int CalculateNextWorkRequired(unsigned int nBitsPrev, int64 nActualTimespan, int algo);
 /** Get the number of active peers */
 int GetNumBlocksOfPeers();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -189,6 +233,8 @@ void UpdateTime(CBlockHeader& block, const CBlockIndex* pindexPrev);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
+/** Allocate nCount block index entries in one block, owned until shutdown */
+CBlockIndex * AllocBlockIndexArena(size_t nCount);
 /** Verify a signature */
 bool VerifySignature(const CCoins& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
 /** Abort with a message */
@@ -342,64 +388,8 @@ public:
         READWRITE(vtxundo);
     )
 
-    bool WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock)
-    {
-        // Open history file to append
-        CAutoFile fileout = CAutoFile(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-        if (!fileout)
-            return error("CBlockUndo::WriteToDisk() : OpenUndoFile failed");
-
-        // Write index header
-        unsigned int nSize = fileout.GetSerializeSize(*this);
-        fileout << FLATDATA(Params().MessageStart()) << nSize;
-
-        // Write undo data
-        long fileOutPos = ftell(fileout);
-        if (fileOutPos < 0)
-            return error("CBlockUndo::WriteToDisk() : ftell failed");
-        pos.nPos = (unsigned int)fileOutPos;
-        fileout << *this;
-
-        // calculate & write checksum
-        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-        hasher << hashBlock;
-        hasher << *this;
-        fileout << hasher.GetHash();
-
-        // Flush stdio buffers and commit to disk before returning
-        fflush(fileout);
-        if (!IsInitialBlockDownload())
-            FileCommit(fileout);
-
-        return true;
-    }
-
-    bool ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock)
-    {
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlockUndo::ReadFromDisk() : OpenBlockFile failed");
-
-        // Read block
-        uint256 hashChecksum;
-        try {
-            filein >> *this;
-            filein >> hashChecksum;
-        }
-        catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
-        }
-
-        // Verify checksum
-        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-        hasher << hashBlock;
-        hasher << *this;
-        if (hashChecksum != hasher.GetHash())
-            return error("CBlockUndo::ReadFromDisk() : checksum mismatch");
-
-        return true;
-    }
+    bool WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock);
+    bool ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock);
 };
 
 
@@ -431,6 +421,23 @@ public:
     }
 };
 
+/** One header of a CheckProofOfWorkBatch() request
+ *  hashPoW and fValid are filled in by the check */
+class CPoWCheck
+{
+public:
+    CBlockHeader header;
+    int algo;
+    uint256 hashTarget;
+
+    uint256 hashPoW;
+    bool fValid;
+
+    CPoWCheck() : algo(ALGO_SHA256D), fValid(false) {}
+    CPoWCheck(const CBlockHeader& headerIn, int algoIn, const uint256& hashTargetIn) :
+        header(headerIn), algo(algoIn), hashTarget(hashTargetIn), fValid(false) {}
+};
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -697,26 +704,33 @@ const int64 nBlockAlgoWorkWeightStart = 142000; // block where algo work weighti
 class CBlockIndex
 {
 public:
-    // pointer to the hash of the block, if any. memory is owned by this CBlockIndex
-    const uint256* phashBlock;
+    // The fields used while walking and comparing chains come first, to share a cache line
+
+    // (memory only) hash of the block, the key of this entry in mapBlockIndex
+    uint256 hashBlock;
 
     // pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
 
+    // (memory only) pointer to the index of the closest predecessor mined with the same algorithm
+    CBlockIndex* pprevAlgo;
+
+    // (memory only) pointer to an older ancestor, so that any ancestor is reached in O(log n) steps
+    CBlockIndex* pskip;
+
     // height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
-    // Which # file this block is stored in (blk?????.dat)
-    int nFile;
-
-    // Byte offset within blk?????.dat where this block's data is stored
-    unsigned int nDataPos;
+    // Verification status of this block. See enum BlockStatus
+    unsigned short nStatus;
 
-    // Byte offset within rev?????.dat where this block's undo data is stored
-    unsigned int nUndoPos;
+    // Which # file this block is stored in (blk?????.dat)
+    unsigned short nFile;
 
-    // (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    uint256 nChainWork;
+    // (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block,
+    // in 128 bits. See GetChainWork()
+    uint64 nChainWorkLow;
+    uint64 nChainWorkHigh;
 
     // Number of transactions in this block.
     // Note: in a potential headers-first mode, this number cannot be relied upon
@@ -725,8 +739,11 @@ public:
     // (memory only) Number of transactions in the chain up to and including this block
     unsigned int nChainTx; // change to 64-bit type when necessary; won't happen before 2030
 
-    // Verification status of this block. See enum BlockStatus
-    unsigned int nStatus;
+    // Byte offset within blk?????.dat where this block's data is stored
+    unsigned int nDataPos;
+
+    // Byte offset within rev?????.dat where this block's undo data is stored
+    unsigned int nUndoPos;
 
     // block header
     int nVersion;
@@ -738,13 +755,16 @@ public:
 
     CBlockIndex()
     {
-        phashBlock = NULL;
+        hashBlock = 0;
         pprev = NULL;
+        pprevAlgo = NULL;
+        pskip = NULL;
         nHeight = 0;
         nFile = 0;
         nDataPos = 0;
         nUndoPos = 0;
-        nChainWork = 0;
+        nChainWorkLow = 0;
+        nChainWorkHigh = 0;
         nTx = 0;
         nChainTx = 0;
         nStatus = 0;
@@ -758,13 +778,16 @@ public:
 
     CBlockIndex(CBlockHeader& block)
     {
-        phashBlock = NULL;
+        hashBlock = 0;
         pprev = NULL;
+        pprevAlgo = NULL;
+        pskip = NULL;
         nHeight = 0;
         nFile = 0;
         nDataPos = 0;
         nUndoPos = 0;
-        nChainWork = 0;
+        nChainWorkLow = 0;
+        nChainWorkHigh = 0;
         nTx = 0;
         nChainTx = 0;
         nStatus = 0;
@@ -777,6 +800,11 @@ public:
     }
     
     int GetAlgo() const { return ::GetAlgo(nVersion); }
+
+    // Whether the header's proof-of-work was already verified when this block was accepted
+    bool HavePoW() const {
+        return (nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_HEADER;
+    }
     
     CDiskBlockPos GetBlockPos() const {
         CDiskBlockPos ret;
@@ -811,7 +839,22 @@ public:
 
     uint256 GetBlockHash() const
     {
-        return *phashBlock;
+        return hashBlock;
+    }
+
+    uint256 GetChainWork() const
+    {
+        uint256 nWork(nChainWorkHigh);
+        nWork <<= 64;
+        return nWork | uint256(nChainWorkLow);
+    }
+
+    void SetChainWork(const uint256 &nWork)
+    {
+        // More than 2^128 expected hashes is out of reach of any proof of work
+        assert(nWork.Get64(2) == 0 && nWork.Get64(3) == 0);
+        nChainWorkLow = nWork.Get64(0);
+        nChainWorkHigh = nWork.Get64(1);
     }
 
     int64 GetBlockTime() const
@@ -819,13 +862,16 @@ public:
         return (int64)nTime;
     }
 
-    CBigNum GetBlockWork() const
+    uint256 GetBlockWork() const
     {
-        CBigNum bnTarget;
-        bnTarget.SetCompact(nBits);
-        if (bnTarget <= 0)
+        bool fNegative, fOverflow;
+        uint256 bnTarget;
+        bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
+        if (fNegative || fOverflow || bnTarget == 0)
             return 0;
-        return (CBigNum(1)<<256) / (bnTarget+1);
+        // 2^256 / (bnTarget+1) does not fit, but as bnTarget+1 is at most 2^256
+        // it equals (2^256 - bnTarget - 1) / (bnTarget+1) + 1
+        return (~bnTarget / (bnTarget + 1)) + 1;
     }
 
     int GetAlgoWorkFactor() const 
@@ -852,11 +898,9 @@ public:
         }
     }
 
-    CBigNum GetBlockWorkAdjusted() const
+    uint256 GetBlockWorkAdjusted() const
     {
-        CBigNum bnRes;
-        bnRes = GetBlockWork() * GetAlgoWorkFactor();
-        return bnRes;
+        return GetBlockWork() * GetAlgoWorkFactor();
     }
     
     bool IsInMainChain() const
@@ -905,6 +949,14 @@ public:
         return pindex->GetMedianTimePast();
     }
 
+    // Fill pprevAlgo and pskip. pprev and nHeight must be set,
+    // and the links of pprev built already.
+    void BuildLinks();
+
+    // The ancestor of this block at the given height, NULL if there is none
+    CBlockIndex* GetAncestor(int height);
+    const CBlockIndex* GetAncestor(int height) const;
+
     /**
      * Returns true if there are nRequired or more blocks of minVersion or above
      * in the last nToCheck blocks, starting at pstart and going backwards.
@@ -931,8 +983,8 @@ public:
 struct CBlockIndexWorkComparator
 {
     bool operator()(CBlockIndex *pa, CBlockIndex *pb) {
-        if (pa->nChainWork > pb->nChainWork) return false;
-        if (pa->nChainWork < pb->nChainWork) return true;
+        if (pa->nChainWorkHigh != pb->nChainWorkHigh) return pa->nChainWorkHigh < pb->nChainWorkHigh;
+        if (pa->nChainWorkLow != pb->nChainWorkLow) return pa->nChainWorkLow < pb->nChainWorkLow;
 
         if (pa->GetBlockHash() < pb->GetBlockHash()) return false;
         if (pa->GetBlockHash() > pb->GetBlockHash()) return true;
@@ -941,6 +993,115 @@ struct CBlockIndexWorkComparator
     }
 };
 
+/**
+ * Hash table of all known block index entries, keyed by block hash.
+ *
+ * Lookups probe a contiguous array of slots (open addressing with linear
+ * probing), each holding the low 64 bits of a block hash and a pointer to its
+ * entry; the full hash, stored in the entry, is only compared when those
+ * match. The slot of a hash is chosen with a per-process salt. Entries are
+ * owned by the caller and are never removed one at a time. Iteration order is
+ * unspecified, and iterators do not survive insert.
+ */
+class CBlockMap
+{
+public:
+    typedef std::pair<uint256, CBlockIndex*> value_type;
+
+private:
+    struct Slot {
+        uint64 nKey;
+        CBlockIndex *pindex;
+    };
+
+    std::vector<Slot> vSlots;   // size is zero or a power of two
+    size_t nSize;
+    uint64 nSalt;
+
+    static uint64 Key(const uint256 &hash) { return hash.Get64(0); }
+    size_t Pos(uint64 nKey) const
+    {
+        uint64 h = (nKey ^ nSalt) * 0x9E3779B97F4A7C15ULL;
+        return (h ^ (h >> 32)) & (vSlots.size() - 1);
+    }
+    void Grow(size_t nSlots);
+
+    // not copyable
+    CBlockMap(const CBlockMap &);
+    CBlockMap &operator=(const CBlockMap &);
+
+public:
+    // Dereferences to a (hash, pointer) pair held by the iterator itself
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef CBlockMap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const value_type *pointer;
+        typedef const value_type &reference;
+
+    private:
+        friend class CBlockMap;
+        const Slot *pslot;
+        const Slot *pend;
+        value_type item;
+        const_iterator(const Slot *pslotIn, const Slot *pendIn) : pslot(pslotIn), pend(pendIn) { Skip(); }
+        void Skip() {
+            while (pslot != pend && pslot->pindex == NULL) pslot++;
+            if (pslot != pend) item = value_type(pslot->pindex->hashBlock, pslot->pindex);
+        }
+    public:
+        const_iterator() : pslot(NULL), pend(NULL) {}
+        const value_type &operator*() const { return item; }
+        const value_type *operator->() const { return &item; }
+        const_iterator &operator++() { pslot++; Skip(); return *this; }
+        const_iterator operator++(int) { const_iterator ret = *this; ++*this; return ret; }
+        bool operator==(const const_iterator &it) const { return pslot == it.pslot; }
+        bool operator!=(const const_iterator &it) const { return pslot != it.pslot; }
+    };
+    typedef const_iterator iterator;
+
+    CBlockMap() : nSize(0), nSalt(0) {}
+
+    const_iterator begin() const { return vSlots.empty() ? const_iterator() : const_iterator(&vSlots[0], &vSlots[0] + vSlots.size()); }
+    const_iterator end() const { return vSlots.empty() ? const_iterator() : const_iterator(&vSlots[0] + vSlots.size(), &vSlots[0] + vSlots.size()); }
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    // The entry for hash, or NULL
+    CBlockIndex *Lookup(const uint256 &hash) const
+    {
+        if (nSize == 0)
+            return NULL;
+        uint64 nKey = Key(hash);
+        size_t nMask = vSlots.size() - 1;
+        for (size_t nPos = Pos(nKey); vSlots[nPos].pindex != NULL; nPos = (nPos + 1) & nMask)
+            if (vSlots[nPos].nKey == nKey && vSlots[nPos].pindex->hashBlock == hash)
+                return vSlots[nPos].pindex;
+        return NULL;
+    }
+
+    const_iterator find(const uint256 &hash) const;
+    size_t count(const uint256 &hash) const { return Lookup(hash) != NULL ? 1 : 0; }
+
+    // Unlike std::map, a missing hash yields NULL and is not added
+    CBlockIndex *operator[](const uint256 &hash) const { return Lookup(hash); }
+
+    // Add pindex under pindex->hashBlock unless an entry for that hash exists;
+    // returns the entry now in the map
+    CBlockIndex *insert(CBlockIndex *pindex);
+
+    // Size the table for nCount entries without growing on the way
+    void reserve(size_t nCount);
+
+    // Forget all entries, without deleting them
+    void clear();
+
+    // Bytes held by the slot array
+    size_t DynamicMemoryUsage() const { return vSlots.capacity() * sizeof(Slot); }
+};
+
 
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, int algo);
 const CBlockIndex* GetLastBlockIndexForAlgo(const CBlockIndex* pindex, int algo);
@@ -1165,13 +1326,28 @@ struct CCoinsStats
     uint256 hashBlock;
     uint64 nTransactions;
     uint64 nTransactionOutputs;
-    uint64 nSerializedSize;
-    uint256 hashSerialized;
+    uint64 nSerializedSize;     // of the transactions' CCoins, plus 32 bytes each for the txid
+    uint256 hashSerialized;     // muhash.GetHash()
     int64 nTotalAmount;
+    CMuHash3072 muhash;         // over the unspent outputs, see UpdateCoinsStats
 
     CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0), nTotalAmount(0) {}
+
+    // The running totals; height and block come from the best block stored with them
+    IMPLEMENT_SERIALIZE(
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    )
 };
 
+/** Apply the change of a transaction's coins from coinsOld to coinsNew to the statistics */
+void UpdateCoinsStats(CCoinsStats &stats, const uint256 &txid, const CCoins &coinsOld, const CCoins &coinsNew);
+/** Add the totals and set hash of statsOther, a disjoint part of the set or a change to it */
+void CombineCoinsStats(CCoinsStats &stats, const CCoinsStats &statsOther);
+
 /** Abstract view on the open txout dataset. */
 class CCoinsView
 {
@@ -1192,8 +1368,10 @@ public:
     // Modify the currently active block index
     virtual bool SetBestBlock(CBlockIndex *pindex);
 
-    // Do a bulk modification (multiple SetCoins + one SetBestBlock)
-    virtual bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    // Do a bulk modification (multiple SetCoins + one SetBestBlock) with the
+    // DIRTY entries of mapCoins, which change the statistics by statsChange.
+    // Their coins may be moved out.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange);
 
     // Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats);
@@ -1216,7 +1394,7 @@ public:
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange);
     bool GetStats(CCoinsStats &stats);
 };
 
@@ -1225,10 +1403,21 @@ class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
     CBlockIndex *pindexTip;
-    std::map<uint256,CCoins> cacheCoins;
+    CCoinsMap cacheCoins;
+
+    // Heap memory of the cached entries, except those in vPendingUsage
+    size_t cachedCoinsUsage;
+
+    // Entries handed out by GetCoins for modification, recounted lazily
+    std::vector<CCoinsCacheEntry*> vPendingUsage;
+
+    // What the modifications made here change in the statistics of the base
+    CCoinsStats statsChange;
 
 public:
-    CCoinsViewCache(CCoinsView &baseIn, bool fDummy = false);
+    CCoinsViewCache(CCoinsView &baseIn);
+    // Stacks a cache on top of another one; caches are never copied
+    CCoinsViewCache(CCoinsViewCache &baseIn);
 
     // Standard CCoinsView methods
     bool GetCoins(const uint256 &txid, CCoins &coins);
@@ -1236,13 +1425,25 @@ public:
     bool HaveCoins(const uint256 &txid);
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange);
+    bool GetStats(CCoinsStats &stats);
 
-    // Return a modifiable reference to a CCoins. Check HaveCoins first.
+    // Return a modifiable reference to a CCoins, which is marked as changed. Check HaveCoins first.
     // Many methods explicitly require a CCoinsViewCache because of this method, to reduce
-    // copying.
+    // copying. Changes made through it are not counted in the statistics; see SpendCoins.
     CCoins &GetCoins(const uint256 &txid);
 
+    // Spend an output and construct undo information, like CCoins::Spend. Check HaveCoins first.
+    bool SpendCoins(const COutPoint &out, CTxInUndo &undo);
+
+    // Return a read-only reference to a CCoins. Check HaveCoins first.
+    const CCoins &AccessCoins(const uint256 &txid);
+
+    // Add the outputs of a new transaction, after a HaveCoins lookup found no
+    // unspent outputs for it (BIP30). If they are spent again before a flush
+    // they never reach the base; entries added by SetCoins always do.
+    bool SetNewCoins(const uint256 &txid, const CCoins &coins);
+
     // Push the modifications applied to this cache to its base.
     // Failure to call this method before destruction will cause the changes to be forgotten.
     bool Flush();
@@ -1250,6 +1451,12 @@ public:
     // Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize();
 
+    // Whether txid is in this cache already, without reading the base
+    bool HaveCoinsInCache(const uint256 &txid);
+
+    // Calculate the memory used by the cache, in bytes
+    size_t DynamicMemoryUsage();
+
     /** Amount of bitcoins coming in to a transaction
         Note that lightweight clients may not know anything besides the hash of previous transactions,
         so may not be able to calculate this.
@@ -1266,7 +1473,96 @@ public:
     const CTxOut &GetOutputFor(const CTxIn& input);
 
 private:
-    std::map<uint256,CCoins>::iterator FetchCoins(const uint256 &txid);
+    CCoinsMap::iterator FetchCoins(const uint256 &txid);
+    CCoinsCacheEntry &ModifyEntry(const uint256 &txid);
+    void UpdatePendingUsage();
+};
+
+/** CCoinsView that writes flushed caches to its base on a background thread.
+    BatchWrite takes over the cache contents as a frozen layer and returns at
+    once; lookups see that layer until the base has durably stored it. At most
+    one layer is in flight: the next BatchWrite waits for it first. */
+class CCoinsViewFlusher : public CCoinsViewBacked
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    boost::thread *pthread;
+
+    // Handed to the writer, not modified until it is written (protected by mutex)
+    CCoinsMap mapWriting;
+    CBlockIndex *pindexWriting;
+    CCoinsStats statsChangeWriting;
+    size_t nWritingUsage;
+    bool fPending;
+    // The statistics of the base with the layer in flight applied, if the base keeps them
+    CCoinsStats statsWriting;
+    bool fHaveStatsWriting;
+    bool fFailed;
+    bool fStop;
+
+    void Thread();
+    bool WaitForWriter(boost::unique_lock<boost::mutex> &lock);
+
+public:
+    CCoinsViewFlusher(CCoinsView &baseIn);
+    ~CCoinsViewFlusher();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins);
+    bool SetCoins(const uint256 &txid, const CCoins &coins);
+    bool HaveCoins(const uint256 &txid);
+    CBlockIndex *GetBestBlock();
+    bool SetBestBlock(CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange);
+    bool GetStats(CCoinsStats &stats);
+
+    // Wait until the layer in flight is written; false if writing it failed
+    bool Sync();
+
+    // The best block the base has stored, not counting the layer in flight
+    CBlockIndex *GetDurableBlock();
+
+    // Heap memory still held by the layer in flight
+    size_t DynamicMemoryUsage();
+};
+
+/** CCoinsView that reads coins from its base on a pool of threads ahead of
+    their use. Prefetched coins are handed out once by GetCoins; they are
+    dropped whenever the base changes, so a lookup never sees a stale copy. */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    boost::condition_variable condRead;     // signalled when a read finishes
+    boost::thread_group threads;
+
+    // All protected by mutex
+    std::vector<uint256> vQueue;
+    std::set<uint256> setReading;           // being read by a thread now
+    std::map<uint256, CCoins> mapPrefetched;
+    size_t nPrefetchedUsage;    // heap memory of mapPrefetched
+    unsigned int nGeneration;   // bumped whenever the base changes
+    bool fStop;
+
+    void Thread();
+    void Invalidate();
+
+public:
+    CCoinsViewPrefetch(CCoinsView &baseIn, int nThreads);
+    ~CCoinsViewPrefetch();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins);
+    bool SetCoins(const uint256 &txid, const CCoins &coins);
+    bool HaveCoins(const uint256 &txid);
+    bool SetBestBlock(CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange);
+
+    // Start reading the given transactions, replacing any earlier request
+    void Prefetch(const std::vector<uint256> &vTxid);
+
+    // Heap memory of the coins read ahead and not handed out yet
+    size_t DynamicMemoryUsage();
 };
 
 /** CCoinsView that brings transactions from a memorypool into view.
@@ -1285,6 +1581,15 @@ public:
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the view writing pcoinsTip's flushes to disk (protected by cs_main) */
+extern CCoinsViewFlusher *pcoinsFlusher;
+
+/** Global variable that points to the view prefetching coins into pcoinsTip (protected by cs_main) */
+extern CCoinsViewPrefetch *pcoinsPrefetch;
+
+/** Global variable that points to the coin database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -0,0 +1,128 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::CMappedFile() : pdata(NULL), nSize(0)
+{
+}
+
+CMappedFile::~CMappedFile()
+{
+    Close();
+}
+
+bool CMappedFile::Open(const boost::filesystem::path &path)
+{
+    Close();
+#ifdef WIN32
+    HANDLE hFile = CreateFileA(path.string().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER nFileSize;
+    if (!GetFileSizeEx(hFile, &nFileSize) || nFileSize.QuadPart == 0 || (uint64)nFileSize.QuadPart > (size_t)-1) {
+        CloseHandle(hFile);
+        return false;
+    }
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (hMapping == NULL)
+        return false;
+    // The view keeps the mapping alive
+    void *p = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if (p == NULL)
+        return false;
+    pdata = (unsigned char*)p;
+    nSize = (size_t)nFileSize.QuadPart;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || (uint64)st.st_size > (size_t)-1) {
+        close(fd);
+        return false;
+    }
+    // The mapping keeps the file alive
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    pdata = (unsigned char*)p;
+    nSize = st.st_size;
+#endif
+    return true;
+}
+
+void CMappedFile::Close()
+{
+    if (pdata == NULL)
+        return;
+#ifdef WIN32
+    UnmapViewOfFile(pdata);
+#else
+    munmap(pdata, nSize);
+#endif
+    pdata = NULL;
+    nSize = 0;
+}
+
+void CMappedFileCache::SetMaxFiles(size_t nMaxFilesIn)
+{
+    LOCK(cs);
+    nMaxFiles = nMaxFilesIn;
+    while (lruFiles.size() > nMaxFiles)
+        lruFiles.pop_back();
+}
+
+boost::shared_ptr<CMappedFile> CMappedFileCache::Get(int nFile, const boost::filesystem::path &path)
+{
+    LOCK(cs);
+    if (nMaxFiles == 0)
+        return boost::shared_ptr<CMappedFile>();
+
+    for (MappingList::iterator it = lruFiles.begin(); it != lruFiles.end(); it++) {
+        if (it->first == nFile) {
+            lruFiles.splice(lruFiles.begin(), lruFiles, it);
+            return lruFiles.front().second;
+        }
+    }
+
+    boost::shared_ptr<CMappedFile> pfile(new CMappedFile());
+    if (!pfile->Open(path)) {
+        printf("CMappedFileCache::Get() : unable to map %s\n", path.string().c_str());
+        return boost::shared_ptr<CMappedFile>();
+    }
+    lruFiles.push_front(std::make_pair(nFile, pfile));
+    if (lruFiles.size() > nMaxFiles)
+        lruFiles.pop_back();
+    return pfile;
+}
+
+void CMappedFileCache::Invalidate(int nFile)
+{
+    LOCK(cs);
+    for (MappingList::iterator it = lruFiles.begin(); it != lruFiles.end(); it++) {
+        if (it->first == nFile) {
+            lruFiles.erase(it);
+            return;
+        }
+    }
+}
+
+void CMappedFileCache::Clear()
+{
+    LOCK(cs);
+    lruFiles.clear();
+}
@@ -0,0 +1,63 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include "sync.h"
+
+#include <list>
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+/** A read-only memory mapping of a whole file. The file must not shrink
+ *  while it is mapped; replacing or unlinking it is fine. */
+class CMappedFile
+{
+private:
+    unsigned char *pdata;
+    size_t nSize;
+
+    CMappedFile(const CMappedFile&);
+    void operator=(const CMappedFile&);
+
+public:
+    CMappedFile();
+    ~CMappedFile();
+
+    bool Open(const boost::filesystem::path &path);
+    void Close();
+
+    const unsigned char *begin() const { return pdata; }
+    const unsigned char *end() const { return pdata + nSize; }
+    size_t size() const { return nSize; }
+};
+
+/** Most recently used mappings of numbered files. Mappings are shared, so
+ *  one stays valid for a reader even after it is evicted or invalidated. */
+class CMappedFileCache
+{
+private:
+    typedef std::list<std::pair<int, boost::shared_ptr<CMappedFile> > > MappingList;
+
+    mutable CCriticalSection cs;
+    MappingList lruFiles;
+    size_t nMaxFiles;
+
+public:
+    CMappedFileCache(size_t nMaxFilesIn = 0) : nMaxFiles(nMaxFilesIn) {}
+
+    /** Set the number of files kept mapped; 0 disables mapping */
+    void SetMaxFiles(size_t nMaxFilesIn);
+
+    /** Mapping of file nFile at path, or NULL if disabled or it can't be mapped */
+    boost::shared_ptr<CMappedFile> Get(int nFile, const boost::filesystem::path &path);
+
+    /** Drop the mapping of nFile, which is about to be replaced */
+    void Invalidate(int nFile);
+
+    void Clear();
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
@@ -0,0 +1,150 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+#include "bignum.h"
+#include "hash.h"
+
+#include <string.h>
+
+const unsigned int CMuHash3072::BYTES;
+
+// 2^3072 - 1103717, the largest 3072-bit safe prime
+static BIGNUM *CreateModulus()
+{
+    BIGNUM *p = BN_new();
+    if (p == NULL || !BN_one(p) || !BN_lshift(p, p, 3072) || !BN_sub_word(p, 1103717))
+        throw bignum_error("CMuHash3072 : failed to set up the modulus");
+    return p;
+}
+
+static const BIGNUM *Modulus()
+{
+    static const BIGNUM *pmod = CreateModulus();
+    return pmod;
+}
+
+// Spread the element hash over 3072 bits
+static void ElementToNumber(const uint256 &hashElement, BIGNUM *bn)
+{
+    unsigned char pchBuf[CMuHash3072::BYTES];
+    unsigned char pchIn[33];
+    memcpy(pchIn, hashElement.begin(), 32);
+    for (unsigned int i = 0; i < CMuHash3072::BYTES / 32; i++) {
+        pchIn[32] = i;
+        SHA256(pchIn, sizeof(pchIn), pchBuf + 32 * i);
+    }
+    if (!BN_bin2bn(pchBuf, sizeof(pchBuf), bn))
+        throw bignum_error("CMuHash3072 : BN_bin2bn failed");
+}
+
+static BIGNUM *NewOne()
+{
+    BIGNUM *bn = BN_new();
+    if (bn == NULL || !BN_one(bn))
+        throw bignum_error("CMuHash3072 : BN_new failed");
+    return bn;
+}
+
+static BIGNUM *Dup(const BIGNUM *bnIn)
+{
+    BIGNUM *bn = BN_dup(bnIn);
+    if (bn == NULL)
+        throw bignum_error("CMuHash3072 : BN_dup failed");
+    return bn;
+}
+
+CMuHash3072::CMuHash3072()
+{
+    pnum = NewOne();
+    pden = NewOne();
+}
+
+CMuHash3072::CMuHash3072(const CMuHash3072 &other)
+{
+    pnum = Dup(other.pnum);
+    pden = Dup(other.pden);
+}
+
+CMuHash3072 &CMuHash3072::operator=(const CMuHash3072 &other)
+{
+    if (this != &other) {
+        if (!BN_copy(pnum, other.pnum) || !BN_copy(pden, other.pden))
+            throw bignum_error("CMuHash3072 : BN_copy failed");
+    }
+    return *this;
+}
+
+CMuHash3072::~CMuHash3072()
+{
+    BN_clear_free(pnum);
+    BN_clear_free(pden);
+}
+
+void CMuHash3072::Insert(const uint256 &hashElement)
+{
+    CAutoBN_CTX pctx;
+    BIGNUM *bn = NewOne();
+    ElementToNumber(hashElement, bn);
+    bool fOk = BN_mod_mul(pnum, pnum, bn, Modulus(), pctx);
+    BN_clear_free(bn);
+    if (!fOk)
+        throw bignum_error("CMuHash3072::Insert : BN_mod_mul failed");
+}
+
+void CMuHash3072::Remove(const uint256 &hashElement)
+{
+    CAutoBN_CTX pctx;
+    BIGNUM *bn = NewOne();
+    ElementToNumber(hashElement, bn);
+    bool fOk = BN_mod_mul(pden, pden, bn, Modulus(), pctx);
+    BN_clear_free(bn);
+    if (!fOk)
+        throw bignum_error("CMuHash3072::Remove : BN_mod_mul failed");
+}
+
+CMuHash3072 &CMuHash3072::operator*=(const CMuHash3072 &other)
+{
+    CAutoBN_CTX pctx;
+    if (!BN_mod_mul(pnum, pnum, other.pnum, Modulus(), pctx) ||
+        !BN_mod_mul(pden, pden, other.pden, Modulus(), pctx))
+        throw bignum_error("CMuHash3072::operator*= : BN_mod_mul failed");
+    return *this;
+}
+
+void CMuHash3072::Normalize()
+{
+    if (BN_is_one(pden))
+        return;
+    CAutoBN_CTX pctx;
+    BIGNUM *inv = BN_mod_inverse(NULL, pden, Modulus(), pctx);
+    if (inv == NULL)
+        throw bignum_error("CMuHash3072::Normalize : BN_mod_inverse failed");
+    bool fOk = BN_mod_mul(pnum, pnum, inv, Modulus(), pctx) && BN_one(pden);
+    BN_clear_free(inv);
+    if (!fOk)
+        throw bignum_error("CMuHash3072::Normalize : BN_mod_mul failed");
+}
+
+std::vector<unsigned char> CMuHash3072::GetBytes() const
+{
+    CMuHash3072 copy(*this);
+    copy.Normalize();
+    std::vector<unsigned char> vch(BYTES, 0);
+    int nBytes = BN_num_bytes(copy.pnum);
+    BN_bn2bin(copy.pnum, &vch[BYTES - nBytes]);
+    return vch;
+}
+
+void CMuHash3072::SetBytes(const std::vector<unsigned char> &vch)
+{
+    if (!BN_bin2bn(&vch[0], vch.size(), pnum) || !BN_one(pden))
+        throw bignum_error("CMuHash3072::SetBytes : BN_bin2bn failed");
+}
+
+uint256 CMuHash3072::GetHash() const
+{
+    std::vector<unsigned char> vch = GetBytes();
+    return Hash(vch.begin(), vch.end());
+}
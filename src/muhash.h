@@ -0,0 +1,69 @@
+// Copyright (c) 2024 The Trinity developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_MUHASH_H
+#define BITCOIN_MUHASH_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <vector>
+#include <openssl/bn.h>
+
+/**
+ * Order-independent hash of a multiset of elements.
+ *
+ * Each element (given as the hash of its serialization) is expanded to a
+ * number modulo the prime 2^3072 - 1103717, and the set is represented by
+ * the product of those numbers. Elements can be inserted and removed in any
+ * order, and sets hashed in parts can be combined by multiplying them.
+ * Removals are collected in a separate product, so the modular inverse is
+ * only taken once, when the final hash or the serialized form is needed.
+ */
+class CMuHash3072
+{
+private:
+    BIGNUM *pnum;   // product of the inserted elements
+    BIGNUM *pden;   // product of the removed elements
+
+    void Normalize();
+
+public:
+    static const unsigned int BYTES = 384;
+
+    CMuHash3072();
+    CMuHash3072(const CMuHash3072 &other);
+    CMuHash3072 &operator=(const CMuHash3072 &other);
+    ~CMuHash3072();
+
+    void Insert(const uint256 &hashElement);
+    void Remove(const uint256 &hashElement);
+
+    // Combine with a disjoint set hashed separately, or apply the changes collected in other
+    CMuHash3072 &operator*=(const CMuHash3072 &other);
+
+    uint256 GetHash() const;
+
+    // The set's number, big-endian, BYTES long
+    std::vector<unsigned char> GetBytes() const;
+    void SetBytes(const std::vector<unsigned char> &vch);
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return BYTES;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        std::vector<unsigned char> vch = GetBytes();
+        s.write((char*)&vch[0], BYTES);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        std::vector<unsigned char> vch(BYTES);
+        s.read((char*)&vch[0], BYTES);
+        SetBytes(vch);
+    }
+};
+
+#endif // BITCOIN_MUHASH_H
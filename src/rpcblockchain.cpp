@@ -4,8 +4,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "main.h"
+#include "txdb.h"
 #include "bitcoinrpc.h"
 #include "core.h"
+#include "compressedstorage.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -163,7 +165,7 @@ Value getblockhash(const Array& params, bool fHelp)
         throw runtime_error("Block number out of range.");
 
     CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
-    return pblockindex->phashBlock->GetHex();
+    return pblockindex->GetBlockHash().GetHex();
 }
 
 Value getblock(const Array& params, bool fHelp)
@@ -187,7 +189,10 @@ Value getblock(const Array& params, bool fHelp)
 
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
-    ReadBlockFromDisk(block, pblockindex);
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    if (!ReadBlockFromDisk(block, pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     if (!fVerbose)
     {
@@ -202,13 +207,22 @@ Value getblock(const Array& params, bool fHelp)
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
-            "Returns statistics about the unspent transaction output set.");
+            "gettxoutsetinfo [verify=false]\n"
+            "Returns statistics about the unspent transaction output set.\n"
+            "With verify, the set is flushed to disk and also scanned in full, and\n"
+            "\"verified\" tells whether the scan agrees with the running statistics.");
+
+    bool fVerify = false;
+    if (params.size() > 0)
+        fVerify = params[0].get_bool();
 
     Object ret;
 
+    if (fVerify && (!pcoinsTip->Flush() || !pcoinsFlusher->Sync()))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to write to coin database");
+
     CCoinsStats stats;
     if (pcoinsTip->GetStats(stats)) {
         ret.push_back(Pair("height", (boost::int64_t)stats.nHeight));
@@ -218,10 +232,92 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
         ret.push_back(Pair("bytes_serialized", (boost::int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+
+        if (fVerify) {
+            CCoinsStats statsScan;
+            bool fVerified = pcoinsdbview->ComputeStats(statsScan, boost::thread::hardware_concurrency()) &&
+                             statsScan.hashBlock == stats.hashBlock &&
+                             statsScan.hashSerialized == stats.hashSerialized &&
+                             statsScan.nTransactions == stats.nTransactions &&
+                             statsScan.nTransactionOutputs == stats.nTransactionOutputs &&
+                             statsScan.nSerializedSize == stats.nSerializedSize &&
+                             statsScan.nTotalAmount == stats.nTotalAmount;
+            ret.push_back(Pair("verified", fVerified));
+        }
     }
     return ret;
 }
 
+Value getcompressioninfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcompressioninfo\n"
+            "Returns statistics about block and undo data compression since startup.");
+
+    Object ret;
+
+    CompressionStats stats = compressedStorage.GetStats();
+    int nCodec = compressedStorage.GetCodec();
+    ret.push_back(Pair("enabled", compressedStorage.IsCompressionEnabled()));
+    ret.push_back(Pair("codec", nCodec == TCMP_CODEC_COLUMNAR ? "columnar" : nCodec == TCMP_CODEC_LZ ? "lz" : "other"));
+    ret.push_back(Pair("level", compressedStorage.GetCompressionLevel()));
+
+    Object blocks;
+    blocks.push_back(Pair("count", (boost::int64_t)stats.nBlocksCompressed));
+    blocks.push_back(Pair("bytes_original", (boost::int64_t)stats.nTotalBytesOriginal));
+    blocks.push_back(Pair("bytes_stored", (boost::int64_t)stats.nTotalBytesCompressed));
+    blocks.push_back(Pair("ratio", stats.GetCompressionRatio()));
+    ret.push_back(Pair("blocks", blocks));
+
+    Object undo;
+    undo.push_back(Pair("count", (boost::int64_t)stats.nUndoCompressed));
+    undo.push_back(Pair("bytes_original", (boost::int64_t)stats.nUndoBytesOriginal));
+    undo.push_back(Pair("bytes_stored", (boost::int64_t)stats.nUndoBytesCompressed));
+    undo.push_back(Pair("ratio", stats.GetUndoCompressionRatio()));
+    ret.push_back(Pair("undo", undo));
+
+    ret.push_back(Pair("deduped_transactions", (boost::int64_t)stats.nDedupedTransactions));
+    ret.push_back(Pair("dedup_cache_bytes", (boost::int64_t)compressedStorage.GetCacheSize()));
+    return ret;
+}
+
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset <file>\n"
+            "Writes the unspent transaction output set, with the headers of the best chain,\n"
+            "to <file> (relative to the data directory), for a new node to start from\n"
+            "with -loadtxoutset=<file> -loadtxoutsethash=<hash_serialized>.");
+
+    boost::filesystem::path path(params[0].get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    // Only appears under its name once complete
+    boost::filesystem::path pathTemp = path.string() + ".incomplete";
+    FILE *file = fopen(pathTemp.string().c_str(), "wb");
+    if (!file)
+        throw JSONRPCError(RPC_MISC_ERROR, "Can't open " + pathTemp.string());
+    CCoinsStats stats;
+    if (!DumpTxOutSet(file, stats) || !RenameOver(pathTemp, path)) {
+        boost::filesystem::remove(pathTemp);
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to write the unspent output set");
+    }
+
+    Object ret;
+    ret.push_back(Pair("file", path.string()));
+    ret.push_back(Pair("height", (boost::int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (boost::int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (boost::int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+    return ret;
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -96,6 +96,10 @@ Value importprivkey(const Array& params, bool fHelp)
     {
         LOCK2(cs_main, pwalletMain->cs_wallet);
 
+        // The key has no birthday, so the rescan needs every block
+        if (fRescan && !HaveBlockDataSince(pindexGenesisBlock))
+            throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is not possible, blocks have been pruned; import with rescan=false");
+
         pwalletMain->MarkDirty();
         pwalletMain->SetAddressBookName(vchAddress, strLabel);
 
@@ -185,7 +189,8 @@ Value importwallet(const Array& params, bool fHelp)
         pindex = pindex->pprev;
 
     printf("Rescanning last %i blocks\n", pindexBest->nHeight - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
+    if (pwalletMain->ScanForWalletTransactions(pindex) < 0)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Keys imported, but blocks needed to rescan for them have been pruned");
     pwalletMain->ReacceptWalletTransactions();
     pwalletMain->MarkDirty();
 
@@ -180,7 +180,7 @@ Value getwork(const Array& params, bool fHelp)
         char phash1[64];
         FormatHashBuffers(pblock, pmidstate, pdata, phash1);
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
         Object result;
         result.push_back(Pair("midstate", HexStr(BEGIN(pmidstate), END(pmidstate)))); // deprecated
@@ -334,7 +334,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
     Object aux;
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
     static Array aMutable;
     if (aMutable.empty())
@@ -389,3 +389,73 @@ Value submitblock(const Array& params, bool fHelp)
 
     return Value::null;
 }
+
+Value checkpowbatch(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "checkpowbatch [{\"header\":hex,\"algo\":algo,\"target\":hex},...]\n"
+            "Checks the proof-of-work of a batch of 80-byte block headers, such as pool shares.\n"
+            "  \"header\" : hex-encoded serialized block header\n"
+            "  \"algo\" : sha256d, scrypt or groestl, or its id (default: taken from the header version)\n"
+            "  \"target\" : hex-encoded 256-bit target the hash must not exceed (default: taken from the header nBits)\n"
+            "Returns an array of {\"hash\",\"algo\",\"valid\"} in the order of the request.");
+
+    const Array& vRequest = params[0].get_array();
+
+    vector<CPoWCheck> vChecks;
+    vChecks.reserve(vRequest.size());
+    BOOST_FOREACH(const Value& request, vRequest)
+    {
+        const Object& o = request.get_obj();
+
+        const Value& header_v = find_value(o, "header");
+        if (header_v.type() != str_type || !IsHex(header_v.get_str()))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, header must be hexadecimal");
+        vector<unsigned char> vchHeader(ParseHex(header_v.get_str()));
+        if (vchHeader.size() != 80)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, header must be 80 bytes");
+        CDataStream ssHeader(vchHeader, SER_NETWORK, PROTOCOL_VERSION);
+        CBlockHeader header;
+        ssHeader >> header;
+
+        int algo = header.GetAlgo();
+        const Value& algo_v = find_value(o, "algo");
+        if (algo_v.type() == int_type)
+            algo = algo_v.get_int();
+        else if (algo_v.type() == str_type)
+            algo = GetAlgoByName(algo_v.get_str());
+        else if (algo_v.type() != null_type)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, algo must be a name or an id");
+        if (algo < 0 || algo >= NUM_ALGOS)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, unknown algo");
+
+        uint256 hashTarget;
+        const Value& target_v = find_value(o, "target");
+        if (target_v.type() == str_type)
+        {
+            if (target_v.get_str().size() != 64 || !IsHex(target_v.get_str()))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, target must be 64 hex digits");
+            hashTarget.SetHex(target_v.get_str());
+        }
+        else if (target_v.type() == null_type)
+            hashTarget = uint256().SetCompact(header.nBits);
+        else
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, target must be a hex string");
+
+        vChecks.push_back(CPoWCheck(header, algo, hashTarget));
+    }
+
+    CheckProofOfWorkBatch(vChecks);
+
+    Array result;
+    BOOST_FOREACH(const CPoWCheck& check, vChecks)
+    {
+        Object entry;
+        entry.push_back(Pair("hash", check.hashPoW.GetHex()));
+        entry.push_back(Pair("algo", GetAlgoName(check.algo)));
+        entry.push_back(Pair("valid", check.fValid));
+        result.push_back(entry);
+    }
+    return result;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+/*
+ * 8-way scrypt using AVX2. Same vertical layout as the 4-way SSE2 kernel in
+ * scrypt-sse2.cpp, with one __m256i holding a state word of eight hashes.
+ * This file must be compiled with -mavx2; callers only reach it after
+ * checking for AVX2 at runtime (see scrypt_best_throughput()).
+ */
+
+#include "scrypt.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <openssl/sha.h>
+
+#include <immintrin.h>
+
+#define ROTL_8WAY(a, b) _mm256_or_si256(_mm256_slli_epi32(a, b), _mm256_srli_epi32(a, 32 - (b)))
+#define QR_8WAY(x, a, b, c, d) \
+	x[b] = _mm256_xor_si256(x[b], ROTL_8WAY(_mm256_add_epi32(x[a], x[d]),  7)); \
+	x[c] = _mm256_xor_si256(x[c], ROTL_8WAY(_mm256_add_epi32(x[b], x[a]),  9)); \
+	x[d] = _mm256_xor_si256(x[d], ROTL_8WAY(_mm256_add_epi32(x[c], x[b]), 13)); \
+	x[a] = _mm256_xor_si256(x[a], ROTL_8WAY(_mm256_add_epi32(x[d], x[c]), 18));
+
+static inline void xor_salsa8_8way(__m256i B[16], const __m256i Bx[16])
+{
+	__m256i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm256_xor_si256(B[i], Bx[i]);
+
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		QR_8WAY(x,  0,  4,  8, 12);
+		QR_8WAY(x,  5,  9, 13,  1);
+		QR_8WAY(x, 10, 14,  2,  6);
+		QR_8WAY(x, 15,  3,  7, 11);
+
+		/* Operate on rows. */
+		QR_8WAY(x,  0,  1,  2,  3);
+		QR_8WAY(x,  5,  6,  7,  4);
+		QR_8WAY(x, 10, 11,  8,  9);
+		QR_8WAY(x, 15, 12, 13, 14);
+	}
+
+	for (i = 0; i < 16; i++)
+		B[i] = _mm256_add_epi32(B[i], x[i]);
+}
+
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[8][128];
+	union {
+		__m256i i256[32];
+		uint32_t u32[32][8];
+	} X;
+	__m256i *V;
+	const int *Vi;
+	uint32_t i, k, l;
+	__m256i vj;
+	const __m256i vlane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	V = (__m256i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	Vi = (const int *)V;
+
+	for (l = 0; l < 8; l++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, (const uint8_t *)input + 80 * l, 80, 1, B[l], 128);
+		for (k = 0; k < 32; k++)
+			X.u32[k][l] = le32dec(&B[l][4 * k]);
+	}
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			V[i * 32 + k] = X.i256[k];
+		xor_salsa8_8way(&X.i256[0], &X.i256[16]);
+		xor_salsa8_8way(&X.i256[16], &X.i256[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* per-lane word index of V[j][0]: 256 * j + lane */
+		vj = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(X.i256[16], _mm256_set1_epi32(1023)), 8), vlane);
+		for (k = 0; k < 32; k++)
+			X.i256[k] = _mm256_xor_si256(X.i256[k], _mm256_i32gather_epi32(Vi + 8 * k, vj, 4));
+		xor_salsa8_8way(&X.i256[0], &X.i256[16]);
+		xor_salsa8_8way(&X.i256[16], &X.i256[0]);
+	}
+
+	for (l = 0; l < 8; l++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[l][4 * k], X.u32[k][l]);
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, B[l], 128, 1, (uint8_t *)output + 32 * l, 32);
+	}
+}
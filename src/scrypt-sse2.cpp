@@ -134,3 +134,87 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
+
+/*
+ * 4-way scrypt: hashes four 80-byte inputs at once. Each __m128i holds the
+ * same state word of four independent hashes ("vertical" layout), so the
+ * Salsa20/8 core needs no shuffles; only the data-dependent lookups into V
+ * are done per lane. The scratchpad must hold 4 * 128 KiB plus 63 bytes of
+ * alignment slack.
+ */
+#define ROTL_4WAY(a, b) _mm_or_si128(_mm_slli_epi32(a, b), _mm_srli_epi32(a, 32 - (b)))
+#define QR_4WAY(x, a, b, c, d) \
+	x[b] = _mm_xor_si128(x[b], ROTL_4WAY(_mm_add_epi32(x[a], x[d]),  7)); \
+	x[c] = _mm_xor_si128(x[c], ROTL_4WAY(_mm_add_epi32(x[b], x[a]),  9)); \
+	x[d] = _mm_xor_si128(x[d], ROTL_4WAY(_mm_add_epi32(x[c], x[b]), 13)); \
+	x[a] = _mm_xor_si128(x[a], ROTL_4WAY(_mm_add_epi32(x[d], x[c]), 18));
+
+static inline void xor_salsa8_4way(__m128i B[16], const __m128i Bx[16])
+{
+	__m128i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm_xor_si128(B[i], Bx[i]);
+
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		QR_4WAY(x,  0,  4,  8, 12);
+		QR_4WAY(x,  5,  9, 13,  1);
+		QR_4WAY(x, 10, 14,  2,  6);
+		QR_4WAY(x, 15,  3,  7, 11);
+
+		/* Operate on rows. */
+		QR_4WAY(x,  0,  1,  2,  3);
+		QR_4WAY(x,  5,  6,  7,  4);
+		QR_4WAY(x, 10, 11,  8,  9);
+		QR_4WAY(x, 15, 12, 13, 14);
+	}
+
+	for (i = 0; i < 16; i++)
+		B[i] = _mm_add_epi32(B[i], x[i]);
+}
+
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[4][128];
+	union {
+		__m128i i128[32];
+		uint32_t u32[32][4];
+	} X;
+	__m128i *V;
+	const uint32_t *Vu;
+	uint32_t i, k, l;
+	uint32_t j[4];
+
+	V = (__m128i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	Vu = (const uint32_t *)V;
+
+	for (l = 0; l < 4; l++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, (const uint8_t *)input + 80 * l, 80, 1, B[l], 128);
+		for (k = 0; k < 32; k++)
+			X.u32[k][l] = le32dec(&B[l][4 * k]);
+	}
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			V[i * 32 + k] = X.i128[k];
+		xor_salsa8_4way(&X.i128[0], &X.i128[16]);
+		xor_salsa8_4way(&X.i128[16], &X.i128[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		for (l = 0; l < 4; l++)
+			j[l] = 128 * (X.u32[16][l] & 1023) + l;
+		for (k = 0; k < 32; k++)
+			X.i128[k] = _mm_xor_si128(X.i128[k],
+				_mm_set_epi32(Vu[j[3] + 4 * k], Vu[j[2] + 4 * k], Vu[j[1] + 4 * k], Vu[j[0] + 4 * k]));
+		xor_salsa8_4way(&X.i128[0], &X.i128[16]);
+		xor_salsa8_4way(&X.i128[16], &X.i128[0]);
+	}
+
+	for (l = 0; l < 4; l++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[l][4 * k], X.u32[k][l]);
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, B[l], 128, 1, (uint8_t *)output + 32 * l, 32);
+	}
+}
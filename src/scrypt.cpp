@@ -303,9 +303,52 @@ void scrypt_detect_sse2(unsigned int cpuid_edx)
 #endif
 #endif
 
-void scrypt_1024_1_1_256(const char *input, char *output)
+int scrypt_best_throughput()
+{
+	static int nLanes = 0;
+	if (nLanes == 0) {
+		int n = 1;
+#if defined(USE_SSE2)
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
+		n = 4;
+#elif defined(__GNUC__)
+		if (__builtin_cpu_supports("sse2"))
+			n = 4;
+#endif
+#endif
+#if defined(USE_AVX2) && defined(__GNUC__)
+		if (__builtin_cpu_supports("avx2"))
+			n = 8;
+#endif
+		printf("scrypt: using %d-way kernel for batched hashing.\n", n);
+		nLanes = n;
+	}
+	return nLanes;
+}
+
+/* Scratchpad reused by every scrypt call on a thread, sized for the widest kernel in use. */
+struct CScryptScratchpad
+{
+	char *pbuf;
+	CScryptScratchpad() : pbuf((char *)malloc(131072 * scrypt_best_throughput() + 63))
+	{
+		if (!pbuf)
+			throw std::bad_alloc();
+	}
+	~CScryptScratchpad() { free(pbuf); }
+};
+
+static boost::thread_specific_ptr<CScryptScratchpad> scryptScratchpad;
+
+static char *scrypt_scratchpad()
+{
+	if (!scryptScratchpad.get())
+		scryptScratchpad.reset(new CScryptScratchpad());
+	return scryptScratchpad->pbuf;
+}
+
+static inline void scrypt_1024_1_1_256_sp_1way(const char *input, char *output, char *scratchpad)
 {
-	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
 #if defined(USE_SSE2)
         // Detection would work, but in cases where we KNOW it always has SSE2,
         // it is faster to use directly than to use a function pointer or conditional.
@@ -321,3 +364,28 @@ void scrypt_1024_1_1_256(const char *input, char *output)
         scrypt_1024_1_1_256_sp_generic(input, output, scratchpad);
 #endif
 }
+
+void scrypt_1024_1_1_256(const char *input, char *output)
+{
+	scrypt_1024_1_1_256_sp_1way(input, output, scrypt_scratchpad());
+}
+
+void scrypt_1024_1_1_256_multi(const char *input, char *output, unsigned int nCount)
+{
+	char *scratchpad = scrypt_scratchpad();
+	int nLanes = scrypt_best_throughput();
+	unsigned int i = 0;
+
+#if defined(USE_AVX2)
+	if (nLanes >= 8)
+		for (; i + 8 <= nCount; i += 8)
+			scrypt_1024_1_1_256_sp_avx2_8way(input + 80 * i, output + 32 * i, scratchpad);
+#endif
+#if defined(USE_SSE2)
+	if (nLanes >= 4)
+		for (; i + 4 <= nCount; i += 4)
+			scrypt_1024_1_1_256_sp_sse2_4way(input + 80 * i, output + 32 * i, scratchpad);
+#endif
+	for (; i < nCount; i++)
+		scrypt_1024_1_1_256_sp_1way(input + 80 * i, output + 32 * i, scratchpad);
+}
@@ -5,12 +5,22 @@
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
 void scrypt_1024_1_1_256(const char *input, char *output);
+/* Hash nCount consecutive 80-byte inputs into nCount consecutive 32-byte outputs,
+   using the widest multi-lane kernel the CPU supports. */
+void scrypt_1024_1_1_256_multi(const char *input, char *output, unsigned int nCount);
+/* Number of inputs hashed per multi-lane kernel call (1, 4 or 8) */
+int scrypt_best_throughput();
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
 #if defined(USE_SSE2)
 extern void scrypt_detect_sse2(unsigned int cpuid_edx);
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp)(const char *input, char *output, char *scratchpad);
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad);
+#endif
+
+#if defined(USE_AVX2)
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad);
 #endif
 
 void
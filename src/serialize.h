@@ -1371,4 +1371,40 @@ public:
     }
 };
 
+/** Deserialize from a byte range owned by someone else, such as a memory
+ *  mapped file, without copying it into a CDataStream first. */
+class CBufferReader
+{
+private:
+    const char *pbegin;
+    const char *pend;
+    int nType;
+    int nVersion;
+
+public:
+    CBufferReader(const unsigned char *pbeginIn, const unsigned char *pendIn, int nTypeIn, int nVersionIn) :
+        pbegin((const char*)pbeginIn), pend((const char*)pendIn), nType(nTypeIn), nVersion(nVersionIn) {
+    }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    size_t size() const { return pend - pbegin; }
+    bool empty() const { return pbegin == pend; }
+
+    CBufferReader& read(char *pch, size_t nSize) {
+        if (nSize > (size_t)(pend - pbegin))
+            throw std::ios_base::failure("CBufferReader::read() : end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CBufferReader& operator>>(T& obj) {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 #endif
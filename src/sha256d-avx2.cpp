@@ -0,0 +1,23 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Must be compiled with -mavx2; only called after a runtime AVX2 check.
+
+#include "sha256d.h"
+
+#include <immintrin.h>
+
+#define NWAY            8
+#define vec_t           __m256i
+#define VADD(a, b)      _mm256_add_epi32(a, b)
+#define VXOR(a, b)      _mm256_xor_si256(a, b)
+#define VAND(a, b)      _mm256_and_si256(a, b)
+#define VOR(a, b)       _mm256_or_si256(a, b)
+#define VSHL(a, n)      _mm256_slli_epi32(a, n)
+#define VSHR(a, n)      _mm256_srli_epi32(a, n)
+#define VSET1(x)        _mm256_set1_epi32(x)
+#define VNONCE(n)       _mm256_add_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))
+#define SHA256D_SCAN_NWAY sha256d_scan_8way
+
+#include "sha256d-nway.h"
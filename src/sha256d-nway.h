@@ -0,0 +1,90 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Vertical N-way SHA256d kernel body, shared by sha256d-sse2.cpp and
+// sha256d-avx2.cpp. Each vector holds the same SHA-256 word for N nonces.
+// The including file defines the vector type and operations:
+//   NWAY, vec_t, VADD, VXOR, VAND, VOR, VSHL, VSHR, VSET1, VNONCE(n),
+//   SHA256D_SCAN_NWAY (name of the exported scan function)
+//
+
+static const uint32_t sha256_k_nway[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_h_nway[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define VROTR(x, n)     VOR(VSHR(x, n), VSHL(x, 32 - (n)))
+#define VCh(x, y, z)    VXOR(VAND(x, VXOR(y, z)), z)
+#define VMaj(x, y, z)   VOR(VAND(x, VOR(y, z)), VAND(y, z))
+#define VS0(x)          VXOR(VXOR(VROTR(x, 2), VROTR(x, 13)), VROTR(x, 22))
+#define VS1(x)          VXOR(VXOR(VROTR(x, 6), VROTR(x, 11)), VROTR(x, 25))
+#define Vs0(x)          VXOR(VXOR(VROTR(x, 7), VROTR(x, 18)), VSHR(x, 3))
+#define Vs1(x)          VXOR(VXOR(VROTR(x, 17), VROTR(x, 19)), VSHR(x, 10))
+
+static inline void sha256_transform_nway(vec_t *state, const vec_t *block)
+{
+    vec_t W[64];
+    vec_t a = state[0], b = state[1], c = state[2], d = state[3];
+    vec_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 16; i++)
+        W[i] = block[i];
+    for (int i = 16; i < 64; i++)
+        W[i] = VADD(VADD(Vs1(W[i - 2]), W[i - 7]), VADD(Vs0(W[i - 15]), W[i - 16]));
+
+    for (int i = 0; i < 64; i++)
+    {
+        vec_t t1 = VADD(VADD(h, VS1(e)), VADD(VCh(e, f, g), VADD(VSET1(sha256_k_nway[i]), W[i])));
+        vec_t t2 = VADD(VS0(a), VMaj(a, b, c));
+        h = g; g = f; f = e; e = VADD(d, t1);
+        d = c; c = b; b = a; a = VADD(t1, t2);
+    }
+
+    state[0] = VADD(state[0], a); state[1] = VADD(state[1], b);
+    state[2] = VADD(state[2], c); state[3] = VADD(state[3], d);
+    state[4] = VADD(state[4], e); state[5] = VADD(state[5], f);
+    state[6] = VADD(state[6], g); state[7] = VADD(state[7], h);
+}
+
+void SHA256D_SCAN_NWAY(uint32_t *phash, const uint32_t *pmidstate, const uint32_t *pdata, uint32_t nNonce)
+{
+    vec_t S[8], W[16];
+    union {
+        vec_t v[8];
+        uint32_t u[8][NWAY];
+    } H;
+
+    for (int i = 0; i < 8; i++)
+        S[i] = VSET1(pmidstate[i]);
+    for (int i = 0; i < 16; i++)
+        W[i] = VSET1(pdata[i]);
+    W[3] = VNONCE(nNonce);
+    sha256_transform_nway(S, W);
+
+    // Second block: the 32-byte first hash plus fixed padding
+    for (int i = 0; i < 8; i++)
+        W[i] = S[i];
+    W[8] = VSET1(0x80000000);
+    for (int i = 9; i < 15; i++)
+        W[i] = VSET1(0);
+    W[15] = VSET1(256);
+    for (int i = 0; i < 8; i++)
+        H.v[i] = VSET1(sha256_h_nway[i]);
+    sha256_transform_nway(H.v, W);
+
+    for (int l = 0; l < NWAY; l++)
+        for (int i = 0; i < 8; i++)
+            phash[8 * l + i] = H.u[i][l];
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 compression using the x86 SHA extensions. Must be compiled with
+// -msse4.1 -msha; only called after a runtime cpuid check.
+
+#include "sha256d.h"
+
+#include <immintrin.h>
+
+static const uint32_t sha256_k_shani[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Four rounds using message words m (already scheduled)
+#define QROUND(i, m) \
+    msg = _mm_add_epi32(m, _mm_load_si128((const __m128i*)&sha256_k_shani[4 * (i)])); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+    msg = _mm_shuffle_epi32(msg, 0x0E); \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+// Extend the schedule: m0 becomes the words 16 positions after it
+#define SCHEDULE(m0, m1, m2, m3) \
+    m0 = _mm_sha256msg1_epu32(m0, m1); \
+    m0 = _mm_add_epi32(m0, _mm_alignr_epi8(m3, m2, 4)); \
+    m0 = _mm_sha256msg2_epu32(m0, m3);
+
+void sha256_transform_shani(uint32_t *state, const uint32_t *block)
+{
+    __m128i state0, state1, msg, tmp, save0, save1;
+    __m128i m0, m1, m2, m3;
+
+    // Load state as ABEF / CDGH
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+    save0 = state0;
+    save1 = state1;
+
+    // Message words are already in native order, no byte swap needed
+    m0 = _mm_loadu_si128((const __m128i*)&block[0]);
+    m1 = _mm_loadu_si128((const __m128i*)&block[4]);
+    m2 = _mm_loadu_si128((const __m128i*)&block[8]);
+    m3 = _mm_loadu_si128((const __m128i*)&block[12]);
+
+    QROUND(0, m0);
+    QROUND(1, m1);
+    QROUND(2, m2);
+    QROUND(3, m3);
+    for (int i = 4; i < 16; i += 4)
+    {
+        SCHEDULE(m0, m1, m2, m3);
+        QROUND(i, m0);
+        SCHEDULE(m1, m2, m3, m0);
+        QROUND(i + 1, m1);
+        SCHEDULE(m2, m3, m0, m1);
+        QROUND(i + 2, m2);
+        SCHEDULE(m3, m0, m1, m2);
+        QROUND(i + 3, m3);
+    }
+
+    state0 = _mm_add_epi32(state0, save0);
+    state1 = _mm_add_epi32(state1, save1);
+
+    // Store back as ABCD / EFGH
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
@@ -0,0 +1,21 @@
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256d.h"
+
+#include <emmintrin.h>
+
+#define NWAY            4
+#define vec_t           __m128i
+#define VADD(a, b)      _mm_add_epi32(a, b)
+#define VXOR(a, b)      _mm_xor_si128(a, b)
+#define VAND(a, b)      _mm_and_si128(a, b)
+#define VOR(a, b)       _mm_or_si128(a, b)
+#define VSHL(a, n)      _mm_slli_epi32(a, n)
+#define VSHR(a, n)      _mm_srli_epi32(a, n)
+#define VSET1(x)        _mm_set1_epi32(x)
+#define VNONCE(n)       _mm_set_epi32((n) + 3, (n) + 2, (n) + 1, (n))
+#define SHA256D_SCAN_NWAY sha256d_scan_4way
+
+#include "sha256d-nway.h"
@@ -0,0 +1,217 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256d.h"
+#include "util.h"
+
+#include <string.h>
+#if defined(USE_SHANI) && defined(__GNUC__)
+#include <cpuid.h>
+#endif
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_h[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR(x, n)      (((x) >> (n)) | ((x) << (32 - (n))))
+#define Ch(x, y, z)     ((x & (y ^ z)) ^ z)
+#define Maj(x, y, z)    ((x & (y | z)) | (y & z))
+#define S0(x)           (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x)           (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define s0(x)           (ROTR(x, 7) ^ ROTR(x, 18) ^ (x >> 3))
+#define s1(x)           (ROTR(x, 17) ^ ROTR(x, 19) ^ (x >> 10))
+
+void sha256_transform(uint32_t *state, const uint32_t *block)
+{
+    uint32_t W[64];
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 16; i++)
+        W[i] = block[i];
+    for (int i = 16; i < 64; i++)
+        W[i] = s1(W[i - 2]) + W[i - 7] + s0(W[i - 15]) + W[i - 16];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + S1(e) + Ch(e, f, g) + sha256_k[i] + W[i];
+        uint32_t t2 = S0(a) + Maj(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256d_scan_1way(uint32_t *phash, const uint32_t *pmidstate, const uint32_t *pdata, uint32_t nNonce)
+{
+    uint32_t data[16], hash1[16];
+
+    memcpy(data, pdata, sizeof(data));
+    data[3] = nNonce;
+    memcpy(hash1, pmidstate, 32);
+    sha256_transform(hash1, data);
+
+    // Second block: the 32-byte first hash plus fixed padding
+    hash1[8] = 0x80000000;
+    memset(&hash1[9], 0, 6 * 4);
+    hash1[15] = 256;
+    memcpy(phash, sha256_h, 32);
+    sha256_transform(phash, hash1);
+}
+
+static const char* sha256d_kernel_name[SHA256D_KERNELS] = {
+    "generic", "4-way sse2", "8-way avx2", "sha-ni"
+};
+
+bool sha256d_kernel_supported(int nKernel)
+{
+    switch (nKernel)
+    {
+    case SHA256D_GENERIC:
+        return true;
+#if defined(USE_SSE2)
+    case SHA256D_SSE2_4WAY:
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
+        return true;
+#elif defined(__GNUC__)
+        return __builtin_cpu_supports("sse2");
+#else
+        return false;
+#endif
+#endif
+#if defined(USE_AVX2) && defined(__GNUC__)
+    case SHA256D_AVX2_8WAY:
+        return __builtin_cpu_supports("avx2");
+#endif
+#if defined(USE_SHANI) && defined(__GNUC__)
+    case SHA256D_SHANI:
+    {
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, NULL) < 7)
+            return false;
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        return (ebx & (1 << 29)) && __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+static int nKernelSelected = -1;
+
+static int sha256d_detect()
+{
+    if (nKernelSelected == -1)
+    {
+        // Later kernels are faster: SHA extensions beat an 8-way AVX2
+        // kernel by a wide margin
+        int n = SHA256D_KERNELS - 1;
+        while (!sha256d_kernel_supported(n))
+            n--;
+        printf("sha256d: using %s kernel for nonce scanning.\n", sha256d_kernel_name[n]);
+        nKernelSelected = n;
+    }
+    return nKernelSelected;
+}
+
+int sha256d_select_kernel(int nKernel)
+{
+    int nPrev = sha256d_detect();
+    if (sha256d_kernel_supported(nKernel))
+        nKernelSelected = nKernel;
+    return nPrev;
+}
+
+int sha256d_best_throughput()
+{
+    switch (sha256d_detect())
+    {
+    case SHA256D_SSE2_4WAY: return 4;
+    case SHA256D_AVX2_8WAY: return 8;
+    default:                return 1;
+    }
+}
+
+unsigned int ScanHash_SHA256d(const char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone)
+{
+    const uint32_t* midstate = (const uint32_t*)pmidstate;
+    const uint32_t* data = (const uint32_t*)pdata;
+    unsigned int& nNonce = *(unsigned int*)(pdata + 12);
+    const int nKernel = sha256d_detect();
+    const unsigned int nLanes = sha256d_best_throughput();
+    uint32_t hashes[8 * 8];
+
+    nHashesDone = 0;
+    for (;;)
+    {
+        unsigned int nFirst = nNonce + 1;
+        switch (nKernel)
+        {
+#if defined(USE_SSE2)
+        case SHA256D_SSE2_4WAY:
+            sha256d_scan_4way(hashes, midstate, data, nFirst);
+            break;
+#endif
+#if defined(USE_AVX2)
+        case SHA256D_AVX2_8WAY:
+            sha256d_scan_8way(hashes, midstate, data, nFirst);
+            break;
+#endif
+#if defined(USE_SHANI)
+        case SHA256D_SHANI:
+            // Hash pdata using pmidstate as the starting state into
+            // pre-formatted buffer phash1, then hash phash1 into hashes
+            nNonce = nFirst;
+            memcpy(phash1, pmidstate, 32);
+            sha256_transform_shani((uint32_t*)phash1, data);
+            memcpy(hashes, sha256_h, 32);
+            sha256_transform_shani(hashes, (const uint32_t*)phash1);
+            break;
+#endif
+        default:
+            nNonce = nFirst;
+            memcpy(phash1, pmidstate, 32);
+            sha256_transform((uint32_t*)phash1, data);
+            memcpy(hashes, sha256_h, 32);
+            sha256_transform(hashes, (const uint32_t*)phash1);
+            break;
+        }
+
+        // Return the nonce if the hash has at least some zero bits,
+        // caller will check if it has enough to reach the target
+        for (unsigned int i = 0; i < nLanes; i++)
+        {
+            if ((hashes[8 * i + 7] & 0xffff) == 0)
+            {
+                nNonce = nFirst + i;
+                nHashesDone += i + 1;
+                memcpy(phash, &hashes[8 * i], 32);
+                return nNonce;
+            }
+        }
+        nNonce = nFirst + nLanes - 1;
+        nHashesDone += nLanes;
+
+        // If nothing found after trying for a while, return -1
+        if ((nNonce & 0xffff) < nLanes)
+            return (unsigned int) -1;
+        if ((nNonce & 0xfff) < nLanes)
+            boost::this_thread::interruption_point();
+    }
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SHA256D_H
+#define BITCOIN_SHA256D_H
+
+#include <stdint.h>
+
+//
+// SHA256d nonce scanning for the sha256d miner.
+//
+// All buffers use the layout prepared by FormatHashBuffers: 32-bit words
+// holding the big endian SHA-256 message/state words in native byte order.
+// pdata is the second 64-byte chunk of the header with the nonce in word 3.
+//
+
+/** SHA-256 compression of one block of 16 message words into state */
+void sha256_transform(uint32_t *state, const uint32_t *block);
+
+/** Double-SHA256 of nLanes consecutive nonces starting at nNonce.
+    State words of lane l are written to phash[8 * l .. 8 * l + 7]. */
+void sha256d_scan_1way(uint32_t *phash, const uint32_t *pmidstate, const uint32_t *pdata, uint32_t nNonce);
+#if defined(USE_SSE2)
+void sha256d_scan_4way(uint32_t *phash, const uint32_t *pmidstate, const uint32_t *pdata, uint32_t nNonce);
+#endif
+#if defined(USE_AVX2)
+void sha256d_scan_8way(uint32_t *phash, const uint32_t *pmidstate, const uint32_t *pdata, uint32_t nNonce);
+#endif
+#if defined(USE_SHANI)
+void sha256_transform_shani(uint32_t *state, const uint32_t *block);
+#endif
+
+/** Nonce scanning kernels, slowest first */
+enum
+{
+    SHA256D_GENERIC,
+    SHA256D_SSE2_4WAY,
+    SHA256D_AVX2_8WAY,
+    SHA256D_SHANI,
+    SHA256D_KERNELS
+};
+
+/** Whether a kernel is compiled in and this CPU can run it */
+bool sha256d_kernel_supported(int nKernel);
+
+/** Make ScanHash_SHA256d use a kernel other than the fastest one, if it is
+    supported; returns the kernel used until now */
+int sha256d_select_kernel(int nKernel);
+
+/** Number of nonces hashed per kernel call by the kernel in use */
+int sha256d_best_throughput();
+
+/** Scan nonces after the one in pdata until a hash with its top 16 bits clear
+    is found; returns that nonce (also left in pdata) with its hash in phash.
+    Returns -1 after trying up to the next multiple of 0x10000. */
+unsigned int ScanHash_SHA256d(const char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone);
+
+#endif
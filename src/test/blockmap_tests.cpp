@@ -0,0 +1,86 @@
+#include <boost/test/unit_test.hpp>
+
+#include <set>
+#include <vector>
+
+#include "main.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(blockmap_tests)
+
+BOOST_AUTO_TEST_CASE(blockmap_find_insert)
+{
+    CBlockMap map;
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.find(1) == map.end());
+    BOOST_CHECK(map.begin() == map.end());
+
+    // Enough entries to grow the table several times
+    std::vector<CBlockIndex> vIndex(5000);
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        vIndex[i].hashBlock = GetRandHash();
+        BOOST_CHECK(map.insert(&vIndex[i]) == &vIndex[i]);
+    }
+    BOOST_CHECK_EQUAL(map.size(), vIndex.size());
+
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        const uint256 &hash = vIndex[i].hashBlock;
+        CBlockMap::const_iterator it = map.find(hash);
+        BOOST_CHECK(it != map.end());
+        BOOST_CHECK(it->first == hash);
+        BOOST_CHECK(it->second == &vIndex[i]);
+        BOOST_CHECK(map[hash] == &vIndex[i]);
+        BOOST_CHECK_EQUAL(map.count(hash), 1U);
+    }
+
+    // A hash that matches an entry in its low 64 bits only
+    uint256 hashNear = vIndex[0].hashBlock;
+    *(hashNear.end() - 1) ^= 1;
+    BOOST_CHECK(map.find(hashNear) == map.end());
+    BOOST_CHECK(map[hashNear] == NULL);
+    BOOST_CHECK_EQUAL(map.count(GetRandHash()), 0U);
+    BOOST_CHECK_EQUAL(map.size(), vIndex.size());
+
+    // A second entry for a hash leaves the first in place
+    CBlockIndex dup;
+    dup.hashBlock = vIndex[7].hashBlock;
+    BOOST_CHECK(map.insert(&dup) == &vIndex[7]);
+    BOOST_CHECK(map[dup.hashBlock] == &vIndex[7]);
+    BOOST_CHECK_EQUAL(map.size(), vIndex.size());
+
+    // Iteration visits every entry once
+    std::set<CBlockIndex*> setSeen;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, map) {
+        BOOST_CHECK(item.first == item.second->hashBlock);
+        BOOST_CHECK(setSeen.insert(item.second).second);
+    }
+    BOOST_CHECK_EQUAL(setSeen.size(), vIndex.size());
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK(map[vIndex[0].hashBlock] == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(blockmap_reserve)
+{
+    CBlockMap map;
+    std::vector<CBlockIndex> vIndex(1000);
+    for (unsigned int i = 0; i < vIndex.size(); i++)
+        vIndex[i].hashBlock = GetRandHash();
+
+    // Inserting what was reserved for does not grow the table
+    map.reserve(vIndex.size());
+    size_t nUsage = map.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > 0);
+    for (unsigned int i = 0; i < vIndex.size(); i++)
+        map.insert(&vIndex[i]);
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), nUsage);
+
+    // Reserving less than what is there keeps the entries
+    map.reserve(10);
+    for (unsigned int i = 0; i < vIndex.size(); i++)
+        BOOST_CHECK(map[vIndex[i].hashBlock] == &vIndex[i]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
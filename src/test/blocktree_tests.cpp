@@ -0,0 +1,103 @@
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <map>
+
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+// What the loader is responsible for in each entry
+static std::map<uint256, std::string> LoadedEntries()
+{
+    std::map<uint256, std::string> mapEntries;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex) {
+        const CBlockIndex *pindex = item.second;
+        BOOST_CHECK(pindex->GetBlockHash() == item.first);
+        mapEntries[item.first] = strprintf("%s %d %u %u %d %u %u %d %u %u %u %s %s",
+            pindex->pprev ? pindex->pprev->GetBlockHash().ToString().c_str() : "-",
+            pindex->nHeight, pindex->nStatus, pindex->nTx, pindex->nFile, pindex->nDataPos, pindex->nUndoPos,
+            pindex->nVersion, pindex->nTime, pindex->nBits, pindex->nNonce,
+            pindex->hashMerkleRoot.ToString().c_str(), pindex->GetChainWork().ToString().c_str());
+    }
+    return mapEntries;
+}
+
+BOOST_AUTO_TEST_SUITE(blocktree_tests)
+
+BOOST_AUTO_TEST_CASE(blocktree_load_threads)
+{
+    CBlockTreeDB *pblocktreeSaved = pblocktree;
+    CBlockIndex *pindexGenesisSaved = pindexGenesisBlock;
+    std::vector<CBlockIndex*> vIndexSaved;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vIndexSaved.push_back(item.second);
+    mapBlockIndex.clear();
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+
+    // A tree with forks, and one entry whose parent is not in the database.
+    // Scrypt headers are not checked for work when loaded.
+    std::vector<CBlockIndex> vIndex(3000);
+    const unsigned int nOrphan = 1500;
+    const uint256 hashMissing = GetRandHash();
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        CBlockIndex *pprev = NULL;
+        if (i > 0 && i != nOrphan)
+            pprev = &vIndex[GetRand(8) == 0 ? GetRand(i) : i - 1];
+        CBlockHeader header;
+        header.nVersion = BLOCK_VERSION_DEFAULT | BLOCK_VERSION_SCRYPT;
+        header.hashPrevBlock = pprev ? pprev->GetBlockHash() : (i == nOrphan ? hashMissing : uint256(0));
+        header.hashMerkleRoot = GetRandHash();
+        header.nTime = 1400000000 + i * 60;
+        header.nBits = 0x1e0fffff;
+        header.nNonce = GetRand(1 << 30);
+        vIndex[i] = CBlockIndex(header);
+        vIndex[i].hashBlock = header.GetHash();
+        vIndex[i].pprev = pprev;
+        vIndex[i].nHeight = pprev ? pprev->nHeight + 1 : (i == nOrphan ? 1000 : 0);
+        vIndex[i].nStatus = BLOCK_VALID_TREE | (GetRand(2) ? BLOCK_HAVE_DATA : 0);
+        vIndex[i].nTx = 1 + GetRand(100);
+        vIndex[i].nFile = i / 500;
+        vIndex[i].nDataPos = 8 + GetRand(1 << 20);
+    }
+
+    // Written in no particular order
+    std::vector<unsigned int> vOrder;
+    for (unsigned int i = 0; i < vIndex.size(); i++)
+        vOrder.push_back(i);
+    std::random_shuffle(vOrder.begin(), vOrder.end(), GetRandInt);
+    BOOST_FOREACH(unsigned int i, vOrder) {
+        CDiskBlockIndex diskindex(&vIndex[i]);
+        if (i == nOrphan)
+            diskindex.hashPrev = hashMissing;
+        BOOST_CHECK(pblocktree->WriteBlockIndex(diskindex));
+    }
+
+    BOOST_CHECK(pblocktree->LoadBlockIndexGuts(1));
+    std::map<uint256, std::string> mapSingle = LoadedEntries();
+    BOOST_CHECK_EQUAL(mapSingle.size(), vIndex.size() + 1);
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        const CBlockIndex *pindex = mapBlockIndex[vIndex[i].GetBlockHash()];
+        BOOST_CHECK(pindex != NULL && pindex != &vIndex[i]);
+        if (i == nOrphan)
+            BOOST_CHECK(pindex->pprev->GetBlockHash() == hashMissing && pindex->pprev->pprev == NULL);
+        else if (i > 0)
+            BOOST_CHECK(pindex->pprev->GetBlockHash() == vIndex[i].pprev->GetBlockHash());
+        BOOST_CHECK_EQUAL(pindex->nHeight, vIndex[i].nHeight);
+    }
+
+    for (int nThreads = 2; nThreads <= 32; nThreads *= 2) {
+        mapBlockIndex.clear();
+        BOOST_CHECK(pblocktree->LoadBlockIndexGuts(nThreads));
+        BOOST_CHECK(LoadedEntries() == mapSingle);
+    }
+
+    delete pblocktree;
+    pblocktree = pblocktreeSaved;
+    pindexGenesisBlock = pindexGenesisSaved;
+    mapBlockIndex.clear();
+    BOOST_FOREACH(CBlockIndex *pindex, vIndexSaved)
+        mapBlockIndex.insert(pindex);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
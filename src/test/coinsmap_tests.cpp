@@ -0,0 +1,525 @@
+#include <boost/test/unit_test.hpp>
+
+#include "coinsmap.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <map>
+#include <boost/bind.hpp>
+
+// Base view that keeps coins in a std::map and records what reaches it
+class CCoinsViewTest : public CCoinsView
+{
+public:
+    std::map<uint256, CCoins> mapCoins;
+    std::map<uint256, unsigned char> mapWritten;
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) {
+        std::map<uint256, CCoins>::iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+
+    bool HaveCoins(const uint256 &txid) { return mapCoins.count(txid) > 0; }
+
+    bool BatchWrite(CCoinsMap &mapCoinsIn, CBlockIndex *pindex, const CCoinsStats &statsChange) {
+        for (CCoinsMap::const_iterator it = mapCoinsIn.begin(); it != mapCoinsIn.end(); it++) {
+            const CCoinsCacheEntry &entry = it->second;
+            if (!(entry.flags & CCoinsCacheEntry::DIRTY))
+                continue;
+            mapWritten[it->first] = entry.flags;
+            if ((entry.flags & CCoinsCacheEntry::FRESH) && entry.coins.IsPruned())
+                continue;
+            if (entry.coins.IsPruned())
+                mapCoins.erase(it->first);
+            else
+                mapCoins[it->first] = entry.coins;
+        }
+        return true;
+    }
+};
+
+// Base view whose writes wait until the test opens the gate
+class CCoinsViewGated : public CCoinsViewTest
+{
+public:
+    boost::mutex gate;
+    CBlockIndex *pindexBest;
+
+    CCoinsViewGated() : pindexBest(NULL) {}
+
+    CBlockIndex *GetBestBlock() { return pindexBest; }
+
+    bool BatchWrite(CCoinsMap &mapCoinsIn, CBlockIndex *pindex, const CCoinsStats &statsChange) {
+        boost::unique_lock<boost::mutex> lock(gate);
+        pindexBest = pindex;
+        return CCoinsViewTest::BatchWrite(mapCoinsIn, pindex, statsChange);
+    }
+};
+
+static CCoins CoinsWithOutputs(unsigned int nOutputs)
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 1;
+    coins.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        coins.vout[i].nValue = i + 1;
+        coins.vout[i].scriptPubKey << OP_TRUE;
+    }
+    return coins;
+}
+
+BOOST_AUTO_TEST_SUITE(coinsmap_tests)
+
+BOOST_AUTO_TEST_CASE(coinsmap_random)
+{
+    CCoinsMap map;
+    std::map<uint256, int> mapExpected;
+    std::map<uint256, CCoinsCacheEntry*> mapEntries;
+    std::vector<uint256> vKeys;
+    for (int i = 0; i < 2000; i++)
+        vKeys.push_back(GetRandHash());
+
+    for (int nStep = 0; nStep < 20000; nStep++) {
+        const uint256 &key = vKeys[GetRand(vKeys.size())];
+        if (GetRand(3) == 0) {
+            CCoinsMap::iterator it = map.find(key);
+            BOOST_CHECK((it != map.end()) == (mapExpected.count(key) > 0));
+            if (it != map.end()) {
+                map.erase(it);
+                mapExpected.erase(key);
+                mapEntries.erase(key);
+            }
+        } else {
+            std::pair<CCoinsMap::iterator, bool> ret = map.insert(key);
+            BOOST_CHECK(ret.second == (mapExpected.count(key) == 0));
+            BOOST_CHECK(ret.first->first == key);
+            if (ret.second) {
+                ret.first->second.coins.nHeight = nStep;
+                mapExpected[key] = nStep;
+                mapEntries[key] = &ret.first->second;
+            }
+        }
+    }
+
+    // Entries never moved while the table grew and shrank around them
+    BOOST_CHECK_EQUAL(map.size(), mapExpected.size());
+    size_t nCount = 0;
+    for (CCoinsMap::const_iterator it = map.begin(); it != map.end(); it++) {
+        BOOST_CHECK_EQUAL(it->second.coins.nHeight, mapExpected[it->first]);
+        BOOST_CHECK(&it->second == mapEntries[it->first]);
+        nCount++;
+    }
+    BOOST_CHECK_EQUAL(nCount, mapExpected.size());
+    for (std::map<uint256, int>::iterator it = mapExpected.begin(); it != mapExpected.end(); it++)
+        BOOST_CHECK(map.count(it->first) == 1);
+
+    CCoinsMap other;
+    other.swap(map);
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK_EQUAL(other.size(), mapExpected.size());
+    BOOST_CHECK(other.DynamicMemoryUsage() > 0);
+    other.clear();
+    BOOST_CHECK(other.empty());
+    BOOST_CHECK_EQUAL(other.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(coinsview_flags)
+{
+    CCoinsViewTest base;
+    uint256 hashOld = GetRandHash(), hashRead = GetRandHash();
+    base.mapCoins[hashOld] = CoinsWithOutputs(2);
+    base.mapCoins[hashRead] = CoinsWithOutputs(2);
+
+    CCoinsViewCache tip(base);
+    uint256 hashNew = GetRandHash(), hashTemp = GetRandHash(), hashChild = GetRandHash(), hashTip = GetRandHash();
+    {
+        CCoinsViewCache view(tip);
+
+        // Entries that were only read are not written back
+        BOOST_CHECK(view.HaveCoins(hashRead));
+        BOOST_CHECK_EQUAL(view.AccessCoins(hashRead).vout.size(), 2U);
+
+        // Spending from an existing transaction is written back
+        CTxInUndo undo;
+        BOOST_CHECK(view.GetCoins(hashOld).Spend(COutPoint(hashOld, 0), undo));
+
+        // New coins, one of which is spent again at once
+        BOOST_CHECK(!view.HaveCoins(hashNew) && !view.HaveCoins(hashTemp));
+        BOOST_CHECK(view.SetNewCoins(hashNew, CoinsWithOutputs(3)));
+        BOOST_CHECK(view.SetNewCoins(hashTemp, CoinsWithOutputs(1)));
+        BOOST_CHECK(view.GetCoins(hashTemp).Spend(0));
+
+        // A transaction created and spent in a nested view never reaches its base
+        {
+            CCoinsViewCache child(view);
+            BOOST_CHECK(!child.HaveCoins(hashChild));
+            BOOST_CHECK(child.SetNewCoins(hashChild, CoinsWithOutputs(1)));
+            BOOST_CHECK(child.GetCoins(hashChild).Spend(0));
+            BOOST_CHECK(child.Flush());
+        }
+        BOOST_CHECK(!view.HaveCoins(hashChild));
+        BOOST_CHECK(view.Flush());
+    }
+    BOOST_CHECK(!tip.HaveCoins(hashTemp));
+
+    // Spent at the bottom cache, so the database is told it may drop it
+    BOOST_CHECK(!tip.HaveCoins(hashTip));
+    BOOST_CHECK(tip.SetNewCoins(hashTip, CoinsWithOutputs(1)));
+    BOOST_CHECK(tip.GetCoins(hashTip).Spend(0));
+
+    // Without a lookup first the base has to be told, even if it had nothing
+    uint256 hashBlind = GetRandHash();
+    BOOST_CHECK(tip.SetCoins(hashBlind, CoinsWithOutputs(1)));
+    BOOST_CHECK(tip.GetCoins(hashBlind).Spend(0));
+
+    size_t nUsage = tip.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > 0);
+    BOOST_CHECK(tip.Flush());
+    BOOST_CHECK(tip.DynamicMemoryUsage() < nUsage);
+
+    BOOST_CHECK_EQUAL(base.mapWritten.size(), 4U);
+    BOOST_CHECK(base.mapWritten.count(hashTip) && (base.mapWritten[hashTip] & CCoinsCacheEntry::FRESH));
+    BOOST_CHECK(base.mapWritten.count(hashBlind) && !(base.mapWritten[hashBlind] & CCoinsCacheEntry::FRESH));
+    BOOST_CHECK(base.mapWritten.count(hashOld) && !(base.mapWritten[hashOld] & CCoinsCacheEntry::FRESH));
+    BOOST_CHECK(base.mapWritten.count(hashNew) && (base.mapWritten[hashNew] & CCoinsCacheEntry::FRESH));
+    BOOST_CHECK(!base.mapWritten.count(hashTemp));
+    BOOST_CHECK(!base.mapWritten.count(hashRead));
+    BOOST_CHECK(!base.mapWritten.count(hashChild));
+
+    BOOST_CHECK(!base.mapCoins[hashOld].IsAvailable(0));
+    BOOST_CHECK(base.mapCoins[hashOld].IsAvailable(1));
+    BOOST_CHECK_EQUAL(base.mapCoins[hashNew].vout.size(), 3U);
+    BOOST_CHECK(!base.mapCoins.count(hashTip));
+}
+
+BOOST_AUTO_TEST_CASE(coinsview_usage)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache view(base);
+    size_t nEmpty = view.DynamicMemoryUsage();
+
+    uint256 hash = GetRandHash();
+    BOOST_CHECK(view.SetCoins(hash, CoinsWithOutputs(100)));
+    size_t nFull = view.DynamicMemoryUsage();
+    BOOST_CHECK(nFull >= nEmpty + 100 * sizeof(CTxOut));
+
+    // Modifications through the returned reference are counted too
+    CCoins &coins = view.GetCoins(hash);
+    coins.vout.resize(1000);
+    BOOST_CHECK(view.DynamicMemoryUsage() >= nFull + 900 * sizeof(CTxOut));
+    view.GetCoins(hash) = CCoins();
+    BOOST_CHECK(view.DynamicMemoryUsage() < nFull);
+}
+
+BOOST_AUTO_TEST_CASE(coinsview_flusher)
+{
+    CCoinsViewGated base;
+    uint256 hashOld = GetRandHash(), hashNew = GetRandHash();
+    base.mapCoins[hashOld] = CoinsWithOutputs(2);
+    CBlockIndex index1, index2;
+
+    CCoinsViewFlusher flusher(base);
+    CCoinsViewCache tip(flusher);
+    {
+        // Hold the write back, the flushed coins are still visible meanwhile
+        boost::unique_lock<boost::mutex> lock(base.gate);
+        BOOST_CHECK(tip.SetCoins(hashNew, CoinsWithOutputs(1)));
+        BOOST_CHECK(tip.GetCoins(hashOld).Spend(0));
+        BOOST_CHECK(tip.GetCoins(hashOld).Spend(1));
+        BOOST_CHECK(tip.SetBestBlock(&index1));
+        size_t nUsage = tip.DynamicMemoryUsage();
+        BOOST_CHECK_EQUAL(flusher.DynamicMemoryUsage(), 0U);
+        BOOST_CHECK(tip.Flush());
+        BOOST_CHECK_EQUAL(tip.GetCacheSize(), 0U);
+
+        // The layer in flight keeps holding the memory the cache gave up
+        BOOST_CHECK(flusher.DynamicMemoryUsage() > 0);
+        BOOST_CHECK(flusher.DynamicMemoryUsage() <= nUsage);
+
+        BOOST_CHECK(base.mapCoins.count(hashOld));
+        BOOST_CHECK(flusher.GetDurableBlock() == NULL);
+        BOOST_CHECK(flusher.GetBestBlock() == &index1);
+        BOOST_CHECK(!tip.HaveCoins(hashOld));
+        BOOST_CHECK(tip.HaveCoins(hashNew));
+
+        // Work on the next layer goes on while the first is written
+        BOOST_CHECK(tip.GetCoins(hashNew).Spend(0));
+    }
+    BOOST_CHECK(flusher.Sync());
+    BOOST_CHECK_EQUAL(flusher.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(!base.mapCoins.count(hashOld));
+    BOOST_CHECK_EQUAL(base.mapCoins[hashNew].vout.size(), 1U);
+    BOOST_CHECK(flusher.GetDurableBlock() == &index1);
+
+    BOOST_CHECK(tip.SetBestBlock(&index2));
+    BOOST_CHECK(tip.Flush());
+    BOOST_CHECK(flusher.Sync());
+    BOOST_CHECK(!base.mapCoins.count(hashNew));
+    BOOST_CHECK(flusher.GetBestBlock() == &index2);
+}
+
+BOOST_AUTO_TEST_CASE(coinsdb_output_layout)
+{
+    CCoinsViewDB db(1 << 20, true);
+    BOOST_CHECK_EQUAL(db.GetLayout(), COINS_LAYOUT_TXID);
+
+    // Records written per transaction survive the conversion
+    uint256 hashOld = GetRandHash(), hashNew = GetRandHash();
+    CCoins coinsOld = CoinsWithOutputs(300);
+    coinsOld.Spend(5);
+    BOOST_CHECK(db.SetCoins(hashOld, coinsOld));
+    BOOST_CHECK(db.UpgradeToOutputLayout());
+    BOOST_CHECK_EQUAL(db.GetLayout(), COINS_LAYOUT_OUTPUT);
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(hashOld, coins));
+    BOOST_CHECK(coins == coinsOld);
+    BOOST_CHECK(!db.HaveCoins(hashNew));
+
+    // Spending single outputs through the cache
+    CTxInUndo undo;
+    {
+        CCoinsViewCache view(db);
+        BOOST_CHECK(view.SetCoins(hashNew, CoinsWithOutputs(2)));
+        BOOST_CHECK(view.SpendCoins(COutPoint(hashOld, 0), undo));
+        BOOST_CHECK(view.SpendCoins(COutPoint(hashOld, 299), undo));
+        coinsOld.Spend(0);
+        coinsOld.Spend(299);
+        coinsOld.Cleanup();
+        BOOST_CHECK(view.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(hashOld, coins));
+    BOOST_CHECK(coins == coinsOld);
+    BOOST_CHECK(db.GetCoins(hashNew, coins));
+    BOOST_CHECK(coins == CoinsWithOutputs(2));
+
+    // Changes passed down a nested cache, then partly undone by a restore
+    {
+        CCoinsViewCache view(db);
+        {
+            CCoinsViewCache viewChild(view);
+            BOOST_CHECK(viewChild.SpendCoins(COutPoint(hashOld, 1), undo));
+            BOOST_CHECK(viewChild.SpendCoins(COutPoint(hashOld, 2), undo));
+            BOOST_CHECK(viewChild.Flush());
+        }
+        CCoins coinsRestored = view.AccessCoins(hashOld);
+        coinsRestored.vout[1] = coinsOld.vout[1];
+        coinsRestored.vout[3].SetNull();
+        BOOST_CHECK(view.SetCoins(hashOld, coinsRestored));
+        coinsOld.Spend(2);
+        coinsOld.Spend(3);
+        BOOST_CHECK(view.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(hashOld, coins));
+    BOOST_CHECK(coins == coinsOld);
+
+    // Spent in full and restored before the flush
+    {
+        CCoinsViewCache view(db);
+        CCoins coinsNew = view.AccessCoins(hashNew);
+        BOOST_CHECK(view.SpendCoins(COutPoint(hashNew, 0), undo));
+        BOOST_CHECK(view.SpendCoins(COutPoint(hashNew, 1), undo));
+        BOOST_CHECK(view.AccessCoins(hashNew).IsPruned());
+        BOOST_CHECK(view.SetCoins(hashNew, coinsNew));
+        BOOST_CHECK(view.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(hashNew, coins));
+    BOOST_CHECK(coins == CoinsWithOutputs(2));
+
+    // Spending the last output removes the transaction
+    {
+        CCoinsViewCache view(db);
+        CCoins &coinsNew = view.GetCoins(hashNew);
+        BOOST_CHECK(coinsNew.Spend(0));
+        BOOST_CHECK(coinsNew.Spend(1));
+        BOOST_CHECK(view.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoins(hashNew));
+    BOOST_CHECK(!db.GetCoins(hashNew, coins));
+}
+
+static bool StatsEqual(const CCoinsStats &a, const CCoinsStats &b)
+{
+    return a.hashSerialized == b.hashSerialized && a.nTransactions == b.nTransactions &&
+           a.nTransactionOutputs == b.nTransactionOutputs && a.nSerializedSize == b.nSerializedSize &&
+           a.nTotalAmount == b.nTotalAmount;
+}
+
+BOOST_AUTO_TEST_CASE(coinsdb_stats)
+{
+    for (int nLayout = 0; nLayout < 2; nLayout++) {
+        CCoinsViewDB db(1 << 20, true, true);
+        if (nLayout)
+            BOOST_CHECK(db.UpgradeToOutputLayout());
+        CCoinsStats statsEmpty;
+        BOOST_CHECK(db.GetStats(statsEmpty));
+        BOOST_CHECK_EQUAL(statsEmpty.nTransactions, 0U);
+
+        std::vector<uint256> vTxid;
+        for (int i = 0; i < 50; i++)
+            vTxid.push_back(GetRandHash());
+        CCoinsViewCache view(db);
+        for (int i = 0; i < 50; i++)
+            BOOST_CHECK(view.SetCoins(vTxid[i], CoinsWithOutputs(1 + i % 5)));
+
+        // Unflushed changes are counted as well
+        CCoinsStats statsCache, statsDB, statsScan;
+        BOOST_CHECK(view.GetStats(statsCache));
+        BOOST_CHECK_EQUAL(statsCache.nTransactions, 50U);
+        BOOST_CHECK_EQUAL(statsCache.nTransactionOutputs, 150U);
+        BOOST_CHECK_EQUAL(statsCache.nTotalAmount, 10 * (1 + 3 + 6 + 10 + 15));
+        BOOST_CHECK(view.Flush());
+        BOOST_CHECK(db.GetStats(statsDB));
+        BOOST_CHECK(StatsEqual(statsCache, statsDB));
+        BOOST_CHECK(db.ComputeStats(statsScan, 4));
+        BOOST_CHECK(StatsEqual(statsDB, statsScan));
+
+        // Partial and full spends, some of them flushed and some not
+        CTxInUndo undo;
+        for (int i = 0; i < 50; i += 3)
+            for (unsigned int n = 0; n < 5; n += 2)
+                view.SpendCoins(COutPoint(vTxid[i], n), undo);
+        BOOST_CHECK(view.Flush());
+        for (int i = 1; i < 50; i += 4)
+            if (view.HaveCoins(vTxid[i]))
+                view.SpendCoins(COutPoint(vTxid[i], 0), undo);
+        BOOST_CHECK(view.GetStats(statsCache));
+        BOOST_CHECK(view.Flush());
+        BOOST_CHECK(db.GetStats(statsDB));
+        BOOST_CHECK(db.ComputeStats(statsScan, 3));
+        BOOST_CHECK(StatsEqual(statsCache, statsDB));
+        BOOST_CHECK(StatsEqual(statsDB, statsScan));
+        BOOST_CHECK(statsDB.nTransactions < 50U);
+        BOOST_CHECK(statsDB.hashSerialized != statsEmpty.hashSerialized);
+    }
+}
+
+// Coin database whose writes wait until the test opens the gate
+class CCoinsViewDBGated : public CCoinsViewDB
+{
+public:
+    boost::mutex gate;
+
+    CCoinsViewDBGated() : CCoinsViewDB(1 << 20, true, true) {}
+
+    bool BatchWrite(CCoinsMap &mapCoinsIn, CBlockIndex *pindex, const CCoinsStats &statsChange) {
+        boost::unique_lock<boost::mutex> lock(gate);
+        return CCoinsViewDB::BatchWrite(mapCoinsIn, pindex, statsChange);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(coinsview_flusher_stats)
+{
+    CCoinsViewDBGated db;
+    CCoinsViewFlusher flusher(db);
+    CCoinsViewCache tip(flusher);
+    std::vector<uint256> vTxid;
+    for (int i = 0; i < 20; i++) {
+        vTxid.push_back(GetRandHash());
+        BOOST_CHECK(tip.SetCoins(vTxid[i], CoinsWithOutputs(1 + i % 3)));
+    }
+    CCoinsStats statsTip, statsPending, statsDB, statsScan;
+    BOOST_CHECK(tip.GetStats(statsTip));
+    BOOST_CHECK_EQUAL(statsTip.nTransactions, 20U);
+    BOOST_CHECK_EQUAL(statsTip.nTransactionOutputs, 39U);
+    {
+        // While the layer is held back, its statistics come without waiting for it
+        boost::unique_lock<boost::mutex> lock(db.gate);
+        BOOST_CHECK(tip.Flush());
+        BOOST_CHECK(tip.GetStats(statsPending));
+        BOOST_CHECK(StatsEqual(statsPending, statsTip));
+
+        CTxInUndo undo;
+        for (int i = 0; i < 20; i += 2)
+            BOOST_CHECK(tip.SpendCoins(COutPoint(vTxid[i], 0), undo));
+        BOOST_CHECK(tip.GetStats(statsTip));
+        BOOST_CHECK_EQUAL(statsTip.nTransactionOutputs, 29U);
+        BOOST_CHECK_EQUAL(statsTip.nTotalAmount, 7 * (1 + 3) + 6 * 6 - 10);
+    }
+    BOOST_CHECK(tip.Flush());
+    BOOST_CHECK(flusher.Sync());
+    BOOST_CHECK(db.GetStats(statsDB));
+    BOOST_CHECK(db.ComputeStats(statsScan, 2));
+    BOOST_CHECK(StatsEqual(statsDB, statsTip));
+    BOOST_CHECK(StatsEqual(statsScan, statsTip));
+}
+
+static bool CollectCoins(std::vector<std::pair<uint256, CCoins> > *pvCoins, const uint256 &txid, const CCoins &coins)
+{
+    pvCoins->push_back(std::make_pair(txid, coins));
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(coinsdb_load)
+{
+    for (int nLayout = 0; nLayout < 2; nLayout++) {
+        CCoinsViewDB dbFrom(1 << 20, true, true);
+        if (nLayout)
+            BOOST_CHECK(dbFrom.UpgradeToOutputLayout());
+        CCoinsViewCache view(dbFrom);
+        for (int i = 0; i < 40; i++)
+            BOOST_CHECK(view.SetCoins(GetRandHash(), CoinsWithOutputs(1 + i % 4)));
+        BOOST_CHECK(view.Flush());
+        CCoinsStats statsFrom;
+        BOOST_CHECK(dbFrom.GetStats(statsFrom));
+
+        // The whole set comes out in key order
+        std::vector<std::pair<uint256, CCoins> > vCoins;
+        const leveldb::Snapshot *psnapshot = dbFrom.GetSnapshot();
+        BOOST_CHECK(dbFrom.ReadCoinsRange(psnapshot, 0, 256, boost::bind(&CollectCoins, &vCoins, _1, _2)));
+        dbFrom.ReleaseSnapshot(psnapshot);
+        BOOST_CHECK_EQUAL(vCoins.size(), 40U);
+        for (unsigned int i = 1; i < vCoins.size(); i++)
+            BOOST_CHECK(memcmp(vCoins[i-1].first.begin(), vCoins[i].first.begin(), sizeof(uint256)) < 0);
+
+        // Only an empty database can be loaded into
+        BOOST_CHECK(!dbFrom.BeginLoad());
+
+        CCoinsViewDB db(1 << 20, true, true);
+        if (nLayout)
+            BOOST_CHECK(db.UpgradeToOutputLayout());
+        std::vector<std::pair<uint256, CCoins> > vFirst(vCoins.begin(), vCoins.begin() + 15);
+        std::vector<std::pair<uint256, CCoins> > vRest(vCoins.begin() + 15, vCoins.end());
+        BOOST_CHECK(db.BeginLoad());
+        BOOST_CHECK(db.IsLoading());
+        BOOST_CHECK(db.LoadCoins(vFirst));
+        BOOST_CHECK(db.HaveCoins(vCoins[0].first));
+
+        // An aborted load leaves nothing behind
+        CCoinsStats stats;
+        BOOST_CHECK(db.AbortLoad());
+        BOOST_CHECK(!db.IsLoading());
+        BOOST_CHECK(!db.HaveCoins(vCoins[0].first));
+        BOOST_CHECK(db.ComputeStats(stats, 2));
+        BOOST_CHECK_EQUAL(stats.nTransactions, 0U);
+        BOOST_CHECK(db.GetStats(stats));
+        BOOST_CHECK_EQUAL(stats.nTransactions, 0U);
+
+        // Loaded in batches, the set and its statistics match the original
+        BOOST_CHECK(db.BeginLoad());
+        BOOST_CHECK(db.LoadCoins(vFirst));
+        BOOST_CHECK(db.LoadCoins(vRest));
+        uint256 hashBlock = GetRandHash();
+        CBlockIndex index;
+        index.hashBlock = hashBlock;
+        BOOST_CHECK(db.EndLoad(&index));
+        BOOST_CHECK(!db.IsLoading());
+        BOOST_CHECK(db.GetStats(stats));
+        BOOST_CHECK(StatsEqual(stats, statsFrom));
+        CCoinsStats statsScan;
+        BOOST_CHECK(db.ComputeStats(statsScan, 2));
+        BOOST_CHECK(StatsEqual(statsScan, statsFrom));
+        BOOST_CHECK(statsScan.hashBlock == hashBlock);
+        for (unsigned int i = 0; i < vCoins.size(); i++) {
+            CCoins coins;
+            BOOST_CHECK(db.GetCoins(vCoins[i].first, coins));
+            BOOST_CHECK(coins == vCoins[i].second);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,429 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include "blockcodec.h"
+#include "compressedstorage.h"
+#include "core.h"
+#include "lzcodec.h"
+#include "main.h"
+#include "mappedfile.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(compressedstorage_tests)
+
+// Something shaped like a serialized block: repeated structure, runs of
+// zeros and incompressible hashes
+static std::vector<unsigned char> BlockLikeData(unsigned int nSize)
+{
+    std::vector<unsigned char> data;
+    unsigned int nRand = 12345;
+    while (data.size() < nSize)
+    {
+        for (int i = 0; i < 32; i++)
+        {
+            nRand = nRand * 1103515245 + 12345;
+            data.push_back(nRand >> 16);
+        }
+        static const unsigned char script[] = { 0x76, 0xa9, 0x14 };
+        data.insert(data.end(), script, script + sizeof(script));
+        data.insert(data.end(), 20, 0);
+        data.push_back(0x88);
+        data.push_back(0xac);
+        data.insert(data.end(), 4, 0xff);
+    }
+    data.resize(nSize);
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(lz_roundtrip)
+{
+    std::vector<unsigned char> data = BlockLikeData(100000);
+    static const unsigned int sizes[] = { 0, 1, 12, 13, 64, 1000, 100000 };
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        size_t nPrevSize = 0;
+        for (int nLevel = 1; nLevel <= 9; nLevel++)
+        {
+            std::vector<unsigned char> compressed, decompressed(sizes[i]);
+            LZCompress(&data[0], sizes[i], compressed, nLevel);
+            BOOST_CHECK(LZDecompress(&compressed[0], compressed.size(), sizes[i] ? &decompressed[0] : NULL, sizes[i]));
+            BOOST_CHECK(std::equal(decompressed.begin(), decompressed.end(), data.begin()));
+
+            // Higher levels never do meaningfully worse than the fast ones
+            if (sizes[i] == 100000)
+            {
+                BOOST_CHECK(compressed.size() < sizes[i] * 3 / 4);
+                if (nLevel == 3 || nLevel == 6)
+                    BOOST_CHECK(compressed.size() <= nPrevSize);
+                nPrevSize = compressed.size();
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lz_malformed)
+{
+    std::vector<unsigned char> data = BlockLikeData(5000);
+    std::vector<unsigned char> compressed, decompressed(data.size());
+    LZCompress(&data[0], data.size(), compressed, 6);
+
+    // Truncation, a wrong expected size and corrupted bytes are all caught
+    // (or decode to garbage) without reading or writing out of bounds
+    BOOST_CHECK(!LZDecompress(&compressed[0], compressed.size() - 1, &decompressed[0], data.size()));
+    BOOST_CHECK(!LZDecompress(&compressed[0], compressed.size(), &decompressed[0], data.size() - 1));
+    for (unsigned int i = 0; i < compressed.size(); i += 7)
+    {
+        std::vector<unsigned char> corrupt(compressed);
+        corrupt[i] ^= 0x5a;
+        LZDecompress(&corrupt[0], corrupt.size(), &decompressed[0], data.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(block_codecs)
+{
+    CCompressedStorage storage;
+    storage.SetCompressionEnabled(true);
+    std::vector<unsigned char> data = BlockLikeData(20000);
+
+    static const int codecs[] = { TCMP_CODEC_STORE, TCMP_CODEC_RLE, TCMP_CODEC_LZ };
+    for (unsigned int i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+    {
+        BOOST_CHECK(storage.SetCodec(codecs[i]));
+        std::vector<unsigned char> compressed, decompressed;
+        BOOST_CHECK(storage.CompressBlock(data, compressed));
+        BOOST_CHECK_EQUAL(compressed[6], codecs[i]);
+        BOOST_CHECK(storage.DecompressBlock(compressed, decompressed));
+        BOOST_CHECK(decompressed == data);
+    }
+    BOOST_CHECK(!storage.SetCodec(99));
+
+    // Incompressible data is stored rather than expanded
+    std::vector<unsigned char> random(1000), compressed, decompressed;
+    for (unsigned int i = 0; i < random.size(); i++)
+        random[i] = GetRand(256);
+    BOOST_CHECK(storage.SetCodec(TCMP_CODEC_LZ));
+    BOOST_CHECK(storage.CompressBlock(random, compressed));
+    BOOST_CHECK_EQUAL(compressed[6], TCMP_CODEC_STORE);
+    BOOST_CHECK(storage.DecompressBlock(compressed, decompressed));
+    BOOST_CHECK(decompressed == random);
+}
+
+BOOST_AUTO_TEST_CASE(undo_records)
+{
+    CCompressedStorage storage;
+    storage.SetCompressionEnabled(true);
+    std::vector<unsigned char> data = BlockLikeData(20000);
+
+    // Undo data is not a block, so the columnar codec gives way to LZ
+    BOOST_CHECK(storage.SetCodec(TCMP_CODEC_COLUMNAR));
+    std::vector<unsigned char> compressed, decompressed;
+    BOOST_CHECK(storage.CompressUndo(data, compressed));
+    BOOST_CHECK_EQUAL(compressed[6], TCMP_CODEC_LZ);
+    BOOST_CHECK(compressed.size() < data.size());
+    BOOST_CHECK(storage.IsCompressedBlock(&compressed[0], &compressed[0] + compressed.size()));
+    BOOST_CHECK(storage.DecompressUndo(&compressed[0], &compressed[0] + compressed.size(), decompressed));
+    BOOST_CHECK(decompressed == data);
+
+    // Raw undo data is not mistaken for a compressed record
+    BOOST_CHECK(!storage.DecompressUndo(&data[0], &data[0] + data.size(), decompressed));
+
+    // Only what is written is counted, and undo records apart from blocks
+    CompressionStats stats = storage.GetStats();
+    BOOST_CHECK_EQUAL(stats.nUndoCompressed, 0U);
+    storage.CountStored(true, data.size(), compressed.size());
+    storage.CountStored(true, 100, 100); // stored as it was
+    stats = storage.GetStats();
+    BOOST_CHECK_EQUAL(stats.nUndoCompressed, 2U);
+    BOOST_CHECK_EQUAL(stats.nUndoBytesOriginal, data.size() + 100);
+    BOOST_CHECK_EQUAL(stats.nUndoBytesCompressed, compressed.size() + 100);
+    BOOST_CHECK_EQUAL(stats.nBlocksCompressed, 0U);
+    BOOST_CHECK(stats.GetUndoCompressionRatio() < 1.0);
+
+    // Disabled compression passes undo data through untouched, but still
+    // reads what was compressed before
+    storage.SetCompressionEnabled(false);
+    std::vector<unsigned char> raw;
+    BOOST_CHECK(storage.CompressUndo(data, raw));
+    BOOST_CHECK(raw == data);
+    BOOST_CHECK(storage.IsCompressedBlock(&compressed[0], &compressed[0] + compressed.size()));
+    decompressed.clear();
+    BOOST_CHECK(storage.DecompressUndo(&compressed[0], &compressed[0] + compressed.size(), decompressed));
+    BOOST_CHECK(decompressed == data);
+    decompressed.clear();
+    BOOST_CHECK(storage.DecompressBlock(compressed, decompressed));
+    BOOST_CHECK(decompressed == data);
+}
+
+BOOST_AUTO_TEST_CASE(block_version1)
+{
+    // Blocks written before codec IDs existed: 14-byte header, RLE payload
+    static const unsigned char v1[] = {
+        'T', 'C', 'M', 'P', 0x01, 0x01,
+        0x00, 0x00, 0x00, 0x0c,     // original size
+        0x00, 0x00, 0x00, 0x07,     // compressed size
+        0x01, 0x02, 0xff, 0x08, 0x00, 0x03, 0x04,
+    };
+    static const unsigned char expected[] = { 0x01, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0x03, 0x04 };
+
+    CCompressedStorage storage;
+    storage.SetCompressionEnabled(true);
+    std::vector<unsigned char> decompressed;
+    std::vector<unsigned char> input(v1, v1 + sizeof(v1));
+    BOOST_CHECK(storage.DecompressBlock(input, decompressed));
+    BOOST_CHECK(decompressed == std::vector<unsigned char>(expected, expected + sizeof(expected)));
+
+    // Unknown versions are rejected
+    input[4] = 0x7f;
+    BOOST_CHECK(!storage.DecompressBlock(input, decompressed));
+}
+
+static std::vector<unsigned char> RandomBytes(unsigned int nSize)
+{
+    std::vector<unsigned char> vch(nSize);
+    for (unsigned int i = 0; i < nSize; i++)
+        vch[i] = insecure_rand();
+    return vch;
+}
+
+// A block exercising every prevout reference kind and script template
+static CBlock ColumnsTestBlock()
+{
+    CBlock block;
+    block.nVersion = BLOCK_VERSION_DEFAULT | BLOCK_VERSION_SCRYPT;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = 1386000000;
+    block.nBits = 0x1d00ffff;
+    block.nNonce = 42;
+
+    CTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 486604799 << 4;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << RandomBytes(65) << OP_CHECKSIG;
+    block.vtx.push_back(coinbase);
+
+    uint256 hashShared = GetRandHash();
+    for (int i = 1; i < 60; i++)
+    {
+        CTransaction tx;
+        tx.nLockTime = (i % 7 == 0) ? 250000 + i : 0;
+        tx.vin.resize(1 + i % 3);
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+        {
+            CTxIn& txin = tx.vin[j];
+            if (j == 1)
+                txin.prevout = COutPoint(hashShared, i);
+            else if (j == 2)
+                txin.prevout = COutPoint(block.vtx[i / 2].GetHash(), 0);
+            else
+                txin.prevout = COutPoint(GetRandHash(), i % 4);
+            txin.scriptSig = CScript() << RandomBytes(71 + i % 2) << RandomBytes(33);
+            if (i % 5 == 0)
+                txin.nSequence = i;
+        }
+        tx.vout.resize(1 + i % 4);
+        for (unsigned int j = 0; j < tx.vout.size(); j++)
+        {
+            CTxOut& txout = tx.vout[j];
+            txout.nValue = (i * 100 + j) * CENT;
+            switch ((i + j) % 5)
+            {
+                case 0:
+                case 1:
+                    txout.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << RandomBytes(20) << OP_EQUALVERIFY << OP_CHECKSIG;
+                    break;
+                case 2:
+                    txout.scriptPubKey = CScript() << OP_HASH160 << RandomBytes(20) << OP_EQUAL;
+                    break;
+                case 3:
+                {
+                    std::vector<unsigned char> vchPubKey = RandomBytes(33);
+                    vchPubKey[0] = 0x02 | (i & 1);
+                    txout.scriptPubKey = CScript() << vchPubKey << OP_CHECKSIG;
+                    break;
+                }
+                case 4:
+                    txout.scriptPubKey = CScript() << OP_RETURN << RandomBytes(i % 40);
+                    break;
+            }
+        }
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(block_columns)
+{
+    CBlock block = ColumnsTestBlock();
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    ssBlock << block;
+    std::vector<unsigned char> data(ssBlock.begin(), ssBlock.end());
+
+    std::vector<unsigned char> encoded, decoded, lz;
+    BOOST_REQUIRE(EncodeBlockColumns(data, encoded, 6));
+    BOOST_CHECK(DecodeBlockColumns(&encoded[0], &encoded[0] + encoded.size(), decoded));
+    BOOST_CHECK(decoded == data);
+
+    // Splitting the fields beats compressing the serialized block
+    LZCompress(&data[0], data.size(), lz, 6);
+    BOOST_CHECK(encoded.size() < lz.size());
+
+    // Through the storage framing
+    CCompressedStorage storage;
+    storage.SetCompressionEnabled(true);
+    BOOST_CHECK(storage.SetCodec(TCMP_CODEC_COLUMNAR));
+    std::vector<unsigned char> compressed;
+    BOOST_CHECK(storage.CompressBlock(data, compressed));
+    BOOST_CHECK_EQUAL(compressed[6], TCMP_CODEC_COLUMNAR);
+    BOOST_CHECK(storage.DecompressBlock(compressed, decoded));
+    BOOST_CHECK(decoded == data);
+
+    // Anything that is not a block falls back to LZ
+    std::vector<unsigned char> notblock = BlockLikeData(5000);
+    BOOST_CHECK(!EncodeBlockColumns(notblock, encoded, 6));
+    BOOST_CHECK(storage.CompressBlock(notblock, compressed));
+    BOOST_CHECK_EQUAL(compressed[6], TCMP_CODEC_LZ);
+
+    // Corrupt input is rejected or decodes to some other block, never crashes
+    BOOST_REQUIRE(EncodeBlockColumns(data, encoded, 6));
+    for (unsigned int i = 0; i < encoded.size(); i += 13)
+    {
+        std::vector<unsigned char> corrupt(encoded);
+        corrupt[i] ^= 0x21;
+        DecodeBlockColumns(&corrupt[0], &corrupt[0] + corrupt.size(), decoded);
+    }
+    BOOST_CHECK(!DecodeBlockColumns(&encoded[0], &encoded[0] + encoded.size() - 1, decoded));
+}
+
+BOOST_AUTO_TEST_CASE(dedup_dictionary)
+{
+    CCompressedStorage storage;
+    storage.SetCompressionEnabled(true);
+
+    // Keep room for only a couple of patterns
+    storage.SetMaxCacheSize(1000);
+    std::vector<std::vector<unsigned char> > vTx, vFirst, vStored;
+    for (int i = 0; i < 20; i++)
+    {
+        std::vector<unsigned char> tx = BlockLikeData(250 + i);
+        std::vector<unsigned char> first, dup;
+        BOOST_CHECK(storage.CompressTransaction(tx, first));
+        BOOST_CHECK(storage.CompressTransaction(tx, dup));
+        BOOST_CHECK(storage.GetCacheSize() <= 1000);
+        vTx.push_back(tx);
+        vFirst.push_back(first);
+        vStored.push_back(dup);
+    }
+
+    // Patterns beyond the budget are not deduplicated rather than evicted
+    // while still referenced, so everything stays readable
+    BOOST_CHECK(vStored[0].size() == 33 && vStored[0][0] == 0xFE);
+    BOOST_CHECK(vStored.back().size() > 33);
+    for (unsigned int i = 0; i < vTx.size(); i++)
+    {
+        std::vector<unsigned char> out;
+        BOOST_CHECK(storage.DecompressTransaction(vStored[i], out));
+        BOOST_CHECK(out == vTx[i]);
+    }
+
+    // Once every reference is released the pattern is gone
+    std::vector<unsigned char> out;
+    BOOST_CHECK(storage.ReleaseTransaction(vStored[0]));
+    BOOST_CHECK(storage.DecompressTransaction(vStored[0], out));
+    BOOST_CHECK(storage.ReleaseTransaction(vFirst[0]));
+    BOOST_CHECK(!storage.DecompressTransaction(vStored[0], out));
+
+    // which makes room for another
+    std::vector<unsigned char> tx = vTx[0], first, dup;
+    tx[0] ^= 1;
+    BOOST_CHECK(storage.CompressTransaction(tx, first));
+    BOOST_CHECK(storage.CompressTransaction(tx, dup));
+    BOOST_CHECK(dup.size() == 33 && dup[0] == 0xFE);
+}
+
+BOOST_AUTO_TEST_CASE(block_read_compression_off)
+{
+    // Block files of its own, with file 0 still being appended to
+    CloseBlockFiles();
+    mappedBlockFiles.Clear();
+    int nLastBlockFileSaved;
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFileSaved = nLastBlockFile;
+        nLastBlockFile = 0;
+    }
+    boost::filesystem::path pathBlocks = GetDataDir() / "blocks";
+    boost::filesystem::path pathSaved = GetDataDir() / "blocks.saved";
+    if (boost::filesystem::exists(pathBlocks))
+        boost::filesystem::rename(pathBlocks, pathSaved);
+    boost::filesystem::create_directories(pathBlocks);
+    bool fEnabledSaved = compressedStorage.IsCompressionEnabled();
+    bool fBackgroundSaved = fCompressInBackground;
+
+    // Payouts to the same script compress well
+    CBlock block;
+    block.nVersion = BLOCK_VERSION_DEFAULT;
+    block.nTime = 1400000000;
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(200);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue = 1000 + i;
+        tx.vout[i].scriptPubKey << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    const uint256 &hashTarget = Params().ProofOfWorkLimit(block.GetAlgo());
+    block.nBits = hashTarget.GetCompact();
+    while (block.GetPoWHash(block.GetAlgo()) > hashTarget)
+        block.nNonce++;
+
+    compressedStorage.SetCompressionEnabled(true);
+    fCompressInBackground = false;
+    CDiskBlockPos pos(0, 0);
+    BOOST_CHECK(WriteBlockToDisk(block, pos));
+    CDiskBlockPos posRaw(0, pos.nPos + 4096);
+    compressedStorage.SetCompressionEnabled(false);
+    BOOST_CHECK(WriteBlockToDisk(block, posRaw));
+
+    // What reached the file is a compressed record
+    {
+        CAutoFile filein = CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        std::vector<unsigned char> vchStored(16);
+        filein.read((char*)&vchStored[0], vchStored.size());
+        BOOST_CHECK(compressedStorage.IsCompressedBlock(&vchStored[0], &vchStored[0] + vchStored.size()));
+    }
+
+    // With compression off, both read back from the file being appended to,
+    // which is never mapped, and once it is finalized
+    for (int nLast = 0; nLast <= 1; nLast++) {
+        {
+            LOCK(cs_LastBlockFile);
+            nLastBlockFile = nLast;
+        }
+        CBlock blockRead;
+        BOOST_CHECK(ReadBlockFromDisk(blockRead, pos));
+        BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+        BOOST_CHECK(blockRead.vtx.size() == 1 && blockRead.vtx[0].GetHash() == tx.GetHash());
+        BOOST_CHECK(ReadBlockFromDisk(blockRead, posRaw));
+        BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+    }
+
+    CloseBlockFiles();
+    mappedBlockFiles.Clear();
+    compressedStorage.SetCompressionEnabled(fEnabledSaved);
+    fCompressInBackground = fBackgroundSaved;
+    {
+        LOCK(cs_LastBlockFile);
+        nLastBlockFile = nLastBlockFileSaved;
+    }
+    boost::filesystem::remove_all(pathBlocks);
+    if (boost::filesystem::exists(pathSaved))
+        boost::filesystem::rename(pathSaved, pathBlocks);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,64 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "mappedfile.h"
+#include "util.h"
+
+#include <stdio.h>
+
+static void WriteTestFile(const boost::filesystem::path &path, const std::string &str)
+{
+    FILE *file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file != NULL);
+    fwrite(str.data(), 1, str.size(), file);
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_SUITE(mappedfile_tests)
+
+BOOST_AUTO_TEST_CASE(mappedfile_cache)
+{
+    boost::filesystem::path pathDir = GetTempPath() / strprintf("test_trinity_mapped_%lu", (unsigned long)GetTime());
+    boost::filesystem::create_directories(pathDir);
+    boost::filesystem::path path0 = pathDir / "file0", path1 = pathDir / "file1";
+    WriteTestFile(path0, "first file");
+    WriteTestFile(path1, "second");
+
+    CMappedFile mapped;
+    BOOST_CHECK(mapped.Open(path0));
+    BOOST_CHECK(std::string(mapped.begin(), mapped.end()) == "first file");
+    BOOST_CHECK(!mapped.Open(pathDir / "missing"));
+    BOOST_CHECK(mapped.size() == 0);
+
+    // Disabled until given room
+    CMappedFileCache cache;
+    BOOST_CHECK(!cache.Get(0, path0));
+    cache.SetMaxFiles(1);
+    boost::shared_ptr<CMappedFile> p0 = cache.Get(0, path0);
+    BOOST_REQUIRE(p0);
+    BOOST_CHECK(cache.Get(0, path0) == p0);
+
+    // Evicted mappings stay valid for whoever still holds them
+    boost::shared_ptr<CMappedFile> p1 = cache.Get(1, path1);
+    BOOST_REQUIRE(p1);
+    BOOST_CHECK(std::string(p1->begin(), p1->end()) == "second");
+    BOOST_CHECK(std::string(p0->begin(), p0->end()) == "first file");
+    BOOST_CHECK(cache.Get(0, path0) != p0);
+
+    // A replaced file is mapped afresh once invalidated
+    WriteTestFile(pathDir / "file1.new", "replaced");
+    boost::filesystem::rename(pathDir / "file1.new", path1);
+    BOOST_CHECK(std::string(p1->begin(), p1->end()) == "second");
+    cache.Invalidate(1);
+    boost::shared_ptr<CMappedFile> p1new = cache.Get(1, path1);
+    BOOST_REQUIRE(p1new);
+    BOOST_CHECK(std::string(p1new->begin(), p1new->end()) == "replaced");
+
+    p0.reset();
+    p1.reset();
+    p1new.reset();
+    cache.Clear();
+    boost::filesystem::remove_all(pathDir);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
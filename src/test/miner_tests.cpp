@@ -6,6 +6,7 @@
 #include "util.h"
 #include "miner.h"
 #include "wallet.h"
+#include "sha256d.h"
 
 extern void SHA256Transform(void* pstate, void* pinput, const void* pinit);
 
@@ -228,4 +229,118 @@ BOOST_AUTO_TEST_CASE(sha256transform_equality)
     BOOST_CHECK(hash == hash_reference);
 }
 
+BOOST_AUTO_TEST_CASE(sha256d_scanhash)
+{
+    CBlock block;
+    block.nVersion = 2;
+    block.hashPrevBlock = uint256("0x000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f");
+    block.hashMerkleRoot = uint256("0x4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    block.nTime = 1385000000;
+    block.nBits = 0x1d00ffff;
+    block.nNonce = 0;
+
+    char pmidstatebuf[32+16]; char* pmidstate = alignup<16>(pmidstatebuf);
+    char pdatabuf[128+16];    char* pdata     = alignup<16>(pdatabuf);
+    char phash1buf[64+16];    char* phash1    = alignup<16>(phash1buf);
+    FormatHashBuffers(&block, pmidstate, pdata, phash1);
+
+    // Every kernel this CPU can run agrees with the single-lane reference
+    uint32_t ref[8 * 8], lanes[8 * 8];
+    for (int i = 0; i < 8; i++)
+        sha256d_scan_1way(&ref[8 * i], (const uint32_t*)pmidstate, (const uint32_t*)(pdata + 64), 100 + i);
+#if defined(USE_SSE2)
+    if (sha256d_kernel_supported(SHA256D_SSE2_4WAY))
+    {
+        sha256d_scan_4way(&lanes[0], (const uint32_t*)pmidstate, (const uint32_t*)(pdata + 64), 100);
+        sha256d_scan_4way(&lanes[32], (const uint32_t*)pmidstate, (const uint32_t*)(pdata + 64), 104);
+        BOOST_CHECK(memcmp(ref, lanes, sizeof(ref)) == 0);
+    }
+#endif
+#if defined(USE_AVX2)
+    if (sha256d_kernel_supported(SHA256D_AVX2_8WAY))
+    {
+        sha256d_scan_8way(&lanes[0], (const uint32_t*)pmidstate, (const uint32_t*)(pdata + 64), 100);
+        BOOST_CHECK(memcmp(ref, lanes, sizeof(ref)) == 0);
+    }
+#endif
+#if defined(USE_SHANI)
+    if (sha256d_kernel_supported(SHA256D_SHANI))
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            uint256 hashState = GetRandHash(), hashBlock[2] = {GetRandHash(), GetRandHash()};
+            uint32_t state[8], stateRef[8], block[16];
+            memcpy(state, &hashState, 32);
+            memcpy(stateRef, &hashState, 32);
+            memcpy(block, hashBlock, 64);
+            sha256_transform_shani(state, block);
+            sha256_transform(stateRef, block);
+            BOOST_CHECK(memcmp(state, stateRef, sizeof(state)) == 0);
+        }
+    }
+#endif
+
+    // With each kernel, a nonce returned by the scanner hashes to the header hash
+    char pdataStart[128];
+    memcpy(pdataStart, pdata, sizeof(pdataStart));
+    int nKernelSaved = sha256d_select_kernel(SHA256D_GENERIC);
+    unsigned int nNonceGeneric = (unsigned int) -1;
+    for (int nKernel = 0; nKernel < SHA256D_KERNELS; nKernel++)
+    {
+        if (!sha256d_kernel_supported(nKernel))
+            continue;
+        sha256d_select_kernel(nKernel);
+        memcpy(pdata, pdataStart, sizeof(pdataStart));
+
+        uint256 hashbuf[2];
+        uint256& hash = *alignup<16>(hashbuf);
+        unsigned int nHashesDone = 0, nHashesTotal = 0;
+        unsigned int nNonceFound = (unsigned int) -1;
+        for (int i = 0; i < 64 && nNonceFound == (unsigned int) -1; i++)
+        {
+            nNonceFound = ScanHash_SHA256d(pmidstate, pdata + 64, phash1, (char*)&hash, nHashesDone);
+            nHashesTotal += nHashesDone;
+        }
+        BOOST_REQUIRE(nNonceFound != (unsigned int) -1);
+        BOOST_CHECK_EQUAL(nHashesTotal, nNonceFound);
+        if (nKernel == SHA256D_GENERIC)
+            nNonceGeneric = nNonceFound;
+        BOOST_CHECK_EQUAL(nNonceFound, nNonceGeneric);
+        for (unsigned int i = 0; i < sizeof(hash)/4; i++)
+            ((unsigned int*)&hash)[i] = ByteReverse(((unsigned int*)&hash)[i]);
+        block.nNonce = ByteReverse(nNonceFound);
+        BOOST_CHECK(hash == block.GetHash());
+        BOOST_CHECK((hash >> 240) == 0);
+    }
+    sha256d_select_kernel(nKernelSaved);
+}
+
+BOOST_AUTO_TEST_CASE(checkpowbatch)
+{
+    // Mixed algorithms, more scrypt headers than one kernel call takes
+    std::vector<CPoWCheck> vChecks;
+    CBlockHeader header;
+    header.nVersion = BLOCK_VERSION_DEFAULT;
+    header.nBits = 0x207fffff;
+    for (int i = 0; i < 40; i++)
+    {
+        header.nNonce = i;
+        int algo = i % NUM_ALGOS;
+        // Every other header gets a target its hash cannot meet
+        uint256 hashTarget = (i & 2) ? uint256(0) : ~uint256(0);
+        vChecks.push_back(CPoWCheck(header, algo, hashTarget));
+    }
+    vChecks.push_back(CPoWCheck(header, NUM_ALGOS, ~uint256(0)));
+
+    CheckProofOfWorkBatch(vChecks);
+
+    for (int i = 0; i < 40; i++)
+    {
+        const CPoWCheck& check = vChecks[i];
+        BOOST_CHECK(check.hashPoW == check.header.GetPoWHash(check.algo));
+        BOOST_CHECK_EQUAL(check.fValid, (i & 2) == 0);
+    }
+    BOOST_CHECK(!vChecks[40].fValid);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
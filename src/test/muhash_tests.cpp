@@ -0,0 +1,87 @@
+#include <boost/test/unit_test.hpp>
+
+#include "muhash.h"
+#include "serialize.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(muhash_tests)
+
+BOOST_AUTO_TEST_CASE(muhash_order)
+{
+    std::vector<uint256> vElements;
+    for (int i = 0; i < 20; i++)
+        vElements.push_back(GetRandHash());
+
+    CMuHash3072 empty, forward, backward;
+    for (unsigned int i = 0; i < vElements.size(); i++) {
+        forward.Insert(vElements[i]);
+        backward.Insert(vElements[vElements.size() - 1 - i]);
+    }
+    BOOST_CHECK(forward.GetHash() == backward.GetHash());
+    BOOST_CHECK(forward.GetHash() != empty.GetHash());
+
+    // Removing in any order undoes the inserts, even before they happen
+    CMuHash3072 set;
+    set.Remove(vElements[3]);
+    for (unsigned int i = 0; i < vElements.size(); i++)
+        set.Insert(vElements[i]);
+    set.Remove(vElements[7]);
+    CMuHash3072 expected;
+    for (unsigned int i = 0; i < vElements.size(); i++)
+        if (i != 3 && i != 7)
+            expected.Insert(vElements[i]);
+    BOOST_CHECK(set.GetHash() == expected.GetHash());
+
+    // A multiset: the same element twice is not the same as once
+    CMuHash3072 once, twice;
+    once.Insert(vElements[0]);
+    twice.Insert(vElements[0]);
+    twice.Insert(vElements[0]);
+    BOOST_CHECK(once.GetHash() != twice.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(muhash_combine)
+{
+    CMuHash3072 all, part1, part2;
+    for (int i = 0; i < 10; i++) {
+        uint256 hash = GetRandHash();
+        all.Insert(hash);
+        if (i % 2)
+            part1.Insert(hash);
+        else
+            part2.Insert(hash);
+    }
+    part1.Remove(1);
+    part2.Insert(1);
+    part1 *= part2;
+    BOOST_CHECK(part1.GetHash() == all.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(muhash_serialize)
+{
+    CMuHash3072 set;
+    set.Insert(GetRandHash());
+    set.Insert(GetRandHash());
+    set.Remove(GetRandHash());
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << set;
+    BOOST_CHECK_EQUAL(ss.size(), CMuHash3072::BYTES);
+    CMuHash3072 set2;
+    ss >> set2;
+    BOOST_CHECK(set2.GetHash() == set.GetHash());
+
+    // Still usable after a round trip
+    uint256 hash = GetRandHash();
+    set.Insert(hash);
+    set2.Insert(hash);
+    BOOST_CHECK(set2.GetHash() == set.GetHash());
+
+    CMuHash3072 copy(set);
+    copy.Remove(hash);
+    set2 = copy;
+    set.Remove(hash);
+    BOOST_CHECK(set2.GetHash() == set.GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
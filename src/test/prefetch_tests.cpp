@@ -0,0 +1,228 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "util.h"
+
+#include <map>
+
+// Base view that can be read from several threads and counts the reads
+class CCoinsViewCounted : public CCoinsView
+{
+public:
+    boost::mutex mutex;
+    std::map<uint256, CCoins> mapCoins;
+    int nReads;
+
+    CCoinsViewCounted() : nReads(0) {}
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nReads++;
+        std::map<uint256, CCoins>::iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+
+    bool HaveCoins(const uint256 &txid) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return mapCoins.count(txid) > 0;
+    }
+
+    bool BatchWrite(CCoinsMap &mapCoinsIn, CBlockIndex *pindex, const CCoinsStats &statsChange) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (CCoinsMap::const_iterator it = mapCoinsIn.begin(); it != mapCoinsIn.end(); it++) {
+            const CCoinsCacheEntry &entry = it->second;
+            if (!(entry.flags & CCoinsCacheEntry::DIRTY))
+                continue;
+            if (entry.coins.IsPruned())
+                mapCoins.erase(it->first);
+            else
+                mapCoins[it->first] = entry.coins;
+        }
+        return true;
+    }
+
+    // Take the coins away, so only a prefetched copy is left
+    void Erase(const uint256 &txid) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        mapCoins.erase(txid);
+    }
+
+    // Wait for the prefetching threads to have read nCount times in total
+    void WaitForReads(int nCount) {
+        for (int i = 0; i < 1000; i++) {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (nReads >= nCount)
+                    return;
+            }
+            MilliSleep(1);
+        }
+    }
+};
+
+// Base view whose reads are held back until released
+class CCoinsViewHeld : public CCoinsViewCounted
+{
+public:
+    boost::condition_variable cond;
+    bool fHold;
+    int nStarted;
+
+    CCoinsViewHeld() : fHold(true), nStarted(0) {}
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nStarted++;
+            while (fHold)
+                cond.wait(lock);
+        }
+        return CCoinsViewCounted::GetCoins(txid, coins);
+    }
+
+    void WaitForStarted(int nCount) {
+        for (int i = 0; i < 1000; i++) {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (nStarted >= nCount)
+                    return;
+            }
+            MilliSleep(1);
+        }
+    }
+
+    void ReleaseAfter(int nMilliseconds) {
+        MilliSleep(nMilliseconds);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fHold = false;
+        }
+        cond.notify_all();
+    }
+};
+
+// Wait until the prefetched coins of txid are there, up to a second
+static bool WaitForPrefetch(CCoinsViewPrefetch &view, const uint256 &txid)
+{
+    for (int i = 0; i < 1000; i++) {
+        if (view.HaveCoins(txid))
+            return true;
+        MilliSleep(1);
+    }
+    return false;
+}
+
+static CCoins CoinsWithOutputs(unsigned int nOutputs)
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 1;
+    coins.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        coins.vout[i].nValue = i + 1;
+        coins.vout[i].scriptPubKey << OP_TRUE;
+    }
+    return coins;
+}
+
+BOOST_AUTO_TEST_SUITE(prefetch_tests)
+
+BOOST_AUTO_TEST_CASE(prefetch_lookup)
+{
+    CCoinsViewCounted base;
+    uint256 hashA = GetRandHash(), hashB = GetRandHash(), hashMissing = GetRandHash();
+    base.mapCoins[hashA] = CoinsWithOutputs(2);
+    base.mapCoins[hashB] = CoinsWithOutputs(3);
+
+    CCoinsViewPrefetch prefetch(base, 2);
+    CCoinsViewCache tip(prefetch);
+
+    // Once read ahead, the coins no longer come from the base
+    std::vector<uint256> vTxid;
+    vTxid.push_back(hashA);
+    vTxid.push_back(hashMissing);
+    prefetch.Prefetch(vTxid);
+    base.WaitForReads(2);
+    base.Erase(hashA);
+    BOOST_CHECK(WaitForPrefetch(prefetch, hashA));
+    BOOST_CHECK(!prefetch.HaveCoins(hashMissing));
+    BOOST_CHECK(tip.HaveCoins(hashA));
+    BOOST_CHECK_EQUAL(tip.AccessCoins(hashA).vout.size(), 2U);
+
+    // Handed out once, then the cache above owns them
+    BOOST_CHECK(!prefetch.HaveCoins(hashA));
+
+    // Writing to the base drops what was read before
+    vTxid.assign(1, hashB);
+    prefetch.Prefetch(vTxid);
+    base.WaitForReads(3);
+    base.Erase(hashB);
+    BOOST_CHECK(WaitForPrefetch(prefetch, hashB));
+    BOOST_CHECK(tip.Flush());
+    BOOST_CHECK(!prefetch.HaveCoins(hashB));
+    BOOST_CHECK(!tip.HaveCoins(hashB));
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_usage)
+{
+    CCoinsViewCounted base;
+    uint256 hashA = GetRandHash(), hashB = GetRandHash();
+    base.mapCoins[hashA] = CoinsWithOutputs(100);
+    base.mapCoins[hashB] = CoinsWithOutputs(1);
+
+    CCoinsViewPrefetch prefetch(base, 1);
+    CCoinsViewCache tip(prefetch);
+    BOOST_CHECK_EQUAL(prefetch.DynamicMemoryUsage(), 0U);
+
+    // Coins waiting to be handed out are counted, the larger ones for more
+    size_t nCoinsUsageA = base.mapCoins[hashA].DynamicMemoryUsage();
+    std::vector<uint256> vTxid(1, hashA);
+    prefetch.Prefetch(vTxid);
+    base.WaitForReads(1);
+    base.Erase(hashA);
+    BOOST_CHECK(WaitForPrefetch(prefetch, hashA));
+    size_t nUsageA = prefetch.DynamicMemoryUsage();
+    BOOST_CHECK(nUsageA > nCoinsUsageA);
+
+    // Handing them out passes the memory on to the cache above
+    BOOST_CHECK(tip.HaveCoins(hashA));
+    BOOST_CHECK_EQUAL(prefetch.DynamicMemoryUsage(), 0U);
+
+    vTxid.assign(1, hashB);
+    prefetch.Prefetch(vTxid);
+    base.WaitForReads(2);
+    base.Erase(hashB);
+    BOOST_CHECK(WaitForPrefetch(prefetch, hashB));
+    size_t nUsageB = prefetch.DynamicMemoryUsage();
+    BOOST_CHECK(nUsageB > 0 && nUsageB < nUsageA);
+
+    // A new request drops what the last one left unused
+    vTxid.clear();
+    prefetch.Prefetch(vTxid);
+    BOOST_CHECK_EQUAL(prefetch.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_in_flight)
+{
+    CCoinsViewHeld base;
+    uint256 hashA = GetRandHash();
+    base.mapCoins[hashA] = CoinsWithOutputs(2);
+
+    CCoinsViewPrefetch prefetch(base, 1);
+    std::vector<uint256> vTxid(1, hashA);
+    prefetch.Prefetch(vTxid);
+    base.WaitForStarted(1);
+
+    // Asked for while a thread reads it: waits for that read instead of repeating it
+    boost::thread threadRelease(boost::bind(&CCoinsViewHeld::ReleaseAfter, &base, 50));
+    CCoins coins;
+    BOOST_CHECK(prefetch.GetCoins(hashA, coins));
+    BOOST_CHECK_EQUAL(coins.vout.size(), 2U);
+    threadRelease.join();
+    BOOST_CHECK_EQUAL(base.nReads, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
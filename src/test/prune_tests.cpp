@@ -0,0 +1,247 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+static const unsigned int FILE_SIZE = 1 << 20;
+static const unsigned int UNDO_SIZE = 1 << 19;
+
+// Runs each test against a block tree and block files of its own, and puts
+// back the ones the other tests use afterwards
+struct PruneSetup
+{
+    CCoinsViewFlusher *pcoinsFlusherSaved;
+    CCoinsViewDB *pcoinsdbviewSaved;
+    CBlockTreeDB *pblocktreeSaved;
+    CBlockIndex *pindexBestSaved;
+    int nBestHeightSaved;
+    std::vector<CBlockIndex*> vBlockIndexByHeightSaved;
+    std::vector<CBlockIndex*> vIndexSaved;
+    int nLastBlockFileSaved;
+    CBlockFileInfo infoLastBlockFileSaved;
+    bool fHavePrunedSaved;
+    uint64 nPruneTargetSaved;
+
+    boost::filesystem::path pathBlocks, pathSaved;
+    std::vector<CBlockIndex*> vIndex;
+
+    PruneSetup()
+    {
+        pcoinsFlusherSaved = pcoinsFlusher;
+        pcoinsdbviewSaved = pcoinsdbview;
+        pblocktreeSaved = pblocktree;
+        pindexBestSaved = pindexBest;
+        nBestHeightSaved = nBestHeight;
+        vBlockIndexByHeightSaved = vBlockIndexByHeight;
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+            vIndexSaved.push_back(item.second);
+        mapBlockIndex.clear();
+        fHavePrunedSaved = fHavePruned;
+        nPruneTargetSaved = nPruneTarget;
+
+        CloseBlockFiles();
+        {
+            LOCK(cs_LastBlockFile);
+            nLastBlockFileSaved = nLastBlockFile;
+            infoLastBlockFileSaved = infoLastBlockFile;
+        }
+        pathBlocks = GetDataDir() / "blocks";
+        pathSaved = GetDataDir() / "blocks.saved";
+        if (boost::filesystem::exists(pathBlocks))
+            boost::filesystem::rename(pathBlocks, pathSaved);
+        boost::filesystem::create_directories(pathBlocks);
+
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 20, true);
+        pcoinsFlusher = new CCoinsViewFlusher(*pcoinsdbview);
+        fHavePruned = false;
+    }
+
+    ~PruneSetup()
+    {
+        CloseBlockFiles();
+        delete pcoinsFlusher;
+        delete pcoinsdbview;
+        delete pblocktree;
+        mapBlockIndex.clear();
+        BOOST_FOREACH(CBlockIndex *pindex, vIndex)
+            delete pindex;
+        BOOST_FOREACH(CBlockIndex *pindex, vIndexSaved)
+            mapBlockIndex.insert(pindex);
+
+        pcoinsFlusher = pcoinsFlusherSaved;
+        pcoinsdbview = pcoinsdbviewSaved;
+        pblocktree = pblocktreeSaved;
+        pindexBest = pindexBestSaved;
+        nBestHeight = nBestHeightSaved;
+        vBlockIndexByHeight = vBlockIndexByHeightSaved;
+        fHavePruned = fHavePrunedSaved;
+        nPruneTarget = nPruneTargetSaved;
+        {
+            LOCK(cs_LastBlockFile);
+            nLastBlockFile = nLastBlockFileSaved;
+            infoLastBlockFile = infoLastBlockFileSaved;
+        }
+        boost::filesystem::remove_all(pathBlocks);
+        if (boost::filesystem::exists(pathSaved))
+            boost::filesystem::rename(pathSaved, pathBlocks);
+    }
+
+    static boost::filesystem::path FilePath(const char *prefix, int nFile)
+    {
+        return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, nFile);
+    }
+
+    CBlockIndex *AddBlock(CBlockIndex *pprev, int nFile, unsigned int nPos)
+    {
+        CBlockIndex *pindex = new CBlockIndex();
+        pindex->hashBlock = GetRandHash();
+        pindex->pprev = pprev;
+        pindex->nHeight = pprev ? pprev->nHeight + 1 : 0;
+        pindex->nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+        pindex->nFile = nFile;
+        pindex->nDataPos = 8 + nPos;
+        pindex->nUndoPos = 8 + nPos / 2;
+        mapBlockIndex.insert(pindex);
+        vIndex.push_back(pindex);
+        return pindex;
+    }
+
+    // A chain of nBlocks blocks, nPerFile to a file, with the last file
+    // still being appended to
+    void BuildChain(int nBlocks, int nPerFile)
+    {
+        vBlockIndexByHeight.clear();
+        CBlockIndex *pindex = NULL;
+        for (int nHeight = 0; nHeight < nBlocks; nHeight++) {
+            pindex = AddBlock(pindex, nHeight / nPerFile, (nHeight % nPerFile) * (FILE_SIZE / nPerFile));
+            vBlockIndexByHeight.push_back(pindex);
+        }
+        pindexBest = pindex;
+        nBestHeight = pindex->nHeight;
+
+        int nFiles = (nBlocks + nPerFile - 1) / nPerFile;
+        for (int nFile = 0; nFile < nFiles; nFile++) {
+            CBlockFileInfo info;
+            info.nBlocks = nPerFile;
+            info.nSize = FILE_SIZE;
+            info.nUndoSize = UNDO_SIZE;
+            info.nHeightFirst = nFile * nPerFile;
+            info.nHeightLast = nFile * nPerFile + nPerFile - 1;
+            BOOST_CHECK(pblocktree->WriteBlockFileInfo(nFile, info));
+            fclose(fopen(FilePath("blk", nFile).string().c_str(), "wb"));
+            fclose(fopen(FilePath("rev", nFile).string().c_str(), "wb"));
+            LOCK(cs_LastBlockFile);
+            nLastBlockFile = nFile;
+            infoLastBlockFile = info;
+        }
+    }
+
+    bool IsPruned(int nFile)
+    {
+        CBlockFileInfo info;
+        BOOST_CHECK(pblocktree->ReadBlockFileInfo(nFile, info));
+        bool fPruned = info.nSize == 0 && info.nUndoSize == 0;
+        BOOST_CHECK_EQUAL(!boost::filesystem::exists(FilePath("blk", nFile)), fPruned);
+        BOOST_CHECK_EQUAL(!boost::filesystem::exists(FilePath("rev", nFile)), fPruned);
+        return fPruned;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(prune_tests, PruneSetup)
+
+BOOST_AUTO_TEST_CASE(prune_budget)
+{
+    // Ten files of 1.5 MiB each
+    BuildChain(1000, 100);
+
+    // Oldest files first, until the rest fits
+    nPruneTarget = 10 * FILE_SIZE;
+    PruneBlockFiles();
+    BOOST_CHECK(fHavePruned);
+    for (int nFile = 0; nFile < 10; nFile++)
+        BOOST_CHECK_EQUAL(IsPruned(nFile), nFile < 4);
+
+    // Nothing more while within the budget
+    PruneBlockFiles();
+    BOOST_CHECK(!IsPruned(4));
+
+    // A budget that cannot be met stops at the blocks that have to be kept
+    nPruneTarget = 0;
+    PruneBlockFiles();
+    for (int nFile = 0; nFile < 10; nFile++)
+        BOOST_CHECK_EQUAL(IsPruned(nFile), nFile < 7);
+}
+
+BOOST_AUTO_TEST_CASE(prune_short_chain)
+{
+    // Nothing until the chain is longer than the window
+    BuildChain(MIN_BLOCKS_TO_KEEP, 10);
+    nPruneTarget = 0;
+    PruneBlockFiles();
+    BOOST_CHECK(!fHavePruned);
+    BOOST_CHECK(!IsPruned(0));
+}
+
+BOOST_AUTO_TEST_CASE(prune_keep_window)
+{
+    // The last MIN_BLOCKS_TO_KEEP blocks stay, counted from the tip
+    BuildChain(1000, 100);
+    CBlockIndex *pindexSide = AddBlock(vBlockIndexByHeight[749], 2, 0);
+    nPruneTarget = 0;
+    PruneBlockFiles();
+    BOOST_CHECK(IsPruned(0));
+    BOOST_CHECK(IsPruned(1));
+    BOOST_CHECK(IsPruned(3));
+    BOOST_CHECK(IsPruned(6));
+    BOOST_CHECK(!IsPruned(7));
+    BOOST_CHECK(!IsPruned(8));
+
+    // by the highest block in a file, not the recorded range
+    BOOST_CHECK(!IsPruned(2));
+    BOOST_CHECK(pindexSide->nStatus & BLOCK_HAVE_DATA);
+    BOOST_CHECK(vBlockIndexByHeight[250]->nStatus & BLOCK_HAVE_DATA);
+}
+
+BOOST_AUTO_TEST_CASE(prune_keep_durable)
+{
+    // Blocks after the coins that reached the disk are kept for a replay
+    BuildChain(1000, 100);
+    BOOST_CHECK(pcoinsdbview->SetBestBlock(vBlockIndexByHeight[450]));
+    nPruneTarget = 0;
+    PruneBlockFiles();
+    for (int nFile = 0; nFile < 10; nFile++)
+        BOOST_CHECK_EQUAL(IsPruned(nFile), nFile < 4);
+}
+
+BOOST_AUTO_TEST_CASE(prune_index_reset)
+{
+    BuildChain(1000, 100);
+    nPruneTarget = 0;
+    PruneBlockFiles();
+
+    // Entries of pruned blocks no longer point into a file
+    for (int nHeight = 0; nHeight < 1000; nHeight++) {
+        CBlockIndex *pindex = vBlockIndexByHeight[nHeight];
+        if (nHeight < 700) {
+            BOOST_CHECK(!(pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)));
+            BOOST_CHECK(pindex->nStatus & BLOCK_VALID_SCRIPTS);
+            BOOST_CHECK_EQUAL(pindex->nFile, 0);
+            BOOST_CHECK_EQUAL(pindex->nDataPos, 0U);
+            BOOST_CHECK_EQUAL(pindex->nUndoPos, 0U);
+        } else {
+            BOOST_CHECK((pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO)) == (BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO));
+            BOOST_CHECK_EQUAL(pindex->nFile, nHeight / 100);
+            BOOST_CHECK(pindex->nDataPos != 0);
+        }
+    }
+
+    BOOST_CHECK(!HaveBlockDataSince(vBlockIndexByHeight[0]));
+    BOOST_CHECK(!HaveBlockDataSince(vBlockIndexByHeight[699]));
+    BOOST_CHECK(HaveBlockDataSince(vBlockIndexByHeight[700]));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -42,4 +42,26 @@ BOOST_AUTO_TEST_CASE(varints)
 
 }
 
+BOOST_AUTO_TEST_CASE(bufferreader)
+{
+    CDataStream ss(SER_DISK, 0);
+    vector<unsigned char> vch(300, 0x5a);
+    ss << 1234567 << vch << string("trinity");
+    vector<unsigned char> vchData(ss.begin(), ss.end());
+
+    CBufferReader reader(&vchData[0], &vchData[0] + vchData.size(), SER_DISK, 0);
+    int n;
+    vector<unsigned char> vchRead;
+    string str;
+    reader >> n >> vchRead >> str;
+    BOOST_CHECK(n == 1234567);
+    BOOST_CHECK(vchRead == vch);
+    BOOST_CHECK(str == "trinity");
+    BOOST_CHECK(reader.empty());
+
+    // Reading past the end throws instead of touching memory beyond it
+    CBufferReader truncated(&vchData[0], &vchData[0] + vchData.size() - 1, SER_DISK, 0);
+    BOOST_CHECK_THROW(truncated >> n >> vchRead >> str, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
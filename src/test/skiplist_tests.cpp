@@ -0,0 +1,75 @@
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "main.h"
+#include "util.h"
+
+#define SKIPLIST_LENGTH 100000
+
+BOOST_AUTO_TEST_SUITE(skiplist_tests)
+
+BOOST_AUTO_TEST_CASE(skiplist_test)
+{
+    std::vector<CBlockIndex> vIndex(SKIPLIST_LENGTH);
+
+    for (int i = 0; i < SKIPLIST_LENGTH; i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].BuildLinks();
+    }
+
+    for (int i = 0; i < SKIPLIST_LENGTH; i++) {
+        if (i > 0) {
+            BOOST_CHECK(vIndex[i].pskip == &vIndex[vIndex[i].pskip->nHeight]);
+            BOOST_CHECK(vIndex[i].pskip->nHeight < i);
+        } else {
+            BOOST_CHECK(vIndex[i].pskip == NULL);
+        }
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        int from = GetRand(SKIPLIST_LENGTH - 1);
+        int to = GetRand(from + 1);
+
+        BOOST_CHECK(vIndex[SKIPLIST_LENGTH - 1].GetAncestor(from) == &vIndex[from]);
+        BOOST_CHECK(vIndex[from].GetAncestor(to) == &vIndex[to]);
+        BOOST_CHECK(vIndex[from].GetAncestor(0) == &vIndex[0]);
+    }
+    BOOST_CHECK(vIndex[10].GetAncestor(11) == NULL);
+    BOOST_CHECK(vIndex[10].GetAncestor(-1) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(skiplist_algo_mediantime)
+{
+    static const int pnAlgoVersion[NUM_ALGOS] = { 0, BLOCK_VERSION_SCRYPT, BLOCK_VERSION_GROESTL };
+    std::vector<CBlockIndex> vIndex(2000);
+
+    // Algorithms mined in runs of random length, out of order timestamps
+    int algo = ALGO_SHA256D;
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        if (GetRand(4) == 0)
+            algo = GetRand(NUM_ALGOS);
+        vIndex[i].nHeight = i;
+        vIndex[i].nVersion = BLOCK_VERSION_DEFAULT | pnAlgoVersion[algo];
+        vIndex[i].nTime = 1400000000 + i * 60 - GetRand(600);
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].BuildLinks();
+    }
+
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        const CBlockIndex &index = vIndex[i];
+        BOOST_CHECK_EQUAL(index.GetAlgo(), GetAlgo(index.nVersion));
+        BOOST_CHECK(index.pprevAlgo == GetLastBlockIndexForAlgo(index.pprev, index.GetAlgo()));
+
+        std::vector<int64> vTime;
+        for (unsigned int j = i - std::min(i, 10U); j <= i; j++)
+            vTime.push_back(vIndex[j].GetBlockTime());
+        std::sort(vTime.begin(), vTime.end());
+        BOOST_CHECK(index.nTimeMedianPast != 0);
+        BOOST_CHECK_EQUAL(index.GetMedianTimePast(), vTime[vTime.size() / 2]);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
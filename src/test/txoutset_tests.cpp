@@ -0,0 +1,383 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include "main.h"
+#include "net.h"
+#include "txdb.h"
+#include "util.h"
+
+// Headers on top of the genesis block that meet the main network's rules:
+// two in a chain, and a third that is another child of the genesis block.
+// Mined once, as each takes about a million hashes.
+static const std::vector<CBlockHeader> &MinedHeaders()
+{
+    static std::vector<CBlockHeader> vHeaders;
+    if (!vHeaders.empty())
+        return vHeaders;
+    const uint256 &hashTarget = Params().ProofOfWorkLimit(ALGO_SHA256D);
+    const CBlockHeader genesis = Params().GenesisBlock().GetBlockHeader();
+    for (int i = 0; i < 3; i++) {
+        CBlockHeader header;
+        header.nVersion = BLOCK_VERSION_DEFAULT;
+        header.hashPrevBlock = i == 1 ? vHeaders[0].GetHash() : genesis.GetHash();
+        header.hashMerkleRoot = GetRandHash();
+        header.nTime = genesis.nTime + 60 * (i + 1);
+        header.nBits = hashTarget.GetCompact();
+        header.nNonce = 0;
+        while (header.GetPoWHash(ALGO_SHA256D) > hashTarget)
+            header.nNonce++;
+        vHeaders.push_back(header);
+    }
+    return vHeaders;
+}
+
+static CCoins RandomCoins()
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 1 + GetRand(2);
+    coins.vout.resize(1 + GetRand(3));
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = 1 + GetRand(100 * COIN);
+        coins.vout[i].scriptPubKey << OP_TRUE;
+    }
+    return coins;
+}
+
+// Runs each test against a chain state of its own, at the genesis block,
+// and puts back the one the other tests use afterwards
+struct TxOutSetSetup
+{
+    CCoinsViewCache *pcoinsTipSaved;
+    CCoinsViewFlusher *pcoinsFlusherSaved;
+    CCoinsViewPrefetch *pcoinsPrefetchSaved;
+    CCoinsViewDB *pcoinsdbviewSaved;
+    CBlockTreeDB *pblocktreeSaved;
+    CBlockIndex *pindexBestSaved;
+    uint256 hashBestChainSaved;
+    int nBestHeightSaved;
+    uint256 nBestChainWorkSaved;
+    std::vector<CBlockIndex*> vBlockIndexByHeightSaved;
+    std::set<CBlockIndex*> setIndexSaved;
+    bool fHavePrunedSaved;
+    bool fLoadedTxOutSetSaved;
+    uint64 nLocalServicesSaved;
+
+    boost::filesystem::path pathDump;
+    std::vector<std::pair<uint256, CCoins> > vCoins;
+
+    TxOutSetSetup()
+    {
+        pcoinsTipSaved = pcoinsTip;
+        pcoinsFlusherSaved = pcoinsFlusher;
+        pcoinsPrefetchSaved = pcoinsPrefetch;
+        pcoinsdbviewSaved = pcoinsdbview;
+        pblocktreeSaved = pblocktree;
+        pindexBestSaved = pindexBest;
+        hashBestChainSaved = hashBestChain;
+        nBestHeightSaved = nBestHeight;
+        nBestChainWorkSaved = nBestChainWork;
+        vBlockIndexByHeightSaved = vBlockIndexByHeight;
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+            setIndexSaved.insert(item.second);
+        fHavePrunedSaved = fHavePruned;
+        fLoadedTxOutSetSaved = fLoadedTxOutSet;
+        nLocalServicesSaved = nLocalServices;
+
+        pcoinsTip = NULL;
+        pcoinsFlusher = NULL;
+        pcoinsPrefetch = NULL;
+        pcoinsdbview = NULL;
+        pblocktree = NULL;
+        pathDump = GetDataDir() / "txoutset.dat";
+        NewNode();
+    }
+
+    ~TxOutSetSetup()
+    {
+        DeleteNode();
+        pcoinsTip = pcoinsTipSaved;
+        pcoinsFlusher = pcoinsFlusherSaved;
+        pcoinsPrefetch = pcoinsPrefetchSaved;
+        pcoinsdbview = pcoinsdbviewSaved;
+        pblocktree = pblocktreeSaved;
+        pindexBest = pindexBestSaved;
+        hashBestChain = hashBestChainSaved;
+        nBestHeight = nBestHeightSaved;
+        nBestChainWork = nBestChainWorkSaved;
+        vBlockIndexByHeight = vBlockIndexByHeightSaved;
+        fHavePruned = fHavePrunedSaved;
+        fLoadedTxOutSet = fLoadedTxOutSetSaved;
+        nLocalServices = nLocalServicesSaved;
+        boost::filesystem::remove(pathDump);
+    }
+
+    void DeleteNode()
+    {
+        delete pcoinsTip;
+        delete pcoinsFlusher;
+        delete pcoinsdbview;
+        delete pblocktree;
+
+        // Drop the entries added since the setup
+        std::vector<CBlockIndex*> vIndex;
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+            vIndex.push_back(item.second);
+        mapBlockIndex.clear();
+        BOOST_FOREACH(CBlockIndex *pindex, vIndex) {
+            if (setIndexSaved.count(pindex))
+                mapBlockIndex.insert(pindex);
+            else
+                delete pindex;
+        }
+    }
+
+    // Empty databases, and a block index that only knows the blocks from before the setup
+    void NewNode()
+    {
+        DeleteNode();
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 20, true);
+        pcoinsFlusher = new CCoinsViewFlusher(*pcoinsdbview);
+        pcoinsTip = new CCoinsViewCache(*pcoinsFlusher);
+        pcoinsTip->SetBestBlock(pindexGenesisBlock);
+        pindexBest = pindexGenesisBlock;
+        hashBestChain = pindexGenesisBlock->GetBlockHash();
+        nBestHeight = 0;
+        nBestChainWork = pindexGenesisBlock->GetChainWork();
+        vBlockIndexByHeight.assign(1, pindexGenesisBlock);
+        fHavePruned = false;
+        fLoadedTxOutSet = false;
+    }
+
+    // Dump some coins at the end of the mined chain, then start over as a new node
+    CCoinsStats Dump()
+    {
+        CBlockIndex *pindexPrev = pindexGenesisBlock;
+        for (int i = 0; i < 2; i++) {
+            CBlockHeader header = MinedHeaders()[i];
+            CBlockIndex *pindex = new CBlockIndex(header);
+            pindex->hashBlock = header.GetHash();
+            pindex->pprev = pindexPrev;
+            pindex->nHeight = pindexPrev->nHeight + 1;
+            pindex->BuildLinks();
+            pindex->nTx = 1;
+            pindex->SetChainWork(pindexPrev->GetChainWork() + pindex->GetBlockWorkAdjusted());
+            pindex->nChainTx = pindexPrev->nChainTx + 1;
+            mapBlockIndex.insert(pindex);
+            pindexPrev = pindex;
+        }
+        vCoins.clear();
+        for (int i = 0; i < 50; i++) {
+            vCoins.push_back(std::make_pair(GetRandHash(), RandomCoins()));
+            BOOST_CHECK(pcoinsTip->SetCoins(vCoins.back().first, vCoins.back().second));
+        }
+        BOOST_CHECK(pcoinsTip->SetBestBlock(pindexPrev));
+
+        CCoinsStats stats;
+        FILE *file = fopen(pathDump.string().c_str(), "wb");
+        BOOST_CHECK(file != NULL);
+        BOOST_CHECK(DumpTxOutSet(file, stats));
+        BOOST_CHECK(stats.hashBlock == pindexPrev->GetBlockHash());
+        BOOST_CHECK_EQUAL(stats.nHeight, 2);
+        BOOST_CHECK_EQUAL(stats.nTransactions, vCoins.size());
+        NewNode();
+        return stats;
+    }
+
+    std::vector<unsigned char> ReadDump()
+    {
+        std::vector<unsigned char> vch(boost::filesystem::file_size(pathDump));
+        FILE *file = fopen(pathDump.string().c_str(), "rb");
+        BOOST_CHECK(file != NULL && fread(&vch[0], 1, vch.size(), file) == vch.size());
+        fclose(file);
+        return vch;
+    }
+
+    bool Load(const std::vector<unsigned char> &vch, const uint256 &hashTrusted)
+    {
+        boost::filesystem::path path = pathDump.string() + ".edited";
+        FILE *file = fopen(path.string().c_str(), "wb");
+        BOOST_CHECK(file != NULL && fwrite(&vch[0], 1, vch.size(), file) == vch.size());
+        fclose(file);
+        file = fopen(path.string().c_str(), "rb");
+        bool fOk = LoadTxOutSet(file, hashTrusted);
+        boost::filesystem::remove(path);
+        return fOk;
+    }
+
+    // A refused load leaves the node as it was
+    void CheckUnchanged()
+    {
+        BOOST_CHECK(pindexBest == pindexGenesisBlock);
+        BOOST_CHECK(!fLoadedTxOutSet);
+        BOOST_CHECK(!pcoinsdbview->IsLoading());
+        BOOST_CHECK(!mapBlockIndex.count(MinedHeaders()[0].GetHash()));
+        CCoinsStats stats;
+        BOOST_CHECK(pcoinsdbview->GetStats(stats));
+        BOOST_CHECK_EQUAL(stats.nTransactions, 0U);
+        BOOST_CHECK(!pcoinsTip->HaveCoins(vCoins[0].first));
+    }
+};
+
+// Offsets in a dump: message start, version, block hash, height, then each
+// header with its transaction count (one byte here)
+static const unsigned int DUMP_HEIGHT_POS = 4 + 4 + 32;
+static const unsigned int DUMP_HEADERS_POS = DUMP_HEIGHT_POS + 4;
+static const unsigned int DUMP_HEADER_SIZE = 80 + 1;
+
+BOOST_FIXTURE_TEST_SUITE(txoutset_tests, TxOutSetSetup)
+
+BOOST_AUTO_TEST_CASE(txoutset_dump_load)
+{
+    CCoinsStats stats = Dump();
+    std::vector<unsigned char> vch = ReadDump();
+    BOOST_CHECK(Load(vch, stats.hashSerialized));
+
+    CBlockIndex *pindexTip = mapBlockIndex[MinedHeaders()[1].GetHash()];
+    BOOST_CHECK(pindexTip != NULL);
+    BOOST_CHECK(pindexBest == pindexTip);
+    BOOST_CHECK_EQUAL(nBestHeight, 2);
+    BOOST_CHECK(pindexTip->pprev->GetBlockHash() == MinedHeaders()[0].GetHash());
+    BOOST_CHECK(pindexTip->pprev->pprev == pindexGenesisBlock);
+    BOOST_CHECK(vBlockIndexByHeight[1] == pindexTip->pprev);
+    BOOST_CHECK(fLoadedTxOutSet);
+    BOOST_CHECK(!pcoinsdbview->IsLoading());
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == pindexTip);
+
+    CCoinsStats statsLoaded;
+    BOOST_CHECK(pcoinsdbview->GetStats(statsLoaded));
+    BOOST_CHECK_EQUAL(statsLoaded.nTransactions, stats.nTransactions);
+    BOOST_CHECK_EQUAL(statsLoaded.nTotalAmount, stats.nTotalAmount);
+    BOOST_CHECK(statsLoaded.muhash.GetHash() == stats.hashSerialized);
+    for (unsigned int i = 0; i < vCoins.size(); i++) {
+        CCoins coins;
+        BOOST_CHECK(pcoinsTip->GetCoins(vCoins[i].first, coins));
+        BOOST_CHECK(coins == vCoins[i].second);
+    }
+
+    // Only a new chain can be started from a UTXO set
+    BOOST_CHECK(!Load(vch, stats.hashSerialized));
+}
+
+BOOST_AUTO_TEST_CASE(txoutset_untrusted)
+{
+    CCoinsStats stats = Dump();
+    std::vector<unsigned char> vch = ReadDump();
+
+    // Nothing outside the file vouches for the coins
+    BOOST_CHECK(!Load(vch, 0));
+    CheckUnchanged();
+    BOOST_CHECK(!Load(vch, GetRandHash()));
+    CheckUnchanged();
+    BOOST_CHECK(Load(vch, stats.hashSerialized));
+}
+
+BOOST_AUTO_TEST_CASE(txoutset_bad_headers)
+{
+    CCoinsStats stats = Dump();
+    const std::vector<unsigned char> vch = ReadDump();
+
+    // A second header that is not a child of the first
+    std::vector<unsigned char> vchFork(vch);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << MinedHeaders()[2];
+    BOOST_CHECK_EQUAL(ss.size(), 80U);
+    std::copy(ss.begin(), ss.end(), vchFork.begin() + DUMP_HEADERS_POS + DUMP_HEADER_SIZE);
+    BOOST_CHECK(!Load(vchFork, stats.hashSerialized));
+    CheckUnchanged();
+
+    // A header without the work it claims
+    std::vector<unsigned char> vchWork(vch);
+    vchWork[DUMP_HEADERS_POS + 4 + 32] ^= 1; // in the merkle root
+    BOOST_CHECK(!Load(vchWork, stats.hashSerialized));
+    CheckUnchanged();
+
+    // Headers that end below the dumped block
+    std::vector<unsigned char> vchHeight(vch);
+    vchHeight[DUMP_HEIGHT_POS] = 1;
+    BOOST_CHECK(!Load(vchHeight, stats.hashSerialized));
+    CheckUnchanged();
+
+    // Or that run into the coins
+    vchHeight[DUMP_HEIGHT_POS] = 3;
+    BOOST_CHECK(!Load(vchHeight, stats.hashSerialized));
+    CheckUnchanged();
+
+    // A dump for another network
+    std::vector<unsigned char> vchMagic(vch);
+    vchMagic[0] ^= 0xff;
+    BOOST_CHECK(!Load(vchMagic, stats.hashSerialized));
+    CheckUnchanged();
+
+    BOOST_CHECK(Load(vch, stats.hashSerialized));
+}
+
+BOOST_AUTO_TEST_CASE(txoutset_bad_coins)
+{
+    CCoinsStats stats = Dump();
+    const std::vector<unsigned char> vch = ReadDump();
+
+    // The last coin differs from the one the statistics were taken of; the
+    // partly loaded set is removed again
+    std::vector<unsigned char> vchCoins(vch);
+    vchCoins.back() ^= 1; // the height of the last transaction
+    BOOST_CHECK(!Load(vchCoins, stats.hashSerialized));
+    CheckUnchanged();
+
+    // A truncated dump
+    std::vector<unsigned char> vchShort(vch.begin(), vch.end() - 10);
+    BOOST_CHECK(!Load(vchShort, stats.hashSerialized));
+    CheckUnchanged();
+
+    BOOST_CHECK(Load(vch, stats.hashSerialized));
+}
+
+static void LoadInterrupted(const boost::filesystem::path &path, const uint256 &hashTrusted, bool *pfInterrupted)
+{
+    // Wait for the interruption, so the load sees it at its first chance
+    while (!boost::this_thread::interruption_requested())
+        boost::this_thread::yield();
+    try {
+        LoadTxOutSet(fopen(path.string().c_str(), "rb"), hashTrusted);
+    } catch (boost::thread_interrupted) {
+        *pfInterrupted = true;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(txoutset_interrupted)
+{
+    CCoinsStats stats = Dump();
+
+    // Shutting down during a load leaves nothing behind
+    bool fInterrupted = false;
+    boost::thread thread(boost::bind(&LoadInterrupted, pathDump, stats.hashSerialized, &fInterrupted));
+    thread.interrupt();
+    thread.join();
+    BOOST_CHECK(fInterrupted);
+    CheckUnchanged();
+
+    // A load cut short by a crash stays marked, and is refused until the
+    // database is rebuilt
+    {
+        CCoinsViewDB db(1 << 20, false, true);
+        BOOST_CHECK(db.BeginLoad());
+        BOOST_CHECK(db.LoadCoins(std::vector<std::pair<uint256, CCoins> >(vCoins.begin(), vCoins.begin() + 10)));
+    }
+    {
+        CCoinsViewDB db(1 << 20, false, false);
+        BOOST_CHECK(db.IsLoading());
+        BOOST_CHECK(!db.BeginLoad());
+        BOOST_CHECK(db.HaveCoins(vCoins[0].first));
+        BOOST_CHECK(db.AbortLoad());
+        BOOST_CHECK(!db.IsLoading());
+        BOOST_CHECK(!db.HaveCoins(vCoins[0].first));
+    }
+
+    std::vector<unsigned char> vch = ReadDump();
+    BOOST_CHECK(Load(vch, stats.hashSerialized));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,9 @@
 #include <boost/test/unit_test.hpp>
 
+#include "bignum.h"
+#include "main.h"
 #include "uint256.h"
+#include "util.h"
 
 BOOST_AUTO_TEST_SUITE(uint256_tests)
 
@@ -15,4 +18,142 @@ BOOST_AUTO_TEST_CASE(uint256_equality)
     BOOST_CHECK(num1+num2 == num3+num2);
 }
 
+// A random number with the given number of significant bits
+static uint256 RandomBits(unsigned int nBits)
+{
+    uint256 n = GetRandHash();
+    if (nBits == 0)
+        return 0;
+    n >>= 256 - nBits;
+    n |= uint256(1) << (nBits - 1);
+    return n;
+}
+
+BOOST_AUTO_TEST_CASE(uint256_arithmetic)
+{
+    const CBigNum bnModulus = CBigNum(1) << 256;
+    for (unsigned int i = 0; i < 2000; i++) {
+        uint256 a = RandomBits(GetRand(257));
+        uint256 b = RandomBits(GetRand(257));
+        uint32_t c = GetRand(0x100000000ULL);
+        CBigNum bnA(a), bnB(b);
+
+        BOOST_CHECK_EQUAL(a.bits(), (unsigned int)BN_num_bits(&bnA));
+        BOOST_CHECK((a * b) == ((bnA * bnB) % bnModulus).getuint256());
+        BOOST_CHECK((a * c) == ((bnA * CBigNum((uint64)c)) % bnModulus).getuint256());
+        if (b != 0)
+            BOOST_CHECK((a / b) == (bnA / bnB).getuint256());
+        if (c != 0)
+            BOOST_CHECK((a / uint256(c)) == (bnA / CBigNum((uint64)c)).getuint256());
+    }
+
+    uint256 a = GetRandHash();
+    BOOST_CHECK(a / a == 1);
+    BOOST_CHECK(a / 1 == a);
+    BOOST_CHECK(a * 1 == a);
+    BOOST_CHECK(a * 0 == 0);
+    BOOST_CHECK(uint256(0).bits() == 0);
+    BOOST_CHECK((~uint256(0)).bits() == 256);
+    BOOST_CHECK_THROW(a / 0, uint_error);
+}
+
+// SetCompact must give the same number as CBigNum, and say when it cannot hold it
+static void CheckSetCompact(uint32_t nCompact)
+{
+    static const CBigNum bnLimit = CBigNum(1) << 256;
+    CBigNum bn;
+    bn.SetCompact(nCompact);
+    bool fNegative, fOverflow;
+    uint256 n;
+    n.SetCompact(nCompact, &fNegative, &fOverflow);
+
+    BOOST_CHECK_EQUAL(fNegative, bn < 0);
+    CBigNum bnAbs = fNegative ? -bn : bn;
+    BOOST_CHECK_EQUAL(fOverflow, bnAbs >= bnLimit);
+    if (!fOverflow) {
+        BOOST_CHECK(n == bnAbs.getuint256());
+        BOOST_CHECK_EQUAL(n.GetCompact(fNegative), bn.GetCompact());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(uint256_SetCompact)
+{
+    // Every exponent and sign, with mantissas covering each byte position
+    for (uint32_t nSize = 0; nSize < 256; nSize++) {
+        for (uint32_t nSign = 0; nSign < 2; nSign++) {
+            static const uint32_t pnWord[] = { 0, 1, 0x7f, 0x80, 0xff, 0x100, 0x7fff, 0x8000, 0xffff,
+                                               0x10000, 0x123456, 0x7fffff };
+            for (unsigned int i = 0; i < sizeof(pnWord) / sizeof(pnWord[0]); i++)
+                CheckSetCompact(nSize << 24 | nSign << 23 | pnWord[i]);
+            for (unsigned int i = 0; i < 200; i++)
+                CheckSetCompact(nSize << 24 | nSign << 23 | (GetRand(0x800000) >> GetRand(24)));
+        }
+    }
+
+    uint256 n;
+    BOOST_CHECK(n.SetCompact(0x04123456) == 0x12345600);
+    BOOST_CHECK_EQUAL(n.GetCompact(), 0x04123456U);
+    BOOST_CHECK_EQUAL(n.GetCompact(true), 0x04923456U);
+    n = 0x80;
+    BOOST_CHECK_EQUAL(n.GetCompact(), 0x02008000U);
+}
+
+BOOST_AUTO_TEST_CASE(uint256_GetCompact)
+{
+    // Every length of number, against CBigNum
+    for (unsigned int nBits = 0; nBits <= 256; nBits++) {
+        for (unsigned int i = 0; i < 50; i++) {
+            uint256 n = RandomBits(nBits);
+            BOOST_CHECK_EQUAL(n.GetCompact(), CBigNum(n).GetCompact());
+            uint256 n2;
+            BOOST_CHECK(n2.SetCompact(n.GetCompact()) == CBigNum().SetCompact(CBigNum(n).GetCompact()).getuint256());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(uint256_blockwork)
+{
+    // The work of a target is 2^256 / (target+1), as it was computed with CBigNum
+    for (unsigned int i = 0; i < 5000; i++) {
+        CBlockHeader header;
+        header.nBits = (GetRand(0x22) << 24) | GetRand(0x1000000);
+        CBlockIndex index(header);
+        CBigNum bnTarget;
+        bnTarget.SetCompact(header.nBits);
+        CBigNum bnWork = bnTarget <= 0 ? CBigNum(0) : (CBigNum(1) << 256) / (bnTarget + 1);
+        BOOST_CHECK(index.GetBlockWork() == bnWork.getuint256());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(uint256_retarget)
+{
+    // The retarget gives what CBigNum gave, including regtest, whose limit
+    // leaves no room for the product in 256 bits
+    static const int64 nTargetTimespan = 10 * 60;
+    CChainParams::Network pnNetwork[] = { CChainParams::MAIN, CChainParams::REGTEST };
+    for (unsigned int n = 0; n < 2; n++) {
+        SelectParams(pnNetwork[n]);
+        const CBigNum bnLimit(Params().ProofOfWorkLimit(ALGO_SHA256D));
+        std::vector<unsigned int> vBits;
+        vBits.push_back(bnLimit.GetCompact());
+        vBits.push_back((bnLimit >> 1).GetCompact());
+        vBits.push_back(0x1b0404cb);
+        vBits.push_back(0x1d00ffff);
+        for (unsigned int i = 0; i < 50; i++)
+            vBits.push_back((bnLimit >> GetRand(64)).GetCompact());
+        BOOST_FOREACH(unsigned int nBits, vBits) {
+            for (int64 nTimespan = nTargetTimespan * 90 / 100; nTimespan <= nTargetTimespan * 2; nTimespan += 1 + GetRand(30)) {
+                CBigNum bnNew;
+                bnNew.SetCompact(nBits);
+                bnNew *= nTimespan;
+                bnNew /= nTargetTimespan;
+                if (bnNew > bnLimit)
+                    bnNew = bnLimit;
+                BOOST_CHECK_EQUAL(CalculateNextWorkRequired(nBits, nTimespan, ALGO_SHA256D), bnNew.GetCompact());
+            }
+        }
+    }
+    SelectParams(CChainParams::MAIN);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,8 @@
 #include "hash.h"
 #include "chainparams.h"
 
+#include <boost/bind.hpp>
+
 using namespace std;
 
 void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
@@ -21,28 +23,171 @@ void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
     batch.Write('B', hash);
 }
 
+/** Transaction data shared by the outputs of the per-output layout */
+class CCoinsHeader
+{
+public:
+    int nVersion;
+    int nHeight;
+    bool fCoinBase;
+
+    CCoinsHeader() : nVersion(0), nHeight(0), fCoinBase(false) { }
+    CCoinsHeader(const CCoins &coins) : nVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase) { }
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(VARINT(this->nVersion));
+        READWRITE(VARINT(nHeight));
+        READWRITE(fCoinBase);
+    )
+};
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+    nLayout = COINS_LAYOUT_TXID;
+    db.Read('L', nLayout);
+
+    // Running statistics are kept from the first write of a new database;
+    // older ones compute them once, on the first GetStats
+    fHaveStats = db.Read('S', statsCommitted) || !db.Exists('B');
+}
+
+// Add the stored outputs of txid to coins.vout, seeking with pcursor if given
+bool CCoinsViewDB::ReadOutputs(const uint256 &txid, CCoins &coins, leveldb::Iterator *pcursorIn) {
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << make_pair('o', COutPoint(txid, 0));
+    const size_t nPrefixSize = 1 + sizeof(uint256);
+
+    leveldb::Iterator *pcursor = pcursorIn ? pcursorIn : db.NewIterator();
+    bool fOk = true;
+    for (pcursor->Seek(leveldb::Slice(&ssPrefix[0], ssPrefix.size())); pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() != ssPrefix.size() || memcmp(slKey.data(), &ssPrefix[0], nPrefixSize) != 0)
+            break;
+        try {
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            COutPoint outpoint;
+            ssKey >> chType >> outpoint;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            if (coins.vout.size() <= outpoint.n)
+                coins.vout.resize(outpoint.n + 1);
+            ssValue >> REF(CTxOutCompressor(coins.vout[outpoint.n]));
+        } catch (std::exception &e) {
+            fOk = error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            break;
+        }
+    }
+    if (!pcursorIn)
+        delete pcursor;
+    return fOk;
+}
+
+// Stage the records of txid for coins, given what is stored now
+void CCoinsViewDB::BatchWriteOutputs(CLevelDBBatch &batch, const uint256 &txid, const CCoins &coins, const CCoins &coinsOld) {
+    if (coins.IsPruned()) {
+        if (!coinsOld.IsPruned())
+            batch.Erase(make_pair('h', txid));
+        for (unsigned int n = 0; n < coinsOld.vout.size(); n++)
+            if (coinsOld.IsAvailable(n))
+                batch.Erase(make_pair('o', COutPoint(txid, n)));
+        return;
+    }
+
+    batch.Write(make_pair('h', txid), CCoinsHeader(coins));
+    for (unsigned int n = 0; n < coinsOld.vout.size(); n++)
+        if (coinsOld.IsAvailable(n) && !coins.IsAvailable(n))
+            batch.Erase(make_pair('o', COutPoint(txid, n)));
+    for (unsigned int n = 0; n < coins.vout.size(); n++)
+        if (coins.IsAvailable(n) && !coinsOld.IsAvailable(n))
+            batch.Write(make_pair('o', COutPoint(txid, n)), CTxOutCompressor(REF(coins.vout[n])));
+}
+
+// Stage the records of txid for coins, given the outputs that changed since they were stored
+void CCoinsViewDB::BatchWriteListedOutputs(CLevelDBBatch &batch, const uint256 &txid, const CCoins &coins, const std::vector<unsigned int> &vChanged) {
+    if (coins.IsPruned())
+        batch.Erase(make_pair('h', txid));
+    else
+        batch.Write(make_pair('h', txid), CCoinsHeader(coins));
+    BOOST_FOREACH(unsigned int n, vChanged) {
+        if (coins.IsAvailable(n))
+            batch.Write(make_pair('o', COutPoint(txid, n)), CTxOutCompressor(REF(coins.vout[n])));
+        else
+            batch.Erase(make_pair('o', COutPoint(txid, n)));
+    }
+}
+
+// Read the stored coins of txid; a transaction that is not stored comes back pruned
+bool CCoinsViewDB::ReadStoredCoins(const uint256 &txid, CCoins &coins, leveldb::Iterator *pcursor) {
+    coins = CCoins();
+    if (nLayout == COINS_LAYOUT_TXID) {
+        db.Read(make_pair('c', txid), coins);
+        return true;
+    }
+    CCoinsHeader header;
+    if (!db.Read(make_pair('h', txid), header))
+        return true;
+    coins.nVersion = header.nVersion;
+    coins.nHeight = header.nHeight;
+    coins.fCoinBase = header.fCoinBase;
+    return ReadOutputs(txid, coins, pcursor);
+}
+
+// Stage the change of txid to coins, and apply it to pstats if given. With the
+// outputs changed since the last write listed in pvChanged, nothing is read back.
+bool CCoinsViewDB::BatchWriteChange(CLevelDBBatch &batch, CCoinsStats *pstats, const uint256 &txid, const CCoins &coins, bool fFresh, const std::vector<unsigned int> *pvChanged, leveldb::Iterator *pcursor) {
+    if (pstats == NULL && pvChanged != NULL && !fFresh && nLayout != COINS_LAYOUT_TXID) {
+        BatchWriteListedOutputs(batch, txid, coins, *pvChanged);
+        return true;
+    }
+    // Only needed for what it replaces; a fresh transaction replaces nothing
+    CCoins coinsOld;
+    if (!fFresh && (pstats != NULL || nLayout != COINS_LAYOUT_TXID))
+        if (!ReadStoredCoins(txid, coinsOld, pcursor))
+            return false;
+    if (pstats != NULL)
+        UpdateCoinsStats(*pstats, txid, coinsOld, coins);
+    if (nLayout == COINS_LAYOUT_TXID)
+        BatchWriteCoins(batch, txid, coins);
+    else
+        BatchWriteOutputs(batch, txid, coins, coinsOld);
+    return true;
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) { 
-    return db.Read(make_pair('c', txid), coins); 
+    if (nLayout == COINS_LAYOUT_TXID)
+        return db.Read(make_pair('c', txid), coins); 
+
+    return ReadStoredCoins(txid, coins) && !coins.IsPruned();
 }
 
 bool CCoinsViewDB::SetCoins(const uint256 &txid, const CCoins &coins) {
+    LOCK(cs_stats);
     CLevelDBBatch batch;
-    BatchWriteCoins(batch, txid, coins);
-    return db.WriteBatch(batch);
+    CCoinsStats statsNew;
+    if (fHaveStats)
+        statsNew = statsCommitted;
+    if (!BatchWriteChange(batch, fHaveStats ? &statsNew : NULL, txid, coins, false))
+        return false;
+    if (fHaveStats)
+        batch.Write('S', statsNew);
+    if (!db.WriteBatch(batch))
+        return false;
+    if (fHaveStats)
+        statsCommitted = statsNew;
+    return true;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) {
-    return db.Exists(make_pair('c', txid)); 
+    if (nLayout == COINS_LAYOUT_TXID)
+        return db.Exists(make_pair('c', txid)); 
+    return db.Exists(make_pair('h', txid));
 }
 
 CBlockIndex *CCoinsViewDB::GetBestBlock() {
     uint256 hashBestChain;
     if (!db.Read('B', hashBestChain))
         return NULL;
-    std::map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(hashBestChain);
+    CBlockMap::iterator it = mapBlockIndex.find(hashBestChain);
     if (it == mapBlockIndex.end())
         return NULL;
     return it->second;
@@ -54,16 +199,52 @@ bool CCoinsViewDB::SetBestBlock(CBlockIndex *pindex) {
     return db.WriteBatch(batch);
 }
 
-bool CCoinsViewDB::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) {
-    printf("Committing %u changed transactions to coin database...\n", (unsigned int)mapCoins.size());
-
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange) {
+    // Held throughout, so the statistics always describe what is stored
+    LOCK(cs_stats);
     CLevelDBBatch batch;
-    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
-        BatchWriteCoins(batch, it->first, it->second);
+    CCoinsStats statsNew;
+    if (fHaveStats) {
+        statsNew = statsCommitted;
+        CombineCoinsStats(statsNew, statsChange);
+    }
+    unsigned int nChanged = 0;
+    // Shared by the transactions whose changed outputs are not listed
+    leveldb::Iterator *pcursor = NULL;
+    bool fOk = true;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        const CCoinsCacheEntry &entry = it->second;
+        if (!(entry.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        // Created and spent again since the last flush: never reached the database
+        bool fFresh = (entry.flags & CCoinsCacheEntry::FRESH) != 0;
+        if (fFresh && entry.coins.IsPruned())
+            continue;
+        bool fListed = !(entry.flags & CCoinsCacheEntry::UNLISTED);
+        if (!fListed && !fFresh && nLayout != COINS_LAYOUT_TXID && pcursor == NULL)
+            pcursor = db.NewIterator();
+        if (!BatchWriteChange(batch, NULL, it->first, entry.coins, fFresh, fListed ? &entry.vChanged : NULL, pcursor)) {
+            fOk = false;
+            break;
+        }
+        nChanged++;
+    }
+    delete pcursor;
+    if (!fOk)
+        return false;
+    printf("Committing %u changed transactions (out of %u) to coin database...\n", nChanged, (unsigned int)mapCoins.size());
+    // The best block and the statistics are only recorded together with the
+    // coins they describe, and only reported back once all are on disk
+    if (fHaveStats)
+        batch.Write('S', statsNew);
     if (pindex)
         BatchWriteHashBestChain(batch, pindex->GetBlockHash());
 
-    return db.WriteBatch(batch);
+    if (!db.WriteBatch(batch, true))
+        return false;
+    if (fHaveStats)
+        statsCommitted = statsNew;
+    return true;
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
@@ -112,54 +293,284 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
-    leveldb::Iterator *pcursor = db.NewIterator();
-    pcursor->SeekToFirst();
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock()->GetBlockHash();
-    ss << stats.hashBlock;
-    int64 nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
+// Does key belong to records of type chType for txids starting with a byte below nEnd
+static bool InShard(const leveldb::Slice &slKey, char chType, unsigned int nEnd) {
+    return slKey.size() > 1 && slKey.data()[0] == chType && (unsigned char)slKey.data()[1] < nEnd;
+}
+
+bool CCoinsViewDB::ReadCoinsRange(const leveldb::Snapshot *psnapshot, unsigned int nBegin, unsigned int nEnd,
+                                  const boost::function<bool (const uint256 &, const CCoins &)> &func) {
+    char chTx = nLayout == COINS_LAYOUT_TXID ? 'c' : 'h';
+    char pchStart[2] = { chTx, (char)nBegin };
+    char pchStartOut[2] = { 'o', (char)nBegin };
+
+    leveldb::Iterator *pcursor = db.NewIterator(psnapshot);
+    leveldb::Iterator *pcursorOut = db.NewIterator(psnapshot);
+    pcursorOut->Seek(leveldb::Slice(pchStartOut, 2));
+    bool fOk = true, fMore = true;
+    try {
+        for (pcursor->Seek(leveldb::Slice(pchStart, 2)); fMore && pcursor->Valid() && InShard(pcursor->key(), chTx, nEnd); pcursor->Next()) {
+            boost::this_thread::interruption_point();
             leveldb::Slice slKey = pcursor->key();
+            leveldb::Slice slValue = pcursor->value();
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
             char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
+            uint256 txid;
+            ssKey >> chType >> txid;
+            CCoins coins;
+            if (chTx == 'c') {
                 ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n'); 
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
+            } else {
+                CCoinsHeader header;
+                ssValue >> header;
+                coins.nVersion = header.nVersion;
+                coins.nHeight = header.nHeight;
+                coins.fCoinBase = header.fCoinBase;
+
+                // Outputs are sorted by txid just like the headers, so walk them alongside
+                for (; pcursorOut->Valid() && InShard(pcursorOut->key(), 'o', nEnd); pcursorOut->Next()) {
+                    leveldb::Slice slKeyOut = pcursorOut->key();
+                    int nCmp = memcmp(slKeyOut.data() + 1, slKey.data() + 1, sizeof(uint256));
+                    if (nCmp > 0)
+                        break;
+                    if (nCmp < 0) {
+                        fOk = error("%s() : output without transaction", __PRETTY_FUNCTION__);
+                        break;
                     }
+                    leveldb::Slice slValueOut = pcursorOut->value();
+                    CDataStream ssKeyOut(slKeyOut.data(), slKeyOut.data()+slKeyOut.size(), SER_DISK, CLIENT_VERSION);
+                    CDataStream ssValueOut(slValueOut.data(), slValueOut.data()+slValueOut.size(), SER_DISK, CLIENT_VERSION);
+                    COutPoint outpoint;
+                    ssKeyOut >> chType >> outpoint;
+                    if (coins.vout.size() <= outpoint.n)
+                        coins.vout.resize(outpoint.n + 1);
+                    ssValueOut >> REF(CTxOutCompressor(coins.vout[outpoint.n]));
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                if (!fOk)
+                    break;
+            }
+            fMore = func(txid, coins);
+        }
+        if (fOk && fMore && chTx == 'h' && pcursorOut->Valid() && InShard(pcursorOut->key(), 'o', nEnd))
+            fOk = error("%s() : output without transaction", __PRETTY_FUNCTION__);
+    } catch (std::exception &e) {
+        fOk = error("%s() : deserialize error", __PRETTY_FUNCTION__);
+    }
+    delete pcursorOut;
+    delete pcursor;
+    return fOk;
+}
+
+static bool AddCoinsStats(CCoinsStats *pstats, const uint256 &txid, const CCoins &coins) {
+    UpdateCoinsStats(*pstats, txid, CCoins(), coins);
+    return true;
+}
+
+bool CCoinsViewDB::ComputeStatsShard(const leveldb::Snapshot *psnapshot, unsigned int nShard, CCoinsStats &stats) {
+    // Shards split the txids by their first serialized byte
+    unsigned int nBegin = nShard * 256 / COINS_STATS_SHARDS, nEnd = (nShard + 1) * 256 / COINS_STATS_SHARDS;
+    return ReadCoinsRange(psnapshot, nBegin, nEnd, boost::bind(&AddCoinsStats, &stats, _1, _2));
+}
+
+// Runs shards handed out through nNext until none are left
+static void ThreadComputeStats(CCoinsViewDB *pview, const leveldb::Snapshot *psnapshot, boost::mutex *pmutex, unsigned int *pnNext,
+                               std::vector<CCoinsStats> *pvStats, std::vector<bool> *pvOk) {
+    while (true) {
+        unsigned int nShard;
+        {
+            boost::unique_lock<boost::mutex> lock(*pmutex);
+            nShard = (*pnNext)++;
+        }
+        if (nShard >= COINS_STATS_SHARDS)
+            return;
+        bool fOk = pview->ComputeStatsShard(psnapshot, nShard, (*pvStats)[nShard]);
+        boost::unique_lock<boost::mutex> lock(*pmutex);
+        (*pvOk)[nShard] = fOk;
+    }
+}
+
+bool CCoinsViewDB::ComputeStats(CCoinsStats &stats, int nThreads) {
+    const leveldb::Snapshot *psnapshot = db.GetSnapshot();
+    uint256 hashBestChain = 0;
+    db.Read('B', hashBestChain, psnapshot);
+
+    std::vector<CCoinsStats> vStats(COINS_STATS_SHARDS);
+    std::vector<bool> vOk(COINS_STATS_SHARDS, false);
+    boost::mutex mutex;
+    unsigned int nNext = 0;
+    nThreads = std::max(1, std::min(nThreads, (int)COINS_STATS_SHARDS));
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&ThreadComputeStats, this, psnapshot, &mutex, &nNext, &vStats, &vOk));
+    threads.join_all();
+    db.ReleaseSnapshot(psnapshot);
+
+    stats = CCoinsStats();
+    for (unsigned int i = 0; i < COINS_STATS_SHARDS; i++) {
+        if (!vOk[i])
+            return false;
+        CombineCoinsStats(stats, vStats[i]);
+    }
+    stats.hashBlock = hashBestChain;
+    stats.hashSerialized = stats.muhash.GetHash();
+    return true;
+}
+
+bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
+    {
+        LOCK(cs_stats);
+        if (fHaveStats) {
+            stats = statsCommitted;
+        } else {
+            // Written before statistics were kept: count once, then keep them up to date
+            printf("Computing unspent output statistics...\n");
+            if (!ComputeStats(stats, boost::thread::hardware_concurrency()))
+                return false;
+            uint256 hashBestChain = 0;
+            db.Read('B', hashBestChain);
+            if (stats.hashBlock == hashBestChain && db.Write('S', stats, true)) {
+                statsCommitted = stats;
+                fHaveStats = true;
             }
-            pcursor->Next();
+        }
+    }
+    CBlockIndex *pindex = GetBestBlock();
+    if (pindex) {
+        stats.hashBlock = pindex->GetBlockHash();
+        stats.nHeight = pindex->nHeight;
+    }
+    stats.hashSerialized = stats.muhash.GetHash();
+    return true;
+}
+
+bool CCoinsViewDB::ReadSnapshotState(const leveldb::Snapshot *psnapshot, uint256 &hashBestChain, CCoinsStats &stats) {
+    return db.Read('B', hashBestChain, psnapshot) && db.Read('S', stats, psnapshot);
+}
+
+bool CCoinsViewDB::BeginLoad() {
+    LOCK(cs_stats);
+    if (!fHaveStats || statsCommitted.nTransactions != 0)
+        return error("CCoinsViewDB::BeginLoad() : coin database is not empty");
+    return db.Write('P', '1', true);
+}
+
+bool CCoinsViewDB::LoadCoins(const std::vector<std::pair<uint256, CCoins> > &vCoins) {
+    LOCK(cs_stats);
+    CLevelDBBatch batch;
+    CCoinsStats statsNew = statsCommitted;
+    for (std::vector<std::pair<uint256, CCoins> >::const_iterator it = vCoins.begin(); it != vCoins.end(); it++)
+        if (!it->second.IsPruned() && !BatchWriteChange(batch, &statsNew, it->first, it->second, true))
+            return false;
+    batch.Write('S', statsNew);
+    // Only synced by EndLoad; a crash before that leaves the 'P' mark
+    if (!db.WriteBatch(batch))
+        return false;
+    statsCommitted = statsNew;
+    return true;
+}
+
+bool CCoinsViewDB::EndLoad(CBlockIndex *pindex) {
+    CLevelDBBatch batch;
+    BatchWriteHashBestChain(batch, pindex->GetBlockHash());
+    batch.Erase('P');
+    return db.WriteBatch(batch, true);
+}
+
+bool CCoinsViewDB::BatchEraseCoins(CLevelDBBatch *pbatch, const uint256 &txid, const CCoins &coins) {
+    if (nLayout == COINS_LAYOUT_TXID)
+        BatchWriteCoins(*pbatch, txid, CCoins());
+    else
+        BatchWriteOutputs(*pbatch, txid, CCoins(), coins);
+    return true;
+}
+
+bool CCoinsViewDB::AbortLoad() {
+    LOCK(cs_stats);
+    // Everything stored came from the load, as it only starts on an empty database
+    const leveldb::Snapshot *psnapshot = db.GetSnapshot();
+    bool fOk = true;
+    for (unsigned int nByte = 0; nByte < 256 && fOk; nByte++) {
+        CLevelDBBatch batch;
+        fOk = ReadCoinsRange(psnapshot, nByte, nByte + 1, boost::bind(&CCoinsViewDB::BatchEraseCoins, this, &batch, _1, _2)) &&
+              db.WriteBatch(batch);
+    }
+    db.ReleaseSnapshot(psnapshot);
+    if (!fOk)
+        return false;
+
+    CLevelDBBatch batch;
+    CCoinsStats statsEmpty;
+    batch.Write('S', statsEmpty);
+    batch.Erase('P');
+    if (!db.WriteBatch(batch, true))
+        return false;
+    statsCommitted = statsEmpty;
+    fHaveStats = true;
+    return true;
+}
+
+bool CCoinsViewDB::IsLoading() {
+    return db.Exists('P');
+}
+
+bool CCoinsViewDB::UpgradeToOutputLayout() {
+    if (nLayout == COINS_LAYOUT_OUTPUT)
+        return true;
+
+    // Each batch moves a set of transactions, so an interrupted conversion
+    // simply continues with the 'c' records that are left
+    nLayout = COINS_LAYOUT_UPGRADING;
+    if (!db.Write('L', nLayout, true))
+        return false;
+    printf("Converting coin database to per-output records...\n");
+
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << 'c';
+    leveldb::Iterator *pcursor = db.NewIterator();
+    CLevelDBBatch batch;
+    unsigned int nBatch = 0, nTotal = 0;
+    bool fOk = true;
+    for (pcursor->Seek(leveldb::Slice(&ssPrefix[0], ssPrefix.size())); pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() == 0 || slKey.data()[0] != 'c')
+            break;
+        try {
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 txhash;
+            CCoins coins;
+            ssKey >> chType >> txhash;
+            ssValue >> coins;
+            batch.Erase(make_pair('c', txhash));
+            BatchWriteOutputs(batch, txhash, coins, CCoins());
         } catch (std::exception &e) {
-            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            fOk = error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            break;
+        }
+        nTotal++;
+        if (++nBatch == 10000) {
+            if (!db.WriteBatch(batch)) {
+                fOk = false;
+                break;
+            }
+            batch.Clear();
+            nBatch = 0;
+            if (nTotal % 100000 == 0)
+                printf("Converted %u transactions\n", nTotal);
         }
     }
     delete pcursor;
-    stats.nHeight = GetBestBlock()->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+    if (!fOk)
+        return false;
+
+    nLayout = COINS_LAYOUT_OUTPUT;
+    batch.Write('L', nLayout);
+    if (!db.WriteBatch(batch, true))
+        return false;
+    printf("Converted %u transactions to per-output records\n", nTotal);
     return true;
 }
 
@@ -174,6 +585,63 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadRecompressCursor(int &nFile) {
+    nFile = 0;
+    Read('C', nFile);
+    return true;
+}
+
+bool CBlockTreeDB::ReadRecompressPending(int &nFile) {
+    return Read('P', nFile);
+}
+
+bool CBlockTreeDB::EraseRecompressPending() {
+    return Erase('P', true);
+}
+
+bool CBlockTreeDB::WriteRecompressedFile(int nFile, const CBlockFileInfo &info, const std::vector<CBlockIndex*> &vIndex) {
+    // The new positions, the pending rename and the cursor move together
+    CLevelDBBatch batch;
+    BOOST_FOREACH(CBlockIndex *pindex, vIndex)
+        batch.Write(make_pair('b', pindex->GetBlockHash()), CDiskBlockIndex(pindex));
+    batch.Write(make_pair('f', nFile), info);
+    batch.Write('P', nFile);
+    batch.Write('C', nFile + 1);
+    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::WriteRecompressCursor(int nFile) {
+    return Write('C', nFile);
+}
+
+bool CBlockTreeDB::WritePrunedFiles(const std::vector<int> &vFiles, const std::vector<CBlockIndex*> &vIndex) {
+    // Forget the files and the blocks they held before they are deleted
+    CLevelDBBatch batch;
+    BOOST_FOREACH(CBlockIndex *pindex, vIndex)
+        batch.Write(make_pair('b', pindex->GetBlockHash()), CDiskBlockIndex(pindex));
+    BOOST_FOREACH(int nFile, vFiles)
+        batch.Write(make_pair('f', nFile), CBlockFileInfo());
+    batch.Write(std::make_pair('F', std::string("prunedblockfiles")), '1');
+    return WriteBatch(batch, true);
+}
+
+bool CBlockTreeDB::WriteLoadedHeaders(const std::vector<CBlockIndex*> &vIndex) {
+    // The blocks below a loaded UTXO set are only known by their headers,
+    // which leaves the node in the same state as a pruned one
+    CLevelDBBatch batch;
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        batch.Write(make_pair('b', vIndex[i]->GetBlockHash()), CDiskBlockIndex(vIndex[i]));
+        if ((i + 1) % 10000 == 0) {
+            if (!WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+    batch.Write(std::make_pair('F', std::string("prunedblockfiles")), '1');
+    batch.Write(std::make_pair('F', std::string("loadedtxoutset")), '1');
+    return WriteBatch(batch, true);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
@@ -186,59 +654,130 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
-{
-    leveldb::Iterator *pcursor = NewIterator();
-
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair('b', uint256(0));
-    pcursor->Seek(ssKeySet.str());
-
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
+bool CBlockTreeDB::LoadBlockIndexShard(const leveldb::Snapshot *psnapshot, unsigned int nBegin, unsigned int nEnd,
+                                       std::vector<CDiskBlockIndex> &vIndex) {
+    char pchStart[2] = { 'b', (char)nBegin };
+    leveldb::Iterator *pcursor = NewIterator(psnapshot);
+    bool fOk = true;
+    try {
+        // One stream reused for every entry; clearing keeps its buffer
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        for (pcursor->Seek(leveldb::Slice(pchStart, 2)); pcursor->Valid() && InShard(pcursor->key(), 'b', nEnd); pcursor->Next()) {
+            boost::this_thread::interruption_point();
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                // Watch for genesis block
-                if (pindexGenesisBlock == NULL && diskindex.GetBlockHash() == Params().HashGenesisBlock())
-                    pindexGenesisBlock = pindexNew;
-
-                if (!pindexNew->CheckIndex())
-                    return error("LoadBlockIndex() : CheckIndex failed: %s", pindexNew->ToString().c_str());
-
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+            leveldb::Slice slValue = pcursor->value();
+            if (slKey.size() != 1 + sizeof(uint256)) {
+                fOk = error("%s() : unexpected key size", __PRETTY_FUNCTION__);
+                break;
             }
-        } catch (std::exception &e) {
-            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            uint256 hash;
+            memcpy(hash.begin(), slKey.data() + 1, sizeof(uint256));
+            ssValue.clear();
+            ssValue.write(slValue.data(), slValue.size());
+            vIndex.push_back(CDiskBlockIndex());
+            CDiskBlockIndex &diskindex = vIndex.back();
+            ssValue >> diskindex;
+            if (diskindex.nHeight < 0) {
+                fOk = error("%s() : negative height for %s", __PRETTY_FUNCTION__, hash.ToString().c_str());
+                break;
+            }
+            if (diskindex.GetBlockHash() != hash) {
+                fOk = error("%s() : block header does not match its key %s", __PRETTY_FUNCTION__, hash.ToString().c_str());
+                break;
+            }
+            diskindex.hashBlock = hash;
+            if (!diskindex.CheckIndex()) {
+                fOk = error("%s() : CheckIndex failed: %s", __PRETTY_FUNCTION__, diskindex.ToString().c_str());
+                break;
+            }
+            diskindex.SetChainWork(diskindex.GetBlockWorkAdjusted());
         }
+    } catch (boost::thread_interrupted) {
+        delete pcursor;
+        throw;
+    } catch (std::exception &e) {
+        fOk = error("%s() : deserialize error", __PRETTY_FUNCTION__);
     }
     delete pcursor;
+    return fOk;
+}
+
+// Runs shards handed out through nNext until none are left
+static void ThreadLoadBlockIndex(CBlockTreeDB *pdb, const leveldb::Snapshot *psnapshot, boost::mutex *pmutex, unsigned int *pnNext,
+                                 std::vector<std::vector<CDiskBlockIndex> > *pvvIndex, std::vector<bool> *pvOk) {
+    try {
+        while (true) {
+            unsigned int nShard;
+            {
+                boost::unique_lock<boost::mutex> lock(*pmutex);
+                nShard = (*pnNext)++;
+            }
+            if (nShard >= BLOCK_INDEX_SHARDS)
+                return;
+            unsigned int nBegin = nShard * 256 / BLOCK_INDEX_SHARDS, nEnd = (nShard + 1) * 256 / BLOCK_INDEX_SHARDS;
+            bool fOk = pdb->LoadBlockIndexShard(psnapshot, nBegin, nEnd, (*pvvIndex)[nShard]);
+            boost::unique_lock<boost::mutex> lock(*pmutex);
+            (*pvOk)[nShard] = fOk;
+        }
+    } catch (boost::thread_interrupted) {
+        // Leaves the remaining shards marked as failed
+    }
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(int nThreads)
+{
+    // Parse the entries on several threads, each taking a range of hashes
+    const leveldb::Snapshot *psnapshot = GetSnapshot();
+    std::vector<std::vector<CDiskBlockIndex> > vvIndex(BLOCK_INDEX_SHARDS);
+    std::vector<bool> vOk(BLOCK_INDEX_SHARDS, false);
+    boost::mutex mutex;
+    unsigned int nNext = 0;
+    nThreads = std::max(1, std::min(nThreads, (int)BLOCK_INDEX_SHARDS));
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&ThreadLoadBlockIndex, this, psnapshot, &mutex, &nNext, &vvIndex, &vOk));
+    try {
+        threads.join_all();
+    } catch (boost::thread_interrupted) {
+        threads.interrupt_all();
+        threads.join_all();
+        ReleaseSnapshot(psnapshot);
+        throw;
+    }
+    ReleaseSnapshot(psnapshot);
+
+    size_t nCount = 0;
+    for (unsigned int i = 0; i < BLOCK_INDEX_SHARDS; i++) {
+        if (!vOk[i])
+            return error("LoadBlockIndex() : failed to read the block index");
+        nCount += vvIndex[i].size();
+    }
+    if (nCount == 0)
+        return true;
+
+    // Move the entries into one block and index them, sized up front so the table never grows
+    CBlockIndex *pindexArena = AllocBlockIndexArena(nCount);
+    std::vector<uint256> vHashPrev;
+    vHashPrev.reserve(nCount);
+    mapBlockIndex.reserve(mapBlockIndex.size() + nCount);
+    for (unsigned int i = 0; i < BLOCK_INDEX_SHARDS; i++) {
+        for (unsigned int j = 0; j < vvIndex[i].size(); j++) {
+            CBlockIndex* pindexNew = &pindexArena[vHashPrev.size()];
+            *pindexNew = vvIndex[i][j];
+            vHashPrev.push_back(vvIndex[i][j].hashPrev);
+            mapBlockIndex.insert(pindexNew);
+
+            // Watch for genesis block
+            if (pindexGenesisBlock == NULL && pindexNew->hashBlock == Params().HashGenesisBlock())
+                pindexGenesisBlock = pindexNew;
+        }
+        std::vector<CDiskBlockIndex>().swap(vvIndex[i]);
+    }
+
+    // Link the entries to their parents; a parent missing from the database
+    // gets an empty entry, as it always has
+    for (size_t i = 0; i < nCount; i++)
+        pindexArena[i].pprev = InsertBlockIndex(vHashPrev[i]);
 
     return true;
 }
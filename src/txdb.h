@@ -8,20 +8,77 @@
 #include "main.h"
 #include "leveldb.h"
 
+#include <boost/function.hpp>
+
+/** Layouts of the coin database, stored under 'L' */
+enum
+{
+    COINS_LAYOUT_TXID = 0,      // one 'c' record per transaction
+    COINS_LAYOUT_UPGRADING = 1, // conversion to COINS_LAYOUT_OUTPUT was interrupted
+    COINS_LAYOUT_OUTPUT = 2,    // an 'h' record per transaction, an 'o' record per unspent output
+};
+
+/** Number of parts the coin database is split into to compute statistics in parallel */
+static const unsigned int COINS_STATS_SHARDS = 16;
+
+/** Number of parts the block index is split into to load it in parallel */
+static const unsigned int BLOCK_INDEX_SHARDS = 16;
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDB db;
+    int nLayout;
+
+    // Statistics of the stored set, stored under 'S' with every write
+    CCriticalSection cs_stats;
+    bool fHaveStats;
+    CCoinsStats statsCommitted;
+
+    bool ReadOutputs(const uint256 &txid, CCoins &coins, leveldb::Iterator *pcursor = NULL);
+    bool ReadStoredCoins(const uint256 &txid, CCoins &coins, leveldb::Iterator *pcursor = NULL);
+    void BatchWriteOutputs(CLevelDBBatch &batch, const uint256 &txid, const CCoins &coins, const CCoins &coinsOld);
+    void BatchWriteListedOutputs(CLevelDBBatch &batch, const uint256 &txid, const CCoins &coins, const std::vector<unsigned int> &vChanged);
+    bool BatchWriteChange(CLevelDBBatch &batch, CCoinsStats *pstats, const uint256 &txid, const CCoins &coins, bool fFresh,
+                          const std::vector<unsigned int> *pvChanged = NULL, leveldb::Iterator *pcursor = NULL);
+    bool BatchEraseCoins(CLevelDBBatch *pbatch, const uint256 &txid, const CCoins &coins);
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
+    int GetLayout() const { return nLayout; }
+    // Convert the database to COINS_LAYOUT_OUTPUT; resumes an interrupted conversion
+    bool UpgradeToOutputLayout();
+
+    // Compute the statistics from scratch, by scanning the database on nThreads threads
+    bool ComputeStats(CCoinsStats &stats, int nThreads);
+    bool ComputeStatsShard(const leveldb::Snapshot *psnapshot, unsigned int nShard, CCoinsStats &stats);
+
+    // A consistent view of the database while it keeps changing
+    const leveldb::Snapshot *GetSnapshot() { return db.GetSnapshot(); }
+    void ReleaseSnapshot(const leveldb::Snapshot *psnapshot) { db.ReleaseSnapshot(psnapshot); }
+    // The best block and the statistics stored in psnapshot
+    bool ReadSnapshotState(const leveldb::Snapshot *psnapshot, uint256 &hashBestChain, CCoinsStats &stats);
+    // Pass the stored transactions whose txid starts with a byte in [nBegin, nEnd)
+    // to func in key order, until it returns false
+    bool ReadCoinsRange(const leveldb::Snapshot *psnapshot, unsigned int nBegin, unsigned int nEnd,
+                        const boost::function<bool (const uint256 &, const CCoins &)> &func);
+
+    // Bulk load of a UTXO set dump into an empty database, see LoadTxOutSet().
+    // Until EndLoad, the database is marked as incomplete under 'P'.
+    bool BeginLoad();
+    bool LoadCoins(const std::vector<std::pair<uint256, CCoins> > &vCoins);
+    bool EndLoad(CBlockIndex *pindex);
+    // Remove everything loaded since BeginLoad
+    bool AbortLoad();
+    bool IsLoading();
+
     bool GetCoins(const uint256 &txid, CCoins &coins);
     bool SetCoins(const uint256 &txid, const CCoins &coins);
     bool HaveCoins(const uint256 &txid);
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex, const CCoinsStats &statsChange);
     bool GetStats(CCoinsStats &stats);
 };
 
@@ -45,9 +102,22 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadRecompressCursor(int &nFile);
+    bool ReadRecompressPending(int &nFile);
+    bool EraseRecompressPending();
+    bool WriteRecompressedFile(int nFile, const CBlockFileInfo &info, const std::vector<CBlockIndex*> &vIndex);
+    bool WriteRecompressCursor(int nFile);
+    bool WritePrunedFiles(const std::vector<int> &vFiles, const std::vector<CBlockIndex*> &vIndex);
+    bool WriteLoadedHeaders(const std::vector<CBlockIndex*> &vIndex);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts();
+    // Read the entries whose hash starts with a byte in [nBegin, nEnd), in key order; each
+    // entry's nChainWork is set to the work of its own block only
+    bool LoadBlockIndexShard(const leveldb::Snapshot *psnapshot, unsigned int nBegin, unsigned int nEnd,
+                             std::vector<CDiskBlockIndex> &vIndex);
+    // Fill mapBlockIndex on nThreads threads, with the entries in one allocation and pprev linked.
+    // nChainWork is left as in LoadBlockIndexShard, for the caller to sum along the chain.
+    bool LoadBlockIndexGuts(int nThreads);
 };
 
 #endif // BITCOIN_TXDB_LEVELDB_H
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,11 @@ typedef unsigned long long  uint64;
 
 inline int Testuint256AdHoc(std::vector<std::string> vArg);
 
+class uint_error : public std::runtime_error
+{
+public:
+    explicit uint_error(const std::string& str) : std::runtime_error(str) {}
+};
 
 
 /** Base class without constructors for uint256 and uint160.
@@ -179,6 +185,65 @@ public:
         return *this;
     }
 
+    base_uint& operator*=(uint32_t b32)
+    {
+        uint64 carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = carry + (uint64)b32 * pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    // Products wrap around at 2^BITS
+    base_uint& operator*=(const base_uint& b)
+    {
+        base_uint a(*this);
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            uint64 carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64 n = carry + pn[i + j] + (uint64)a.pn[j] * b.pn[i];
+                pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        return *this;
+    }
+
+    base_uint& operator/=(const base_uint& b)
+    {
+        // Shift-and-subtract long division; num ends up holding the remainder
+        base_uint div(b);
+        base_uint num(*this);
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+        int nNumBits = num.bits();
+        int nDivBits = div.bits();
+        if (nDivBits == 0)
+            throw uint_error("base_uint::operator/= : division by zero");
+        if (nDivBits > nNumBits)
+            return *this;
+        int shift = nNumBits - nDivBits;
+        div <<= shift;
+        while (shift >= 0)
+        {
+            if (num >= div)
+            {
+                num -= div;
+                pn[shift / 32] |= (1U << (shift & 31));
+            }
+            div >>= 1;
+            shift--;
+        }
+        return *this;
+    }
+
 
     base_uint& operator++()
     {
@@ -375,6 +440,22 @@ public:
         return pn[2*n] | (uint64)pn[2*n+1] << 32;
     }
 
+    // Position of the highest set bit plus one, 0 for zero
+    unsigned int bits() const
+    {
+        for (int pos = WIDTH-1; pos >= 0; pos--)
+        {
+            if (pn[pos])
+            {
+                for (int nbits = 31; nbits > 0; nbits--)
+                    if (pn[pos] & (1U << nbits))
+                        return 32*pos + nbits + 1;
+                return 32*pos + 1;
+            }
+        }
+        return 0;
+    }
+
 //    unsigned int GetSerializeSize(int nType=0, int nVersion=PROTOCOL_VERSION) const
     unsigned int GetSerializeSize(int nType, int nVersion) const
     {
@@ -589,6 +670,60 @@ public:
         else
             *this = 0;
     }
+
+    // The "compact" format is a representation of a whole number N using an
+    // unsigned 32-bit number similar to a floating point format: the most
+    // significant 8 bits are the unsigned exponent of base 256, the next bit
+    // is a sign and the lower 23 bits are the mantissa, so
+    // N = (-1^sign) * mantissa * 256^(exponent-3), as with CBigNum.
+    // Negative numbers and numbers of 2^256 or more can be encoded but not
+    // held here; they are reported through pfNegative and pfOverflow.
+    uint256& SetCompact(uint32_t nCompact, bool *pfNegative = NULL, bool *pfOverflow = NULL)
+    {
+        unsigned int nSize = nCompact >> 24;
+        uint32_t nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8*(3-nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8*(nSize-3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        if (pfOverflow)
+            *pfOverflow = nWord != 0 && ((nSize > 34) ||
+                                         (nWord > 0xff && nSize > 33) ||
+                                         (nWord > 0xffff && nSize > 32));
+        return *this;
+    }
+
+    uint32_t GetCompact(bool fNegative = false) const
+    {
+        unsigned int nSize = (bits() + 7) / 8;
+        uint32_t nCompact = 0;
+        if (nSize <= 3)
+            nCompact = pn[0] << 8*(3-nSize);
+        else
+        {
+            uint256 bn(*this);
+            bn >>= 8*(nSize-3);
+            nCompact = bn.pn[0];
+        }
+        // The 0x00800000 bit denotes the sign.
+        // Thus, if it is already set, divide the mantissa by 256 and increase the exponent.
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        nCompact |= (fNegative && (nCompact & 0x007fffff) ? 0x00800000 : 0);
+        return nCompact;
+    }
 };
 
 inline bool operator==(const uint256& a, uint64 b)                           { return (base_uint256)a == b; }
@@ -597,12 +732,16 @@ inline const uint256 operator<<(const base_uint256& a, unsigned int shift)   { r
 inline const uint256 operator>>(const base_uint256& a, unsigned int shift)   { return uint256(a) >>= shift; }
 inline const uint256 operator<<(const uint256& a, unsigned int shift)        { return uint256(a) <<= shift; }
 inline const uint256 operator>>(const uint256& a, unsigned int shift)        { return uint256(a) >>= shift; }
+inline const uint256 operator*(const base_uint256& a, uint32_t b)            { return uint256(a) *= b; }
+inline const uint256 operator*(const uint256& a, uint32_t b)                 { return uint256(a) *= b; }
 
 inline const uint256 operator^(const base_uint256& a, const base_uint256& b) { return uint256(a) ^= b; }
 inline const uint256 operator&(const base_uint256& a, const base_uint256& b) { return uint256(a) &= b; }
 inline const uint256 operator|(const base_uint256& a, const base_uint256& b) { return uint256(a) |= b; }
 inline const uint256 operator+(const base_uint256& a, const base_uint256& b) { return uint256(a) += b; }
 inline const uint256 operator-(const base_uint256& a, const base_uint256& b) { return uint256(a) -= b; }
+inline const uint256 operator*(const base_uint256& a, const base_uint256& b) { return uint256(a) *= b; }
+inline const uint256 operator/(const base_uint256& a, const base_uint256& b) { return uint256(a) /= b; }
 
 inline bool operator<(const base_uint256& a, const uint256& b)          { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const base_uint256& a, const uint256& b)         { return (base_uint256)a <= (base_uint256)b; }
@@ -615,6 +754,8 @@ inline const uint256 operator&(const base_uint256& a, const uint256& b) { return
 inline const uint256 operator|(const base_uint256& a, const uint256& b) { return (base_uint256)a |  (base_uint256)b; }
 inline const uint256 operator+(const base_uint256& a, const uint256& b) { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const base_uint256& a, const uint256& b) { return (base_uint256)a -  (base_uint256)b; }
+inline const uint256 operator*(const base_uint256& a, const uint256& b) { return (base_uint256)a *  (base_uint256)b; }
+inline const uint256 operator/(const base_uint256& a, const uint256& b) { return (base_uint256)a /  (base_uint256)b; }
 
 inline bool operator<(const uint256& a, const base_uint256& b)          { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const uint256& a, const base_uint256& b)         { return (base_uint256)a <= (base_uint256)b; }
@@ -627,6 +768,8 @@ inline const uint256 operator&(const uint256& a, const base_uint256& b) { return
 inline const uint256 operator|(const uint256& a, const base_uint256& b) { return (base_uint256)a |  (base_uint256)b; }
 inline const uint256 operator+(const uint256& a, const base_uint256& b) { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const uint256& a, const base_uint256& b) { return (base_uint256)a -  (base_uint256)b; }
+inline const uint256 operator*(const uint256& a, const base_uint256& b) { return (base_uint256)a *  (base_uint256)b; }
+inline const uint256 operator/(const uint256& a, const base_uint256& b) { return (base_uint256)a /  (base_uint256)b; }
 
 inline bool operator<(const uint256& a, const uint256& b)               { return (base_uint256)a <  (base_uint256)b; }
 inline bool operator<=(const uint256& a, const uint256& b)              { return (base_uint256)a <= (base_uint256)b; }
@@ -639,6 +782,8 @@ inline const uint256 operator&(const uint256& a, const uint256& b)      { return
 inline const uint256 operator|(const uint256& a, const uint256& b)      { return (base_uint256)a |  (base_uint256)b; }
 inline const uint256 operator+(const uint256& a, const uint256& b)      { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const uint256& a, const uint256& b)      { return (base_uint256)a -  (base_uint256)b; }
+inline const uint256 operator*(const uint256& a, const uint256& b)      { return (base_uint256)a *  (base_uint256)b; }
+inline const uint256 operator/(const uint256& a, const uint256& b)      { return (base_uint256)a /  (base_uint256)b; }
 
 
 
@@ -786,7 +786,8 @@ bool CWalletTx::WriteToDisk()
 
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
-// exist in the wallet will be updated.
+// exist in the wallet will be updated. Returns -1 without scanning
+// anything if blocks the scan needs have been pruned.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
@@ -794,6 +795,16 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     CBlockIndex* pindex = pindexStart;
     {
         LOCK(cs_wallet);
+
+        // Blocks from before our wallet birthday are not read
+        CBlockIndex* pindexFirst = pindexStart;
+        while (pindexFirst && nTimeFirstKey && (pindexFirst->nTime < (nTimeFirstKey - 7200)))
+            pindexFirst = pindexFirst->GetNextInMainChain();
+        if (pindexFirst && !HaveBlockDataSince(pindexFirst)) {
+            printf("ScanForWalletTransactions() : blocks from height %d on have been pruned\n", pindexFirst->nHeight);
+            return -1;
+        }
+
         while (pindex)
         {
             // no need to read and scan block, if block was created before
@@ -864,7 +875,7 @@ void CWallet::ReacceptWalletTransactions()
         if (fMissing)
         {
             // TODO: optimize this to scan just part of the block chain?
-            if (ScanForWalletTransactions(pindexGenesisBlock))
+            if (ScanForWalletTransactions(pindexGenesisBlock) > 0)
                 fRepeat = true;  // Found missing transactions: re-do re-accept.
         }
     }
@@ -1936,7 +1947,7 @@ void CWallet::GetKeyBirthTimes(std::map<CKeyID, int64> &mapKeyBirth) const {
     for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); it++) {
         // iterate over all wallet transactions...
         const CWalletTx &wtx = (*it).second;
-        std::map<uint256, CBlockIndex*>::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
+        CBlockMap::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
         if (blit != mapBlockIndex.end() && blit->second->IsInMainChain()) {
             // ... which are already in a block
             int nHeight = blit->second->nHeight;
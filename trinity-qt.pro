@@ -169,7 +169,12 @@ HEADERS += src/qt/bitcoingui.h \
     src/uint256.h \
     src/serialize.h \
     src/core.h \
+    src/coinsmap.h \
+    src/muhash.h \
     src/compressedstorage.h \
+    src/lzcodec.h \
+    src/blockcodec.h \
+    src/mappedfile.h \
     src/main.h \
     src/net.h \
     src/key.h \
@@ -231,6 +236,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/qt/splashscreen.h \
     src/qt/intro.h \
     src/scrypt.h \
+    src/sha256d.h \
     src/sph_blake.h \
     src/sph_groestl.h \
     src/sph_keccak.h \
@@ -265,7 +271,12 @@ SOURCES += src/qt/bitcoin.cpp \
     src/key.cpp \
     src/script.cpp \
     src/core.cpp \
+    src/coinsmap.cpp \
+    src/muhash.cpp \
     src/compressedstorage.cpp \
+    src/lzcodec.cpp \
+    src/blockcodec.cpp \
+    src/mappedfile.cpp \
     src/main.cpp \
     src/init.cpp \
     src/net.cpp \
@@ -316,6 +327,8 @@ SOURCES += src/qt/bitcoin.cpp \
     src/qt/splashscreen.cpp \
     src/qt/intro.cpp \
     src/scrypt.cpp \
+    src/sha256d.cpp \
+    src/hashgroestl.cpp \
     src/blake.c \
     src/bmw.c \
     src/groestl.c \